@@ -111,6 +111,8 @@ if(USE_LEVELDB)
   find_package(Snappy REQUIRED)
   list(APPEND Caffe_INCLUDE_DIRS PRIVATE ${Snappy_INCLUDE_DIR})
   list(APPEND Caffe_LINKER_LIBS PRIVATE ${Snappy_LIBRARIES})
+  # Record compression of the packed db backend
+  list(APPEND Caffe_DEFINITIONS PRIVATE -DUSE_SNAPPY)
 endif()
 
 # ---[ ViennaCL
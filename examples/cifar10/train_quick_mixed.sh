@@ -0,0 +1,7 @@
+#!/usr/bin/env sh
+set -e
+
+TOOLS=./build/tools
+
+$TOOLS/caffe train \
+  --solver=examples/cifar10/cifar10_quick_solver_mixed.prototxt $@
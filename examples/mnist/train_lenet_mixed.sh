@@ -0,0 +1,4 @@
+#!/usr/bin/env sh
+set -e
+
+./build/tools/caffe train --solver=examples/mnist/lenet_solver_mixed.prototxt $@
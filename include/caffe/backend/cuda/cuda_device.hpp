@@ -35,6 +35,7 @@ class CudaDevice : public Device {
                            DeviceKernel* kernel,
                            bool auto_select);
   virtual void FinishQueues();
+  virtual void FinishQueue(uint_tp id);
   virtual uint_tp num_queues();
   virtual bool is_host_unified();
   virtual string name();
@@ -50,6 +51,7 @@ class CudaDevice : public Device {
   virtual void memcpy(const uint_tp n, vptr<const void> x, vptr<void> y);
   virtual void memcpy(const uint_tp n, const void* x, vptr<void> y);
   virtual void memcpy(const uint_tp n, vptr<const void> x, void* y);
+  virtual void memcpy_async(const uint_tp n, const void* x, vptr<void> y);
 
   virtual void rng_uniform(const uint_tp n, vptr<uint32_t> r);
   virtual void rng_uniform(const uint_tp n, vptr<uint64_t> r);
@@ -130,6 +132,11 @@ class CudaDevice : public Device {
 
   vector<char*> cuda_headers_;
   vector<char*> cuda_header_sources_;
+  // memcpy_async copies on its own stream, which does not synchronize with
+  // the default stream, so uploads overlap with kernels. FinishQueue waits
+  // for the event recorded after the last copy.
+  cudaStream_t upload_stream_;
+  cudaEvent_t upload_event_;
 };
 
 #endif  // USE_CUDA
@@ -10,6 +10,7 @@
 #include <vector>
 #include "caffe/blob.hpp"
 #include "caffe/backend/backend.hpp"
+#include "caffe/backend/host_memory_pool.hpp"
 #include "caffe/backend/device_program.hpp"
 #include "caffe/backend/device_kernel.hpp"
 #include "caffe/backend/vptr.hpp"
@@ -93,6 +94,10 @@ class Device {
   void decrease_memory_usage(uint_tp bytes);
   void reset_peak_memory_usage();
 
+  // Caching host allocator, used by SyncedMemory if
+  // Caffe::host_memory_pool() is enabled
+  HostMemoryPool* host_memory_pool();
+
   virtual void Init();
   virtual bool CheckCapability(DeviceCapability cap);
   virtual bool CheckVendor(string vendor);
@@ -106,6 +111,8 @@ class Device {
                            DeviceKernel* kernel,
                            bool auto_select);
   virtual void FinishQueues();
+  /// @brief Blocks until the work enqueued on queue id is done.
+  virtual void FinishQueue(uint_tp id);
   virtual uint_tp num_queues();
   virtual bool is_host_unified();
   bool is_fast_unsafe_math() const;
@@ -187,6 +194,14 @@ class Device {
   virtual void memcpy(const uint_tp n, vptr<const void> x, vptr<void> y);
   virtual void memcpy(const uint_tp n, const void* x, vptr<void> y);
   virtual void memcpy(const uint_tp n, vptr<const void> x, void* y);
+  /**
+   * @brief Enqueues a host to device copy on the current queue without
+   *        waiting for it. x must not change until the queue is finished.
+   *        CUDA copies on a dedicated upload stream instead, which
+   *        FinishQueue waits for. Backends that do not override it copy
+   *        synchronously.
+   */
+  virtual void memcpy_async(const uint_tp n, const void* x, vptr<void> y);
 
   template<typename Dtype>
   void set(const uint_tp n, const Dtype alpha, vptr<Dtype> x);
@@ -561,6 +576,8 @@ class Device {
   Backend backend_;
   uint_tp memory_usage_;
   uint_tp peak_memory_usage_;
+  shared_ptr<HostMemoryPool> host_memory_pool_;
+  std::mutex host_memory_pool_mutex_;
   vector<shared_ptr<Blob<int8_t> > > buffers_;
   std::mutex buffer_vec_mutex_;
   vector<shared_ptr<std::mutex> > buffer_mutex_;
@@ -0,0 +1,98 @@
+#ifndef CAFFE_BACKEND_HOST_MEMORY_POOL_HPP_
+#define CAFFE_BACKEND_HOST_MEMORY_POOL_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Allocation statistics of a HostMemoryPool.
+ *
+ * The per thread statistics (HostMemoryPool::thread_stats) only count
+ * allocations, cache hits and releases, since blocks can be released on a
+ * different thread than the one that allocated them.
+ */
+struct HostMemoryStats {
+  HostMemoryStats()
+      : allocations(0), cache_hits(0), releases(0), bytes_in_use(0),
+        peak_bytes_in_use(0), bytes_cached(0) {
+  }
+  /// Number of Allocate() calls
+  uint64_t allocations;
+  /// Allocations served from a free list instead of the system allocator
+  uint64_t cache_hits;
+  /// Number of Release() calls
+  uint64_t releases;
+  /// Bytes handed out and not yet released (rounded to the size class)
+  uint64_t bytes_in_use;
+  /// High-water mark of bytes_in_use
+  uint64_t peak_bytes_in_use;
+  /// Bytes held in the free lists
+  uint64_t bytes_cached;
+};
+
+struct HostMemoryThreadCache;
+
+/**
+ * @brief Caching, size-bucketed allocator for the host memory of a Device.
+ *
+ * Requests are rounded up to one of four size classes per power of two, so
+ * a released block can be handed out again for any request of the same
+ * class. Blocks are 64 byte aligned, page aligned from one page up and huge
+ * page aligned (and advised as huge pages on Linux) from 2 MB up.
+ *
+ * Released blocks up to 256 kB go to a free list of the releasing thread
+ * first, everything else goes to free lists shared by all threads. Cached
+ * memory is only returned to the system by Trim() or when the pool is
+ * destroyed.
+ *
+ * The pool is opt-in through Caffe::set_host_memory_pool() and is used by
+ * SyncedMemory for its host buffers. It must be owned by a shared_ptr.
+ */
+class HostMemoryPool : public std::enable_shared_from_this<HostMemoryPool> {
+ public:
+  HostMemoryPool();
+  ~HostMemoryPool();
+
+  void* Allocate(size_t size);
+  /// @brief Returns a block to the pool, size has to match the allocation.
+  void Release(void* ptr, size_t size);
+  /// @brief Frees the shared free lists and the calling thread's cache.
+  void Trim();
+
+  HostMemoryStats stats() const;
+  /// @brief Statistics of the calling thread, accumulated over all pools.
+  static const HostMemoryStats& thread_stats();
+
+  /// @brief Returns the size class index of size and its rounded size.
+  static size_t size_class(size_t size, size_t* class_size);
+  /// @brief Returns the rounded size of a size class index.
+  static size_t class_size_of(size_t cls);
+
+ private:
+  void* PopShared(size_t cls);
+  void PushShared(size_t cls, void* ptr);
+
+  const uint64_t id_;
+  mutable std::mutex mutex_;
+  vector<vector<void*> > free_lists_;
+
+  std::atomic<uint64_t> allocations_;
+  std::atomic<uint64_t> cache_hits_;
+  std::atomic<uint64_t> releases_;
+  std::atomic<uint64_t> bytes_in_use_;
+  std::atomic<uint64_t> peak_bytes_in_use_;
+  std::atomic<uint64_t> bytes_cached_;
+
+  friend struct HostMemoryThreadCache;
+
+DISABLE_COPY_AND_ASSIGN(HostMemoryPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_BACKEND_HOST_MEMORY_POOL_HPP_
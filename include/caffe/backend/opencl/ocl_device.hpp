@@ -30,6 +30,7 @@ class OclDevice : public Device {
                            DeviceKernel* kernel,
                            bool auto_select);
   virtual void FinishQueues();
+  virtual void FinishQueue(uint_tp id);
   virtual uint_tp num_queues();
   virtual bool is_host_unified();
   bool is_beignet();
@@ -48,6 +49,7 @@ class OclDevice : public Device {
   virtual void memcpy(const uint_tp n, vptr<const void> x, vptr<void> y);
   virtual void memcpy(const uint_tp n, const void* x, vptr<void> y);
   virtual void memcpy(const uint_tp n, vptr<const void> x, void* y);
+  virtual void memcpy_async(const uint_tp n, const void* x, vptr<void> y);
 
 #ifdef USE_HALF
   virtual void gemm_half
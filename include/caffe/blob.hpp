@@ -250,6 +250,13 @@ class BlobBase {
 
   void ShareDataBase(const BlobBase* other);
   void ShareDiffBase(const BlobBase* other);
+  /**
+   * @brief Set the data_ shared_ptr to a memory buffer that may be larger
+   *        than this Blob, such as a buffer shared by several blobs.
+   *
+   * The buffer has to hold at least the current capacity of the Blob.
+   */
+  void ShareDataMemory(const shared_ptr<SyncedMemory>& memory);
 
   inline const shared_ptr<SyncedMemory>& data() const {
     CHECK(data_);
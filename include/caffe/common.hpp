@@ -150,6 +150,11 @@ class Caffe {
   inline static bool multiprocess() { return Get().multiprocess_; }
   inline static void set_multiprocess(bool val) { Get().multiprocess_ = val; }
   inline static bool root_solver() { return Get().solver_rank_ == 0; }
+  // Caching of host memory through the per device HostMemoryPool
+  inline static bool host_memory_pool() { return Get().host_memory_pool_; }
+  inline static void set_host_memory_pool(bool val) {
+    Get().host_memory_pool_ = val;
+  }
 
   // Get the default device
   static Device *GetDefaultDevice();
@@ -188,6 +193,7 @@ class Caffe {
   int solver_count_;
   int solver_rank_;
   bool multiprocess_;
+  bool host_memory_pool_;
 };
 
 }  // namespace caffe
@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
 
 namespace caffe {
 
@@ -26,6 +27,11 @@ class DataTransformer {
    *    transformation.
    */
   void InitRand();
+  /**
+   * @brief Initialize the Random number generations if needed by the
+   *    transformation, from the given seed.
+   */
+  void InitRand(size_t seed);
 
   /**
    * @brief Applies the transformation defined in the data layer's
@@ -39,6 +45,18 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Applies the transformation defined in the data layer's
+   * transform_param block to a Datum read in place.
+   *
+   * @param datum
+   *    DatumView of the data to be transformed, e.g. from ParseDatumView.
+   * @param transformed_blob
+   *    This is destination blob. It can be part of top blob's data if
+   *    set_cpu_data() is used. See data_layer.cpp for an example.
+   */
+  void Transform(const DatumView& datum, Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -77,6 +95,12 @@ class DataTransformer {
    *    set_cpu_data() is used. See image_data_layer.cpp for an example.
    */
   void Transform(const cv::Mat& cv_img, Blob<Dtype>* transformed_blob);
+
+  /**
+   * @brief Decodes an encoded Datum the way Transform does, in color or
+   * gray if transform_param forces it.
+   */
+  cv::Mat DecodeDatum(const DatumView& datum);
 #endif  // USE_OPENCV
 
   /**
@@ -140,7 +164,7 @@ class DataTransformer {
    */
   virtual int_tp Rand(int_tp n);
 
-  void Transform(const Datum& datum, Dtype* transformed_data);
+  void Transform(const DatumView& datum, Dtype* transformed_data);
   // Tranformation parameters
   TransformationParameter param_;
 
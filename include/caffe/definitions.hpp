@@ -48,6 +48,10 @@
 #define CAFFE_MALLOC_CACHE_ALIGN 64
 #endif  // CAFFE_MALLOC_CACHE_ALIGN
 
+#ifndef CAFFE_MALLOC_HUGE_PAGE_ALIGN
+#define CAFFE_MALLOC_HUGE_PAGE_ALIGN 2097152
+#endif  // CAFFE_MALLOC_HUGE_PAGE_ALIGN
+
 namespace caffe {
 
 // Common functions and classes from std and boost that Caffe often uses.
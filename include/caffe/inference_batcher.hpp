@@ -0,0 +1,110 @@
+#ifndef CAFFE_INFERENCE_BATCHER_HPP_
+#define CAFFE_INFERENCE_BATCHER_HPP_
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A single sample waiting to be batched by an InferenceBatcher.
+ */
+template<typename Dtype>
+struct InferenceRequest {
+  /// One sample for each input blob of the net
+  vector<vector<Dtype> > inputs;
+  /// Receives one sample for each output blob of the net
+  std::promise<vector<vector<Dtype> > > result;
+  std::chrono::steady_clock::time_point submitted;
+};
+
+/**
+ * @brief Latency and batching statistics of an InferenceBatcher.
+ */
+struct InferenceBatcherStats {
+  InferenceBatcherStats()
+      : requests(0), batches(0), mean_batch_size(0), batch_fill(0),
+        p50_latency_ms(0), p99_latency_ms(0), max_latency_ms(0) {
+  }
+  uint64_t requests;
+  uint64_t batches;
+  double mean_batch_size;
+  /// mean_batch_size relative to the maximum batch size
+  double batch_fill;
+  /// Time from Submit() until the result is set, over the last requests
+  double p50_latency_ms;
+  double p99_latency_ms;
+  double max_latency_ms;
+  /// Number of batches of each size, index 0 is unused
+  vector<uint64_t> batch_sizes;
+};
+
+/**
+ * @brief Coalesces single requests from many threads into batches for one
+ *        Net.
+ *
+ * A batch is run as soon as it holds max_batch_size requests or the oldest
+ * request has waited max_delay_us microseconds. The net is reshaped along
+ * the first axis of its input blobs to the batch size (Net::Reshape), run
+ * once, and every request gets the slice of each output blob belonging to
+ * it. Outputs without a batch axis (e.g. a loss) are returned whole.
+ *
+ * The net is used by the internal thread only. Several batchers over
+ * InferenceSession%s of the same InferenceModel serve in parallel.
+ */
+template<typename Dtype>
+class InferenceBatcher : public InternalThread {
+ public:
+  InferenceBatcher(const shared_ptr<Net<Dtype> >& net, int max_batch_size,
+                   int64_t max_delay_us);
+  virtual ~InferenceBatcher();
+
+  /**
+   * @brief Queues a request, inputs holds one sample (the count of the
+   *        input blob without its first axis) for each net input.
+   */
+  std::future<vector<vector<Dtype> > > Submit(
+      const vector<vector<Dtype> >& inputs);
+
+  InferenceBatcherStats stats() const;
+  void ResetStats();
+
+  inline int max_batch_size() const {
+    return max_batch_size_;
+  }
+  inline int64_t max_delay_us() const {
+    return max_delay_us_;
+  }
+
+ protected:
+  virtual void InternalThreadEntry();
+  void RunBatch(const vector<InferenceRequest<Dtype>*>& batch);
+
+  shared_ptr<Net<Dtype> > net_;
+  const int max_batch_size_;
+  const int64_t max_delay_us_;
+  // Count of one sample of each input blob
+  vector<int_tp> sample_counts_;
+  BlockingQueue<InferenceRequest<Dtype>*> requests_;
+
+  mutable std::mutex stats_mutex_;
+  uint64_t num_requests_;
+  vector<uint64_t> batch_sizes_;
+  // Ring buffer of the latest latencies in microseconds
+  vector<double> latencies_;
+  size_t next_latency_;
+
+  DISABLE_COPY_AND_ASSIGN(InferenceBatcher);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INFERENCE_BATCHER_HPP_
@@ -0,0 +1,101 @@
+#ifndef CAFFE_INFERENCE_SESSION_HPP_
+#define CAFFE_INFERENCE_SESSION_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+template<typename Dtype>
+class InferenceSession;
+
+/**
+ * @brief The immutable weights of a TEST phase net, shared by any number of
+ *        InferenceSession%s.
+ *
+ * The net definition is parsed and the weights are loaded once. Sessions
+ * use the learnable parameter blobs of the model directly, so creating a
+ * session neither allocates nor fills weights. The column buffers of CPU
+ * convolutions come from the per device buffer pool and compiled kernels
+ * from the device program cache.
+ */
+template<typename Dtype>
+class InferenceModel {
+ public:
+  InferenceModel(const NetParameter& param, Device* device_context);
+  InferenceModel(const string& param_file, const string& trained_filename,
+                 Device* device_context, const int level = 0,
+                 const vector<string>* stages = NULL);
+
+  /**
+   * @brief Creates a session owning its own activations.
+   *
+   * Sessions plan their activation memory (NetParameter.optimize_memory)
+   * unless the net definition sets it explicitly. Can be called from any
+   * thread.
+   */
+  shared_ptr<InferenceSession<Dtype> > CreateSession() const;
+
+  /// @brief The net owning the weights. Do not run it concurrently.
+  inline const shared_ptr<Net<Dtype> >& net() const {
+    return net_;
+  }
+  /// @brief The net definition of the sessions, without weights.
+  inline const NetParameter& session_param() const {
+    return session_param_;
+  }
+
+ protected:
+  void Init(const NetParameter& param, const string& trained_filename);
+
+  Device* device_;
+  shared_ptr<Net<Dtype> > net_;
+  NetParameter session_param_;
+
+  DISABLE_COPY_AND_ASSIGN(InferenceModel);
+};
+
+/**
+ * @brief A Net sharing the weights of an InferenceModel.
+ *
+ * Every session owns its input, output and intermediate blobs and the
+ * state of its layers. Different sessions can run Forward concurrently,
+ * a single session must be used by one thread at a time.
+ */
+template<typename Dtype>
+class InferenceSession {
+ public:
+  const vector<BlobBase*>& Forward(Dtype* loss = NULL) {
+    return net_->Forward(loss);
+  }
+  inline const vector<BlobBase*>& input_blobs() const {
+    return net_->input_blobs();
+  }
+  inline const vector<BlobBase*>& output_blobs() const {
+    return net_->output_blobs();
+  }
+  inline const shared_ptr<Net<Dtype> >& net() const {
+    return net_;
+  }
+
+ protected:
+  InferenceSession(const shared_ptr<Net<Dtype> >& weights_net,
+                   const NetParameter& param, Device* device_context);
+
+  // Keeps the weights alive as long as the session
+  shared_ptr<Net<Dtype> > weights_net_;
+  shared_ptr<Net<Dtype> > net_;
+
+  friend class InferenceModel<Dtype>;
+
+  DISABLE_COPY_AND_ASSIGN(InferenceSession);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INFERENCE_SESSION_HPP_
@@ -205,11 +205,25 @@ class LayerBase {
   virtual void SetUp(const vector<BlobBase*>& bottom,
         const vector<BlobBase*>& top) = 0;
 
+  /**
+   * @brief Multiplies the loss weights stored in the diff of the top blobs by
+   *        scale, and so the gradients of the backward pass. A scale of 1
+   *        restores the weights set up by SetUp.
+   */
+  virtual void ScaleLossWeights(const vector<BlobBase*>& top,
+                                float scale) = 0;
+
   /**
    * @brief Returns the vector of learnable parameter blobs.
    */
   virtual vector<shared_ptr<BlobBase> > blob_bases() = 0;
 
+  /**
+   * @brief Uses the given blobs as learnable parameters. Set before SetUp,
+   *        layers skip the initialization of their parameters.
+   */
+  virtual void set_blob_bases(const vector<shared_ptr<BlobBase> >& blobs) = 0;
+
   /**
    * @brief Returns the vector of all initialized quantizers in the layers.
    */
@@ -488,6 +502,22 @@ class Layer : public LayerBase {
     return blob_base_vec;
   }
 
+  virtual void ScaleLossWeights(const vector<BlobBase*>& top, float scale) {
+    vector<Blob<MOtype>*> cast_top;
+    for (size_t i = 0; i < top.size(); ++i) {
+      cast_top.push_back(static_cast<Blob<MOtype>*>(top[i]));
+    }
+    SetLossWeights(cast_top, scale);
+  }
+
+  virtual void set_blob_bases(const vector<shared_ptr<BlobBase> >& blobs) {
+    blobs_.resize(blobs.size());
+    for (size_t i = 0; i < blobs.size(); ++i) {
+      CHECK_EQ(blobs[i]->data_type(), proto_data_type<Dtype>());
+      blobs_[i] = static_pointer_cast<Blob<Dtype> >(blobs[i]);
+    }
+  }
+
   virtual vector<shared_ptr<QuantizerBase> > get_all_quantizers() {
     vector<shared_ptr<QuantizerBase> > quant_base_vec;
     if (this->net_quant_ != nullptr) {
@@ -630,9 +660,11 @@ class Layer : public LayerBase {
 
   /**
    * Called by SetUp to initialize the weights associated with any top blobs in
-   * the loss function. Store non-zero loss weights in the diff blob.
+   * the loss function. Store non-zero loss weights in the diff blob, times
+   * scale.
    */
-  inline void SetLossWeights(const vector<Blob<MOtype>*>& top) {
+  inline void SetLossWeights(const vector<Blob<MOtype>*>& top,
+                             float scale = 1) {
     const int_tp num_loss_weights = layer_param_.loss_weight_size();
     if (num_loss_weights) {
       CHECK_EQ(top.size(), num_loss_weights) << "loss_weight must be "
@@ -644,6 +676,10 @@ class Layer : public LayerBase {
         quant.Forward_cpu(1, &loss_weight_param, &loss_weight);
         if (loss_weight == MOtype(0)) { continue; }
         this->set_loss(top_id, loss_weight);
+        if (scale != 1) {
+          loss_weight_param *= scale;
+          quant.Forward_cpu(1, &loss_weight_param, &loss_weight);
+        }
         const int_tp count = top[top_id]->count();
         MOtype* loss_multiplier = top[top_id]->mutable_cpu_diff();
         caffe_set(count, loss_weight, loss_multiplier);
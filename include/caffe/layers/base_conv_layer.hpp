@@ -36,10 +36,12 @@ class BaseConvolutionLayer : public Layer<Dtype, MItype, MOtype> {
   }
 
  protected:
-#ifndef CPU_ONLY
+  /**
+   * @brief Column buffer from the device's buffer pool, locked for this layer
+   *        until unlock_col_buffer() is called.
+   */
   shared_ptr<Blob<Dtype> > col_buffer();
   void unlock_col_buffer();
-#endif
 
   /// @brief The spatial dimensions of the input.
   inline int_tp input_shape(int_tp i) {
@@ -1,6 +1,7 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <functional>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -8,7 +9,10 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/decoded_cache.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -56,6 +60,7 @@ class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype, MItype, MOtype>, public InternalThread {
  public:
   explicit BasePrefetchingDataLayer(const LayerParameter& param);
+  virtual ~BasePrefetchingDataLayer();
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
   // This method may not be overridden.
@@ -67,14 +72,64 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<MItype>*>& bottom,
       const vector<Blob<MOtype>*>& top);
 
+#ifdef USE_OPENCV
+  /// @brief Cache of decoded images of the layer, NULL if not enabled.
+  const shared_ptr<DecodedCache>& decoded_cache() const {
+    return decoded_cache_;
+  }
+#endif  // USE_OPENCV
+
  protected:
+  // Decodes and transforms items of a batch, on a slice of the batch
+  struct DecodeWorker {
+    shared_ptr<DataTransformer<Dtype> > transformer;
+    // Set to the item of the batch being transformed
+    Blob<MOtype> transformed_data;
+    // Microseconds spent by the worker on the current batch
+    double decode_time;
+    double trans_time;
+  };
+
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<MOtype>* batch) = 0;
+  // Starts uploading the next loaded batch to the device, if there is one,
+  // so that the copy overlaps with the rest of the forward and backward pass
+  void StartUpload();
+
+  /**
+   * @brief Runs load_item for the items [0, batch_size) of a batch, with the
+   *        decode_threads workers each taking a contiguous slice.
+   *
+   * Called from load_batch after the items were read in order. Before every
+   * item the RNG of the worker's transformer is seeded from the position of
+   * the item in the data stream, so transformations are the same for any
+   * number of workers. load_item must only write to its own item.
+   */
+  void LoadItems(int_tp batch_size,
+      const std::function<void(int_tp item_id, DecodeWorker* worker)>&
+          load_item);
+  // Logs the per stage times of a batch loaded with LoadItems, with the
+  // decode and transform times summed over the workers (microseconds).
+  void LogBatchTimes(double batch_time, double read_time) const;
+
+  vector<shared_ptr<DecodeWorker> > decode_workers_;
+  shared_ptr<ThreadPool> decode_pool_;
+  // Base of the per item seeds, and number of items loaded so far
+  size_t rand_seed_;
+  uint64_t items_loaded_;
+#ifdef USE_OPENCV
+  // Shared by the layers reading the same source, set by layers that cache
+  shared_ptr<DecodedCache> decoded_cache_;
+#endif  // USE_OPENCV
 
   vector<shared_ptr<Batch<MOtype> > > prefetch_;
   BlockingQueue<Batch<MOtype>*> prefetch_free_;
   BlockingQueue<Batch<MOtype>*> prefetch_full_;
   Batch<MOtype>* prefetch_current_;
+  // Batch uploaded on upload_queue_ since the last forward pass, if any
+  Batch<MOtype>* prefetch_uploading_;
+  uint_tp upload_queue_;
+  CPUTimer upload_timer_;
 
   Blob<MOtype> transformed_data_;
 };
@@ -27,7 +27,8 @@ class CaffeConvolutionLayer
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
   // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // we just called weight_cpu_gemm with the same input. The CPU helpers keep
+  // the column buffer locked, call unlock_col_buffer() after the last image.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output,
                         bool skip_im2col = false);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
@@ -36,7 +37,7 @@ class CaffeConvolutionLayer
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
 
-#ifndef CPU_ONLY
+#if 1  // local
   void forward_gpu_gemm(vptr<const Dtype> col_input, const uint_tp col_input_off,
                         vptr<const Dtype> weights, vptr<Dtype> output,
                         const uint_tp output_off, bool skip_im2col = false);
@@ -95,7 +96,7 @@ class CaffeConvolutionLayer
     }
   }
 
-#ifndef CPU_ONLY
+#if 1  // local
   inline void conv_im2col_gpu(vptr<const Dtype> data, vptr<Dtype> col_buff) {
     if (!this->force_nd_im2col_ && this->num_spatial_axes_ == 2) {
       this->device_->im2col(data, this->conv_in_channels_,
@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_LAYER_HPP_
 #define CAFFE_DATA_LAYER_HPP_
 
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -31,9 +33,42 @@ class DataLayer
   bool Skip();
   virtual void load_batch(Batch<Dtype>* batch);
 
+  // Shuffle buffer, see DataParameter.shuffle_buffer_size
+  void InitShuffle();
+  // Positions the range cursors for the next epoch
+  void StartEpoch();
+  // Reads the next item of the interleaved ranges kept by this solver into
+  // view, or into value if the cursors do not keep views valid, and its key
+  // into key if not NULL
+  void ReadShuffleInput(std::pair<const char*, size_t>* view, string* value,
+                        string* key);
+  // Draws an item from the shuffle buffer and replaces it with the next one
+  void NextShuffled(std::pair<const char*, size_t>* view, string* value,
+                    string* key);
+  // Whether the keys of the items are needed, as keys of the decoded cache
+  bool ReadKeys() const;
+
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
   uint64_t offset_;
+  // Serialized items of the batch being loaded, copied only if the cursor
+  // does not keep them valid
+  vector<string> values_;
+  vector<std::pair<const char*, size_t> > value_views_;
+  // Keys of the items of the batch, if ReadKeys()
+  vector<string> keys_;
+
+  vector<shared_ptr<db::Cursor> > range_cursors_;
+  vector<size_t> range_begin_, range_end_, range_position_;
+  // Order the ranges are read in during this epoch
+  vector<int_tp> range_order_;
+  size_t next_range_;
+  uint64_t epoch_;
+  // Items of the shuffle buffer, as views or as copies like the batch items
+  vector<std::pair<const char*, size_t> > shuffle_views_;
+  vector<string> shuffle_values_;
+  vector<string> shuffle_keys_;
+  shared_ptr<Caffe::RNG> shuffle_rng_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,102 @@
+#ifndef CAFFE_DIRECT_CONV_LAYER_HPP_
+#define CAFFE_DIRECT_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Direct 2D convolution on channel blocked (NCHWc) activations.
+ *
+ * Instead of expanding every image into a column buffer of
+ * channels x kernel size x output size values, each output row is computed
+ * from the input in place: a register tile of a few output pixels times one
+ * block of 8 or 16 output channels accumulates over input channels and
+ * kernel taps, the output channels being the innermost, vectorizable
+ * dimension. The filters are repacked accordingly when the weights change.
+ *
+ * Bottom and top are either plain NCHW or blocked with the shape
+ * (n, channels / c, h, w, c), see ConvolutionParameter.channel_block and
+ * ReorderLayer. The fuse_type FUSED_CONV_RELU applies the ReLU of
+ * relu_param, FUSED_CONV_ELTWISE_RELU first adds a second bottom of the
+ * shape of the top, both in the same pass that adds the bias.
+ *
+ * Blocked or fused layers are forward only and run on the CPU. Otherwise
+ * backward and the GPU use the ConvolutionLayer implementation.
+ */
+template<typename Dtype, typename MItype, typename MOtype>
+class DirectConvolutionLayer
+    : public ConvolutionLayer<Dtype, MItype, MOtype> {
+ public:
+  explicit DirectConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype, MItype, MOtype>(param), bottom_block_(1),
+        top_block_(1), packed_memory_(NULL), packed_version_(0) {
+  }
+  virtual void LayerSetUp(const vector<Blob<MItype>*>& bottom,
+                          const vector<Blob<MOtype>*>& top);
+  virtual void Reshape(const vector<Blob<MItype>*>& bottom,
+                       const vector<Blob<MOtype>*>& top);
+
+  virtual inline bool EqualNumBottomTopBlobs() const {
+    return !IsFusedWithEltwiseReLU();
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<MItype>*>& bottom,
+                           const vector<Blob<MOtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<MItype>*>& bottom,
+                           const vector<Blob<MOtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<MOtype>*>& top,
+                            const vector<bool>& propagate_down,
+                            const vector<Blob<MItype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<MOtype>*>& top,
+                            const vector<bool>& propagate_down,
+                            const vector<Blob<MItype>*>& bottom);
+
+  bool IsFusedWithEltwiseReLU() const {
+    return (this->layer_param_.convolution_param().fuse_type()
+            == ConvolutionParameter_FuseType_FUSED_CONV_ELTWISE_RELU);
+  }
+  bool IsFusedWithReLU() const {
+    return IsFusedWithEltwiseReLU() ||
+           (this->layer_param_.convolution_param().fuse_type()
+            == ConvolutionParameter_FuseType_FUSED_CONV_RELU);
+  }
+  // Whether only the direct forward pass can handle the blobs.
+  bool ForwardOnly() const {
+    return bottom_block_ > 1 || top_block_ > 1 || IsFusedWithReLU();
+  }
+
+  // Filters repacked to output channel blocks x channels x kernel height x
+  // kernel width x output channels of the block, zero padded.
+  const Dtype* packed_weights();
+  template<int_tp OB>
+  void ForwardImage(const Dtype* bottom_data, const Dtype* weights,
+                    const Dtype* bias, const Dtype* eltwise_data,
+                    Dtype* top_data);
+
+  // Block sizes of bottom and top, 1 for NCHW
+  int_tp bottom_block_;
+  int_tp top_block_;
+  // Output channels per register tile
+  int_tp output_block_;
+  Dtype negative_slope_;
+
+  // The plain NCHW shapes the ConvolutionLayer works with
+  Blob<MItype> bottom_shape_blob_;
+  Blob<MOtype> top_shape_blob_;
+
+  Blob<Dtype> packed_weights_;
+  const SyncedMemory* packed_memory_;
+  uint64_t packed_version_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_DIRECT_CONV_LAYER_HPP_
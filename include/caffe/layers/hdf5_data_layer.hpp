@@ -9,6 +9,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/thread_pool.hpp"
 
 #include "caffe/layers/base_data_layer.hpp"
 
@@ -17,13 +18,19 @@ namespace caffe {
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
+ * Files are loaded completely, unless HDF5DataParameter.chunk_size is set.
+ * The layer then streams chunks of that many rows, reading the next chunk
+ * on a prefetch thread while the current one is served, so memory use does
+ * not depend on the size of the files.
+ *
  * TODO(dox): thorough documentation for Forward and proto params.
  */
 template<typename Dtype, typename MItype, typename MOtype>
 class HDF5DataLayer : public Layer<Dtype, MItype, MOtype> {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype, MItype, MOtype>(param), offset_() {}
+      : Layer<Dtype, MItype, MOtype>(param), offset_(),
+        stream_file_id_(-1) {}
   virtual ~HDF5DataLayer();
   virtual void LayerSetUp(const vector<Blob<MItype>*>& bottom,
       const vector<Blob<MOtype>*>& top);
@@ -38,6 +45,9 @@ class HDF5DataLayer : public Layer<Dtype, MItype, MOtype> {
  protected:
   void Next();
   bool Skip();
+  // Number of rows, up to max_rows, from the current one on that are stored
+  // back to back and can be copied at once
+  int_tp ContiguousRows(int_tp max_rows) const;
 
   virtual void Forward_cpu(const vector<Blob<MItype>*>& bottom,
       const vector<Blob<MOtype>*>& top);
@@ -51,6 +61,12 @@ class HDF5DataLayer : public Layer<Dtype, MItype, MOtype> {
       const vector<Blob<MItype>*>& bottom) {}
   virtual void LoadHDF5FileData(const char* filename);
 
+  // Streaming, run on the prefetch thread except during setup
+  void OpenStreamFile();
+  void LoadChunk();
+  void NextChunk();
+  void StopStreaming();
+
   vector<string> hdf_filenames_;
   uint_tp num_files_;
   uint_tp current_file_;
@@ -59,6 +75,19 @@ class HDF5DataLayer : public Layer<Dtype, MItype, MOtype> {
   vector<uint_tp> data_permutation_;
   vector<uint_tp> file_permutation_;
   uint64_t offset_;
+
+  // Streaming state, owned by the prefetch thread
+  hid_t stream_file_id_;
+  uint_tp stream_file_;
+  vector<uint_tp> chunk_permutation_;
+  uint_tp stream_chunk_;
+  hsize_t stream_rows_;
+  // Next chunk, swapped with hdf_blobs_ once the current one is served
+  vector<shared_ptr<Blob<Dtype> > > prefetch_blobs_;
+  // Rows of the next chunk in file order, when shuffling
+  Blob<Dtype> chunk_buffer_;
+  shared_ptr<Caffe::RNG> stream_rng_;
+  shared_ptr<ThreadPool> prefetch_pool_;
 };
 
 }  // namespace caffe
@@ -37,6 +37,8 @@ class ImageDataLayer
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  // Reads and resizes the image of item, or takes it from the decoded cache
+  cv::Mat ReadImage(const std::pair<string, int_tp>& item);
 
   vector<pair<string, int_tp> > lines_;
   int_tp lines_id_;
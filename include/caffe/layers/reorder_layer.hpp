@@ -0,0 +1,54 @@
+#ifndef CAFFE_REORDER_LAYER_HPP_
+#define CAFFE_REORDER_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Converts activations between the plain NCHW layout and the channel
+ *        blocked NCHWc layout used by the DIRECT convolution engine.
+ *
+ * A blocked blob with block size c has the shape (n, channels / c, h, w, c):
+ * the values of c consecutive channels at one pixel are contiguous. A block
+ * size of 0 is the plain layout. The number of channels must be a multiple
+ * of every block size involved.
+ *
+ * Net::Init inserts these layers where blocked and plain layers meet
+ * (InsertLayoutConversions), they are rarely written by hand.
+ */
+template<typename Dtype, typename MItype, typename MOtype>
+class ReorderLayer : public Layer<Dtype, MItype, MOtype> {
+ public:
+  explicit ReorderLayer(const LayerParameter& param)
+      : Layer<Dtype, MItype, MOtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+  virtual void Reshape(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+
+  virtual inline const char* type() const { return "Reorder"; }
+  virtual inline int_tp ExactNumBottomBlobs() const { return 1; }
+  virtual inline int_tp ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<MItype>*>& bottom,
+      const vector<Blob<MOtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<MOtype>*>& top,
+      const vector<bool>& propagate_down,
+      const vector<Blob<MItype>*>& bottom);
+
+  int_tp bottom_block_;
+  int_tp top_block_;
+  int_tp num_;
+  int_tp channels_;
+  int_tp spatial_dim_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_REORDER_LAYER_HPP_
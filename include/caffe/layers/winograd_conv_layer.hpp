@@ -0,0 +1,96 @@
+#ifndef CAFFE_WINOGRAD_CONV_LAYER_HPP_
+#define CAFFE_WINOGRAD_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Convolves the input with 3x3 filters by Winograd minimal filtering,
+ *        F(2x2, 3x3) or F(4x4, 3x3) (Lavin & Gray, "Fast Algorithms for
+ *        Convolutional Neural Networks", 2015).
+ *
+ * The input is cut into overlapping (m+2)x(m+2) tiles which are transformed
+ * together with the filters, so that each of the (m+2)^2 transformed
+ * positions becomes one GEMM over all channels and the tiles of a batch of
+ * images. The transformed filters are cached until the weights change.
+ * The gradient w.r.t. the bottom is the Winograd convolution of the top
+ * gradient with the rotated filters, the weight gradient uses im2col.
+ *
+ * Only 2D convolution with 3x3 kernels, stride 1, dilation 1 and padding
+ * of at most 2 runs on the CPU this way. Other shapes and the GPU use the
+ * ConvolutionLayer implementation.
+ */
+template<typename Dtype, typename MItype, typename MOtype>
+class WinogradConvolutionLayer
+    : public ConvolutionLayer<Dtype, MItype, MOtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype, MItype, MOtype>(param), winograd_(false),
+        tile_(0), forward_memory_(NULL), forward_version_(0),
+        backward_memory_(NULL), backward_version_(0) {
+  }
+  virtual void LayerSetUp(const vector<Blob<MItype>*>& bottom,
+                          const vector<Blob<MOtype>*>& top);
+  virtual void Reshape(const vector<Blob<MItype>*>& bottom,
+                       const vector<Blob<MOtype>*>& top);
+
+  /// @brief Whether the current shapes take the Winograd path on the CPU.
+  inline bool winograd() const {
+    return winograd_;
+  }
+  /// @brief The output tile size m of F(m x m, 3 x 3).
+  inline int_tp tile() const {
+    return tile_;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<MItype>*>& bottom,
+                           const vector<Blob<MOtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<MOtype>*>& top,
+                            const vector<bool>& propagate_down,
+                            const vector<Blob<MItype>*>& bottom);
+
+  // Filters transformed to (m+2)^2 x output channels x input channels per
+  // group. For backward, filters are rotated by 180 degrees and input and
+  // output channels swap roles. Transformed again only if the weights
+  // changed since the last call.
+  const Dtype* transformed_filters(bool backward);
+  void TransformFilters(const Dtype* weight, bool backward,
+                        Dtype* transformed);
+  // Stride 1 correlation of num images (channels x height x width) with
+  // transformed 3x3 filters into out_channels x out_height x out_width.
+  void WinogradConvolution(const Dtype* input, int_tp num, int_tp channels,
+                           int_tp height, int_tp width, int_tp pad_h,
+                           int_tp pad_w, const Dtype* filters,
+                           int_tp out_channels, int_tp out_height,
+                           int_tp out_width, Dtype* output);
+
+  bool winograd_;
+  int_tp tile_;
+  // Transformation matrices of the current tile size
+  vector<Dtype> input_transform_;
+  vector<Dtype> filter_transform_;
+  vector<Dtype> output_transform_;
+
+  Blob<Dtype> forward_filters_;
+  Blob<Dtype> backward_filters_;
+  // Weight memory and its version the filters were transformed from
+  const SyncedMemory* forward_memory_;
+  uint64_t forward_version_;
+  const SyncedMemory* backward_memory_;
+  uint64_t backward_version_;
+
+  Blob<Dtype> input_tiles_;
+  Blob<Dtype> output_tiles_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_WINOGRAD_CONV_LAYER_HPP_
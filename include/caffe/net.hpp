@@ -1,7 +1,9 @@
 #ifndef CAFFE_NET_HPP_
 #define CAFFE_NET_HPP_
 
+#include <algorithm>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <utility>
@@ -12,6 +14,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/backend/device.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 
 namespace caffe {
@@ -28,6 +31,13 @@ class Net {
   explicit Net(const NetParameter& param, Device* device_context);
   explicit Net(const string& param_file, Phase phase, Device* device_context,
                const int level = 0, const vector<string>* stages = NULL);
+  /**
+   * @brief Constructs a net using the learnable parameter blobs of the
+   *        layers with the same name in weights_net, instead of allocating
+   *        and filling its own (see InferenceModel).
+   */
+  explicit Net(const NetParameter& param, const Net* weights_net,
+               Device* device_context);
   virtual ~Net() { }
 
   /// @brief Initialize a network with a NetParameter.
@@ -207,6 +217,14 @@ class Net {
   inline const vector<int_tp>& param_owners() const {
     return param_owners_;
   }
+  /// @brief returns the layer id and index in the layer of each parameter
+  inline const vector<pair<int_tp, int_tp> >& param_layer_indices() const {
+    return param_layer_indices_;
+  }
+  /// @brief returns the index in learnable_params of each parameter
+  inline const vector<int_tp>& learnable_param_ids() const {
+    return learnable_param_ids_;
+  }
   inline const vector<string>& param_display_names() const {
     return param_display_names_;
   }
@@ -239,6 +257,55 @@ class Net {
     debug_info_ = value;
   }
 
+  /**
+   * @brief Multiplies the gradients of the backward pass by scale, through
+   *        the loss weights. The loss of the forward pass is not scaled.
+   *        Used for loss scaling in mixed precision training.
+   */
+  void set_loss_scale(float scale) {
+    loss_scale_ = scale;
+  }
+  inline float loss_scale() const {
+    return loss_scale_;
+  }
+
+  /**
+   * @brief Host memory pool allocations made by Init, Reshape, Forward and
+   *        Backward of this net (see Caffe::set_host_memory_pool).
+   *
+   * The byte counts are those of the device's pool after the last of these
+   * calls, so they include memory of other nets on the same device.
+   */
+  inline const HostMemoryStats& host_memory_stats() const {
+    return host_memory_stats_;
+  }
+
+  /**
+   * @brief Runs independent layers of the forward pass concurrently on a
+   *        work-stealing pool of num_threads threads (CPU mode only).
+   *
+   * A layer runs as soon as the layers it depends on are done. Dependencies
+   * follow the bottom and top blobs of the layers and the blobs sharing
+   * memory, so in-place layers and consumers of Split tops keep their order.
+   * The before_forward and after_forward callbacks of a layer run on its
+   * thread right before and after it; callback calls are serialized.
+   * With 1 thread, layers run in order on the calling thread.
+   */
+  void set_forward_threads(int num_threads);
+  inline int forward_threads() const {
+    return forward_pool_ ? forward_pool_->num_threads() : 1;
+  }
+
+  /**
+   * @brief Bytes of the data buffers shared by the intermediate blobs of a
+   *        memory-optimized inference net (see NetParameter.optimize_memory).
+   *
+   * Returns 0 if the memory of the net is not planned.
+   */
+  inline size_t memory_optimized() const {
+    return memory_optimized_;
+  }
+
   // Helpers for Init.
   /**
    * @brief Remove layers that the user specified should be excluded given the current
@@ -274,6 +341,11 @@ class Net {
   void add_after_backward(Callback* value) {
     after_backward_.push_back(value);
   }
+  void remove_after_backward(Callback* value) {
+    after_backward_.erase(std::remove(after_backward_.begin(),
+                                      after_backward_.end(), value),
+                          after_backward_.end());
+  }
 
  protected:
   // Helpers for Init.
@@ -295,6 +367,17 @@ class Net {
   void BackwardDebugInfo(const int_tp layer_id);
   /// @brief Helper for displaying debug info in Update.
   void UpdateDebugInfo(const int_tp param_id);
+  /**
+   * @brief Assigns the data of intermediate blobs with disjoint lifetimes
+   *        to shared buffers, for nets that run no backward pass.
+   */
+  void PlanMemory();
+  /// @brief Builds the forward layer dependencies for parallel execution.
+  void BuildForwardGraph();
+  /// @brief ForwardFromTo on the forward thread pool.
+  Dtype ForwardFromToParallel(int_tp start, int_tp end);
+  /// @brief Adds the calling thread's pool allocations since start.
+  void AccumulateHostMemoryStats(const HostMemoryStats& start);
 
   /// @brief The network name
   string name_;
@@ -353,10 +436,32 @@ class Net {
   vector<bool> has_params_decay_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// Whether intermediate blobs share memory (memory-optimized inference)
+  bool optimize_memory_;
+  /// BatchNorm and Scale layers folded into each convolution, see FuseLayers
+  map<string, vector<LayerParameter> > folded_layers_;
+  /// The bytes of the buffers shared by the intermediate blobs
+  size_t memory_optimized_;
+  /// Lowest id of the blobs aliasing the memory of each blob before planning
+  vector<int_tp> memory_alias_;
+  /// Layers that have to finish before each layer in the forward pass
+  vector<vector<int_tp> > forward_predecessors_;
+  /// Layers waiting for each layer in the forward pass
+  vector<vector<int_tp> > forward_successors_;
+  /// Runs the forward pass if forward_threads > 1
+  shared_ptr<ThreadPool> forward_pool_;
+  /// Serializes callbacks and statistics of concurrently running layers
+  std::mutex forward_mutex_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Multiplier of the loss weights during Backward, see set_loss_scale
+  float loss_scale_;
+  /// Host memory pool allocations attributed to this net
+  HostMemoryStats host_memory_stats_;
 
   Device* device_;
+  /// Net providing the learnable parameters during Init, or NULL
+  const Net* weights_net_;
 
   // Callbacks
   vector<Callback*> before_forward_;
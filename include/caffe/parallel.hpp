@@ -7,11 +7,9 @@
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 
-#ifdef USE_CUDA
-#ifdef USE_NCCL
-
-#include <boost/thread.hpp>
-
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -19,12 +17,24 @@
 #include "caffe/common.hpp"
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/transport.hpp"
+
+#ifdef USE_CUDA
+#ifdef USE_NCCL
+
+#include <boost/thread.hpp>
+
 #include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/nccl.hpp"
 
+#endif  // USE_NCCL
+#endif  // USE_CUDA
+
 namespace caffe {
 
 // Represents a net parameters. Once a net is created, its parameter buffers can
@@ -34,6 +44,7 @@ template<typename Dtype>
 class Params {
  public:
   explicit Params(shared_ptr<Solver<Dtype> > root_solver);
+  explicit Params(const Net<Dtype>& net);
   virtual ~Params() {
   }
 
@@ -55,6 +66,317 @@ class Params {
 DISABLE_COPY_AND_ASSIGN(Params);
 };
 
+// Params stored in host memory. The gradient buffer can be followed by extra
+// elements, e.g. for values reduced along with the gradient.
+template<typename Dtype>
+class CPUParams : public Params<Dtype> {
+ public:
+  explicit CPUParams(shared_ptr<Solver<Dtype> > root_solver,
+                     uint_tp extra = 0);
+  CPUParams(const Net<Dtype>& net, Device* device, uint_tp extra = 0);
+  virtual ~CPUParams();
+
+  void Configure(Solver<Dtype>* solver) const;
+  void Configure(Net<Dtype>* net) const;
+
+ protected:
+  Device* device_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+// Barrier for a fixed number of threads. Cancelling it releases the threads
+// waiting on it and makes all later waits fail, so the other threads do not
+// wait forever for one that stopped early.
+class CancelableBarrier {
+ public:
+  explicit CancelableBarrier(int count);
+
+  // Returns false if the barrier is cancelled.
+  bool Wait();
+  void Cancel();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  const int count_;
+  int waiting_;
+  uint64_t generation_;
+  bool cancelled_;
+
+DISABLE_COPY_AND_ASSIGN(CancelableBarrier);
+};
+
+/**
+ * @brief Reduces the gradient while the backward pass is still running.
+ *
+ * The learnable parameters of the net are grouped, from the last one to the
+ * first, into buckets of consecutive parameters of at least bucket_bytes.
+ * Offsets are those of the gradient buffer of Params, whose size elements are
+ * all covered, the ones after the parameters going with the last bucket.
+ * Called after the backward of each layer, it hands a bucket to reduce on its
+ * own thread as soon as all layers using its parameters are done, shared
+ * parameters included, in the last of the iter_size passes of an iteration.
+ * reduce may use any transport, it is called for the same buckets in the same
+ * order in all solvers of a data parallel run.
+ */
+template<typename Dtype>
+class GradientBuckets : public Net<Dtype>::Callback, public InternalThread {
+ public:
+  // Reduces count elements of the gradient buffer from offset
+  typedef std::function<void(uint_tp offset, uint_tp count)> Reduce;
+
+  GradientBuckets(shared_ptr<Net<Dtype> > net, int_tp iter_size,
+                  uint_tp bucket_bytes, uint_tp size, const Reduce& reduce);
+  virtual ~GradientBuckets();
+
+  /**
+   * Reduces the buckets not handed yet and waits for all of them, before the
+   * update reads the gradient.
+   */
+  void Wait();
+
+  inline int num_buckets() const {
+    return buckets_.size();
+  }
+  // Milliseconds spent in reduce during the last iteration
+  inline double reduce_ms() const {
+    return reduce_ms_;
+  }
+  // Milliseconds the last Wait blocked, the part of reduce_ms not hidden
+  // behind the backward pass
+  inline double exposed_ms() const {
+    return exposed_ms_;
+  }
+
+ protected:
+  struct Bucket {
+    uint_tp offset;
+    uint_tp count;
+    // Lowest layer using the parameters of the bucket
+    int_tp layer;
+  };
+
+  void run(int layer);  // Net callback
+  void Launch(int count);
+  void InternalThreadEntry();
+
+  shared_ptr<Net<Dtype> > net_;
+  const int_tp iter_size_;
+  const Reduce reduce_;
+  vector<Bucket> buckets_;
+  // Backward passes of the current iteration
+  int_tp passes_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  // Buckets handed to the thread and reduced in the current iteration
+  int launched_;
+  int reduced_;
+  bool stop_;
+
+  double reduce_ms_;
+  double exposed_ms_;
+
+DISABLE_COPY_AND_ASSIGN(GradientBuckets);
+};
+
+/**
+ * @brief Data parallel training on the host, without NCCL.
+ *
+ * Run() starts one solver per worker thread. Each solver reads its own shard
+ * of the data (see DataLayer::Skip), so the effective batch size is the batch
+ * size times the number of workers. After every backward pass the gradients
+ * are averaged with an all-reduce in shared memory: rank r sums the r-th
+ * chunk of the gradient over the buffers of all ranks, starting from its
+ * right neighbour like a ring, and writes the average back to all of them.
+ * Every rank then applies the same update to the same weights. With
+ * layer_wise_reduce, the same is done per bucket of GradientBuckets during
+ * the backward pass.
+ */
+template<typename Dtype>
+class CPUSync : public CPUParams<Dtype>,
+                public Solver<Dtype>::Callback {
+ public:
+  explicit CPUSync(shared_ptr<Solver<Dtype> > solver);
+
+  /**
+   * Broadcast weights from rank 0 to the other solvers.
+   */
+  void Broadcast();
+
+  /**
+   * Trains with Caffe::solver_count() solvers, the current one is rank 0.
+   */
+  void Run(const char* restore);
+
+  // Statistics of the last Run.
+  // Iterations per second of wall time, tests included.
+  inline double iterations_per_second() const {
+    return iterations_per_second_;
+  }
+  // Milliseconds per iteration of each worker spent in the all-reduce,
+  // waiting for the other workers included.
+  inline double reduce_ms() const {
+    return iterations_ ? reduce_ms_ / iterations_ : 0;
+  }
+  // Part of reduce_ms the update waited for, the rest overlapped with the
+  // backward pass.
+  inline double exposed_ms() const {
+    return iterations_ ? exposed_ms_ / iterations_ : 0;
+  }
+  // Fraction of the forward, backward and exposed all-reduce time of the
+  // workers spent computing rather than reducing or waiting for each other.
+  inline double efficiency() const {
+    return compute_ms_ + exposed_ms_ > 0 ?
+           compute_ms_ / (compute_ms_ + exposed_ms_) : 1;
+  }
+
+ protected:
+  void on_start();
+  void on_gradients_ready();
+  void Join(vector<CPUSync<Dtype>*>* syncs, CancelableBarrier* barrier);
+  // Averages count elements from offset over the gradients of all ranks
+  void Reduce(uint_tp offset, uint_tp count);
+
+  shared_ptr<Solver<Dtype> > solver_;
+  const int rank_;
+  vector<CPUSync<Dtype>*>* syncs_;
+  CancelableBarrier* barrier_;
+  // Set once a barrier is cancelled, the solver then stops
+  bool cancelled_;
+  // Set with layer_wise_reduce
+  shared_ptr<GradientBuckets<Dtype> > buckets_;
+
+  CPUTimer timer_;
+  double compute_ms_;
+  double reduce_ms_;
+  double exposed_ms_;
+  int_tp iterations_;
+  double iterations_per_second_;
+
+  template<typename T> friend class CPUWorker;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+/**
+ * @brief Collective operations between the processes of a Transport.
+ *
+ * AllReduce uses recursive halving and doubling when the number of processes
+ * is a power of two, which takes log2(size) steps, and a ring otherwise,
+ * which takes 2 * (size - 1) steps. Both send 2 * (size - 1) / size times the
+ * data per process.
+ */
+template<typename Dtype>
+class Collective {
+ public:
+  enum Algorithm { AUTO, RING, HALVING_DOUBLING };
+
+  explicit Collective(shared_ptr<Transport> transport);
+
+  inline int rank() const { return transport_->rank(); }
+  inline int size() const { return transport_->size(); }
+  inline void set_algorithm(Algorithm value) { algorithm_ = value; }
+
+  // Sums data over all processes, in place.
+  void AllReduce(Dtype* data, uint_tp count);
+  // Copies data of root to all processes, along a binomial tree.
+  void Broadcast(Dtype* data, uint_tp count, int root);
+  void Barrier();
+
+ protected:
+  void RingAllReduce(Dtype* data, uint_tp count);
+  void HalvingDoublingAllReduce(Dtype* data, uint_tp count);
+
+  shared_ptr<Transport> transport_;
+  Algorithm algorithm_;
+  // Received chunks, before they are added
+  vector<Dtype> buffer_;
+
+DISABLE_COPY_AND_ASSIGN(Collective);
+};
+
+/**
+ * @brief Data parallel training over several processes, possibly on several
+ *        hosts, connected by a Transport.
+ *
+ * Every process runs one solver on its own shard of the data, its rank being
+ * Caffe::solver_rank(). The gradients of all parameters live in one buffer,
+ * so they are averaged with a single all-reduce per iteration instead of one
+ * per parameter blob, or with one per bucket of GradientBuckets during the
+ * backward pass with layer_wise_reduce. A stop request of rank 0 is reduced
+ * along with the gradient, all processes then stop after the same iteration.
+ */
+template<typename Dtype>
+class CollectiveSync : public CPUParams<Dtype>,
+                       public Solver<Dtype>::Callback {
+ public:
+  CollectiveSync(shared_ptr<Solver<Dtype> > solver,
+                 shared_ptr<Transport> transport);
+
+  inline Collective<Dtype>* collective() { return &collective_; }
+
+  /**
+   * Broadcast weights from rank 0 to the other processes.
+   */
+  void Broadcast();
+
+  /**
+   * Trains until max_iter or until action, checked by rank 0, asks to stop.
+   */
+  void Run(ActionCallback action = ActionCallback());
+
+  // Statistics of the last Run, see CPUSync.
+  inline double iterations_per_second() const {
+    return iterations_per_second_;
+  }
+  inline double reduce_ms() const {
+    return iterations_ ? reduce_ms_ / iterations_ : 0;
+  }
+  inline double exposed_ms() const {
+    return iterations_ ? exposed_ms_ / iterations_ : 0;
+  }
+  inline double efficiency() const {
+    return compute_ms_ + exposed_ms_ > 0 ?
+           compute_ms_ / (compute_ms_ + exposed_ms_) : 1;
+  }
+
+ protected:
+  void on_start();
+  void on_gradients_ready();
+  SolverAction::Enum GetRequestedAction();
+  // Averages count elements of the gradient from offset, the stop flag
+  // after it is summed
+  void Reduce(uint_tp offset, uint_tp count);
+
+  shared_ptr<Solver<Dtype> > solver_;
+  Collective<Dtype> collective_;
+  ActionCallback action_;
+  // Rank 0 got a stop request, sent with the next gradient
+  bool stop_requested_;
+  // All processes stop after the current iteration
+  bool stopping_;
+  // Set with layer_wise_reduce
+  shared_ptr<GradientBuckets<Dtype> > buckets_;
+
+  CPUTimer timer_;
+  double compute_ms_;
+  double reduce_ms_;
+  double exposed_ms_;
+  int_tp iterations_;
+  double iterations_per_second_;
+
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+#ifdef USE_CUDA
+#ifdef USE_NCCL
+
 // Params stored in GPU memory.
 template<typename Dtype>
 class GPUParams : public Params<Dtype> {
@@ -125,8 +447,9 @@ class NCCL : public GPUParams<Dtype>,
   using Params<Dtype>::diff_;
 };
 
-}  // namespace caffe
-
 #endif  // USE_NCCL
 #endif  // USE_CUDA
+
+}  // namespace caffe
+
 #endif  // header
@@ -0,0 +1,128 @@
+#ifndef CAFFE_QUANTIZER_CALIBRATOR_HPP_
+#define CAFFE_QUANTIZER_CALIBRATOR_HPP_
+
+#include <map>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+enum CalibrationMethod {
+  // Largest observed absolute value
+  CALIBRATION_MAX,
+  // Absolute value covering a percentile of the observed values
+  CALIBRATION_PERCENTILE,
+  // Range minimizing the KL divergence between the observed distribution
+  // and its quantized counterpart
+  CALIBRATION_ENTROPY
+};
+
+/**
+ * @brief Gives every layer its own quantizer index, so that the ranges of
+ *        different layers are calibrated separately.
+ *
+ * Layers share quantizer index 0 unless their definition sets one. Does
+ * nothing and returns false if any layer of param sets quantizer_index.
+ */
+bool AssignQuantizerIndices(NetParameter* param);
+
+/**
+ * @brief Smallest upper bin edge of the histogram of absolute values hist
+ *        that covers percentile (in percent) of all values.
+ */
+double HistogramPercentileRange(const vector<double>& hist, double bin_width,
+                                double percentile);
+
+/**
+ * @brief Clipping range of the histogram of absolute values hist with the
+ *        smallest KL divergence between the clipped distribution and the
+ *        distribution quantized to levels values.
+ *
+ * Values above a candidate range are counted in its last bin, as clipping
+ * maps them there. Candidates range from levels bins to all bins.
+ */
+double HistogramEntropyRange(const vector<double>& hist, double bin_width,
+                             int_tp levels = 128);
+
+/**
+ * @brief Post-training calibration of the quantizer ranges of a net.
+ *
+ * Calibrate runs the net twice over the given number of batches. The first
+ * pass switches all quantizers to OBSERVE to find the range of every
+ * quantizer index, the second one collects histograms of the absolute
+ * values of the bottom and top blobs of the layers with that index.
+ * ComputeRanges then picks a symmetric range per index from its histogram.
+ */
+template<typename Dtype>
+class QuantizerCalibrator {
+ public:
+  explicit QuantizerCalibrator(Net<Dtype>* net, int_tp num_bins = 2048);
+
+  void Calibrate(int_tp iterations);
+  void ComputeRanges(CalibrationMethod method, double percentile = 99.99);
+
+  /// @brief The calibrated range per quantizer index.
+  inline const map<int_tp, double>& ranges() const {
+    return ranges_;
+  }
+  inline const map<int_tp, vector<double> >& histograms() const {
+    return histograms_;
+  }
+  /// @brief Replaces the quantizer entries of param by the calibrated ranges.
+  void RangesToProto(NetParameter* param) const;
+
+ protected:
+  class HistogramCallback : public Net<Dtype>::Callback {
+   public:
+    explicit HistogramCallback(QuantizerCalibrator* calibrator)
+        : calibrator_(calibrator) {}
+   protected:
+    virtual void run(int layer);
+    QuantizerCalibrator* calibrator_;
+  };
+
+  void SetQuantizerMode(QuantizerMode mode, bool reset_range);
+  void AddToHistogram(int_tp index, const vector<BlobBase*>& blobs);
+
+  Net<Dtype>* net_;
+  int_tp num_bins_;
+  // Largest observed absolute value per quantizer index
+  map<int_tp, double> max_abs_;
+  map<int_tp, vector<double> > histograms_;
+  map<int_tp, double> ranges_;
+  HistogramCallback histogram_callback_;
+  bool collect_;
+
+  DISABLE_COPY_AND_ASSIGN(QuantizerCalibrator);
+};
+
+/**
+ * @brief Simulates int8 inference of a floating point net.
+ *
+ * Quantizes the weights of layers with learnable parameters to 8 bit
+ * symmetric values in place, and their bottom blobs to the range of their
+ * quantizer index before each forward pass of the layer. Accuracy of the
+ * net then approximates the int8 accuracy for the given ranges. Runs the
+ * forward pass on a single thread, as bottom blobs are modified in place.
+ */
+template<typename Dtype>
+class SimulatedQuantization : public Net<Dtype>::Callback {
+ public:
+  SimulatedQuantization(Net<Dtype>* net, const map<int_tp, double>& ranges);
+
+ protected:
+  virtual void run(int layer);
+
+  Net<Dtype>* net_;
+  map<int_tp, double> ranges_;
+
+  DISABLE_COPY_AND_ASSIGN(SimulatedQuantization);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_QUANTIZER_CALIBRATOR_HPP_
@@ -1,13 +1,18 @@
 #ifndef CAFFE_SGD_SOLVERS_HPP_
 #define CAFFE_SGD_SOLVERS_HPP_
 
+#include <cmath>
 #include <string>
 #include <vector>
 
 #include "caffe/solver.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+template<typename Dtype>
+class CPUParams;
+
 /**
  * @brief Optimizes the parameters of a Net using
  *        stochastic gradient descent (SGD) with momentum.
@@ -33,6 +38,12 @@ class SGDSolver : public Solver<Dtype> {
 
   const vector<shared_ptr<Blob<Dtype> > >& history() { return history_; }
 
+  // Mixed precision training, see SolverParameter.mixed_precision
+  inline float loss_scale() const { return loss_scale_; }
+  inline int_tp skipped_updates() const { return skipped_updates_; }
+  inline int_tp loss_scale_increases() const { return loss_scale_increases_; }
+  inline int_tp loss_scale_decreases() const { return loss_scale_decreases_; }
+
  protected:
   void PreSolve();
   Dtype GetLearningRate();
@@ -46,13 +57,64 @@ class SGDSolver : public Solver<Dtype> {
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
   virtual void RestoreSolverStateFromHDF5(const string& state_file);
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file);
+  // Restores the loss scale of mixed precision training if positive, and
+  // the master copy of the parameters if saved
+  void RestoreMixedPrecision(float loss_scale,
+                             shared_ptr<Blob<Dtype> > master);
   virtual void GenerateProgram();
+
+  // Flat update, see SolverParameter.flat_update. Returns whether all
+  // learnable parameters are contiguous, as arranged by PreSolve or by the
+  // Params of data parallel training, and the history is.
+  bool FlatParams();
+  // Clips, normalizes, regularizes and updates all parameters in one pass.
+  virtual void ApplyFlatUpdate(Dtype rate);
+  // Pass of ApplyFlatUpdate, update(i, g, local_rate) returns the value
+  // subtracted from the i-th parameter given its regularized gradient g and
+  // updates the history.
+  template<typename Op>
+  void FlatUpdate(Dtype rate, Op update);
+  inline Dtype* flat_history(int i) {
+    return flat_history_->mutable_cpu_data() + i * flat_size_;
+  }
+  // Mixed precision, copies the parameter gradients into the master copy,
+  // divided by the loss scale. Returns false if they overflowed, and adapts
+  // the loss scale.
+  bool MasterGradients();
+  // Mixed precision, copies the updated master copy into the parameters
+  void CopyMasterParams();
+
   // history maintains the historical momentum data.
   // update maintains update related data and is not needed in snapshots.
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
 
+  // Range of the flat buffers with the same multipliers, parameter blobs
+  // are split into several for the threads of FlatUpdate
+  struct FlatSegment {
+    uint_tp offset;
+    uint_tp count;
+    Dtype lr_mult;
+    Dtype decay_mult;
+  };
+  shared_ptr<CPUParams<Dtype> > flat_params_;
+  // history_ blobs point into it, one parameter sized range after another
+  shared_ptr<Blob<Dtype> > flat_history_;
+  vector<FlatSegment> flat_segments_;
+  Dtype* flat_data_;
+  Dtype* flat_diff_;
+  uint_tp flat_size_;
+  // The master copy of the parameters and their gradients in mixed
+  // precision training, flat_data_ and flat_diff_ point into it then
+  shared_ptr<Blob<Dtype> > flat_master_;
+  float loss_scale_;
+  // Updates since the loss scale last changed
+  int_tp loss_scale_iter_;
+  int_tp skipped_updates_;
+  int_tp loss_scale_increases_;
+  int_tp loss_scale_decreases_;
+
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
 
@@ -75,6 +137,7 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ApplyFlatUpdate(Dtype rate);
   virtual void GenerateProgram();
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
@@ -101,6 +164,7 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ApplyFlatUpdate(Dtype rate);
   virtual void GenerateProgram();
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
@@ -132,6 +196,7 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ApplyFlatUpdate(Dtype rate);
   virtual void GenerateProgram();
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
@@ -167,6 +232,7 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ApplyFlatUpdate(Dtype rate);
   virtual void GenerateProgram();
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
@@ -202,11 +268,53 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ApplyFlatUpdate(Dtype rate);
   virtual void GenerateProgram();
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
 
+template<typename Dtype>
+template<typename Op>
+void SGDSolver<Dtype>::FlatUpdate(Dtype rate, Op update) {
+  // Gradient scale counterbalancing accumulation, and clipping
+  Dtype scale = Dtype(1.) / this->param_.iter_size();
+  const Dtype clip_gradients = this->param_.clip_gradients();
+  if (clip_gradients >= 0) {
+    const Dtype l2norm_diff =
+        std::sqrt(caffe_dot(flat_size_, flat_diff_, flat_diff_));
+    if (l2norm_diff > clip_gradients) {
+      Dtype scale_factor = clip_gradients / l2norm_diff;
+      LOG(INFO)<< "Gradient clipping: scaling down gradients (L2 norm "
+      << l2norm_diff << " > " << clip_gradients << ") "
+      << "by scale factor " << scale_factor;
+      scale *= scale_factor;
+    }
+  }
+  const Dtype weight_decay = this->param_.weight_decay();
+  const bool l1 = this->param_.regularization_type() == "L1";
+  Dtype* data = flat_data_;
+  Dtype* diff = flat_diff_;
+  const FlatSegment* segments = flat_segments_.data();
+  const int_tp num_segments = flat_segments_.size();
+#pragma omp parallel for schedule(static)
+  for (int_tp s = 0; s < num_segments; ++s) {
+    const uint_tp begin = segments[s].offset;
+    const uint_tp end = begin + segments[s].count;
+    const Dtype local_rate = rate * segments[s].lr_mult;
+    const Dtype local_decay = weight_decay * segments[s].decay_mult;
+#pragma omp simd
+    for (uint_tp i = begin; i < end; ++i) {
+      const Dtype w = data[i];
+      const Dtype decay = l1 ? Dtype((Dtype(0) < w) - (w < Dtype(0))) : w;
+      const Dtype u = update(i, diff[i] * scale + local_decay * decay,
+                             local_rate);
+      diff[i] = u;
+      data[i] = w - u;
+    }
+  }
+}
+
 }  // namespace caffe
 
 #endif  // CAFFE_SGD_SOLVERS_HPP_
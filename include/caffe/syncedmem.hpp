@@ -30,6 +30,8 @@ class SyncedMemory {
         own_cpu_data_(false),
         own_gpu_data_(false),
         own_zero_copy_data_(false),
+        own_pooled_data_(false),
+        version_(0),
         device_(device_context) {
   }
   explicit SyncedMemory(uint_tp size, Device *device_context)
@@ -40,6 +42,8 @@ class SyncedMemory {
         own_cpu_data_(false),
         own_gpu_data_(false),
         own_zero_copy_data_(false),
+        own_pooled_data_(false),
+        version_(0),
         device_(device_context) {
   }
 
@@ -50,6 +54,14 @@ class SyncedMemory {
   void set_gpu_data(vptr<void> data);
   void* mutable_cpu_data();
   vptr<void> mutable_gpu_data();
+  /**
+   * @brief Starts copying host data to the device on the given queue.
+   *
+   * The memory is marked as synced right away, the device copy is complete
+   * once the device has finished the queue. The host data must not change
+   * until then.
+   */
+  void async_gpu_push(uint_tp queue);
   enum SyncedHead {
     UNINITIALIZED,
     HEAD_AT_CPU,
@@ -62,12 +74,21 @@ class SyncedMemory {
   uint_tp size() {
     return size_;
   }
+  // Incremented every time the data may have been written: on each mutable
+  // access and when the data pointers are replaced. Lets consumers cache
+  // values derived from the data (e.g. transformed convolution filters).
+  uint64_t version() const {
+    return version_;
+  }
 
  private:
   void check_device();
 
   void to_cpu();
   void to_gpu();
+  // Host buffer allocation, through the device's HostMemoryPool if enabled
+  void malloc_host();
+  void free_host();
   void* cpu_ptr_;
   vptr<void> gpu_ptr_;
 
@@ -76,6 +97,8 @@ class SyncedMemory {
   bool own_cpu_data_;
   bool own_gpu_data_;
   bool own_zero_copy_data_;
+  bool own_pooled_data_;
+  uint64_t version_;
   Device *device_;
 
 DISABLE_COPY_AND_ASSIGN(SyncedMemory);
@@ -79,6 +79,10 @@ struct TypeLMDB {
 };
 #endif
 
+struct TypePacked {
+  static DataParameter_DB backend;
+};
+
 
 template<typename Dtype>
 bool isSupported(void);
@@ -109,6 +113,8 @@ template<> bool isSupported<TypeLevelDB>(void);
 template<> bool isSupported<TypeLMDB>(void);
 #endif  // USE_LMDB
 
+template<> bool isSupported<TypePacked>(void);
+
 #ifdef TYPED_TEST
 #undef TYPED_TEST
 #endif  // TYPED_TEST
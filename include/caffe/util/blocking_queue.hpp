@@ -19,6 +19,9 @@ class BlockingQueue {
   // useful for detecting e.g. when data feeding is too slow
   T pop(const string& log_on_wait = "");
 
+  // Waits at most the given time for an element, returns false on timeout
+  bool pop_for(T* t, int64_t microseconds);
+
   bool try_peek(T* t);
 
   // Return element without removing it
@@ -18,7 +18,33 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  /**
+   * @brief Points data to the current value and sets its size, without
+   *        copying the value if the backend supports it.
+   *
+   * The view stays valid until the next call to Next() or SeekToFirst(), or
+   * as long as the cursor exists if stable_values() is true.
+   */
+  virtual void value(const char** data, size_t* size) {
+    value_ = value();
+    *data = value_.data();
+    *size = value_.size();
+  }
+  /// @brief Whether views of values remain valid after moving the cursor.
+  virtual bool stable_values() const { return false; }
   virtual bool valid() = 0;
+  /// @brief Whether Seek() can move the cursor to any record in O(1).
+  virtual bool random_access() const { return false; }
+  /// @brief Number of records, for cursors with random access.
+  virtual size_t num_records() const { return 0; }
+  /// @brief Moves the cursor to the record at position, in insertion order.
+  virtual void Seek(size_t position) {
+    LOG(FATAL) << "This database backend does not support random access";
+  }
+
+ protected:
+  // Copy of the current value, for backends without views
+  string value_;
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
@@ -34,6 +34,13 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  virtual void value(const char** data, size_t* size) {
+    *data = static_cast<const char*>(mdb_value_.mv_data);
+    *size = mdb_value_.mv_size;
+  }
+  // Values point into the memory map, which the read transaction of the
+  // cursor keeps unchanged until the cursor is destroyed.
+  virtual bool stable_values() const { return true; }
   virtual bool valid() { return valid_; }
 
  private:
@@ -0,0 +1,123 @@
+#ifndef CAFFE_UTIL_DB_PACKED_HPP
+#define CAFFE_UTIL_DB_PACKED_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+/**
+ * A packed db is a single file holding a PackedHeader, the values of all
+ * records back to back, an index with one PackedRecord per record and the
+ * keys of all records. Readers map the file into memory, so uncompressed
+ * values are read in place and any record is found in O(1) by its position.
+ * Records keep the order in which they were put, duplicate keys are kept.
+ */
+struct PackedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t num_records;
+  uint64_t index_offset;
+  uint64_t keys_offset;
+  // Size of every record if all of them are uncompressed, of the same size
+  // and stored back to back from the end of the header, 0 otherwise
+  uint64_t record_stride;
+};
+
+enum PackedCodec { PACKED_RAW = 0, PACKED_SNAPPY = 1 };
+
+// Set in PackedHeader::flags if any record is compressed
+const uint32_t kPackedCompressed = 1;
+
+struct PackedRecord {
+  uint64_t offset;
+  // Stored size, and size of the value once decompressed
+  uint64_t size;
+  uint64_t raw_size;
+  // Offset of the key from the start of the keys
+  uint64_t key_offset;
+  uint32_t key_size;
+  uint32_t codec;
+};
+
+class PackedCursor : public Cursor {
+ public:
+  PackedCursor(const char* data, const PackedHeader& header);
+  virtual void SeekToFirst() { position_ = 0; }
+  virtual void Next() { ++position_; }
+  virtual string key();
+  virtual string value();
+  virtual void value(const char** data, size_t* size);
+  // Uncompressed values point into the memory map of the db.
+  virtual bool stable_values() const {
+    return (header_.flags & kPackedCompressed) == 0;
+  }
+  virtual bool valid() { return position_ < header_.num_records; }
+  virtual bool random_access() const { return true; }
+  virtual size_t num_records() const { return header_.num_records; }
+  virtual void Seek(size_t position) { position_ = position; }
+
+ private:
+  const char* data_;
+  const PackedHeader& header_;
+  const PackedRecord* index_;
+  const char* keys_;
+  size_t position_;
+  // Decompressed value of the current record
+  string buffer_;
+};
+
+class PackedDB;
+
+class PackedTransaction : public Transaction {
+ public:
+  explicit PackedTransaction(PackedDB* db) : db_(db) { }
+  virtual void Put(const string& key, const string& value);
+  virtual void Commit();
+
+ private:
+  PackedDB* db_;
+  vector<string> keys, values;
+
+  DISABLE_COPY_AND_ASSIGN(PackedTransaction);
+};
+
+class PackedDB : public DB {
+ public:
+  PackedDB() : file_(NULL), map_(NULL), map_size_(0), compress_(false) { }
+  virtual ~PackedDB() { Close(); }
+  virtual void Open(const string& source, Mode mode);
+  virtual void Close();
+  virtual PackedCursor* NewCursor();
+  virtual PackedTransaction* NewTransaction();
+
+  /**
+   * @brief Compresses the values written from now on, records that do not
+   *        get smaller are stored uncompressed.
+   */
+  void set_compress(bool compress);
+
+ protected:
+  friend class PackedTransaction;
+  void Append(const string& key, const string& value);
+
+  string source_;
+  PackedHeader header_;
+  // Writing
+  FILE* file_;
+  vector<PackedRecord> index_;
+  string keys_;
+  bool compress_;
+  // Reading
+  char* map_;
+  size_t map_size_;
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_PACKED_HPP
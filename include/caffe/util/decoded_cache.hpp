@@ -0,0 +1,67 @@
+#ifndef CAFFE_UTIL_DECODED_CACHE_HPP_
+#define CAFFE_UTIL_DECODED_CACHE_HPP_
+
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Least recently used cache of decoded images and their labels, keyed
+ * by database key or file name and bounded by the size of the pixels.
+ *
+ * Data layers keep decoded images in it so that later epochs only crop,
+ * mirror and scale them. Images are shared with the layers, an evicted image
+ * stays valid for as long as a layer uses it. All methods are thread safe.
+ */
+class DecodedCache {
+ public:
+  explicit DecodedCache(size_t capacity);
+
+  /**
+   * @brief Returns the cache named name, created with the given capacity in
+   *        bytes if no layer uses it yet. The layers of all solvers reading
+   *        the same source this way share one cache.
+   */
+  static shared_ptr<DecodedCache> Shared(const string& name, size_t capacity);
+
+  /// @brief Sets image and label if key is cached, and counts a hit or miss.
+  bool Lookup(const string& key, cv::Mat* image, int_tp* label);
+  /// @brief Caches a copy of the header of image, evicting the least
+  ///        recently used images until it fits. Larger images are not cached.
+  void Insert(const string& key, const cv::Mat& image, int_tp label);
+
+  size_t capacity() const { return capacity_; }
+  size_t bytes();
+  size_t size();
+  uint64_t hits();
+  uint64_t misses();
+  /// @brief Fraction of the lookups that were hits, 0 before any lookup.
+  double hit_rate();
+
+ private:
+  struct Entry;
+  typedef std::list<shared_ptr<Entry> > EntryList;
+
+  const size_t capacity_;
+  size_t bytes_;
+  uint64_t hits_, misses_;
+  // Most recently used first
+  EntryList entries_;
+  std::unordered_map<string, EntryList::iterator> index_;
+  std::mutex mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(DecodedCache);
+};
+
+}  // namespace caffe
+
+#endif  // USE_OPENCV
+#endif  // CAFFE_UTIL_DECODED_CACHE_HPP_
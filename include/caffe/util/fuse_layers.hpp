@@ -0,0 +1,30 @@
+#ifndef CAFFE_UTIL_FUSE_LAYERS_HPP_
+#define CAFFE_UTIL_FUSE_LAYERS_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters of TEST phase nets with fuse_layers set, with
+// BatchNorm and Scale layers folded into the convolution before them, ReLU
+// and Eltwise SUM + ReLU fused into convolutions whose engine supports it
+// (fuse_type), and in-place Dropout and single top Split layers removed.
+// The removed BatchNorm and Scale layers are returned per convolution,
+// in order, for FoldLayerWeights.
+void FuseLayers(const NetParameter& param, NetParameter* param_fused,
+    map<string, vector<LayerParameter> >* folded_layers);
+
+// Folds the weights of BatchNorm and Scale layers into the weights and bias
+// of the convolution they were fused into, for the layers present in
+// weights. Adds the bias if the convolution had none.
+void FoldLayerWeights(
+    const map<string, vector<LayerParameter> >& folded_layers,
+    NetParameter* weights);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FUSE_LAYERS_HPP_
@@ -11,6 +11,9 @@
 
 namespace caffe {
 
+vector<int_tp> hdf5_get_dataset_shape(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim);
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -21,6 +24,15 @@ void hdf5_load_nd_dataset(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
     Blob<Dtype>* blob, bool reshape = false);
 
+/**
+ * @brief Reads num_rows rows of a dataset, starting at row_start along its
+ *        first axis, into blob, which is reshaped accordingly.
+ */
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(
+    hid_t file_id, const char* dataset_name_, hsize_t row_start,
+    hsize_t num_rows, Blob<Dtype>* blob);
+
 template <typename Dtype>
 void hdf5_save_nd_dataset(
     const hid_t file_id, const string& dataset_name, const Blob<Dtype>& blob,
@@ -28,6 +40,8 @@ void hdf5_save_nd_dataset(
 
 int hdf5_load_int(hid_t loc_id, const string& dataset_name);
 void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i);
+float hdf5_load_float(hid_t loc_id, const string& dataset_name);
+void hdf5_save_float(hid_t loc_id, const string& dataset_name, float f);
 string hdf5_load_string(hid_t loc_id, const string& dataset_name);
 void hdf5_save_string(hid_t loc_id, const string& dataset_name,
                       const string& s);
@@ -19,6 +19,21 @@ string ConversionLayerName(const string& layer_name, const string& blob_name,
 string ConversionBlobName(const string& layer_name, const string& blob_name,
     const int_tp blob_idx);
 
+// Keeps the activations between DIRECT engine convolutions channel blocked
+// (NCHWc) in TEST phase nets: sets their channel_block and
+// bottom_channel_block, renames blocked tops (BlockedBlobName) and inserts
+// Reorder layers where other layers read or write these blobs and for
+// blocked net outputs. Split layers pass blocked blobs on unchanged.
+void InsertLayoutConversions(const NetParameter& param,
+                             NetParameter* param_convert);
+
+void ConfigureReorderLayer(const string& bottom_name,
+    const int_tp bottom_channel_block, const string& top_name,
+    const int_tp top_channel_block, DataType data_type,
+    LayerParameter* reorder_layer_param);
+
+string BlockedBlobName(const string& blob_name, const int_tp channel_block);
+
 }  // namespace caffe
 
 
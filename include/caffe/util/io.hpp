@@ -148,6 +148,40 @@ inline bool ReadImageToDatum(const string& filename, const int_tp label,
 bool DecodeDatumNative(Datum* datum);
 bool DecodeDatum(Datum* datum, bool is_color);
 
+/**
+ * @brief The fields of a Datum, with data and float_data pointing to the
+ *        storage of the Datum or of its serialized bytes instead of a copy.
+ */
+struct DatumView {
+  DatumView()
+      : channels(0), height(0), width(0), label(0), data(NULL), data_size(0),
+        float_data(NULL), float_data_size(0), encoded(false) {}
+  explicit DatumView(const Datum& datum)
+      : channels(datum.channels()), height(datum.height()),
+        width(datum.width()), label(datum.label()),
+        data(datum.data().data()), data_size(datum.data().size()),
+        float_data(datum.float_data().data()),
+        float_data_size(datum.float_data_size()), encoded(datum.encoded()) {}
+
+  int_tp channels;
+  int_tp height;
+  int_tp width;
+  int_tp label;
+  const char* data;
+  size_t data_size;
+  const float* float_data;
+  size_t float_data_size;
+  bool encoded;
+};
+
+/**
+ * @brief Reads a serialized Datum in place, the view points into bytes.
+ *
+ * Returns false if bytes is not a valid Datum or holds float_data, which
+ * is not aligned in the serialized bytes. Parse a Datum in that case.
+ */
+bool ParseDatumView(const char* bytes, size_t size, DatumView* datum);
+
 #ifdef USE_OPENCV
 cv::Mat ReadImageToCVMat(const string& filename,
     const int_tp height, const int_tp width, const bool is_color);
@@ -162,6 +196,8 @@ cv::Mat ReadImageToCVMat(const string& filename);
 
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
+cv::Mat DecodeDatumToCVMatNative(const DatumView& datum);
+cv::Mat DecodeDatumToCVMat(const DatumView& datum, bool is_color);
 
 void CVMatToDatum(const cv::Mat& cv_img, Datum* datum);
 #endif  // USE_OPENCV
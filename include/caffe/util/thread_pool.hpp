@@ -0,0 +1,81 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/backend/device.hpp"
+
+/**
+ Forward declare boost::thread instead of including boost/thread.hpp
+ to avoid a boost/NVCC issues (#1009, #1010) on OSX.
+ */
+namespace boost {
+class thread;
+}
+
+namespace caffe {
+
+/**
+ * @brief Fixed size work-stealing thread pool.
+ *
+ * Every worker owns a task deque. Tasks submitted by a worker are pushed to
+ * its own deque and popped LIFO by that worker, which keeps dependent work
+ * on the same core. Idle workers steal FIFO from the deques of the others.
+ * Tasks submitted from outside the pool are distributed round robin.
+ *
+ * Caffe's thread local state of the workers is initialized like for an
+ * InternalThread, from the values of the thread constructing the pool.
+ */
+class ThreadPool {
+ public:
+  ThreadPool(int num_threads, Device* device_context);
+  ~ThreadPool();
+
+  /// @brief Enqueues a task, can be called from inside a task.
+  void Submit(const std::function<void()>& task);
+  /**
+   * @brief Blocks until all submitted tasks, including tasks submitted by
+   *        them, are done. Must not be called from a worker.
+   */
+  void Wait();
+
+  inline int num_threads() const {
+    return threads_.size();
+  }
+  /// @brief Index of the calling worker in this pool, -1 for other threads.
+  int worker_index() const;
+
+ private:
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()> > tasks;
+  };
+
+  void entry(int index, Device* dev, Caffe::Brew mode, int_tp rand_seed,
+             int_tp solver_count, int_tp solver_rank, bool multiprocess);
+  bool PopTask(int index, std::function<void()>* task);
+
+  vector<shared_ptr<boost::thread> > threads_;
+  vector<shared_ptr<TaskQueue> > queues_;
+  std::mutex mutex_;
+  std::condition_variable work_condition_;
+  std::condition_variable done_condition_;
+  // Tasks submitted and not finished yet
+  std::atomic<int_tp> pending_;
+  // Tasks sitting in one of the deques
+  std::atomic<int_tp> queued_;
+  std::atomic<uint_tp> next_queue_;
+  bool stop_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
@@ -0,0 +1,67 @@
+#ifndef CAFFE_UTIL_TRANSPORT_HPP_
+#define CAFFE_UTIL_TRANSPORT_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Point to point byte transfers between the processes of a training
+ *        job, numbered from 0 to size() - 1. Collective operations are built
+ *        on top of it, see Collective in parallel.hpp.
+ *
+ * Messages between two processes are delivered in the order they were sent.
+ * All calls block until the data is sent or received.
+ */
+class Transport {
+ public:
+  Transport() { }
+  virtual ~Transport() { }
+
+  virtual int rank() const = 0;
+  virtual int size() const = 0;
+  virtual void Send(int peer, const void* data, size_t size) = 0;
+  virtual void Recv(int peer, void* data, size_t size) = 0;
+  /**
+   * @brief Sends to dst while receiving from src, which may be the same
+   *        process. Unlike a Send followed by a Recv, it cannot deadlock when
+   *        all processes send large messages to each other at once.
+   */
+  virtual void SendRecv(int dst, const void* send_data, size_t send_size,
+                        int src, void* recv_data, size_t recv_size) = 0;
+
+  DISABLE_COPY_AND_ASSIGN(Transport);
+};
+
+/**
+ * @brief Transport over TCP connections between every pair of processes.
+ *
+ * Rank 0 listens on the port of master, given as "host:port", and the other
+ * ranks connect to it to learn the addresses of each other. The constructor
+ * returns once all processes are connected.
+ */
+class TCPTransport : public Transport {
+ public:
+  TCPTransport(const string& master, int rank, int size);
+  virtual ~TCPTransport();
+
+  virtual int rank() const { return rank_; }
+  virtual int size() const { return size_; }
+  virtual void Send(int peer, const void* data, size_t size);
+  virtual void Recv(int peer, void* data, size_t size);
+  virtual void SendRecv(int dst, const void* send_data, size_t send_size,
+                        int src, void* recv_data, size_t recv_size);
+
+ protected:
+  const int rank_;
+  const int size_;
+  // Socket connected to each rank, -1 for this one
+  vector<int> sockets_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TRANSPORT_HPP_
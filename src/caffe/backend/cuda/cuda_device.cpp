@@ -18,6 +18,8 @@ CudaDevice::CudaDevice(uint_tp id, uint_tp list_id) {
   peak_memory_usage_ = 0;
   host_unified_ = false;
   name_ = "";
+  upload_stream_ = nullptr;
+  upload_event_ = nullptr;
 }
 
 CudaDevice::~CudaDevice() {
@@ -26,6 +28,12 @@ CudaDevice::~CudaDevice() {
     free(cuda_header_sources_[i]);
   }
   buffers_.clear();
+  if (upload_event_) {
+    cudaEventDestroy(upload_event_);
+  }
+  if (upload_stream_) {
+    cudaStreamDestroy(upload_stream_);
+  }
 }
 
 void CudaDevice::Init() {
@@ -43,6 +51,11 @@ void CudaDevice::Init() {
   max_group_sizes_[2] = prop.maxGridSize[2];
   max_local_size_ = prop.maxThreadsPerBlock;
 
+  CUDA_CHECK(cudaStreamCreateWithFlags(&upload_stream_,
+                                       cudaStreamNonBlocking));
+  CUDA_CHECK(cudaEventCreateWithFlags(&upload_event_,
+                                      cudaEventDisableTiming));
+
   ReadHeaders();
   Device::Init();
 
@@ -229,6 +242,11 @@ void CudaDevice::SwitchQueue(uint_tp id) { }
 
 void CudaDevice::FinishQueues() { }
 
+void CudaDevice::FinishQueue(uint_tp id) {
+  // Kernels run on the default stream, only the uploads run asynchronously
+  CUDA_CHECK(cudaEventSynchronize(upload_event_));
+}
+
 }  // namespace caffe
 
 #endif  // USE_CUDA
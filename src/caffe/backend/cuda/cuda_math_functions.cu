@@ -41,6 +41,22 @@ void CudaDevice::memcpy(const uint_tp n, const void* x, vptr<void> y) {
   }
 }
 
+void CudaDevice::memcpy_async(const uint_tp n, const void* x, vptr<void> y) {
+  if (x != y.get_cuda_ptr()) {
+    CHECK(x);
+    CHECK(y.get_cuda_ptr());
+    // Kernels enqueued so far may still read y
+    CUDA_CHECK(cudaEventRecord(upload_event_, 0));
+    CUDA_CHECK(cudaStreamWaitEvent(upload_stream_, upload_event_, 0));
+    // Overlaps with later kernels if x was allocated by MallocMemHost, which
+    // pins it. Pageable memory, such as from the host memory pool, is staged
+    // by the driver before the call returns.
+    CUDA_CHECK(cudaMemcpyAsync(y.get_cuda_ptr(), x, n, cudaMemcpyDefault,
+                               upload_stream_));  // NOLINT(caffe/alt_fn)
+    CUDA_CHECK(cudaEventRecord(upload_event_, upload_stream_));
+  }
+}
+
 void CudaDevice::memcpy(const uint_tp n, vptr<const void> x, void* y) {
   if (x.get_cuda_ptr() != y) {
     CHECK(x.get_cuda_ptr());
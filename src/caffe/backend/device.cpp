@@ -97,6 +97,8 @@ void Device::SwitchQueue(uint_tp id) {}
 
 void Device::FinishQueues() {}
 
+void Device::FinishQueue(uint_tp id) {}
+
 shared_ptr<DeviceProgram> Device::CreateProgram() {
   return nullptr;
 }
@@ -113,6 +115,10 @@ void Device::memcpy(const uint_tp n, vptr<const void> x, void* y) {
   NOT_IMPLEMENTED;
 }
 
+void Device::memcpy_async(const uint_tp n, const void* x, vptr<void> y) {
+  memcpy(n, x, y);
+}
+
 Backend Device::backend() const {
   return backend_;
 }
@@ -156,6 +162,14 @@ void Device::decrease_memory_usage(uint_tp bytes) {
   memory_usage_ -= bytes;
 }
 
+HostMemoryPool* Device::host_memory_pool() {
+  std::lock_guard<std::mutex> lock(host_memory_pool_mutex_);
+  if (!host_memory_pool_) {
+    host_memory_pool_ = make_shared<HostMemoryPool>();
+  }
+  return host_memory_pool_.get();
+}
+
 void Device::reset_peak_memory_usage() {
   peak_memory_usage_ = memory_usage_;
 }
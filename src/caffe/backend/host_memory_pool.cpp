@@ -0,0 +1,257 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "caffe/backend/host_memory_pool.hpp"
+
+namespace caffe {
+
+// Blocks up to this size are kept in the per thread free lists
+static const size_t kThreadCacheMaxBytes = 256 * 1024;
+// Number of blocks per size class a thread keeps before spilling over
+static const size_t kThreadCacheBlocks = 8;
+
+static std::atomic<uint64_t> next_pool_id_(0);
+
+static void* AllocateAligned(size_t size) {
+  size_t align = CAFFE_MALLOC_CACHE_ALIGN;
+  if (size >= CAFFE_MALLOC_HUGE_PAGE_ALIGN) {
+    align = CAFFE_MALLOC_HUGE_PAGE_ALIGN;
+  } else if (size >= CAFFE_MALLOC_PAGE_ALIGN) {
+    align = CAFFE_MALLOC_PAGE_ALIGN;
+  }
+  void* ptr = nullptr;
+#ifdef _MSC_VER
+  ptr = _aligned_malloc(size, align);
+#else
+  CHECK_EQ(0, posix_memalign(&ptr, align, size))
+      << "Host memory allocation error of size: " << size << " b";
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (size >= CAFFE_MALLOC_HUGE_PAGE_ALIGN) {
+    // Only a hint, transparent huge pages may be disabled.
+    madvise(ptr, size, MADV_HUGEPAGE);
+  }
+#endif  // __linux__
+#endif  // _MSC_VER
+  CHECK(ptr) << "Host allocation of size " << size << " failed";
+  return ptr;
+}
+
+static void FreeAligned(void* ptr) {
+#ifdef _MSC_VER
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif  // _MSC_VER
+}
+
+// Free lists of one thread for one pool. Holds only a weak reference, so
+// that a thread outliving the pool frees its blocks directly.
+struct HostMemoryThreadCache {
+  explicit HostMemoryThreadCache(std::weak_ptr<HostMemoryPool> owner)
+      : pool(owner) {
+  }
+  ~HostMemoryThreadCache() {
+    Flush();
+  }
+  void Flush() {
+    shared_ptr<HostMemoryPool> owner = pool.lock();
+    for (size_t cls = 0; cls < free_lists.size(); ++cls) {
+      for (size_t i = 0; i < free_lists[cls].size(); ++i) {
+        if (owner) {
+          owner->PushShared(cls, free_lists[cls][i]);
+        } else {
+          FreeAligned(free_lists[cls][i]);
+        }
+      }
+      free_lists[cls].clear();
+    }
+  }
+  vector<void*>& free_list(size_t cls) {
+    if (cls >= free_lists.size()) {
+      free_lists.resize(cls + 1);
+    }
+    return free_lists[cls];
+  }
+  std::weak_ptr<HostMemoryPool> pool;
+  vector<vector<void*> > free_lists;
+};
+
+struct HostMemoryThreadState {
+  HostMemoryStats stats;
+  std::map<uint64_t, shared_ptr<HostMemoryThreadCache> > caches;
+};
+
+static boost::thread_specific_ptr<HostMemoryThreadState> thread_state_;
+
+static HostMemoryThreadState* GetThreadState() {
+  if (!thread_state_.get()) {
+    thread_state_.reset(new HostMemoryThreadState());
+  }
+  return thread_state_.get();
+}
+
+HostMemoryPool::HostMemoryPool()
+    : id_(next_pool_id_++), allocations_(0), cache_hits_(0), releases_(0),
+      bytes_in_use_(0), peak_bytes_in_use_(0), bytes_cached_(0) {
+}
+
+HostMemoryPool::~HostMemoryPool() {
+  // Blocks in the caches of other threads are freed when those threads exit.
+  HostMemoryThreadState* state = thread_state_.get();
+  if (state) {
+    state->caches.erase(id_);
+  }
+  for (size_t cls = 0; cls < free_lists_.size(); ++cls) {
+    for (size_t i = 0; i < free_lists_[cls].size(); ++i) {
+      FreeAligned(free_lists_[cls][i]);
+    }
+  }
+}
+
+size_t HostMemoryPool::size_class(size_t size, size_t* class_size) {
+  // Classes of 64 bytes up to 256 bytes, then four classes per power of two
+  if (size <= 4 * CAFFE_MALLOC_CACHE_ALIGN) {
+    const size_t cls = size == 0 ? 0 : (size - 1) / CAFFE_MALLOC_CACHE_ALIGN;
+    *class_size = (cls + 1) * CAFFE_MALLOC_CACHE_ALIGN;
+    return cls;
+  }
+  size_t log2 = 0;
+  while ((size - 1) >> (log2 + 1)) {
+    ++log2;
+  }
+  const size_t base = size_t(1) << log2;
+  const size_t step = base >> 2;
+  const size_t sub = (size - 1 - base) / step;
+  *class_size = base + (sub + 1) * step;
+  return 4 + (log2 - 8) * 4 + sub;
+}
+
+size_t HostMemoryPool::class_size_of(size_t cls) {
+  if (cls < 4) {
+    return (cls + 1) * CAFFE_MALLOC_CACHE_ALIGN;
+  }
+  const size_t base = size_t(1) << ((cls - 4) / 4 + 8);
+  return base + ((cls - 4) % 4 + 1) * (base >> 2);
+}
+
+void* HostMemoryPool::Allocate(size_t size) {
+  size_t class_size;
+  const size_t cls = size_class(size, &class_size);
+  HostMemoryThreadState* state = GetThreadState();
+  ++state->stats.allocations;
+  ++allocations_;
+
+  void* ptr = nullptr;
+  if (class_size <= kThreadCacheMaxBytes) {
+    shared_ptr<HostMemoryThreadCache>& cache = state->caches[id_];
+    if (!cache) {
+      cache.reset(new HostMemoryThreadCache(shared_from_this()));
+    }
+    vector<void*>& list = cache->free_list(cls);
+    if (!list.empty()) {
+      ptr = list.back();
+      list.pop_back();
+    }
+  }
+  if (ptr == nullptr) {
+    ptr = PopShared(cls);
+  }
+  if (ptr != nullptr) {
+    ++state->stats.cache_hits;
+    ++cache_hits_;
+    bytes_cached_ -= class_size;
+  } else {
+    ptr = AllocateAligned(class_size);
+  }
+
+  const uint64_t in_use = (bytes_in_use_ += class_size);
+  uint64_t peak = peak_bytes_in_use_.load();
+  while (in_use > peak
+         && !peak_bytes_in_use_.compare_exchange_weak(peak, in_use)) {
+  }
+  return ptr;
+}
+
+void HostMemoryPool::Release(void* ptr, size_t size) {
+  if (ptr == nullptr) {
+    return;
+  }
+  size_t class_size;
+  const size_t cls = size_class(size, &class_size);
+  HostMemoryThreadState* state = GetThreadState();
+  ++state->stats.releases;
+  ++releases_;
+  bytes_in_use_ -= class_size;
+  bytes_cached_ += class_size;
+
+  if (class_size <= kThreadCacheMaxBytes) {
+    shared_ptr<HostMemoryThreadCache>& cache = state->caches[id_];
+    if (!cache) {
+      cache.reset(new HostMemoryThreadCache(shared_from_this()));
+    }
+    vector<void*>& list = cache->free_list(cls);
+    if (list.size() < kThreadCacheBlocks) {
+      list.push_back(ptr);
+      return;
+    }
+  }
+  PushShared(cls, ptr);
+}
+
+void HostMemoryPool::Trim() {
+  HostMemoryThreadState* state = thread_state_.get();
+  if (state && state->caches.count(id_)) {
+    state->caches[id_]->Flush();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t cls = 0; cls < free_lists_.size(); ++cls) {
+    for (size_t i = 0; i < free_lists_[cls].size(); ++i) {
+      FreeAligned(free_lists_[cls][i]);
+    }
+    bytes_cached_ -= class_size_of(cls) * free_lists_[cls].size();
+    free_lists_[cls].clear();
+  }
+}
+
+HostMemoryStats HostMemoryPool::stats() const {
+  HostMemoryStats stats;
+  stats.allocations = allocations_.load();
+  stats.cache_hits = cache_hits_.load();
+  stats.releases = releases_.load();
+  stats.bytes_in_use = bytes_in_use_.load();
+  stats.peak_bytes_in_use = peak_bytes_in_use_.load();
+  stats.bytes_cached = bytes_cached_.load();
+  return stats;
+}
+
+const HostMemoryStats& HostMemoryPool::thread_stats() {
+  return GetThreadState()->stats;
+}
+
+void* HostMemoryPool::PopShared(size_t cls) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cls >= free_lists_.size() || free_lists_[cls].empty()) {
+    return nullptr;
+  }
+  void* ptr = free_lists_[cls].back();
+  free_lists_[cls].pop_back();
+  return ptr;
+}
+
+void HostMemoryPool::PushShared(size_t cls, void* ptr) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cls >= free_lists_.size()) {
+    free_lists_.resize(cls + 1);
+  }
+  free_lists_[cls].push_back(ptr);
+}
+
+}  // namespace caffe
@@ -361,6 +361,13 @@ void OclDevice::FinishQueues() {
   current_queue_id_ = 0;
 }
 
+void OclDevice::FinishQueue(uint_tp id) {
+  viennacl::ocl::context &ctx = viennacl::ocl::get_context(id_);
+  ctx.switch_queue(id % num_queues());
+  ctx.get_queue().finish();
+  ctx.switch_queue(current_queue_id_);
+}
+
 bool OclDevice::is_host_unified() {
   return host_unified_;
 }
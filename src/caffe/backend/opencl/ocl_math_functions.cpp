@@ -41,6 +41,16 @@ void OclDevice::memcpy(const uint_tp n, const void* x, vptr<void> y) {
   }
 }
 
+void OclDevice::memcpy_async(const uint_tp n, const void* x, vptr<void> y) {
+  viennacl::ocl::context &ctx = viennacl::ocl::get_context(this->id());
+  if (x != nullptr) {
+    cl_int err = clEnqueueWriteBuffer(ctx.get_queue().handle().get(),
+                    y.get_ocl_mem(), CL_FALSE, y.get_ocl_off(), n, x, 0,
+                    NULL, NULL);
+    OCL_CHECK(err);
+  }
+}
+
 void OclDevice::memcpy(const uint_tp n, vptr<const void> x, void* y) {
   viennacl::ocl::context &ctx = viennacl::ocl::get_context(this->id());
   if (y != nullptr) {
@@ -487,6 +487,12 @@ void BlobBase::ShareDiffBase(const BlobBase* other) {
   diff_ = other->diff();
 }
 
+void BlobBase::ShareDataMemory(const shared_ptr<SyncedMemory>& memory) {
+  CHECK(data_);
+  CHECK_GE(memory->size(), data_->size());
+  data_ = memory;
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int_tp> or Blob<int_tp>.
@@ -114,7 +114,7 @@ void GlobalInit(int* pargc, char*** pargv) {
 Device *Caffe::GetDevice(int id, bool listId) {
   if (listId) {
     return
-        id == -1 ?
+        (id == -1 || Get().devices_.empty()) ?  // local
             Get().default_device_ :
             Get().devices_[id % Get().devices_.size()].get();
   } else {
@@ -148,11 +148,13 @@ Caffe::Caffe(const Caffe &obj)
       mode_(Caffe::CPU),
       cpu_device_(new Device()),
       default_device_(cpu_device_.get()),
-      solver_count_(1) {
+      solver_count_(1),
+      host_memory_pool_(false) {
   mode_ = obj.mode_;
   default_device_ = obj.default_device_;
   cpu_device_ = obj.cpu_device_;
   solver_count_ = obj.solver_count_;
+  host_memory_pool_ = obj.host_memory_pool_;
 }
 
 void Caffe::SelectDevice(int id, bool listId) {
@@ -211,9 +213,10 @@ void Caffe::SelectDevice(Device* device_context) {
 
 Caffe::Caffe() : random_generator_(),
                  mode_(Caffe::CPU),
-                 cpu_device_(new Device(-1, -1, Backend::BACKEND_CPU)),
+                 cpu_device_(new Device()),
                  default_device_(cpu_device_.get()),
-                 solver_count_(1), solver_rank_(0), multiprocess_(false) { }
+                 solver_count_(1), solver_rank_(0), multiprocess_(false),
+                 host_memory_pool_(false) { }
 
 Caffe::~Caffe() {}
 
@@ -289,7 +292,8 @@ Caffe::Caffe()
       mode_(Caffe::CPU),
       cpu_device_(new Device()),
       default_device_(cpu_device_.get()),
-    solver_count_(1), solver_rank_(0), multiprocess_(false) {
+    solver_count_(1), solver_rank_(0), multiprocess_(false),
+    host_memory_pool_(false) {
 }
 
 Caffe::~Caffe() {
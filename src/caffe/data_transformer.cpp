@@ -5,6 +5,10 @@
 #include <string>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "caffe/data_transformer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -12,6 +16,96 @@
 
 namespace caffe {
 
+// Type the fused uint8 path computes in: half_fp is converted from fp32 once
+// per output element, double keeps the precision of the float_data path.
+template<typename Dtype>
+struct transform_compute {
+  typedef float type;
+};
+template<>
+struct transform_compute<double> {
+  typedef double type;
+};
+
+// One output row of the fused uint8 path: converts width bytes read every
+// stride elements, subtracts mean_row (or mean_value if mean_row is NULL),
+// scales and writes the row to out, reversed if mirror. The inner loops are
+// free of branches so that the compiler can vectorize them.
+template<typename Dtype>
+inline void transform_bytes_row_generic(const uint8_t* in, const int_tp stride,
+    const Dtype* mean_row, const typename transform_compute<Dtype>::type mean,
+    const typename transform_compute<Dtype>::type scale, const int_tp width,
+    const bool mirror, Dtype* out) {
+  typedef typename transform_compute<Dtype>::type Ctype;
+  if (mean_row) {
+    if (mirror) {
+      for (int_tp w = 0; w < width; ++w) {
+        out[width - 1 - w] = static_cast<Dtype>((static_cast<Ctype>(
+            in[w * stride]) - static_cast<Ctype>(mean_row[w])) * scale);
+      }
+    } else {
+      for (int_tp w = 0; w < width; ++w) {
+        out[w] = static_cast<Dtype>((static_cast<Ctype>(in[w * stride])
+            - static_cast<Ctype>(mean_row[w])) * scale);
+      }
+    }
+  } else {
+    if (mirror) {
+      for (int_tp w = 0; w < width; ++w) {
+        out[width - 1 - w] = static_cast<Dtype>(
+            (static_cast<Ctype>(in[w * stride]) - mean) * scale);
+      }
+    } else {
+      for (int_tp w = 0; w < width; ++w) {
+        out[w] = static_cast<Dtype>(
+            (static_cast<Ctype>(in[w * stride]) - mean) * scale);
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+inline void transform_bytes_row(const uint8_t* in, const int_tp stride,
+    const Dtype* mean_row, const typename transform_compute<Dtype>::type mean,
+    const typename transform_compute<Dtype>::type scale, const int_tp width,
+    const bool mirror, Dtype* out) {
+  transform_bytes_row_generic(in, stride, mean_row, mean, scale, width,
+                              mirror, out);
+}
+
+#ifdef __AVX2__
+// Planar rows of 8 bytes at a time, mirrored by reversing the lanes.
+// Subtracting before scaling without FMA gives the same results as the
+// generic loop.
+template<>
+inline void transform_bytes_row<float>(const uint8_t* in, const int_tp stride,
+    const float* mean_row, const float mean, const float scale,
+    const int_tp width, const bool mirror, float* out) {
+  int_tp w = 0;
+  if (stride == 1) {
+    const __m256 mean_v = _mm256_set1_ps(mean);
+    const __m256 scale_v = _mm256_set1_ps(scale);
+    const __m256i reverse = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (; w + 8 <= width; w += 8) {
+      __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + w))));
+      x = _mm256_sub_ps(x, mean_row ? _mm256_loadu_ps(mean_row + w) : mean_v);
+      x = _mm256_mul_ps(x, scale_v);
+      if (mirror) {
+        _mm256_storeu_ps(out + width - 8 - w,
+                         _mm256_permutevar8x32_ps(x, reverse));
+      } else {
+        _mm256_storeu_ps(out + w, x);
+      }
+    }
+  }
+  // Remaining pixels, the mirrored ones go to the start of the row
+  transform_bytes_row_generic(in + w * stride, stride,
+                              mean_row ? mean_row + w : NULL, mean, scale,
+                              width - w, mirror, mirror ? out : out + w);
+}
+#endif  // __AVX2__
+
 template<typename Dtype>
 DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
                                         Phase phase,
@@ -41,18 +135,19 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
 }
 
 template<typename Dtype>
-void DataTransformer<Dtype>::Transform(const Datum& datum,
+void DataTransformer<Dtype>::Transform(const DatumView& datum,
                                        Dtype* transformed_data) {
-  const string& data = datum.data();
-  const int_tp datum_channels = datum.channels();
-  const int_tp datum_height = datum.height();
-  const int_tp datum_width = datum.width();
+  const char* data = datum.data;
+  const float* float_data = datum.float_data;
+  const int_tp datum_channels = datum.channels;
+  const int_tp datum_height = datum.height;
+  const int_tp datum_width = datum.width;
 
   const int_tp crop_size = param_.crop_size();
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
   const bool has_mean_file = param_.has_mean_file();
-  const bool has_uint8 = data.size() > 0;
+  const bool has_uint8 = datum.data_size > 0;
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(datum_channels, 0);
@@ -96,6 +191,26 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     }
   }
 
+  if (has_uint8) {
+    // Crop, mirror, mean subtraction, scaling and conversion in one pass
+    typedef typename transform_compute<Dtype>::type Ctype;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    for (int_tp c = 0; c < datum_channels; ++c) {
+      const Ctype mean_value =
+          has_mean_values ? static_cast<Ctype>(mean_values_[c]) : Ctype(0);
+      for (int_tp h = 0; h < height; ++h) {
+        const int_tp data_index =
+            (c * datum_height + h_off + h) * datum_width + w_off;
+        transform_bytes_row(bytes + data_index, 1,
+                            has_mean_file ? mean + data_index : NULL,
+                            mean_value, static_cast<Ctype>(scale), width,
+                            do_mirror, transformed_data
+                                       + (c * height + h) * width);
+      }
+    }
+    return;
+  }
+
   Dtype datum_element;
   int_tp top_index, data_index;
   for (int_tp c = 0; c < datum_channels; ++c) {
@@ -107,12 +222,7 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
         } else {
           top_index = (c * height + h) * width + w;
         }
-        if (has_uint8) {
-          datum_element =
-              static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-        } else {
-          datum_element = datum.float_data(data_index);
-        }
+        datum_element = float_data[data_index];
         if (has_mean_file) {
           transformed_data[top_index] = (datum_element - mean[data_index])
               * scale;
@@ -133,20 +243,17 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
                                        Blob<Dtype>* transformed_blob) {
+  Transform(DatumView(datum), transformed_blob);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const DatumView& datum,
+                                       Blob<Dtype>* transformed_blob) {
   // If datum is encoded, decode and transform the cv::image.
-  if (datum.encoded()) {
+  if (datum.encoded) {
 #ifdef USE_OPENCV
-    CHECK(!(param_.force_color() && param_.force_gray()))
-        << "cannot set both force_color and force_gray";
-    cv::Mat cv_img;
-    if (param_.force_color() || param_.force_gray()) {
-    // If force_color then decode in color otherwise decode in gray.
-      cv_img = DecodeDatumToCVMat(datum, param_.force_color());
-    } else {
-      cv_img = DecodeDatumToCVMatNative(datum);
-    }
     // Transform the cv::image into blob.
-    return Transform(cv_img, transformed_blob);
+    return Transform(DecodeDatum(datum), transformed_blob);
 #else
     LOG(FATAL) << "Encoded datum requires OpenCV; compile with USE_OPENCV.";
 #endif  // USE_OPENCV
@@ -157,9 +264,9 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   }
 
   const int_tp crop_size = param_.crop_size();
-  const int_tp datum_channels = datum.channels();
-  const int_tp datum_height = datum.height();
-  const int_tp datum_width = datum.width();
+  const int_tp datum_channels = datum.channels;
+  const int_tp datum_height = datum.height;
+  const int_tp datum_width = datum.width;
 
   // Check dimensions.
   const int_tp channels = transformed_blob->channels();
@@ -184,6 +291,19 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   Transform(datum, transformed_data);
 }
 
+#ifdef USE_OPENCV
+template<typename Dtype>
+cv::Mat DataTransformer<Dtype>::DecodeDatum(const DatumView& datum) {
+  CHECK(!(param_.force_color() && param_.force_gray()))
+      << "cannot set both force_color and force_gray";
+  if (param_.force_color() || param_.force_gray()) {
+    // If force_color then decode in color otherwise decode in gray.
+    return DecodeDatumToCVMat(datum, param_.force_color());
+  }
+  return DecodeDatumToCVMatNative(datum);
+}
+#endif  // USE_OPENCV
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const vector<Datum> & datum_vector,
                                        Blob<Dtype>* transformed_blob) {
@@ -300,6 +420,27 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK(cv_cropped_img.data);
 
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
+  if (cv_img.depth() == CV_8U) {
+    // Crop, mirror, mean subtraction, scaling and conversion of each plane
+    // of an interleaved row in one pass
+    typedef typename transform_compute<Dtype>::type Ctype;
+    for (int_tp h = 0; h < height; ++h) {
+      const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
+      for (int_tp c = 0; c < img_channels; ++c) {
+        const Ctype mean_value =
+            has_mean_values ? static_cast<Ctype>(mean_values_[c]) : Ctype(0);
+        const int_tp mean_index =
+            (c * img_height + h_off + h) * img_width + w_off;
+        transform_bytes_row(ptr + c, img_channels,
+                            has_mean_file ? mean + mean_index : NULL,
+                            mean_value, static_cast<Ctype>(scale), width,
+                            do_mirror, transformed_data
+                                       + (c * height + h) * width);
+      }
+    }
+    return;
+  }
+
   int_tp top_index;
   for (int_tp h = 0; h < height; ++h) {
     const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
@@ -312,13 +453,8 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
           top_index = (c * height + h) * width + w;
         }
         // int_tp top_index = (c * height + h) * width + w;
-        Dtype pixel;
-        if (cv_img.depth() == CV_8U) {
-          pixel = static_cast<Dtype>(ptr[img_index++]);
-        } else {
-          pixel = static_cast<Dtype>((reinterpret_cast<const float*>(ptr))
-                                     [img_index++]);
-        }
+        const Dtype pixel = static_cast<Dtype>(
+            (reinterpret_cast<const float*>(ptr))[img_index++]);
         if (has_mean_file) {
           int_tp mean_index = (c * img_height + h_off + h) * img_width + w_off
               + w;
@@ -543,6 +679,17 @@ void DataTransformer<Dtype>::InitRand() {
   }
 }
 
+template <typename Dtype>
+void DataTransformer<Dtype>::InitRand(size_t seed) {
+  const bool needs_rand = param_.mirror()
+      || (phase_ == TRAIN && param_.crop_size());
+  if (needs_rand) {
+    rng_.reset(new Caffe::RNG(seed));
+  } else {
+    rng_.reset();
+  }
+}
+
 template<typename Dtype>
 int_tp DataTransformer<Dtype>::Rand(int_tp n) {
   CHECK(rng_);
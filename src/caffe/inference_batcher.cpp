@@ -0,0 +1,195 @@
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "caffe/inference_batcher.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Number of latencies kept for the percentiles
+static const size_t kLatencyWindow = 100000;
+
+template<typename Dtype>
+InferenceBatcher<Dtype>::InferenceBatcher(const shared_ptr<Net<Dtype> >& net,
+                                          int max_batch_size,
+                                          int64_t max_delay_us)
+    : net_(net), max_batch_size_(max_batch_size),
+      max_delay_us_(max_delay_us), num_requests_(0),
+      batch_sizes_(max_batch_size + 1, 0), next_latency_(0) {
+  CHECK_GT(max_batch_size_, 0);
+  CHECK_GE(max_delay_us_, 0);
+  const vector<BlobBase*>& inputs = net_->input_blobs();
+  CHECK_GT(inputs.size(), 0) << "The net has no input blobs";
+  for (int i = 0; i < inputs.size(); ++i) {
+    CHECK_GT(inputs[i]->num_axes(), 0);
+    sample_counts_.push_back(inputs[i]->count(1));
+  }
+  StartInternalThread(Caffe::GetDefaultDevice());
+}
+
+template<typename Dtype>
+InferenceBatcher<Dtype>::~InferenceBatcher() {
+  StopInternalThread();
+  InferenceRequest<Dtype>* request;
+  while (requests_.try_pop(&request)) {
+    request->result.set_exception(std::make_exception_ptr(
+        std::runtime_error("InferenceBatcher stopped")));
+    delete request;
+  }
+}
+
+template<typename Dtype>
+std::future<vector<vector<Dtype> > > InferenceBatcher<Dtype>::Submit(
+    const vector<vector<Dtype> >& inputs) {
+  CHECK_EQ(inputs.size(), sample_counts_.size())
+      << "One sample per net input expected";
+  for (int i = 0; i < inputs.size(); ++i) {
+    CHECK_EQ(inputs[i].size(), sample_counts_[i])
+        << "Wrong sample size for input " << i;
+  }
+  InferenceRequest<Dtype>* request = new InferenceRequest<Dtype>();
+  request->inputs = inputs;
+  request->submitted = std::chrono::steady_clock::now();
+  std::future<vector<vector<Dtype> > > future = request->result.get_future();
+  requests_.push(request);
+  return future;
+}
+
+template<typename Dtype>
+void InferenceBatcher<Dtype>::InternalThreadEntry() {
+  vector<InferenceRequest<Dtype>*> batch;
+  try {
+    while (!must_stop()) {
+      batch.clear();
+      batch.push_back(requests_.pop());
+      const std::chrono::steady_clock::time_point deadline =
+          batch[0]->submitted + std::chrono::microseconds(max_delay_us_);
+      while (batch.size() < max_batch_size_) {
+        const int64_t remaining =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        InferenceRequest<Dtype>* request;
+        // Take what is queued already even if the deadline passed
+        if (!(remaining > 0 ? requests_.pop_for(&request, remaining)
+                            : requests_.try_pop(&request))) {
+          break;
+        }
+        batch.push_back(request);
+      }
+      RunBatch(batch);
+      batch.clear();
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+    for (int i = 0; i < batch.size(); ++i) {
+      batch[i]->result.set_exception(std::make_exception_ptr(
+          std::runtime_error("InferenceBatcher stopped")));
+      delete batch[i];
+    }
+  }
+}
+
+template<typename Dtype>
+void InferenceBatcher<Dtype>::RunBatch(
+    const vector<InferenceRequest<Dtype>*>& batch) {
+  const int batch_size = batch.size();
+  const vector<BlobBase*>& inputs = net_->input_blobs();
+  bool reshape = false;
+  for (int i = 0; i < inputs.size(); ++i) {
+    Blob<Dtype>* input = static_cast<Blob<Dtype>*>(inputs[i]);
+    if (input->shape(0) != batch_size) {
+      vector<int_tp> shape = input->shape();
+      shape[0] = batch_size;
+      input->Reshape(shape);
+      reshape = true;
+    }
+    Dtype* input_data = input->mutable_cpu_data();
+    for (int j = 0; j < batch_size; ++j) {
+      caffe_copy(sample_counts_[i], &batch[j]->inputs[i][0],
+                 input_data + j * sample_counts_[i]);
+    }
+  }
+  if (reshape) {
+    net_->Reshape();
+  }
+  const vector<BlobBase*>& outputs = net_->Forward();
+
+  vector<vector<vector<Dtype> > > results(batch_size,
+      vector<vector<Dtype> >(outputs.size()));
+  for (int i = 0; i < outputs.size(); ++i) {
+    const Blob<Dtype>* output = static_cast<const Blob<Dtype>*>(outputs[i]);
+    const Dtype* output_data = output->cpu_data();
+    const bool batched = output->num_axes() > 0
+        && output->shape(0) == batch_size;
+    const int_tp count = batched ? output->count(1) : output->count();
+    for (int j = 0; j < batch_size; ++j) {
+      const Dtype* sample = output_data + (batched ? j * count : 0);
+      results[j][i].assign(sample, sample + count);
+    }
+  }
+
+  const std::chrono::steady_clock::time_point done =
+      std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    num_requests_ += batch_size;
+    ++batch_sizes_[batch_size];
+    for (int j = 0; j < batch_size; ++j) {
+      const double latency = std::chrono::duration_cast<
+          std::chrono::microseconds>(done - batch[j]->submitted).count();
+      if (latencies_.size() < kLatencyWindow) {
+        latencies_.push_back(latency);
+      } else {
+        latencies_[next_latency_] = latency;
+        next_latency_ = (next_latency_ + 1) % kLatencyWindow;
+      }
+    }
+  }
+  for (int j = 0; j < batch_size; ++j) {
+    batch[j]->result.set_value(results[j]);
+    delete batch[j];
+  }
+}
+
+template<typename Dtype>
+InferenceBatcherStats InferenceBatcher<Dtype>::stats() const {
+  InferenceBatcherStats stats;
+  vector<double> latencies;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats.requests = num_requests_;
+    stats.batch_sizes = batch_sizes_;
+    latencies = latencies_;
+  }
+  for (int i = 1; i < stats.batch_sizes.size(); ++i) {
+    stats.batches += stats.batch_sizes[i];
+  }
+  if (stats.batches > 0) {
+    stats.mean_batch_size = static_cast<double>(stats.requests)
+        / stats.batches;
+    stats.batch_fill = stats.mean_batch_size / max_batch_size_;
+  }
+  if (latencies.size() > 0) {
+    std::sort(latencies.begin(), latencies.end());
+    const size_t last = latencies.size() - 1;
+    stats.p50_latency_ms = latencies[last / 2] / 1000.0;
+    stats.p99_latency_ms = latencies[last * 99 / 100] / 1000.0;
+    stats.max_latency_ms = latencies[last] / 1000.0;
+  }
+  return stats;
+}
+
+template<typename Dtype>
+void InferenceBatcher<Dtype>::ResetStats() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  num_requests_ = 0;
+  std::fill(batch_sizes_.begin(), batch_sizes_.end(), 0);
+  latencies_.clear();
+  next_latency_ = 0;
+}
+
+INSTANTIATE_CLASS_1T_GUARDED(InferenceBatcher, (half_fp)(float)(double));
+
+}  // namespace caffe
@@ -0,0 +1,82 @@
+#include <string>
+#include <vector>
+
+#include "caffe/inference_session.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+namespace caffe {
+
+template<typename Dtype>
+InferenceModel<Dtype>::InferenceModel(const NetParameter& param,
+                                      Device* device_context)
+    : device_(device_context) {
+  Init(param, "");
+}
+
+template<typename Dtype>
+InferenceModel<Dtype>::InferenceModel(const string& param_file,
+                                      const string& trained_filename,
+                                      Device* device_context, const int level,
+                                      const vector<string>* stages)
+    : device_(device_context) {
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(param_file, &param);
+  param.mutable_state()->set_level(level);
+  if (stages != NULL) {
+    for (int i = 0; i < stages->size(); i++) {
+      param.mutable_state()->add_stage((*stages)[i]);
+    }
+  }
+  Init(param, trained_filename);
+}
+
+template<typename Dtype>
+void InferenceModel<Dtype>::Init(const NetParameter& param,
+                                 const string& trained_filename) {
+  session_param_ = param;
+  session_param_.mutable_state()->set_phase(TEST);
+  net_.reset(new Net<Dtype>(session_param_, device_));
+  if (!trained_filename.empty()) {
+    net_->CopyTrainedLayersFrom(trained_filename);
+  }
+  // Weights embedded in the definition are already in the model.
+  for (int i = 0; i < session_param_.layer_size(); ++i) {
+    session_param_.mutable_layer(i)->clear_blobs();
+  }
+  if (!session_param_.has_optimize_memory()) {
+    session_param_.set_optimize_memory(true);
+  }
+  // Move the weights to where they are used now, concurrent sessions only
+  // read them afterwards.
+  const vector<shared_ptr<BlobBase> >& params = net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    if (params[i]->count() == 0) {
+      continue;
+    }
+    if (Caffe::mode() == Caffe::GPU) {
+      params[i]->data()->gpu_data();
+    } else {
+      params[i]->data()->cpu_data();
+    }
+  }
+}
+
+template<typename Dtype>
+shared_ptr<InferenceSession<Dtype> >
+    InferenceModel<Dtype>::CreateSession() const {
+  return shared_ptr<InferenceSession<Dtype> >(
+      new InferenceSession<Dtype>(net_, session_param_, device_));
+}
+
+template<typename Dtype>
+InferenceSession<Dtype>::InferenceSession(
+    const shared_ptr<Net<Dtype> >& weights_net, const NetParameter& param,
+    Device* device_context)
+    : weights_net_(weights_net),
+      net_(new Net<Dtype>(param, weights_net.get(), device_context)) {
+}
+
+INSTANTIATE_CLASS_1T_GUARDED(InferenceModel, (half_fp)(float)(double));
+INSTANTIATE_CLASS_1T_GUARDED(InferenceSession, (half_fp)(float)(double));
+
+}  // namespace caffe
@@ -12,12 +12,14 @@
 #include "caffe/layers/conv_layer.hpp"
 #include "caffe/layers/conv_spatial_layer.hpp"
 #include "caffe/layers/deconv_layer.hpp"
+#include "caffe/layers/direct_conv_layer.hpp"
 #include "caffe/layers/lrn_layer.hpp"
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/layers/relu_layer.hpp"
 #include "caffe/layers/sigmoid_layer.hpp"
 #include "caffe/layers/softmax_layer.hpp"
 #include "caffe/layers/tanh_layer.hpp"
+#include "caffe/layers/winograd_conv_layer.hpp"
 #include "caffe/util/type_utils.hpp"
 
 #ifdef USE_CUDNN
@@ -196,6 +198,15 @@ shared_ptr<Layer<Dtype, MItype, MOtype> > GetConvolutionLayer(const LayerParamet
 #endif  // USE_INTEL_SPATIAL
   }
 
+  if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return shared_ptr<Layer<Dtype, MItype, MOtype> >(
+        new WinogradConvolutionLayer<Dtype, MItype, MOtype>(param));
+  }
+  if (engine == ConvolutionParameter_Engine_DIRECT) {
+    return shared_ptr<Layer<Dtype, MItype, MOtype> >(
+        new DirectConvolutionLayer<Dtype, MItype, MOtype>(param));
+  }
+
 #ifdef USE_INTEL_SPATIAL
   if (engine == ConvolutionParameter_Engine_INTEL_SPATIAL) {
     return shared_ptr<Layer<Dtype, MItype, MOtype> >
@@ -245,6 +256,16 @@ REGISTER_LAYER_CREATOR(Convolution, GetConvolutionLayer,
 REGISTER_LAYER_CREATOR(Convolution, GetConvolutionLayer,
                        (double), (double), (double));
 
+template<typename Dtype, typename MItype, typename MOtype>
+shared_ptr<Layer<Dtype, MItype, MOtype> > GetCaffeConvolutionLayer(
+    const LayerParameter& param) {
+  return shared_ptr<Layer<Dtype, MItype, MOtype> >(
+      new ConvolutionLayer<Dtype, MItype, MOtype>(param));
+}
+
+REGISTER_LAYER_CREATOR(Convolution, GetCaffeConvolutionLayer,
+                       (half_fp), (half_fp), (half_fp));
+
 
 // Get deconvolution layer according to engine.
 template<typename Dtype, typename MItype, typename MOtype>
@@ -278,6 +299,16 @@ REGISTER_LAYER_CREATOR(Deconvolution, GetDeconvolutionLayer,
 REGISTER_LAYER_CREATOR(Deconvolution, GetDeconvolutionLayer,
                        (double), (double), (double));
 
+template<typename Dtype, typename MItype, typename MOtype>
+shared_ptr<Layer<Dtype, MItype, MOtype> > GetCaffeDeconvolutionLayer(
+    const LayerParameter& param) {
+  return shared_ptr<Layer<Dtype, MItype, MOtype> >(
+      new DeconvolutionLayer<Dtype, MItype, MOtype>(param));
+}
+
+REGISTER_LAYER_CREATOR(Deconvolution, GetCaffeDeconvolutionLayer,
+                       (half_fp), (half_fp), (half_fp));
+
 // Get pooling layer according to engine.
 template<typename Dtype, typename MItype, typename MOtype>
 shared_ptr<Layer<Dtype, MItype, MOtype> > GetPoolingLayer(
@@ -337,6 +368,16 @@ REGISTER_LAYER_CREATOR(Pooling, GetPoolingLayer,
 REGISTER_LAYER_CREATOR(Pooling, GetPoolingLayer,
                        (double), (double), (double));
 
+template<typename Dtype, typename MItype, typename MOtype>
+shared_ptr<Layer<Dtype, MItype, MOtype> > GetCaffePoolingLayer(
+    const LayerParameter& param) {
+  return shared_ptr<Layer<Dtype, MItype, MOtype> >(
+      new PoolingLayer<Dtype, MItype, MOtype>(param));
+}
+
+REGISTER_LAYER_CREATOR(Pooling, GetCaffePoolingLayer,
+                       (half_fp), (half_fp), (half_fp));
+
 // Get LRN layer according to engine
 template <typename Dtype, typename MItype, typename MOtype>
 shared_ptr<Layer<Dtype, MItype, MOtype> > GetLRNLayer(
@@ -445,6 +486,16 @@ REGISTER_LAYER_CREATOR(Sigmoid, GetSigmoidLayer,
 REGISTER_LAYER_CREATOR(Sigmoid, GetSigmoidLayer,
                        (double), (double), (double));
 
+template<typename Dtype, typename MItype, typename MOtype>
+shared_ptr<Layer<Dtype, MItype, MOtype> > GetCaffeSigmoidLayer(
+    const LayerParameter& param) {
+  return shared_ptr<Layer<Dtype, MItype, MOtype> >(
+      new SigmoidLayer<Dtype, MItype, MOtype>(param));
+}
+
+REGISTER_LAYER_CREATOR(Sigmoid, GetCaffeSigmoidLayer,
+                       (half_fp), (half_fp), (half_fp));
+
 // Get softmax layer according to engine.
 template<typename Dtype, typename MItype, typename MOtype>
 shared_ptr<Layer<Dtype, MItype, MOtype> > GetSoftmaxLayer(
@@ -300,8 +300,6 @@ void BaseConvolutionLayer<Dtype, MItype, MOtype>::Reshape(
   }
 }
 
-#ifndef CPU ONLY
-
 template<typename Dtype, typename MItype, typename MOtype>
 shared_ptr<Blob<Dtype> >
                      BaseConvolutionLayer<Dtype, MItype, MOtype>::col_buffer() {
@@ -320,8 +318,6 @@ void BaseConvolutionLayer<Dtype, MItype, MOtype>::unlock_col_buffer() {
   }
 }
 
-#endif  // !CPU_ONLY
-
 
 INSTANTIATE_CLASS_3T_GUARDED(BaseConvolutionLayer, (half_fp), (half_fp),
                              PROTO_TYPES);
@@ -8,6 +8,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
@@ -38,13 +39,23 @@ BasePrefetchingDataLayer<Dtype, MItype, MOtype>::BasePrefetchingDataLayer(
     const LayerParameter& param)
     : BaseDataLayer<Dtype, MItype, MOtype>(param),
       prefetch_(param.data_param().prefetch()),
-      prefetch_free_(), prefetch_full_(), prefetch_current_() {
+      rand_seed_(0), items_loaded_(0),
+      prefetch_free_(), prefetch_full_(), prefetch_current_(),
+      prefetch_uploading_(), upload_queue_(0) {
   for (int i = 0; i < prefetch_.size(); ++i) {
     prefetch_[i].reset(new Batch<Dtype>());
     prefetch_free_.push(prefetch_[i].get());
   }
 }
 
+template<typename Dtype, typename MItype, typename MOtype>
+BasePrefetchingDataLayer<Dtype, MItype, MOtype>::~BasePrefetchingDataLayer() {
+  // The host memory of the batch must outlive its upload
+  if (prefetch_uploading_) {
+    this->device_->FinishQueue(upload_queue_);
+  }
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::LayerSetUp(
     const vector<Blob<MItype>*>& bottom,
@@ -71,63 +82,124 @@ void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::LayerSetUp(
     }
   }
 #endif
+  // Uploads go to the last queue of the device, away from the compute
+  // kernels on queue 0
+  upload_queue_ = this->device_->num_queues() - 1;
+  prefetch_uploading_ = nullptr;
   DLOG(INFO) << "Initializing prefetch";
   this->data_transformer_->InitRand();
+  const int_tp decode_threads = this->layer_param_.data_param()
+      .decode_threads();
+  CHECK_GT(decode_threads, 0) << "decode_threads must be positive";
+  rand_seed_ = caffe_rng_rand();
+  items_loaded_ = 0;
+  decode_workers_.clear();
+  for (int_tp i = 0; i < decode_threads; ++i) {
+    shared_ptr<DecodeWorker> worker(new DecodeWorker());
+    worker->transformer.reset(new DataTransformer<Dtype>(
+        this->transform_param_, this->phase_, this->device_));
+    decode_workers_.push_back(worker);
+  }
+  decode_pool_.reset();
+  if (decode_threads > 1) {
+    decode_pool_.reset(new ThreadPool(decode_threads, this->get_device()));
+  }
   StartInternalThread(this->get_device());
   DLOG(INFO) << "Prefetch initialized.";
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
 void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::InternalThreadEntry() {
-#ifndef CPU_ONLY
-#ifdef USE_CUDA
-  cudaStream_t stream;
-  if (this->get_device()->backend() == BACKEND_CUDA) {
-    if (Caffe::mode() == Caffe::GPU) {
-      if (this->get_device()->backend() == BACKEND_CUDA) {
-        CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
-      }
-    }
-  }
-#endif  // USE_CUDA
-#endif  // !CPU_ONLY
-
+  // Batches are uploaded to the device by the thread running the net, see
+  // StartUpload, as device queues are not meant to be shared between threads.
   try {
     while (!must_stop()) {
       Batch<Dtype>* batch = prefetch_free_.pop();
       load_batch(batch);
-#ifndef CPU_ONLY
-#ifdef USE_CUDA
-      if (Caffe::mode() == Caffe::GPU) {
-        // FIXME: Async load
-        /*
-        if (this->get_device()->backend() == BACKEND_CUDA) {
-          batch->data_.data().get()->async_gpu_push(stream);
-          if (this->output_labels_) {
-            batch->label_.data().get()->async_gpu_push(stream);
-          }
-          CUDA_CHECK(cudaStreamSynchronize(stream));
-        }
-        */
-      }
-#endif  // USE_CUDA
-#endif  // !CPU_ONLY
       prefetch_full_.push(batch);
     }
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
   }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::StartUpload() {
 #ifndef CPU_ONLY
-#ifdef USE_CUDA
-  if (Caffe::mode() == Caffe::GPU) {
-    if (this->get_device()->backend() == BACKEND_CUDA) {
-      CUDA_CHECK(cudaStreamDestroy(stream));
-    }
+  Batch<MOtype>* batch;
+  if (!prefetch_full_.try_peek(&batch)
+      || batch->data_.data()->head() != SyncedMemory::HEAD_AT_CPU) {
+    return;
   }
-#endif  // USE_CUDA
+  batch->data_.data()->async_gpu_push(upload_queue_);
+  if (this->output_labels_
+      && batch->label_.data()->head() == SyncedMemory::HEAD_AT_CPU) {
+    batch->label_.data()->async_gpu_push(upload_queue_);
+  }
+  prefetch_uploading_ = batch;
+  upload_timer_.Start();
 #endif  // !CPU_ONLY
 }
 
+template<typename Dtype, typename MItype, typename MOtype>
+void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::LoadItems(
+    int_tp batch_size,
+    const std::function<void(int_tp item_id, DecodeWorker* worker)>&
+        load_item) {
+  const int_tp num_workers = decode_workers_.size();
+  for (int_tp i = 0; i < num_workers; ++i) {
+    decode_workers_[i]->transformed_data.Reshape(
+        this->transformed_data_.shape());
+    decode_workers_[i]->decode_time = 0;
+    decode_workers_[i]->trans_time = 0;
+  }
+  const uint64_t first_item = items_loaded_;
+  const size_t rand_seed = rand_seed_;
+  std::function<void(int_tp)> load_slice = [&](int_tp worker_id) {
+    DecodeWorker* worker = decode_workers_[worker_id].get();
+    const int_tp begin = worker_id * batch_size / num_workers;
+    const int_tp end = (worker_id + 1) * batch_size / num_workers;
+    for (int_tp item_id = begin; item_id < end; ++item_id) {
+      // Multiplicative hash, seeds of consecutive items are unrelated
+      const uint64_t item_seed = (rand_seed + first_item + item_id)
+          * 0x9E3779B97F4A7C15ULL;
+      worker->transformer->InitRand(item_seed ^ (item_seed >> 32));
+      load_item(item_id, worker);
+    }
+  };
+  if (decode_pool_) {
+    for (int_tp i = 0; i < num_workers; ++i) {
+      decode_pool_->Submit([&load_slice, i] { load_slice(i); });
+    }
+    decode_pool_->Wait();
+  } else {
+    load_slice(0);
+  }
+  items_loaded_ += batch_size;
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::LogBatchTimes(
+    double batch_time, double read_time) const {
+  double decode_time = 0;
+  double trans_time = 0;
+  for (int_tp i = 0; i < decode_workers_.size(); ++i) {
+    decode_time += decode_workers_[i]->decode_time;
+    trans_time += decode_workers_[i]->trans_time;
+  }
+  DLOG(INFO) << "Prefetch batch: " << batch_time / 1000 << " ms.";
+  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
+  DLOG(INFO) << "   Decode time: " << decode_time / 1000 << " ms.";
+  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+#ifdef USE_OPENCV
+  if (decoded_cache_) {
+    DLOG(INFO) << " Decoded cache: " << decoded_cache_->hit_rate() * 100
+               << "% hits, " << decoded_cache_->size() << " images, "
+               << (decoded_cache_->bytes() >> 20) << " MB.";
+  }
+#endif  // USE_OPENCV
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::Forward_cpu(
     const vector<Blob<MItype>*>& bottom,
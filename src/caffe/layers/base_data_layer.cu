@@ -8,19 +8,21 @@ template<typename Dtype, typename MItype, typename MOtype>
 void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::Forward_gpu(
     const vector<Blob<MItype>*>& bottom,
     const vector<Blob<MOtype>*>& top) {
-
-#ifdef USE_OPENCL
-  // Direct async to GPU currently unsupported on OpenCL
-  if (this->device_->backend() == BACKEND_OPENCL) {
-    this->Forward_cpu(bottom, top);
-    return;
-  }
-#endif  // USE_OPENCL
-
   if (prefetch_current_) {
     prefetch_free_.push(prefetch_current_);
   }
   prefetch_current_ = prefetch_full_.pop("Waiting for data");
+  if (prefetch_current_ == prefetch_uploading_) {
+    // The upload started during the previous pass, report how long it ran
+    // alongside compute and how long it still had to be waited for
+    const float overlap_time = upload_timer_.MicroSeconds();
+    upload_timer_.Start();
+    this->device_->FinishQueue(upload_queue_);
+    const float wait_time = upload_timer_.MicroSeconds();
+    DLOG(INFO) << "Upload overlap: " << overlap_time / 1000 << " ms, wait: "
+               << wait_time / 1000 << " ms.";
+    prefetch_uploading_ = nullptr;
+  }
   // Reshape to loaded data.
   top[0]->ReshapeLike(prefetch_current_->data_);
   top[0]->set_gpu_data(prefetch_current_->data_.mutable_gpu_data());
@@ -29,6 +31,7 @@ void BasePrefetchingDataLayer<Dtype, MItype, MOtype>::Forward_gpu(
     top[1]->ReshapeLike(prefetch_current_->label_);
     top[1]->set_gpu_data(prefetch_current_->label_.mutable_gpu_data());
   }
+  StartUpload();
 }
 
 INSTANTIATE_LAYER_GPU_FORWARD(BasePrefetchingDataLayer,
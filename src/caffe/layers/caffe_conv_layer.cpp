@@ -16,10 +16,11 @@ void CaffeConvolutionLayer<Dtype, MItype, MOtype>::forward_cpu_gemm(
                                                    bool skip_im2col) {
   const Dtype* col_buff = input;
   if (!this->is_1x1_) {
+    shared_ptr<Blob<Dtype> > col_buffer = this->col_buffer();
     if (!skip_im2col) {
-      conv_im2col_cpu(input, this->col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buffer->mutable_cpu_data());
     }
-    col_buff = this->col_buffer_.cpu_data();
+    col_buff = col_buffer->cpu_data();
   }
   for (int_tp g = 0; g < this->group_; ++g) {
     caffe_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
@@ -44,9 +45,9 @@ void CaffeConvolutionLayer<Dtype, MItype, MOtype>::backward_cpu_gemm(
                                                     const Dtype* output,
                                                     const Dtype* weights,
                                                     Dtype* input) {
-  Dtype* col_buff = this->col_buffer_.mutable_cpu_data();
-  if (this->is_1x1_) {
-    col_buff = input;
+  Dtype* col_buff = input;
+  if (!this->is_1x1_) {
+    col_buff = this->col_buffer()->mutable_cpu_data();
   }
   for (int_tp g = 0; g < this->group_; ++g) {
     caffe_gemm<Dtype>(CblasTrans, CblasNoTrans, this->kernel_dim_,
@@ -67,8 +68,9 @@ void CaffeConvolutionLayer<Dtype, MItype, MOtype>::weight_cpu_gemm(
                                                   Dtype* weights) {
   const Dtype* col_buff = input;
   if (!this->is_1x1_) {
-    conv_im2col_cpu(input, this->col_buffer_.mutable_cpu_data());
-    col_buff = this->col_buffer_.cpu_data();
+    shared_ptr<Blob<Dtype> > col_buffer = this->col_buffer();
+    conv_im2col_cpu(input, col_buffer->mutable_cpu_data());
+    col_buff = col_buffer->cpu_data();
   }
   for (int_tp g = 0; g < this->group_; ++g) {
     caffe_gemm<Dtype>(CblasNoTrans, CblasTrans,
@@ -89,7 +91,7 @@ void CaffeConvolutionLayer<Dtype, MItype, MOtype>::backward_cpu_bias(
                         this->bias_multiplier_.cpu_data(), 1., bias);
 }
 
-#ifndef CPU_ONLY
+#if 1  // local
 
 template<typename Dtype, typename MItype, typename MOtype>
 void CaffeConvolutionLayer<Dtype, MItype, MOtype>::forward_gpu_gemm(
@@ -21,6 +21,7 @@ void ConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(
       }
     }
   }
+  this->unlock_col_buffer();
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -56,6 +57,7 @@ void ConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(
       }
     }
   }
+  this->unlock_col_buffer();
 }
 
 #ifdef CPU_ONLY
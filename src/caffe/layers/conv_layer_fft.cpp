@@ -409,6 +409,7 @@ void ConvolutionLayerFFT<Dtype>::Backward_cpu(
           this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
               top_diff + n * this->top_dim_, weight_diff);
         }
+        this->unlock_col_buffer();
       }
       if (propagate_down[i]) {
         for (int n = 0; n < this->num_; ++n) {
@@ -173,6 +173,7 @@ void ConvolutionLayerSpatial<Dtype>::Forward_cpu(
       }
     }
   }
+  this->unlock_col_buffer();
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -207,6 +208,7 @@ void ConvolutionLayerSpatial<Dtype>::Backward_cpu(
       }
     }
   }
+  this->unlock_col_buffer();
 }
 
 #ifndef CPU_ONLY
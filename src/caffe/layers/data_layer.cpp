@@ -3,11 +3,17 @@
 #endif  // USE_OPENCV
 #include <stdint.h>
 
+#include <algorithm>
+#include <limits>
+#include <utility>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
@@ -15,7 +21,7 @@ namespace caffe {
 template<typename Dtype, typename MItype, typename MOtype>
 DataLayer<Dtype, MItype, MOtype>::DataLayer(const LayerParameter& param)
   : BasePrefetchingDataLayer<Dtype, MItype, MOtype>(param),
-    offset_() {
+    offset_(), next_range_(), epoch_() {
   db_.reset(db::GetDB(param.data_param().backend()));
   db_->Open(param.data_param().source(), db::READ);
   cursor_.reset(db_->NewCursor());
@@ -55,6 +61,161 @@ void DataLayer<Dtype, MItype, MOtype>::DataLayerSetUp(const vector<Blob<MItype>*
       this->prefetch_[i]->label_.Reshape(label_shape);
     }
   }
+#ifdef USE_OPENCV
+  const DataParameter& data_param = this->layer_param_.data_param();
+  if (data_param.decoded_cache_mb() > 0) {
+    // Decoding depends on the source and on forcing color or gray
+    const TransformationParameter& transform_param =
+        this->layer_param_.transform_param();
+    this->decoded_cache_ = DecodedCache::Shared(data_param.source()
+        + (transform_param.force_color() ? " color" : "")
+        + (transform_param.force_gray() ? " gray" : ""),
+        static_cast<size_t>(data_param.decoded_cache_mb()) << 20);
+  }
+#endif  // USE_OPENCV
+  if (this->layer_param_.data_param().shuffle_buffer_size() > 0) {
+    InitShuffle();
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+bool DataLayer<Dtype, MItype, MOtype>::ReadKeys() const {
+#ifdef USE_OPENCV
+  return static_cast<bool>(this->decoded_cache_);
+#else
+  return false;
+#endif  // USE_OPENCV
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DataLayer<Dtype, MItype, MOtype>::InitShuffle() {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  int_tp num_ranges = data_param.shuffle_ranges();
+  CHECK_GT(num_ranges, 0);
+  range_cursors_.clear();
+  range_begin_.clear();
+  range_end_.clear();
+  if (cursor_->random_access()) {
+    const size_t num_records = cursor_->num_records();
+    num_ranges = std::min<size_t>(num_ranges, num_records);
+    for (int_tp i = 0; i < num_ranges; ++i) {
+      range_cursors_.push_back(shared_ptr<db::Cursor>(db_->NewCursor()));
+      range_begin_.push_back(num_records * i / num_ranges);
+      range_end_.push_back(num_records * (i + 1) / num_ranges);
+    }
+  } else {
+    LOG_IF(WARNING, num_ranges > 1 && Caffe::root_solver())
+        << "shuffle_ranges requires a backend with random access, reading "
+        << data_param.source() << " as a single range";
+    // The end of the range is where the cursor becomes invalid
+    range_cursors_.push_back(cursor_);
+    range_begin_.push_back(0);
+    range_end_.push_back(std::numeric_limits<size_t>::max());
+  }
+  epoch_ = 0;
+  StartEpoch();
+
+  shuffle_rng_.reset(new Caffe::RNG(caffe_rng_rand()));
+  // Fill the buffer, with no more than about one epoch of items
+  const size_t buffer_size = data_param.shuffle_buffer_size();
+  shuffle_views_.clear();
+  shuffle_values_.clear();
+  shuffle_keys_.clear();
+  while (shuffle_views_.size() < buffer_size && epoch_ == 0) {
+    shuffle_views_.push_back(std::pair<const char*, size_t>(NULL, 0));
+    shuffle_values_.push_back(string());
+    shuffle_keys_.push_back(string());
+    ReadShuffleInput(&shuffle_views_.back(), &shuffle_values_.back(),
+                     ReadKeys() ? &shuffle_keys_.back() : NULL);
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Shuffling with a buffer of " << shuffle_views_.size()
+      << " items from " << range_cursors_.size() << " ranges";
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DataLayer<Dtype, MItype, MOtype>::StartEpoch() {
+  // The order of the ranges only depends on the epoch, so that all solvers
+  // agree on the stream of items they split between them
+  range_order_.resize(range_cursors_.size());
+  for (int_tp i = 0; i < range_order_.size(); ++i) {
+    range_order_[i] = i;
+  }
+  rng_t rng(epoch_);
+  shuffle(range_order_.begin(), range_order_.end(), &rng);
+  range_position_ = range_begin_;
+  for (int_tp i = 0; i < range_cursors_.size(); ++i) {
+    if (range_cursors_[i]->random_access()) {
+      range_cursors_[i]->Seek(range_begin_[i]);
+    } else {
+      range_cursors_[i]->SeekToFirst();
+    }
+  }
+  next_range_ = 0;
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DataLayer<Dtype, MItype, MOtype>::ReadShuffleInput(
+    std::pair<const char*, size_t>* view, string* value, string* key) {
+  const int_tp num_ranges = range_cursors_.size();
+  while (true) {
+    // Next range in the order of this epoch that is not exhausted
+    int_tp range = -1;
+    for (int_tp i = 0; i < num_ranges && range < 0; ++i) {
+      const int_tp candidate =
+          range_order_[(next_range_ + i) % num_ranges];
+      if (range_position_[candidate] < range_end_[candidate]
+          && range_cursors_[candidate]->valid()) {
+        range = candidate;
+        next_range_ = (next_range_ + i + 1) % num_ranges;
+      }
+    }
+    if (range < 0) {
+      ++epoch_;
+      LOG_IF(INFO, Caffe::root_solver())
+          << "Restarting data prefetching from start, epoch " << epoch_;
+      StartEpoch();
+      continue;
+    }
+    db::Cursor* cursor = range_cursors_[range].get();
+    const bool skip = Skip();
+    if (!skip) {
+      if (key) {
+        *key = cursor->key();
+      }
+      const char* data;
+      size_t size;
+      cursor->value(&data, &size);
+      if (cursor->stable_values()) {
+        *view = std::make_pair(data, size);
+      } else {
+        value->assign(data, size);
+      }
+    }
+    cursor->Next();
+    ++range_position_[range];
+    offset_++;
+    if (!skip) {
+      return;
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DataLayer<Dtype, MItype, MOtype>::NextShuffled(
+    std::pair<const char*, size_t>* view, string* value, string* key) {
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(shuffle_rng_->generator());
+  const size_t i = (*rng)() % shuffle_views_.size();
+  if (cursor_->stable_values()) {
+    *view = shuffle_views_[i];
+  } else {
+    value->swap(shuffle_values_[i]);
+  }
+  if (key) {
+    key->swap(shuffle_keys_[i]);
+  }
+  ReadShuffleInput(&shuffle_views_[i], &shuffle_values_[i],
+                   key ? &shuffle_keys_[i] : NULL);
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -83,53 +244,117 @@ template<typename Dtype, typename MItype, typename MOtype>
 void DataLayer<Dtype, MItype, MOtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
-  double read_time = 0;
-  double trans_time = 0;
   CPUTimer timer;
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
   const int_tp batch_size = this->layer_param_.data_param().batch_size();
 
-  Datum datum;
+  // Read the serialized items in order, the workers parse and transform them
+  timer.Start();
+  const bool stable_values = cursor_->stable_values();
+  values_.resize(batch_size);
+  value_views_.resize(batch_size);
+  const bool read_keys = ReadKeys();
+  keys_.resize(read_keys ? batch_size : 0);
+  const bool shuffle = !shuffle_views_.empty();
   for (int_tp item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
+    if (shuffle) {
+      NextShuffled(&value_views_[item_id], &values_[item_id],
+                   read_keys ? &keys_[item_id] : NULL);
+      continue;
+    }
     while (Skip()) {
       Next();
     }
-    datum.ParseFromString(cursor_->value());
-    read_time += timer.MicroSeconds();
+    if (read_keys) {
+      keys_[item_id] = cursor_->key();
+    }
+    const char* data;
+    size_t size;
+    cursor_->value(&data, &size);
+    if (stable_values) {
+      // Zero copy, the view stays valid while the cursor moves on
+      value_views_[item_id] = std::make_pair(data, size);
+    } else {
+      // Reuses the storage of the previous batches
+      values_[item_id].assign(data, size);
+    }
+    Next();
+  }
+  if (!stable_values) {
+    for (int_tp item_id = 0; item_id < batch_size; ++item_id) {
+      value_views_[item_id] = std::make_pair(values_[item_id].data(),
+                                             values_[item_id].size());
+    }
+  }
+  const double read_time = timer.MicroSeconds();
 
-    if (item_id == 0) {
-      // Reshape according to the first datum of each batch
-      // on single input batches allows for inputs of varying dimension.
-      // Use data_transformer to infer the expected blob shape from datum.
-      vector<int_tp> top_shape = this->data_transformer_
-          ->InferBlobShape(datum);
-      this->transformed_data_.Reshape(top_shape);
-      // Reshape batch according to the batch_size.
-      top_shape[0] = batch_size;
-      batch->data_.Reshape(top_shape);
+  // Reshape according to the first datum of each batch
+  // on single input batches allows for inputs of varying dimension.
+  // Use data_transformer to infer the expected blob shape from datum.
+  Datum datum;
+  CHECK(datum.ParseFromArray(value_views_[0].first, value_views_[0].second));
+  vector<int_tp> top_shape = this->data_transformer_->InferBlobShape(datum);
+  this->transformed_data_.Reshape(top_shape);
+  // Reshape batch according to the batch_size.
+  top_shape[0] = batch_size;
+  batch->data_.Reshape(top_shape);
+
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = this->output_labels_ ?
+      batch->label_.mutable_cpu_data() : NULL;
+  this->LoadItems(batch_size, [&](int_tp item_id,
+      typename BasePrefetchingDataLayer<Dtype, MItype, MOtype>::DecodeWorker*
+          worker) {
+    CPUTimer item_timer;
+    item_timer.Start();
+    DatumView item_datum;
+    Datum float_datum;
+    // Read the datum in place, only float data needs a parsed copy
+    const char* value = value_views_[item_id].first;
+    const size_t value_size = value_views_[item_id].second;
+    if (!ParseDatumView(value, value_size, &item_datum)) {
+      CHECK(float_datum.ParseFromArray(value, value_size));
+      item_datum = DatumView(float_datum);
+    }
+    int_tp label = item_datum.label;
+#ifdef USE_OPENCV
+    // Only encoded items are cached, a hit skips decoding
+    cv::Mat cv_img;
+    if (item_datum.encoded) {
+      if (!this->decoded_cache_
+          || !this->decoded_cache_->Lookup(keys_[item_id], &cv_img, &label)) {
+        cv_img = worker->transformer->DecodeDatum(item_datum);
+        if (this->decoded_cache_) {
+          this->decoded_cache_->Insert(keys_[item_id], cv_img, label);
+        }
+      }
     }
+#endif  // USE_OPENCV
+    worker->decode_time += item_timer.MicroSeconds();
 
     // Apply data transformations (mirror, scale, crop...)
-    timer.Start();
-    int_tp offset = batch->data_.offset(item_id);
-    Dtype* top_data = batch->data_.mutable_cpu_data();
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
+    item_timer.Start();
+    worker->transformed_data.set_cpu_data(
+        top_data + batch->data_.offset(item_id));
+#ifdef USE_OPENCV
+    if (cv_img.data) {
+      worker->transformer->Transform(cv_img, &(worker->transformed_data));
+    } else {
+      worker->transformer->Transform(item_datum,
+                                     &(worker->transformed_data));
+    }
+#else
+    worker->transformer->Transform(item_datum, &(worker->transformed_data));
+#endif  // USE_OPENCV
     // Copy label.
-    if (this->output_labels_) {
-      Dtype* top_label = batch->label_.mutable_cpu_data();
-      top_label[item_id] = datum.label();
+    if (top_label) {
+      top_label[item_id] = label;
     }
-    trans_time += timer.MicroSeconds();
-    Next();
-  }
-  timer.Stop();
+    worker->trans_time += item_timer.MicroSeconds();
+  });
   batch_timer.Stop();
-  DLOG(INFO)<< "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO)<< "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO)<< "Transform time: " << trans_time / 1000 << " ms.";
+  this->LogBatchTimes(batch_timer.MicroSeconds(), read_time);
 }
 
 INSTANTIATE_CLASS_3T_GUARDED(DataLayer, (half_fp), (half_fp), (half_fp));
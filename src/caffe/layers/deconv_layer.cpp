@@ -21,6 +21,7 @@ void DeconvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(
       }
     }
   }
+  this->unlock_col_buffer();
 }
 
 template<typename Dtype, typename MItype, typename MOtype>
@@ -58,6 +59,7 @@ void DeconvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(
       }
     }
   }
+  this->unlock_col_buffer();
 }
 
 #ifdef CPU_ONLY
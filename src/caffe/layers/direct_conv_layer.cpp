@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/direct_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Output pixels per register tile
+static const int_tp kDirectWidthTile = 4;
+
+// The NCHW shape of a blob with the given channel block size.
+static vector<int_tp> plain_shape(const vector<int_tp>& shape,
+                                  int_tp block) {
+  if (block == 1) {
+    return shape;
+  }
+  CHECK_EQ(shape.size(), 5) << "Channel blocked blobs are (n, c / block, "
+                            << "h, w, block).";
+  CHECK_EQ(shape[4], block) << "Bottom is not blocked by " << block
+                            << " channels.";
+  vector<int_tp> plain(shape.begin(), shape.end() - 1);
+  plain[1] *= block;
+  return plain;
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DirectConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  bottom_block_ = std::max(conv_param.bottom_channel_block(), uint64_t(1));
+  top_block_ = std::max(conv_param.channel_block(), uint64_t(1));
+  CHECK(top_block_ == 1 || top_block_ == 8 || top_block_ == 16)
+      << "DIRECT convolution channel_block must be 0, 8 or 16.";
+  output_block_ = top_block_ > 1 ? top_block_ : 8;
+  CHECK(conv_param.fuse_type() == ConvolutionParameter_FuseType_UNFUSED
+        || IsFusedWithReLU())
+      << "DIRECT convolution can only be fused with ReLU or Eltwise + ReLU.";
+  negative_slope_ = conv_param.relu_param().negative_slope();
+  if (IsFusedWithEltwiseReLU()) {
+    CHECK_EQ(bottom.size(), 2)
+        << "Fused Eltwise needs the convolution input and the summand.";
+    const EltwiseParameter& eltwise_param = conv_param.eltwise_param();
+    CHECK_EQ(eltwise_param.operation(), EltwiseParameter_EltwiseOp_SUM)
+        << "Only Eltwise SUM can be fused.";
+    for (int_tp i = 0; i < eltwise_param.coeff_size(); ++i) {
+      CHECK_EQ(eltwise_param.coeff(i), 1) << "Fused Eltwise coefficients "
+                                          << "must be 1.";
+    }
+  }
+  bottom_shape_blob_.Reshape(plain_shape(bottom[0]->shape(), bottom_block_));
+  const vector<Blob<MItype>*> shape_bottom(1, &bottom_shape_blob_);
+  const vector<Blob<MOtype>*> shape_top(1, &top_shape_blob_);
+  ConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(shape_bottom,
+                                                      shape_top);
+  CHECK_EQ(this->num_spatial_axes_, 2) << "DIRECT convolution is 2D only.";
+  if (bottom_block_ > 1 || top_block_ > 1) {
+    CHECK_EQ(this->channel_axis_, 1)
+        << "Channel blocked blobs need channel axis 1.";
+  }
+  if (this->group_ > 1) {
+    CHECK(!ForwardOnly()) << "Grouped DIRECT convolution can not use "
+                          << "channel blocked or fused blobs.";
+  }
+  CHECK_EQ(this->num_output_ % top_block_, 0)
+      << "num_output must be a multiple of channel_block.";
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DirectConvolutionLayer<Dtype, MItype, MOtype>::Reshape(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  const int_tp image_bottoms = IsFusedWithEltwiseReLU() ? 1 : bottom.size();
+  for (int_tp i = 1; i < image_bottoms; ++i) {
+    CHECK(bottom[0]->shape() == bottom[i]->shape())
+        << "All inputs must have the same shape.";
+  }
+  bottom_shape_blob_.Reshape(plain_shape(bottom[0]->shape(), bottom_block_));
+  const vector<Blob<MItype>*> shape_bottom(1, &bottom_shape_blob_);
+  const vector<Blob<MOtype>*> shape_top(1, &top_shape_blob_);
+  ConvolutionLayer<Dtype, MItype, MOtype>::Reshape(shape_bottom, shape_top);
+  vector<int_tp> top_shape = top_shape_blob_.shape();
+  if (top_block_ > 1) {
+    top_shape[1] /= top_block_;
+    top_shape.push_back(top_block_);
+  }
+  for (int_tp i = 0; i < top.size(); ++i) {
+    top[i]->Reshape(top_shape);
+  }
+  if (IsFusedWithEltwiseReLU()) {
+    CHECK(bottom[1]->shape() == top_shape)
+        << "The fused Eltwise bottom must have the shape and layout of the "
+        << "top.";
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+const Dtype* DirectConvolutionLayer<Dtype, MItype, MOtype>::packed_weights() {
+  const SyncedMemory* memory = this->blobs_[0]->data().get();
+  const uint64_t version = this->blobs_[0]->data()->version();
+  if (memory != packed_memory_ || version != packed_version_) {
+    const int_tp block = output_block_;
+    const int_tp num_output = this->num_output_;
+    const int_tp channels = this->channels_;
+    const int_tp kernel_dim = this->blobs_[0]->count(2);
+    vector<int_tp> shape(1, (num_output + block - 1) / block);
+    shape.push_back(channels);
+    shape.push_back(kernel_dim);
+    shape.push_back(block);
+    packed_weights_.Reshape(shape);
+    Dtype* packed = packed_weights_.mutable_cpu_data();
+    caffe_set(packed_weights_.count(), Dtype(0), packed);
+    const Dtype* weight = this->blobs_[0]->cpu_data();
+    for (int_tp k = 0; k < num_output; ++k) {
+      for (int_tp c = 0; c < channels; ++c) {
+        for (int_tp s = 0; s < kernel_dim; ++s) {
+          packed[((k / block * channels + c) * kernel_dim + s) * block
+                 + k % block] = weight[(k * channels + c) * kernel_dim + s];
+        }
+      }
+    }
+    packed_memory_ = memory;
+    packed_version_ = version;
+  }
+  return packed_weights_.cpu_data();
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+template<int_tp OB>
+void DirectConvolutionLayer<Dtype, MItype, MOtype>::ForwardImage(
+    const Dtype* bottom_data, const Dtype* weights, const Dtype* bias,
+    const Dtype* eltwise_data, Dtype* top_data) {
+  const int_tp channels = this->channels_;
+  const int_tp num_output = this->num_output_;
+  const int_tp height = this->conv_input_shape_.cpu_data()[1];
+  const int_tp width = this->conv_input_shape_.cpu_data()[2];
+  const int_tp out_height = this->output_shape_[0];
+  const int_tp out_width = this->output_shape_[1];
+  const int_tp kernel_h = this->kernel_shape_.cpu_data()[0];
+  const int_tp kernel_w = this->kernel_shape_.cpu_data()[1];
+  const int_tp stride_h = this->stride_.cpu_data()[0];
+  const int_tp stride_w = this->stride_.cpu_data()[1];
+  const int_tp pad_h = this->pad_.cpu_data()[0];
+  const int_tp pad_w = this->pad_.cpu_data()[1];
+  const int_tp dilation_h = this->dilation_.cpu_data()[0];
+  const int_tp dilation_w = this->dilation_.cpu_data()[1];
+  const int_tp bottom_block = bottom_block_;
+  const bool blocked_top = top_block_ > 1;
+  const bool relu = IsFusedWithReLU();
+  const Dtype negative_slope = negative_slope_;
+  const int_tp output_blocks = (num_output + OB - 1) / OB;
+
+#pragma omp parallel for
+  for (int_tp row = 0; row < output_blocks * out_height; ++row) {
+    const int_tp kb = row / out_height;
+    const int_tp oh = row % out_height;
+    const int_tp k0 = kb * OB;
+    const int_tp block_outputs = std::min(OB, num_output - k0);
+    const Dtype* block_weights = weights + kb * channels * kernel_h
+        * kernel_w * OB;
+    for (int_tp ow0 = 0; ow0 < out_width; ow0 += kDirectWidthTile) {
+      Dtype acc[kDirectWidthTile][OB];
+      for (int_tp o = 0; o < OB; ++o) {
+        const Dtype b = (bias && o < block_outputs) ? bias[k0 + o] : Dtype(0);
+        for (int_tp t = 0; t < kDirectWidthTile; ++t) {
+          acc[t][o] = b;
+        }
+      }
+      for (int_tp c = 0; c < channels; ++c) {
+        const Dtype* channel = bottom_data
+            + (c / bottom_block) * height * width * bottom_block
+            + c % bottom_block;
+        const Dtype* channel_weights = block_weights
+            + c * kernel_h * kernel_w * OB;
+        for (int_tp kh = 0; kh < kernel_h; ++kh) {
+          const int_tp ih = oh * stride_h - pad_h + kh * dilation_h;
+          if (ih < 0 || ih >= height) {
+            continue;
+          }
+          const Dtype* in_row = channel + ih * width * bottom_block;
+          for (int_tp kw = 0; kw < kernel_w; ++kw) {
+            const Dtype* w = channel_weights + (kh * kernel_w + kw) * OB;
+            for (int_tp t = 0; t < kDirectWidthTile; ++t) {
+              const int_tp iw = (ow0 + t) * stride_w - pad_w + kw * dilation_w;
+              if (iw < 0 || iw >= width) {
+                continue;
+              }
+              const Dtype v = in_row[iw * bottom_block];
+              for (int_tp o = 0; o < OB; ++o) {
+                acc[t][o] += v * w[o];
+              }
+            }
+          }
+        }
+      }
+      // Bias is in, add the eltwise summand, apply the ReLU and store.
+      const int_tp tile_width = std::min(kDirectWidthTile, out_width - ow0);
+      for (int_tp t = 0; t < tile_width; ++t) {
+        const int_tp ow = ow0 + t;
+        for (int_tp o = 0; o < block_outputs; ++o) {
+          const int_tp index = blocked_top ?
+              ((kb * out_height + oh) * out_width + ow) * OB + o :
+              ((k0 + o) * out_height + oh) * out_width + ow;
+          Dtype value = acc[t][o];
+          if (eltwise_data) {
+            value += eltwise_data[index];
+          }
+          if (relu && value < Dtype(0)) {
+            value *= negative_slope;
+          }
+          top_data[index] = value;
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DirectConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  if (this->group_ > 1) {
+    ConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const Dtype* weights = packed_weights();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const int_tp image_bottoms = IsFusedWithEltwiseReLU() ? 1 : bottom.size();
+  for (int_tp i = 0; i < image_bottoms; ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    const Dtype* eltwise_data =
+        IsFusedWithEltwiseReLU() ? bottom[1]->cpu_data() : NULL;
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int_tp n = 0; n < this->num_; ++n) {
+      const int_tp top_offset = n * this->top_dim_;
+      if (output_block_ == 16) {
+        ForwardImage<16>(bottom_data + n * this->bottom_dim_, weights, bias,
+                         eltwise_data ? eltwise_data + top_offset : NULL,
+                         top_data + top_offset);
+      } else {
+        ForwardImage<8>(bottom_data + n * this->bottom_dim_, weights, bias,
+                        eltwise_data ? eltwise_data + top_offset : NULL,
+                        top_data + top_offset);
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DirectConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(
+    const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<MItype>*>& bottom) {
+  CHECK(!ForwardOnly()) << "DIRECT convolution with channel blocked or "
+                        << "fused blobs is forward only.";
+  ConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(top, propagate_down,
+                                                        bottom);
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DirectConvolutionLayer<Dtype, MItype, MOtype>::Forward_gpu(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  CHECK(!ForwardOnly()) << "DIRECT convolution with channel blocked or "
+                        << "fused blobs runs on the CPU only.";
+  ConvolutionLayer<Dtype, MItype, MOtype>::Forward_gpu(bottom, top);
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void DirectConvolutionLayer<Dtype, MItype, MOtype>::Backward_gpu(
+    const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<MItype>*>& bottom) {
+  CHECK(!ForwardOnly()) << "DIRECT convolution with channel blocked or "
+                        << "fused blobs is forward only.";
+  ConvolutionLayer<Dtype, MItype, MOtype>::Backward_gpu(top, propagate_down,
+                                                        bottom);
+}
+
+INSTANTIATE_CLASS_3T_GUARDED(DirectConvolutionLayer,
+                             (float), (float), (float));
+INSTANTIATE_CLASS_3T_GUARDED(DirectConvolutionLayer,
+                             (double), (double), (double));
+
+}  // namespace caffe
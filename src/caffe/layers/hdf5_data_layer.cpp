@@ -1,12 +1,5 @@
 #ifdef USE_HDF5
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_data_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -17,12 +10,123 @@ TODO:
 
 #include "caffe/layers/hdf5_data_layer.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template<typename Dtype, typename MItype, typename MOtype>
 HDF5DataLayer<Dtype, MItype, MOtype>::~HDF5DataLayer<Dtype, MItype, MOtype>() {
+  StopStreaming();
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void HDF5DataLayer<Dtype, MItype, MOtype>::StopStreaming() {
+  if (prefetch_pool_) {
+    prefetch_pool_->Wait();
+  }
+  if (stream_file_id_ >= 0) {
+    H5Fclose(stream_file_id_);
+    stream_file_id_ = -1;
+  }
+}
+
+// Open the file at stream_file_ in the file permutation and plan its chunks.
+template<typename Dtype, typename MItype, typename MOtype>
+void HDF5DataLayer<Dtype, MItype, MOtype>::OpenStreamFile() {
+  if (stream_file_id_ >= 0) {
+    H5Fclose(stream_file_id_);
+  }
+  const char* filename =
+      hdf_filenames_[file_permutation_[stream_file_]].c_str();
+  DLOG(INFO) << "Streaming HDF5 file: " << filename;
+  stream_file_id_ = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (stream_file_id_ < 0) {
+    LOG(FATAL) << "Failed opening HDF5 file: " << filename;
+  }
+  const int_tp top_size = this->layer_param_.top_size();
+  for (int_tp i = 0; i < top_size; ++i) {
+    vector<int_tp> shape = hdf5_get_dataset_shape(stream_file_id_,
+        this->layer_param_.top(i).c_str(), 1, INT_MAX);
+    if (i == 0) {
+      stream_rows_ = shape[0];
+    } else {
+      CHECK_EQ(static_cast<hsize_t>(shape[0]), stream_rows_);
+    }
+  }
+  CHECK_GT(stream_rows_, 0) << "No rows in HDF5 file: " << filename;
+  const hsize_t chunk_size = this->layer_param_.hdf5_data_param().chunk_size();
+  chunk_permutation_.resize((stream_rows_ + chunk_size - 1) / chunk_size);
+  for (uint_tp i = 0; i < chunk_permutation_.size(); ++i) {
+    chunk_permutation_[i] = i;
+  }
+  if (this->layer_param_.hdf5_data_param().shuffle()) {
+    caffe::rng_t* rng = static_cast<caffe::rng_t*>(stream_rng_->generator());
+    shuffle(chunk_permutation_.begin(), chunk_permutation_.end(), rng);
+  }
+  stream_chunk_ = 0;
+}
+
+// Read the next chunk into prefetch_blobs_, moving on to the next file once
+// all chunks of the current one are read.
+template<typename Dtype, typename MItype, typename MOtype>
+void HDF5DataLayer<Dtype, MItype, MOtype>::LoadChunk() {
+  const bool shuffle_rows = this->layer_param_.hdf5_data_param().shuffle();
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(stream_rng_->generator());
+  if (stream_chunk_ == chunk_permutation_.size()) {
+    if (++stream_file_ == num_files_) {
+      stream_file_ = 0;
+      if (shuffle_rows) {
+        shuffle(file_permutation_.begin(), file_permutation_.end(), rng);
+      }
+      DLOG(INFO) << "Looping around to first file.";
+    }
+    OpenStreamFile();
+  }
+  const hsize_t chunk_size = this->layer_param_.hdf5_data_param().chunk_size();
+  const hsize_t row_start = chunk_permutation_[stream_chunk_] * chunk_size;
+  const hsize_t num_rows = std::min(chunk_size, stream_rows_ - row_start);
+  ++stream_chunk_;
 
+  vector<uint_tp> rows(num_rows);
+  for (uint_tp i = 0; i < num_rows; ++i) {
+    rows[i] = i;
+  }
+  if (shuffle_rows) {
+    shuffle(rows.begin(), rows.end(), rng);
+  }
+  const int_tp top_size = this->layer_param_.top_size();
+  for (int_tp i = 0; i < top_size; ++i) {
+    Blob<Dtype>* blob = prefetch_blobs_[i].get();
+    const char* name = this->layer_param_.top(i).c_str();
+    if (!shuffle_rows) {
+      hdf5_load_nd_dataset_rows(stream_file_id_, name, row_start, num_rows,
+                                blob);
+      continue;
+    }
+    // Store the rows in shuffled order, so that they are still copied to the
+    // top in bulk
+    hdf5_load_nd_dataset_rows(stream_file_id_, name, row_start, num_rows,
+                              &chunk_buffer_);
+    blob->ReshapeLike(chunk_buffer_);
+    const int_tp dim = blob->count(1);
+    const Dtype* src = chunk_buffer_.cpu_data();
+    Dtype* dst = blob->mutable_cpu_data();
+    for (uint_tp j = 0; j < num_rows; ++j) {
+      caffe_copy(dim, src + rows[j] * dim, dst + j * dim);
+    }
+  }
+}
+
+// Serve the prefetched chunk and start reading the one after it.
+template<typename Dtype, typename MItype, typename MOtype>
+void HDF5DataLayer<Dtype, MItype, MOtype>::NextChunk() {
+  prefetch_pool_->Wait();
+  hdf_blobs_.swap(prefetch_blobs_);
+  data_permutation_.resize(hdf_blobs_[0]->shape(0));
+  for (int_tp i = 0; i < hdf_blobs_[0]->shape(0); ++i) {
+    data_permutation_[i] = i;
+  }
+  prefetch_pool_->Submit([this]() { LoadChunk(); });
 }
 
 // Load data and label from HDF5 filename into the class property blobs.
@@ -112,8 +216,28 @@ void HDF5DataLayer<Dtype, MItype, MOtype>::LayerSetUp(
     std::random_shuffle(file_permutation_.begin(), file_permutation_.end());
   }
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
+  if (this->layer_param_.hdf5_data_param().chunk_size() > 0) {
+    // Read the first chunk and start prefetching the second one.
+    StopStreaming();
+    if (!prefetch_pool_) {
+      prefetch_pool_.reset(new ThreadPool(1, this->device_));
+    }
+    stream_rng_.reset(new Caffe::RNG(caffe_rng_rand()));
+    stream_file_ = 0;
+    OpenStreamFile();
+    prefetch_blobs_.resize(this->layer_param_.top_size());
+    hdf_blobs_.resize(this->layer_param_.top_size());
+    for (int_tp i = 0; i < this->layer_param_.top_size(); ++i) {
+      prefetch_blobs_[i].reset(new Blob<Dtype>());
+      hdf_blobs_[i].reset(new Blob<Dtype>());
+    }
+    LoadChunk();
+    NextChunk();
+  } else {
+    // Load the first HDF5 file.
+    LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
+  }
+  // Initialize the line counter.
   current_row_ = 0;
 
   // Reshape blobs.
@@ -140,10 +264,30 @@ bool HDF5DataLayer<Dtype, MItype, MOtype>::Skip() {
   return !keep;
 }
 
+template<typename Dtype, typename MItype, typename MOtype>
+int_tp HDF5DataLayer<Dtype, MItype, MOtype>::ContiguousRows(
+    int_tp max_rows) const {
+  // Rows are interleaved between solvers when training on several of them
+  if (Caffe::solver_count() > 1 && this->layer_param_.phase() != TEST) {
+    return 1;
+  }
+  const int_tp num_rows = hdf_blobs_[0]->shape(0);
+  const uint_tp first = data_permutation_[current_row_];
+  int_tp rows = 1;
+  while (rows < max_rows && current_row_ + rows < num_rows
+         && data_permutation_[current_row_ + rows] == first + rows) {
+    ++rows;
+  }
+  return rows;
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void HDF5DataLayer<Dtype, MItype, MOtype>::Next() {
   if (++current_row_ == hdf_blobs_[0]->shape(0)) {
-    if (num_files_ > 1) {
+    const HDF5DataParameter& hdf5_param = this->layer_param_.hdf5_data_param();
+    if (hdf5_param.chunk_size() > 0) {
+      NextChunk();
+    } else if (num_files_ > 1) {
       ++current_file_;
       if (current_file_ == num_files_) {
         current_file_ = 0;
@@ -157,7 +301,8 @@ void HDF5DataLayer<Dtype, MItype, MOtype>::Next() {
         hdf_filenames_[file_permutation_[current_file_]].c_str());
     }
     current_row_ = 0;
-    if (this->layer_param_.hdf5_data_param().shuffle())
+    // Streamed chunks are shuffled while they are read
+    if (hdf5_param.shuffle() && hdf5_param.chunk_size() == 0)
       std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
   }
   offset_++;
@@ -188,18 +333,22 @@ void HDF5DataLayer<Dtype, MItype, MOtype>::Forward_cpu(
       const vector<Blob<MItype>*>& bottom,
       const vector<Blob<MOtype>*>& top) {
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  for (int i = 0; i < batch_size; ++i) {
+  for (int i = 0; i < batch_size;) {
     while (Skip()) {
       Next();
     }
+    const int_tp rows = ContiguousRows(batch_size - i);
     for (int_tp j = 0; j < this->layer_param_.top_size(); ++j) {
       int_tp data_dim = top[j]->count() / top[j]->shape(0);
-      data_copy_to_top<Dtype, MOtype>(data_dim,
+      data_copy_to_top<Dtype, MOtype>(rows * data_dim,
           &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_]
             * data_dim], &top[j]->mutable_cpu_data()[i * data_dim],
             this->top_quant_.get());
     }
-    Next();
+    for (int_tp k = 0; k < rows; ++k) {
+      Next();
+    }
+    i += rows;
   }
 }
 
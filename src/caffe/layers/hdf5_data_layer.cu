@@ -1,9 +1,4 @@
 #ifdef USE_HDF5
-/*
- TODO:
- - only load parts of the file, in accordance with a prototxt param "max_mem"
- */
-
 #include <stdint.h>
 #include <vector>
 
@@ -50,18 +45,22 @@ void HDF5DataLayer<Dtype, MItype, MOtype>::Forward_gpu(
                                          const vector<Blob<MItype>*>& bottom,
                                          const vector<Blob<MOtype>*>& top) {
   const int_tp batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  for (int_tp i = 0; i < batch_size; ++i) {
+  for (int_tp i = 0; i < batch_size;) {
     while (Skip()) {
       Next();
     }
+    const int_tp rows = ContiguousRows(batch_size - i);
     for (int j = 0; j < this->layer_param_.top_size(); ++j) {
       int data_dim = top[j]->count() / top[j]->shape(0);
       vptr<MOtype> top_data = top[j]->mutable_gpu_data() + i * data_dim;
-      data_copy_to_top<Dtype, MOtype>(data_dim,
+      data_copy_to_top<Dtype, MOtype>(rows * data_dim,
          &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_] * data_dim],
          top_data, this->top_quant_.get(), this->device_);
     }
-    Next();
+    for (int_tp k = 0; k < rows; ++k) {
+      Next();
+    }
+    i += rows;
   }
 }
 
@@ -3,6 +3,7 @@
 
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -48,6 +49,16 @@ void ImageDataLayer<Dtype, MItype, MOtype>::DataLayerSetUp(const vector<Blob<MIt
 
   CHECK(!lines_.empty()) << "File is empty";
 
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  if (image_data_param.decoded_cache_mb() > 0) {
+    std::ostringstream name;
+    name << source << " " << root_folder << " " << new_height << "x"
+         << new_width << (is_color ? " color" : " gray");
+    this->decoded_cache_ = DecodedCache::Shared(name.str(),
+        static_cast<size_t>(image_data_param.decoded_cache_mb()) << 20);
+  }
+
   if (this->layer_param_.image_data_param().shuffle()) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
@@ -98,6 +109,27 @@ void ImageDataLayer<Dtype, MItype, MOtype>::DataLayerSetUp(const vector<Blob<MIt
   }
 }
 
+template<typename Dtype, typename MItype, typename MOtype>
+cv::Mat ImageDataLayer<Dtype, MItype, MOtype>::ReadImage(
+    const std::pair<string, int_tp>& item) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  cv::Mat cv_img;
+  int_tp label;
+  if (this->decoded_cache_
+      && this->decoded_cache_->Lookup(item.first, &cv_img, &label)) {
+    return cv_img;
+  }
+  cv_img = ReadImageToCVMat(image_data_param.root_folder() + item.first,
+      image_data_param.new_height(), image_data_param.new_width(),
+      image_data_param.is_color());
+  CHECK(cv_img.data) << "Could not load " << item.first;
+  if (this->decoded_cache_) {
+    this->decoded_cache_->Insert(item.first, cv_img, item.second);
+  }
+  return cv_img;
+}
+
 template<typename Dtype, typename MItype, typename MOtype>
 void ImageDataLayer<Dtype, MItype, MOtype>::ShuffleImages() {
   caffe::rng_t* prefetch_rng =
@@ -110,51 +142,19 @@ template<typename Dtype, typename MItype, typename MOtype>
 void ImageDataLayer<Dtype, MItype, MOtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
-  double read_time = 0;
-  double trans_time = 0;
   CPUTimer timer;
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
   ImageDataParameter image_data_param = this->layer_param_.image_data_param();
   const int_tp batch_size = image_data_param.batch_size();
-  const int_tp new_height = image_data_param.new_height();
-  const int_tp new_width = image_data_param.new_width();
-  const bool is_color = image_data_param.is_color();
-  string root_folder = image_data_param.root_folder();
-
-  // Reshape according to the first image of each batch
-  // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-      new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-  // Use data_transformer to infer the expected blob shape from a cv_img.
-  vector<int_tp> top_shape = this->data_transformer_->InferBlobShape(cv_img);
-  this->transformed_data_.Reshape(top_shape);
-  // Reshape batch according to the batch_size.
-  top_shape[0] = batch_size;
-  batch->data_.Reshape(top_shape);
 
-  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
-  Dtype* prefetch_label = batch->label_.mutable_cpu_data();
-
-  // datum scales
+  // Pick the items in order, the workers decode and transform them
+  timer.Start();
   const int_tp lines_size = lines_.size();
+  vector<pair<string, int_tp> > items(batch_size);
   for (int_tp item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
     CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int_tp offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
-    prefetch_label[item_id] = lines_[lines_id_].second;
+    items[item_id] = lines_[lines_id_];
     // go to the next iter
     lines_id_++;
     if (lines_id_ >= lines_size) {
@@ -166,10 +166,39 @@ void ImageDataLayer<Dtype, MItype, MOtype>::load_batch(Batch<Dtype>* batch) {
       }
     }
   }
+  double read_time = timer.MicroSeconds();
+
+  // Reshape according to the first image of each batch
+  // on single input batches allows for inputs of varying dimension.
+  timer.Start();
+  cv::Mat cv_img = ReadImage(items[0]);
+  read_time += timer.MicroSeconds();
+  // Use data_transformer to infer the expected blob shape from a cv_img.
+  vector<int_tp> top_shape = this->data_transformer_->InferBlobShape(cv_img);
+  this->transformed_data_.Reshape(top_shape);
+  // Reshape batch according to the batch_size.
+  top_shape[0] = batch_size;
+  batch->data_.Reshape(top_shape);
+
+  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
+  Dtype* prefetch_label = batch->label_.mutable_cpu_data();
+  this->LoadItems(batch_size, [&](int_tp item_id,
+      typename BasePrefetchingDataLayer<Dtype, MItype, MOtype>::DecodeWorker*
+          worker) {
+    CPUTimer item_timer;
+    item_timer.Start();
+    cv::Mat cv_img = ReadImage(items[item_id]);
+    worker->decode_time += item_timer.MicroSeconds();
+    item_timer.Start();
+    // Apply transformations (mirror, crop...) to the image
+    worker->transformed_data.set_cpu_data(
+        prefetch_data + batch->data_.offset(item_id));
+    worker->transformer->Transform(cv_img, &(worker->transformed_data));
+    prefetch_label[item_id] = items[item_id].second;
+    worker->trans_time += item_timer.MicroSeconds();
+  });
   batch_timer.Stop();
-  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  this->LogBatchTimes(batch_timer.MicroSeconds(), read_time);
 }
 
 INSTANTIATE_CLASS_3T_GUARDED(ImageDataLayer, (half_fp), (half_fp), (half_fp));
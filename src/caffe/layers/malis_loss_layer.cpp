@@ -392,7 +392,7 @@ void MalisLossLayer<Dtype, MItype, MOtype>::Forward_cpu(const vector<Blob<MItype
 
   Dtype loss = 0;
 
-#pragma omp parallel for reduction(+:loss)
+// local: omp reduction disabled for half
   for (int_tp batch = 0; batch < bottom[0]->shape()[0]; ++batch) {
     Dtype loss_out = 0;
     Dtype classerr_out = 0;
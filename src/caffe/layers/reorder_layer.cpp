@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/reorder_layer.hpp"
+
+namespace caffe {
+
+// Copies num x channels x spatial_dim values between two channel blocked
+// layouts, a block size of 1 being the plain layout.
+template<typename Dtype>
+static void reorder_channels(const Dtype* src, int_tp src_block, int_tp num,
+                             int_tp channels, int_tp spatial_dim,
+                             int_tp dst_block, Dtype* dst) {
+  const int_tp src_blocks = channels / src_block;
+  const int_tp dst_blocks = channels / dst_block;
+#pragma omp parallel for
+  for (int_tp nc = 0; nc < num * channels; ++nc) {
+    const int_tp n = nc / channels;
+    const int_tp c = nc % channels;
+    const Dtype* src_channel = src
+        + (n * src_blocks + c / src_block) * spatial_dim * src_block
+        + c % src_block;
+    Dtype* dst_channel = dst
+        + (n * dst_blocks + c / dst_block) * spatial_dim * dst_block
+        + c % dst_block;
+    for (int_tp s = 0; s < spatial_dim; ++s) {
+      dst_channel[s * dst_block] = src_channel[s * src_block];
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ReorderLayer<Dtype, MItype, MOtype>::LayerSetUp(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  const ReorderParameter& reorder_param = this->layer_param_.reorder_param();
+  bottom_block_ = std::max(reorder_param.bottom_channel_block(), uint64_t(1));
+  top_block_ = std::max(reorder_param.top_channel_block(), uint64_t(1));
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ReorderLayer<Dtype, MItype, MOtype>::Reshape(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  const vector<int_tp>& bottom_shape = bottom[0]->shape();
+  int_tp spatial_end = bottom_shape.size();
+  if (bottom_block_ > 1) {
+    CHECK_EQ(bottom_shape.back(), bottom_block_)
+        << "Bottom of " << this->layer_param_.name()
+        << " is not blocked by " << bottom_block_ << " channels.";
+    --spatial_end;
+  }
+  CHECK_GE(spatial_end, 2);
+  num_ = bottom_shape[0];
+  channels_ = bottom_shape[1] * bottom_block_;
+  CHECK_EQ(channels_ % top_block_, 0) << "The " << channels_
+      << " channels of " << this->layer_param_.name()
+      << " can not be blocked by " << top_block_ << ".";
+  vector<int_tp> top_shape(1, num_);
+  top_shape.push_back(channels_ / top_block_);
+  top_shape.insert(top_shape.end(), bottom_shape.begin() + 2,
+                   bottom_shape.begin() + spatial_end);
+  if (top_block_ > 1) {
+    top_shape.push_back(top_block_);
+  }
+  top[0]->Reshape(top_shape);
+  spatial_dim_ = bottom[0]->count() / (num_ * channels_);
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ReorderLayer<Dtype, MItype, MOtype>::Forward_cpu(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  reorder_channels(bottom[0]->cpu_data(), bottom_block_, num_, channels_,
+                   spatial_dim_, top_block_, top[0]->mutable_cpu_data());
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void ReorderLayer<Dtype, MItype, MOtype>::Backward_cpu(
+    const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<MItype>*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  reorder_channels(top[0]->cpu_diff(), top_block_, num_, channels_,
+                   spatial_dim_, bottom_block_, bottom[0]->mutable_cpu_diff());
+}
+
+INSTANTIATE_CLASS_3T_GUARDED(ReorderLayer, (half_fp), (half_fp), (half_fp));
+INSTANTIATE_CLASS_3T_GUARDED(ReorderLayer, (float), (float), (float));
+INSTANTIATE_CLASS_3T_GUARDED(ReorderLayer, (double), (double), (double));
+
+REGISTER_LAYER_CLASS(Reorder);
+REGISTER_LAYER_CLASS_INST(Reorder, (half_fp), (half_fp), (half_fp));
+REGISTER_LAYER_CLASS_INST(Reorder, (float), (float), (float));
+REGISTER_LAYER_CLASS_INST(Reorder, (double), (double), (double));
+
+}  // namespace caffe
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/winograd_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Transformation matrices B^T, G and A^T of F(2, 3) and F(4, 3)
+static const double kInputTransform2[4 * 4] = {
+  1,  0, -1,  0,
+  0,  1,  1,  0,
+  0, -1,  1,  0,
+  0,  1,  0, -1
+};
+static const double kFilterTransform2[4 * 3] = {
+  1,    0,   0,
+  0.5,  0.5, 0.5,
+  0.5, -0.5, 0.5,
+  0,    0,   1
+};
+static const double kOutputTransform2[2 * 4] = {
+  1, 1,  1,  0,
+  0, 1, -1, -1
+};
+static const double kInputTransform4[6 * 6] = {
+  4,  0, -5,  0, 1, 0,
+  0, -4, -4,  1, 1, 0,
+  0,  4, -4, -1, 1, 0,
+  0, -2, -1,  2, 1, 0,
+  0,  2, -1, -2, 1, 0,
+  0,  4,  0, -5, 0, 1
+};
+static const double kFilterTransform4[6 * 3] = {
+  1.0 / 4,         0,        0,
+  -1.0 / 6,  -1.0 / 6, -1.0 / 6,
+  -1.0 / 6,   1.0 / 6, -1.0 / 6,
+  1.0 / 24,  1.0 / 12,  1.0 / 6,
+  1.0 / 24, -1.0 / 12,  1.0 / 6,
+  0,                0,        1
+};
+static const double kOutputTransform4[4 * 6] = {
+  1, 1,  1, 1,  1, 0,
+  0, 1, -1, 2, -2, 0,
+  0, 1,  1, 4,  4, 0,
+  0, 1, -1, 8, -8, 1
+};
+
+// Minimum number of tiles per GEMM, images are batched until reached.
+static const int_tp kMinWinogradTiles = 256;
+
+// Y = L X R^T for row major L (l_rows x n), X (n x n) and R (r_rows x n),
+// skipping the zero coefficients of the transformation matrices.
+template<typename Dtype>
+static void winograd_transform(const Dtype* left, int_tp l_rows,
+                               const Dtype* x, int_tp n, const Dtype* right,
+                               int_tp r_rows, Dtype* temp, Dtype* y) {
+  for (int_tp i = 0; i < l_rows; ++i) {
+    for (int_tp j = 0; j < n; ++j) {
+      Dtype sum = 0;
+      for (int_tp k = 0; k < n; ++k) {
+        const Dtype l = left[i * n + k];
+        if (l != Dtype(0)) {
+          sum += l * x[k * n + j];
+        }
+      }
+      temp[i * n + j] = sum;
+    }
+  }
+  for (int_tp i = 0; i < l_rows; ++i) {
+    for (int_tp j = 0; j < r_rows; ++j) {
+      Dtype sum = 0;
+      for (int_tp k = 0; k < n; ++k) {
+        const Dtype r = right[j * n + k];
+        if (r != Dtype(0)) {
+          sum += temp[i * n + k] * r;
+        }
+      }
+      y[i * r_rows + j] = sum;
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void WinogradConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  ConvolutionLayer<Dtype, MItype, MOtype>::LayerSetUp(bottom, top);
+  const uint_tp tile = this->layer_param_.convolution_param().winograd_tile();
+  CHECK(tile == 0 || tile == 2 || tile == 4)
+      << "Winograd tile size must be 0 (automatic), 2 or 4.";
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void WinogradConvolutionLayer<Dtype, MItype, MOtype>::Reshape(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  ConvolutionLayer<Dtype, MItype, MOtype>::Reshape(bottom, top);
+  winograd_ = this->num_spatial_axes_ == 2 && !this->force_nd_im2col_;
+  for (int_tp i = 0; winograd_ && i < this->num_spatial_axes_; ++i) {
+    winograd_ = this->kernel_shape_.cpu_data()[i] == 3
+        && this->stride_.cpu_data()[i] == 1
+        && this->dilation_.cpu_data()[i] == 1
+        && this->pad_.cpu_data()[i] <= 2;
+  }
+  if (!winograd_) {
+    return;
+  }
+  int_tp tile = this->layer_param_.convolution_param().winograd_tile();
+  if (tile == 0) {
+    tile = (this->output_shape_[0] >= 8 && this->output_shape_[1] >= 8) ?
+        4 : 2;
+  }
+  if (tile == tile_) {
+    return;
+  }
+  tile_ = tile;
+  const int_tp a = tile_ + 2;
+  const double* input_transform =
+      tile_ == 2 ? kInputTransform2 : kInputTransform4;
+  const double* filter_transform =
+      tile_ == 2 ? kFilterTransform2 : kFilterTransform4;
+  const double* output_transform =
+      tile_ == 2 ? kOutputTransform2 : kOutputTransform4;
+  input_transform_.assign(input_transform, input_transform + a * a);
+  filter_transform_.assign(filter_transform, filter_transform + a * 3);
+  output_transform_.assign(output_transform, output_transform + tile_ * a);
+  // Cached filters are for the previous tile size.
+  forward_memory_ = NULL;
+  backward_memory_ = NULL;
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void WinogradConvolutionLayer<Dtype, MItype, MOtype>::TransformFilters(
+    const Dtype* weight, bool backward, Dtype* transformed) {
+  const int_tp a = tile_ + 2;
+  const int_tp num_output = this->num_output_;
+  const int_tp channels = this->channels_ / this->group_;
+  const int_tp group_output = num_output / this->group_;
+  Dtype filter[9];
+  Dtype temp[6 * 3];
+  Dtype result[6 * 6];
+  for (int_tp k = 0; k < num_output; ++k) {
+    for (int_tp c = 0; c < channels; ++c) {
+      const Dtype* w = weight + (k * channels + c) * 9;
+      for (int_tp i = 0; i < 9; ++i) {
+        filter[i] = backward ? w[8 - i] : w[i];
+      }
+      // U = G g G^T, (a x 3) (3 x 3) (3 x a)
+      for (int_tp i = 0; i < a; ++i) {
+        for (int_tp j = 0; j < 3; ++j) {
+          temp[i * 3 + j] = filter_transform_[i * 3] * filter[j]
+              + filter_transform_[i * 3 + 1] * filter[3 + j]
+              + filter_transform_[i * 3 + 2] * filter[6 + j];
+        }
+      }
+      for (int_tp i = 0; i < a; ++i) {
+        for (int_tp j = 0; j < a; ++j) {
+          result[i * a + j] = temp[i * 3] * filter_transform_[j * 3]
+              + temp[i * 3 + 1] * filter_transform_[j * 3 + 1]
+              + temp[i * 3 + 2] * filter_transform_[j * 3 + 2];
+        }
+      }
+      // Forward: a^2 x num_output x channels per group.
+      // Backward: a^2 x all channels x num_output per group.
+      int_tp offset;
+      int_tp stride;
+      if (backward) {
+        const int_tp g = k / group_output;
+        offset = (g * channels + c) * group_output + k % group_output;
+        stride = this->channels_ * group_output;
+      } else {
+        offset = k * channels + c;
+        stride = num_output * channels;
+      }
+      for (int_tp xi = 0; xi < a * a; ++xi) {
+        transformed[xi * stride + offset] = result[xi];
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+const Dtype* WinogradConvolutionLayer<Dtype, MItype, MOtype>::
+    transformed_filters(bool backward) {
+  const SyncedMemory* memory = this->blobs_[0]->data().get();
+  const uint64_t version = this->blobs_[0]->data()->version();
+  Blob<Dtype>* filters = backward ? &backward_filters_ : &forward_filters_;
+  const SyncedMemory** cached_memory =
+      backward ? &backward_memory_ : &forward_memory_;
+  uint64_t* cached_version = backward ? &backward_version_ : &forward_version_;
+  if (*cached_memory != memory || *cached_version != version) {
+    const int_tp a = tile_ + 2;
+    vector<int_tp> shape(1, a * a);
+    shape.push_back(this->blobs_[0]->count() / 9);
+    filters->Reshape(shape);
+    TransformFilters(this->blobs_[0]->cpu_data(), backward,
+                     filters->mutable_cpu_data());
+    *cached_memory = memory;
+    *cached_version = version;
+  }
+  return filters->cpu_data();
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void WinogradConvolutionLayer<Dtype, MItype, MOtype>::WinogradConvolution(
+    const Dtype* input, int_tp num, int_tp channels, int_tp height,
+    int_tp width, int_tp pad_h, int_tp pad_w, const Dtype* filters,
+    int_tp out_channels, int_tp out_height, int_tp out_width, Dtype* output) {
+  const int_tp m = tile_;
+  const int_tp a = m + 2;
+  const int_tp tiles_h = (out_height + m - 1) / m;
+  const int_tp tiles_w = (out_width + m - 1) / m;
+  const int_tp tiles = tiles_h * tiles_w;
+  const int_tp batch = std::min(num, std::max(int_tp(1),
+      (kMinWinogradTiles + tiles - 1) / tiles));
+  const int_tp group_channels = channels / this->group_;
+  const int_tp group_out_channels = out_channels / this->group_;
+
+  vector<int_tp> shape(1, a * a);
+  shape.push_back(channels);
+  shape.push_back(batch * tiles);
+  input_tiles_.Reshape(shape);
+  shape[1] = out_channels;
+  output_tiles_.Reshape(shape);
+  Dtype* input_tiles = input_tiles_.mutable_cpu_data();
+  Dtype* output_tiles = output_tiles_.mutable_cpu_data();
+  const Dtype* input_transform = &input_transform_[0];
+  const Dtype* output_transform = &output_transform_[0];
+
+  Dtype tile[6 * 6];
+  Dtype temp[6 * 6];
+  Dtype result[6 * 6];
+  for (int_tp n0 = 0; n0 < num; n0 += batch) {
+    const int_tp batch_images = std::min(batch, num - n0);
+    const int_tp cols = batch_images * tiles;
+    // V = B^T d B for every input tile d
+    for (int_tp b = 0; b < batch_images; ++b) {
+      for (int_tp c = 0; c < channels; ++c) {
+        const Dtype* plane = input + ((n0 + b) * channels + c) * height * width;
+        for (int_tp ty = 0; ty < tiles_h; ++ty) {
+          for (int_tp tx = 0; tx < tiles_w; ++tx) {
+            const int_tp y0 = ty * m - pad_h;
+            const int_tp x0 = tx * m - pad_w;
+            for (int_tp i = 0; i < a; ++i) {
+              const int_tp y = y0 + i;
+              for (int_tp j = 0; j < a; ++j) {
+                const int_tp x = x0 + j;
+                tile[i * a + j] = (y >= 0 && y < height && x >= 0 && x < width)
+                    ? plane[y * width + x] : Dtype(0);
+              }
+            }
+            winograd_transform(input_transform, a, tile, a, input_transform, a,
+                               temp, result);
+            const int_tp col = b * tiles + ty * tiles_w + tx;
+            for (int_tp xi = 0; xi < a * a; ++xi) {
+              input_tiles[(xi * channels + c) * cols + col] = result[xi];
+            }
+          }
+        }
+      }
+    }
+    // M = U V, one GEMM per transformed position and group
+    for (int_tp xi = 0; xi < a * a; ++xi) {
+      for (int_tp g = 0; g < this->group_; ++g) {
+        caffe_gemm<Dtype>(CblasNoTrans, CblasNoTrans, group_out_channels,
+            cols, group_channels, (Dtype) 1.,
+            filters + (xi * out_channels + g * group_out_channels)
+                * group_channels,
+            input_tiles + (xi * channels + g * group_channels) * cols,
+            (Dtype) 0.,
+            output_tiles + (xi * out_channels + g * group_out_channels) * cols);
+      }
+    }
+    // Y = A^T M A, clipped at the bottom and right border
+    for (int_tp b = 0; b < batch_images; ++b) {
+      for (int_tp k = 0; k < out_channels; ++k) {
+        Dtype* plane = output
+            + ((n0 + b) * out_channels + k) * out_height * out_width;
+        for (int_tp ty = 0; ty < tiles_h; ++ty) {
+          for (int_tp tx = 0; tx < tiles_w; ++tx) {
+            const int_tp col = b * tiles + ty * tiles_w + tx;
+            for (int_tp xi = 0; xi < a * a; ++xi) {
+              tile[xi] = output_tiles[(xi * out_channels + k) * cols + col];
+            }
+            winograd_transform(output_transform, m, tile, a, output_transform,
+                               m, temp, result);
+            const int_tp rows = std::min(m, out_height - ty * m);
+            const int_tp row_width = std::min(m, out_width - tx * m);
+            for (int_tp i = 0; i < rows; ++i) {
+              Dtype* out = plane + (ty * m + i) * out_width + tx * m;
+              for (int_tp j = 0; j < row_width; ++j) {
+                out[j] = result[i * m + j];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void WinogradConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(
+    const vector<Blob<MItype>*>& bottom, const vector<Blob<MOtype>*>& top) {
+  if (!winograd_) {
+    ConvolutionLayer<Dtype, MItype, MOtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const Dtype* filters = transformed_filters(false);
+  const int_tp* input_shape = this->conv_input_shape_.cpu_data();
+  const int_tp* pad = this->pad_.cpu_data();
+  for (int_tp i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    WinogradConvolution(bottom_data, this->num_, this->channels_,
+                        input_shape[1], input_shape[2], pad[0], pad[1],
+                        filters, this->num_output_, this->output_shape_[0],
+                        this->output_shape_[1], top_data);
+    if (this->bias_term_) {
+      const Dtype* bias = this->blobs_[1]->cpu_data();
+      for (int_tp n = 0; n < this->num_; ++n) {
+        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+      }
+    }
+  }
+}
+
+template<typename Dtype, typename MItype, typename MOtype>
+void WinogradConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(
+    const vector<Blob<MOtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<MItype>*>& bottom) {
+  if (!winograd_) {
+    ConvolutionLayer<Dtype, MItype, MOtype>::Backward_cpu(top, propagate_down,
+                                                          bottom);
+    return;
+  }
+  const int_tp* input_shape = this->conv_input_shape_.cpu_data();
+  const int_tp* pad = this->pad_.cpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  for (int_tp i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int_tp n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    // Gradient w.r.t. weight. Note that we will accumulate diffs.
+    if (this->param_propagate_down_[0]) {
+      const Dtype* bottom_data = bottom[i]->cpu_data();
+      for (int_tp n = 0; n < this->num_; ++n) {
+        this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+                              top_diff + n * this->top_dim_, weight_diff);
+      }
+      this->unlock_col_buffer();
+    }
+    // Gradient w.r.t. bottom data: the full correlation of the top
+    // gradient with the rotated filters.
+    if (propagate_down[i]) {
+      WinogradConvolution(top_diff, this->num_, this->num_output_,
+                          this->output_shape_[0], this->output_shape_[1],
+                          2 - pad[0], 2 - pad[1], transformed_filters(true),
+                          this->channels_, input_shape[1], input_shape[2],
+                          bottom[i]->mutable_cpu_diff());
+    }
+  }
+}
+
+INSTANTIATE_CLASS_3T_GUARDED(WinogradConvolutionLayer,
+                             (float), (float), (float));
+INSTANTIATE_CLASS_3T_GUARDED(WinogradConvolutionLayer,
+                             (double), (double), (double));
+
+}  // namespace caffe
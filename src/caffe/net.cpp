@@ -16,6 +16,7 @@
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fuse_layers.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/insert_conversions.hpp"
@@ -28,14 +29,22 @@ namespace caffe {
 
 template<typename Dtype>
 Net<Dtype>::Net(const NetParameter& param, Device* device_context)
-    : device_(device_context) {
+    : device_(device_context), weights_net_(NULL) {
   Init(param);
 }
 
+template<typename Dtype>
+Net<Dtype>::Net(const NetParameter& param, const Net* weights_net,
+                Device* device_context)
+    : device_(device_context), weights_net_(weights_net) {
+  Init(param);
+  weights_net_ = NULL;
+}
+
 template<typename Dtype>
 Net<Dtype>::Net(const string& param_file, Phase phase, Device* device_context,
                 const int level, const vector<string>* stages)
-    : device_(device_context) {
+    : device_(device_context), weights_net_(NULL) {
   NetParameter param;
   ReadNetParamsFromTextFileOrDie(param_file, &param);
   // Set phase, stages and level
@@ -51,6 +60,7 @@ Net<Dtype>::Net(const string& param_file, Phase phase, Device* device_context,
 
 template<typename Dtype>
 void Net<Dtype>::Init(const NetParameter& in_param) {
+  const HostMemoryStats host_memory_start = HostMemoryPool::thread_stats();
   // Set phase from the state.
   phase_ = in_param.state().phase();
 
@@ -65,17 +75,27 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     LOG(INFO) << "Initializing net from parameters: " << std::endl
               << filtered_param.DebugString();
   }
-  // Create a copy of filtered_param with splits added where necessary.
+  // Create a copy of filtered_param with layers fused into convolutions
+  // where possible.
+  NetParameter fused_param;
+  folded_layers_.clear();
+  FuseLayers(filtered_param, &fused_param, &folded_layers_);
+  // Create a copy of fused_param with splits added where necessary.
   NetParameter splitted_param;
-  InsertSplits(filtered_param, &splitted_param);
+  InsertSplits(fused_param, &splitted_param);
   // Create a copy of splitted_param with type conversions added where
   // necessary.
   NetParameter converted_param;
   InsertConversions(splitted_param, &converted_param);
+  // Create a copy of converted_param with the activations between DIRECT
+  // convolutions channel blocked, and reorders added where necessary.
+  NetParameter layout_param;
+  InsertLayoutConversions(converted_param, &layout_param);
 
-  NetParameter param = converted_param;
+  NetParameter param = layout_param;
 
-  // To debug InsertSplits and InsertConversions
+  // To debug FuseLayers, InsertSplits, InsertConversions and
+  // InsertLayoutConversions
   // std::cout << param.DebugString() << std::endl;
 
   // Basically, build all the layers and set up its connections.
@@ -142,6 +162,12 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     }
     layers_.push_back(CreateLayer(layer_param));
     layer_names_.push_back(layer_param.name());
+    const bool shared_layer = weights_net_
+        && weights_net_->has_layer(layer_param.name());
+    if (shared_layer) {
+      layers_[layer_id]->set_blob_bases(
+          weights_net_->layer_by_name(layer_param.name())->blob_bases());
+    }
     if (Caffe::root_solver()) {
       LOG(INFO) << "Creating Layer " << layer_param.name();
     }
@@ -181,6 +207,21 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     }
     // After this layer is connected, set it up.
     layers_[layer_id]->SetUp(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+    if (shared_layer) {
+      // Layers creating their parameters regardless (e.g. RecurrentLayer)
+      // share the data of the weights net instead.
+      vector<shared_ptr<BlobBase> > source_blobs =
+          weights_net_->layer_by_name(layer_param.name())->blob_bases();
+      vector<shared_ptr<BlobBase> > target_blobs =
+          layers_[layer_id]->blob_bases();
+      CHECK_EQ(target_blobs.size(), source_blobs.size())
+          << "Incompatible number of blobs for layer " << layer_param.name();
+      for (int_tp j = 0; j < target_blobs.size(); ++j) {
+        if (target_blobs[j] != source_blobs[j]) {
+          target_blobs[j]->ShareDataBase(source_blobs[j].get());
+        }
+      }
+    }
     LOG_IF(INFO, Caffe::root_solver())
         << "Setting up " << layer_names_[layer_id];
     for (int_tp top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
@@ -327,12 +368,39 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (uint_tp layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
-  ShareWeights();
+  // Parameters taken from a weights net are shared there already.
+  if (!weights_net_) {
+    ShareWeights();
+  }
   debug_info_ = param.debug_info();
+  loss_scale_ = 1;
   if (Caffe::root_solver()) {
     LOG(INFO) << "Network initialization done.";
     LOG(INFO) << "Memory required for data: " << memory_used_ << " B";
   }
+  memory_optimized_ = 0;
+  optimize_memory_ = false;
+  set_forward_threads(param.forward_threads());
+  if (param.optimize_memory()) {
+    bool any_backward = false;
+    for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      any_backward |= layer_need_backward_[layer_id];
+    }
+    if (phase_ != TEST || any_backward) {
+      LOG(WARNING) << "Memory optimization is only done for TEST nets "
+                   << "without backward computation, ignoring it.";
+    } else {
+      optimize_memory_ = true;
+      PlanMemory();
+    }
+  }
+  BuildForwardGraph();
+  AccumulateHostMemoryStats(host_memory_start);
+  if (Caffe::host_memory_pool() && Caffe::root_solver()) {
+    LOG(INFO) << "Host memory pool allocations during initialization: "
+              << host_memory_stats_.allocations << " ("
+              << host_memory_stats_.cache_hits << " from cache)";
+  }
 }
 
 template<typename Dtype>
@@ -609,10 +677,140 @@ void Net<Dtype>::AppendParam(const NetParameter& param, const int_tp layer_id,
   }
 }
 
+template<typename Dtype>
+void Net<Dtype>::set_forward_threads(int num_threads) {
+  CHECK_GE(num_threads, 1);
+  if (num_threads == forward_threads()) {
+    return;
+  }
+  forward_pool_.reset();
+  if (num_threads > 1) {
+    forward_pool_.reset(new ThreadPool(num_threads, device_));
+    if (Caffe::root_solver()) {
+      LOG(INFO) << "Running independent layers of the forward pass on "
+                << num_threads << " threads";
+    }
+  }
+}
+
+template<typename Dtype>
+void Net<Dtype>::BuildForwardGraph() {
+  // A layer depends on the last layer writing one of its bottoms (or memory
+  // shared with it), and writing a top has to wait for all earlier readers.
+  // Learnable parameters are only written in the forward pass in TRAIN,
+  // e.g. by the running statistics of BatchNorm.
+  map<const void*, int_tp> last_writer;
+  map<const void*, vector<int_tp> > readers;
+  forward_predecessors_.assign(layers_.size(), vector<int_tp>());
+  forward_successors_.assign(layers_.size(), vector<int_tp>());
+  for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    vector<const void*> reads;
+    vector<const void*> writes;
+    for (int_tp i = 0; i < bottom_vecs_[layer_id].size(); ++i) {
+      const BlobBase* blob = bottom_vecs_[layer_id][i];
+      reads.push_back(blob->count() > 0 ?
+          static_cast<const void*>(blob->data().get()) : blob);
+    }
+    for (int_tp i = 0; i < top_vecs_[layer_id].size(); ++i) {
+      const BlobBase* blob = top_vecs_[layer_id][i];
+      writes.push_back(blob->count() > 0 ?
+          static_cast<const void*>(blob->data().get()) : blob);
+    }
+    const vector<shared_ptr<BlobBase> >& params =
+        layers_[layer_id]->blob_bases();
+    for (int_tp i = 0; i < params.size(); ++i) {
+      if (params[i]->count() > 0) {
+        (phase_ == TRAIN ? writes : reads).push_back(params[i]->data().get());
+      }
+    }
+    std::set<int_tp> predecessors;
+    for (int_tp i = 0; i < reads.size(); ++i) {
+      map<const void*, int_tp>::iterator it = last_writer.find(reads[i]);
+      if (it != last_writer.end()) {
+        predecessors.insert(it->second);
+      }
+      readers[reads[i]].push_back(layer_id);
+    }
+    for (int_tp i = 0; i < writes.size(); ++i) {
+      map<const void*, int_tp>::iterator it = last_writer.find(writes[i]);
+      if (it != last_writer.end()) {
+        predecessors.insert(it->second);
+      }
+      vector<int_tp>& write_readers = readers[writes[i]];
+      predecessors.insert(write_readers.begin(), write_readers.end());
+      write_readers.clear();
+      last_writer[writes[i]] = layer_id;
+    }
+    predecessors.erase(layer_id);
+    forward_predecessors_[layer_id].assign(predecessors.begin(),
+                                           predecessors.end());
+    for (std::set<int_tp>::iterator it = predecessors.begin();
+         it != predecessors.end(); ++it) {
+      forward_successors_[*it].push_back(layer_id);
+    }
+  }
+}
+
+template<typename Dtype>
+Dtype Net<Dtype>::ForwardFromToParallel(int_tp start, int_tp end) {
+  const int_tp num_layers = end - start + 1;
+  // Layers in [start, end] still to finish before each layer can run
+  vector<std::atomic<int_tp> > waiting(num_layers);
+  vector<Dtype> layer_losses(num_layers, Dtype(0));
+  for (int_tp i = start; i <= end; ++i) {
+    const vector<int_tp>& predecessors = forward_predecessors_[i];
+    waiting[i - start] = std::count_if(predecessors.begin(),
+        predecessors.end(), [start](int_tp p) { return p >= start; });
+  }
+  std::function<void(int_tp)> run_layer = [&](int_tp i) {
+    const HostMemoryStats host_memory_start = HostMemoryPool::thread_stats();
+    if (before_forward_.size() > 0) {
+      std::lock_guard<std::mutex> lock(forward_mutex_);
+      for (int_tp c = 0; c < before_forward_.size(); ++c) {
+        before_forward_[c]->run(i);
+      }
+    }
+    layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i],
+                        static_cast<void*>(&layer_losses[i - start]));
+    {
+      std::lock_guard<std::mutex> lock(forward_mutex_);
+      for (int_tp c = 0; c < after_forward_.size(); ++c) {
+        after_forward_[c]->run(i);
+      }
+      AccumulateHostMemoryStats(host_memory_start);
+    }
+    for (int_tp j = 0; j < forward_successors_[i].size(); ++j) {
+      const int_tp successor = forward_successors_[i][j];
+      if (successor <= end && --waiting[successor - start] == 0) {
+        forward_pool_->Submit([&run_layer, successor] {
+          run_layer(successor);
+        });
+      }
+    }
+  };
+  for (int_tp i = start; i <= end; ++i) {
+    if (waiting[i - start] == 0) {
+      forward_pool_->Submit([&run_layer, i] { run_layer(i); });
+    }
+  }
+  forward_pool_->Wait();
+  // Sum in layer order, the result does not depend on the schedule.
+  Dtype loss = 0;
+  for (int_tp i = 0; i < num_layers; ++i) {
+    loss += layer_losses[i];
+  }
+  return loss;
+}
+
 template<typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int_tp start, int_tp end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
+  if (forward_pool_ && Caffe::mode() == Caffe::CPU && !debug_info_
+      && quant_mode_ != OBSERVE) {
+    return ForwardFromToParallel(start, end);
+  }
+  const HostMemoryStats host_memory_start = HostMemoryPool::thread_stats();
   Dtype loss = 0;
   for (int_tp i = start; i <= end; ++i) {
     for (int_tp c = 0; c < before_forward_.size(); ++c) {
@@ -628,6 +826,7 @@ Dtype Net<Dtype>::ForwardFromTo(int_tp start, int_tp end) {
       after_forward_[c]->run(i);
     }
   }
+  AccumulateHostMemoryStats(host_memory_start);
   return loss;
 }
 
@@ -655,6 +854,12 @@ template<typename Dtype>
 void Net<Dtype>::BackwardFromTo(int_tp start, int_tp end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  const HostMemoryStats host_memory_start = HostMemoryPool::thread_stats();
+  if (loss_scale_ != 1) {
+    for (int_tp i = start; i >= end; --i) {
+      layers_[i]->ScaleLossWeights(top_vecs_[i], loss_scale_);
+    }
+  }
   for (int_tp i = start; i >= end; --i) {
     for (int_tp c = 0; c < before_backward_.size(); ++c) {
       before_backward_[c]->run(i);
@@ -670,6 +875,13 @@ void Net<Dtype>::BackwardFromTo(int_tp start, int_tp end) {
       after_backward_[c]->run(i);
     }
   }
+  if (loss_scale_ != 1) {
+    // The loss weights also weigh the loss of the next forward pass
+    for (int_tp i = start; i >= end; --i) {
+      layers_[i]->ScaleLossWeights(top_vecs_[i], 1);
+    }
+  }
+  AccumulateHostMemoryStats(host_memory_start);
 }
 
 template <typename Dtype>
@@ -775,6 +987,14 @@ void Net<Dtype>::UpdateDebugInfo(const int_tp param_id) {
 
 template<typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
+  for (map<string, vector<LayerParameter> >::const_iterator it =
+       folded_layers_.begin(); it != folded_layers_.end(); ++it) {
+    for (int_tp i = 0; i < it->second.size(); ++i) {
+      CHECK(!other->has_layer(it->second[i].name()))
+          << "Cannot share the weights of layer '" << it->second[i].name()
+          << "', it is folded into '" << it->first << "'.";
+    }
+  }
   int_tp num_source_layers = other->layers().size();
   for (int_tp i = 0; i < num_source_layers; ++i) {
     LayerBase* source_layer = other->layers()[i].get();
@@ -841,13 +1061,218 @@ void Net<Dtype>::Backward() {
 
 template<typename Dtype>
 void Net<Dtype>::Reshape() {
+  const HostMemoryStats host_memory_start = HostMemoryPool::thread_stats();
   for (int_tp i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  // Blobs that grew got their own memory again.
+  if (optimize_memory_) {
+    PlanMemory();
+    BuildForwardGraph();
+  }
+  AccumulateHostMemoryStats(host_memory_start);
 }
 
 template<typename Dtype>
-void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
+void Net<Dtype>::PlanMemory() {
+  // Blobs aliasing the same memory (tops of Split, Flatten, Reshape, ...)
+  // form one group, alive from the first to the last layer using any of them.
+  // Net inputs and outputs keep their memory, as well as the tops of layers
+  // without bottoms: data layers may point their tops at prefetch buffers.
+  vector<bool> pinned(blobs_.size(), false);
+  for (int_tp i = 0; i < net_input_blob_indices_.size(); ++i) {
+    pinned[net_input_blob_indices_[i]] = true;
+  }
+  for (int_tp i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[net_output_blob_indices_[i]] = true;
+  }
+  for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (bottom_id_vecs_[layer_id].size() == 0) {
+      for (int_tp top_id = 0; top_id < top_id_vecs_[layer_id].size();
+           ++top_id) {
+        pinned[top_id_vecs_[layer_id][top_id]] = true;
+      }
+    }
+  }
+  // Aliases are taken from the memory before the first plan, later on blobs
+  // with disjoint lifetimes share a buffer without being aliases.
+  if (memory_alias_.empty()) {
+    memory_alias_.resize(blobs_.size());
+    map<SyncedMemory*, int_tp> memory_blob;
+    for (int_tp blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+      memory_alias_[blob_id] = blob_id;
+      if (blobs_[blob_id]->count() > 0) {
+        memory_alias_[blob_id] = memory_blob.insert(std::make_pair(
+            blobs_[blob_id]->data().get(), blob_id)).first->second;
+      }
+    }
+  }
+  // Memory also held outside of the net's blobs, such as by the internal
+  // blobs of a RecurrentLayer that share its bottoms and tops, has to stay.
+  map<SyncedMemory*, int_tp> memory_refs;
+  for (int_tp blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blobs_[blob_id]->count() > 0) {
+      ++memory_refs[blobs_[blob_id]->data().get()];
+    }
+  }
+  for (int_tp blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blobs_[blob_id]->count() > 0) {
+      const shared_ptr<SyncedMemory>& memory = blobs_[blob_id]->data();
+      if (memory.use_count() > memory_refs[memory.get()]) {
+        pinned[blob_id] = true;
+      }
+    }
+  }
+
+  struct MemoryGroup {
+    vector<int_tp> blob_ids;
+    int_tp first_layer;
+    int_tp last_layer;
+    uint_tp size;
+    Device* device;
+    bool pinned;
+  };
+  vector<MemoryGroup> groups;
+  map<int_tp, int_tp> alias_to_group;
+  vector<int_tp> blob_group(blobs_.size(), -1);
+  for (int_tp layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    vector<int_tp> blob_ids = bottom_id_vecs_[layer_id];
+    blob_ids.insert(blob_ids.end(), top_id_vecs_[layer_id].begin(),
+                    top_id_vecs_[layer_id].end());
+    for (int_tp i = 0; i < blob_ids.size(); ++i) {
+      const int_tp blob_id = blob_ids[i];
+      BlobBase* blob = blobs_[blob_id].get();
+      if (blob->count() == 0) {
+        continue;
+      }
+      int_tp group_id = blob_group[blob_id];
+      if (group_id < 0) {
+        map<int_tp, int_tp>::iterator it =
+            alias_to_group.find(memory_alias_[blob_id]);
+        if (it == alias_to_group.end()) {
+          MemoryGroup group;
+          group.first_layer = layer_id;
+          group.last_layer = layer_id;
+          group.size = 0;
+          group.device = blob->get_device();
+          group.pinned = false;
+          groups.push_back(group);
+          it = alias_to_group.insert(std::make_pair(
+              memory_alias_[blob_id], int_tp(groups.size() - 1))).first;
+        }
+        group_id = it->second;
+        blob_group[blob_id] = group_id;
+        groups[group_id].blob_ids.push_back(blob_id);
+        groups[group_id].size = std::max(groups[group_id].size,
+            static_cast<uint_tp>(blob->data()->size()));
+        groups[group_id].pinned = groups[group_id].pinned || pinned[blob_id];
+      }
+      groups[group_id].last_layer = layer_id;
+    }
+  }
+
+  // Interval coloring: walk the groups by their first layer and give each one
+  // the best fitting buffer whose previous owners are all dead by then.
+  struct MemorySlab {
+    uint_tp size;
+    int_tp last_layer;
+    Device* device;
+  };
+  vector<MemorySlab> slabs;
+  vector<int_tp> group_slab(groups.size(), -1);
+  uint_tp memory_before = 0;
+  int_tp num_blobs = 0;
+  // Groups are created in order of their first layer.
+  for (int_tp group_id = 0; group_id < groups.size(); ++group_id) {
+    const MemoryGroup& group = groups[group_id];
+    if (group.pinned) {
+      continue;
+    }
+    memory_before += group.size;
+    num_blobs += group.blob_ids.size();
+    int_tp best = -1;
+    for (int_tp slab_id = 0; slab_id < slabs.size(); ++slab_id) {
+      const MemorySlab& slab = slabs[slab_id];
+      if (slab.last_layer >= group.first_layer
+          || slab.device != group.device) {
+        continue;
+      }
+      if (best < 0) {
+        best = slab_id;
+        continue;
+      }
+      const bool fits = slab.size >= group.size;
+      const bool best_fits = slabs[best].size >= group.size;
+      // Smallest buffer that fits, otherwise the largest one to grow
+      if ((fits && (!best_fits || slab.size < slabs[best].size))
+          || (!fits && !best_fits && slab.size > slabs[best].size)) {
+        best = slab_id;
+      }
+    }
+    if (best < 0) {
+      MemorySlab slab;
+      slab.size = 0;
+      slab.device = group.device;
+      slabs.push_back(slab);
+      best = slabs.size() - 1;
+    }
+    slabs[best].size = std::max(slabs[best].size, group.size);
+    slabs[best].last_layer = group.last_layer;
+    group_slab[group_id] = best;
+  }
+
+  vector<shared_ptr<SyncedMemory> > memory(slabs.size());
+  memory_optimized_ = 0;
+  for (int_tp slab_id = 0; slab_id < slabs.size(); ++slab_id) {
+    memory[slab_id].reset(new SyncedMemory(slabs[slab_id].size,
+                                           slabs[slab_id].device));
+    memory_optimized_ += slabs[slab_id].size;
+  }
+  for (int_tp group_id = 0; group_id < groups.size(); ++group_id) {
+    if (group_slab[group_id] < 0) {
+      continue;
+    }
+    for (int_tp i = 0; i < groups[group_id].blob_ids.size(); ++i) {
+      blobs_[groups[group_id].blob_ids[i]]->ShareDataMemory(
+          memory[group_slab[group_id]]);
+    }
+  }
+  if (Caffe::root_solver()) {
+    LOG(INFO) << "Memory-optimized inference: " << num_blobs
+              << " intermediate blobs in " << slabs.size()
+              << " shared buffers, " << memory_optimized_ << " B instead of "
+              << memory_before << " B (saves "
+              << (memory_before == 0 ? 0.0 : 100.0 *
+                  (memory_before - memory_optimized_) / memory_before)
+              << "%)";
+  }
+}
+
+template<typename Dtype>
+void Net<Dtype>::AccumulateHostMemoryStats(const HostMemoryStats& start) {
+  const HostMemoryStats& now = HostMemoryPool::thread_stats();
+  host_memory_stats_.allocations += now.allocations - start.allocations;
+  host_memory_stats_.cache_hits += now.cache_hits - start.cache_hits;
+  host_memory_stats_.releases += now.releases - start.releases;
+  if (Caffe::host_memory_pool()) {
+    // Byte counts are kept per pool, not per thread
+    const HostMemoryStats pool = device_->host_memory_pool()->stats();
+    host_memory_stats_.bytes_in_use = pool.bytes_in_use;
+    host_memory_stats_.peak_bytes_in_use = pool.peak_bytes_in_use;
+    host_memory_stats_.bytes_cached = pool.bytes_cached;
+  }
+}
+
+template<typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& trained_param) {
+  // Fold the weights of the layers fused into convolutions.
+  NetParameter folded_param;
+  if (!folded_layers_.empty()) {
+    folded_param.CopyFrom(trained_param);
+    FoldLayerWeights(folded_layers_, &folded_param);
+  }
+  const NetParameter& param = folded_layers_.empty() ?
+      trained_param : folded_param;
 
   // Load quantizer statistics
   std::map<int_tp, std::pair<double, double> > quantizer_map;
@@ -4,17 +4,21 @@
 
 #ifdef USE_CUDA
 #ifdef USE_NCCL
-
 #include <cuda_runtime.h>
+#endif  // USE_NCCL
+#endif  // USE_CUDA
 #include <glog/logging.h>
 #include <stdio.h>
+#include <algorithm>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/sgd_solvers.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
@@ -27,10 +31,13 @@ enum Op {
 };
 
 template<typename Dtype>
-static void apply_buffers(const vector<Blob<Dtype>*>& blobs, Dtype* buffer,
+static void apply_buffers(const vector<BlobBase*>& blobs, Dtype* buffer,
                           uint_tp total_size, Op op) {
   Dtype* ptr = buffer;
   for (int i = 0; i < blobs.size(); ++i) {
+    CHECK_EQ(blobs[i]->data_type(), proto_data_type<Dtype>())
+        << "Parameters of a different type than the solver cannot share "
+        << "one buffer";
     int_tp size = blobs[i]->count();
     switch (op) {
       case copy: {
@@ -43,15 +50,21 @@ static void apply_buffers(const vector<Blob<Dtype>*>& blobs, Dtype* buffer,
       case replace_cpu:
         blobs[i]->data()->set_cpu_data(ptr);
         break;
-      case replace_gpu:
-        blobs[i]->data()->set_gpu_data(ptr);
-        break;
       case replace_cpu_diff:
         blobs[i]->diff()->set_cpu_data(ptr);
         break;
+#ifdef USE_CUDA
+#ifdef USE_NCCL
+      case replace_gpu:
+        blobs[i]->data()->set_gpu_data(ptr);
+        break;
       case replace_gpu_diff:
         blobs[i]->diff()->set_gpu_data(ptr);
         break;
+#endif  // USE_NCCL
+#endif  // USE_CUDA
+      default:
+        LOG(FATAL) << "Unsupported buffer operation " << op;
     }
     ptr += size;
   }
@@ -61,7 +74,7 @@ static void apply_buffers(const vector<Blob<Dtype>*>& blobs, Dtype* buffer,
 
 // Buffer size necessary to store given blobs
 template<typename Dtype>
-static uint_tp total_size(const vector<Blob<Dtype>*>& params) {
+static uint_tp total_size(const vector<BlobBase*>& params) {
   uint_tp size = 0;
   for (int i = 0; i < params.size(); ++i)
     size += params[i]->count();
@@ -72,11 +85,643 @@ static uint_tp total_size(const vector<Blob<Dtype>*>& params) {
 
 template<typename Dtype>
 Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
-  : size_(total_size<Dtype>(root_solver->net()->learnable_params())),
+  : Params<Dtype>(*root_solver->net()) {
+}
+
+template<typename Dtype>
+Params<Dtype>::Params(const Net<Dtype>& net)
+  : size_(total_size<Dtype>(net.learnable_params())),
     data_(),
     diff_() {
 }
 
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(shared_ptr<Solver<Dtype> > root_solver,
+                            uint_tp extra)
+  : CPUParams<Dtype>(*root_solver->net(), root_solver->get_device(), extra) {
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(const Net<Dtype>& net, Device* device,
+                            uint_tp extra)
+  : Params<Dtype>(net), device_(device) {
+  void* data;
+  device_->MallocMemHost(size_ * sizeof(Dtype), &data);
+  data_ = static_cast<Dtype*>(data);
+
+  // Copy blob values
+  apply_buffers(net.learnable_params(), data_, size_, copy);
+
+  void* diff;
+  device_->MallocMemHost((size_ + extra) * sizeof(Dtype), &diff);
+  diff_ = static_cast<Dtype*>(diff);
+  caffe_set(size_ + extra, Dtype(0), diff_);
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::~CPUParams() {
+  device_->FreeMemHost(data_);
+  device_->FreeMemHost(diff_);
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::Configure(Solver<Dtype>* solver) const {
+  Configure(solver->net().get());
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::Configure(Net<Dtype>* net) const {
+  const vector<BlobBase*>& params = net->learnable_params();
+  apply_buffers(params, data_, size_, replace_cpu);
+  apply_buffers(params, diff_, size_, replace_cpu_diff);
+}
+
+CancelableBarrier::CancelableBarrier(int count)
+  : count_(count), waiting_(0), generation_(0), cancelled_(false) {
+}
+
+bool CancelableBarrier::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (cancelled_) {
+    return false;
+  }
+  const uint64_t generation = generation_;
+  if (++waiting_ == count_) {
+    waiting_ = 0;
+    ++generation_;
+    condition_.notify_all();
+    return true;
+  }
+  condition_.wait(lock, [this, generation] {
+    return cancelled_ || generation_ != generation;
+  });
+  return generation_ != generation;
+}
+
+void CancelableBarrier::Cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cancelled_ = true;
+  condition_.notify_all();
+}
+
+template<typename Dtype>
+GradientBuckets<Dtype>::GradientBuckets(shared_ptr<Net<Dtype> > net,
+                                        int_tp iter_size,
+                                        uint_tp bucket_bytes, uint_tp size,
+                                        const Reduce& reduce)
+  : net_(net), iter_size_(iter_size), reduce_(reduce), buckets_(),
+    passes_(0), launched_(0), reduced_(0), stop_(false), reduce_ms_(0),
+    exposed_ms_(0) {
+  const vector<BlobBase*>& params = net->learnable_params();
+  const int_tp num_layers = net->layers().size();
+  // Lowest layer using each learnable parameter, after which its gradient
+  // is final
+  vector<int_tp> layers(params.size(), num_layers);
+  for (int i = 0; i < net->params().size(); ++i) {
+    const int_tp id = net->learnable_param_ids()[i];
+    layers[id] = std::min(layers[id], net->param_layer_indices()[i].first);
+  }
+  vector<uint_tp> offsets(params.size());
+  uint_tp offset = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    offsets[i] = offset;
+    offset += params[i]->count();
+  }
+  CHECK_LE(offset, size);
+  // Buckets in the order the backward pass completes them
+  uint_tp end = size;
+  int_tp layer = num_layers;
+  for (int i = params.size() - 1; i >= 0; --i) {
+    layer = std::min(layer, layers[i]);
+    if ((end - offsets[i]) * sizeof(Dtype) >= bucket_bytes || i == 0) {
+      Bucket bucket = {offsets[i], end - offsets[i], layer};
+      buckets_.push_back(bucket);
+      end = offsets[i];
+      layer = num_layers;
+    }
+  }
+  if (buckets_.empty()) {
+    Bucket bucket = {0, size, 0};
+    buckets_.push_back(bucket);
+  }
+  net_->add_after_backward(this);
+  StartInternalThread(Caffe::GetDefaultDevice());
+}
+
+template<typename Dtype>
+GradientBuckets<Dtype>::~GradientBuckets() {
+  net_->remove_after_backward(this);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    condition_.notify_all();
+  }
+  StopInternalThread();
+}
+
+template<typename Dtype>
+void GradientBuckets<Dtype>::run(int layer) {
+  if (layer == net_->layers().size() - 1) {
+    ++passes_;
+  }
+  // Gradients still accumulate over the other passes
+  if (passes_ < iter_size_) {
+    return;
+  }
+  int count = launched_;
+  while (count < buckets_.size() && buckets_[count].layer >= layer) {
+    ++count;
+  }
+  if (count > launched_) {
+    Launch(count);
+  }
+}
+
+template<typename Dtype>
+void GradientBuckets<Dtype>::Launch(int count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  launched_ = count;
+  condition_.notify_all();
+}
+
+template<typename Dtype>
+void GradientBuckets<Dtype>::Wait() {
+  CPUTimer timer;
+  timer.Start();
+  Launch(buckets_.size());
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.wait(lock, [this] { return reduced_ == buckets_.size(); });
+  exposed_ms_ = timer.MilliSeconds();
+  launched_ = 0;
+  reduced_ = 0;
+  passes_ = 0;
+}
+
+template<typename Dtype>
+void GradientBuckets<Dtype>::InternalThreadEntry() {
+  CPUTimer timer;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    condition_.wait(lock, [this] { return stop_ || reduced_ < launched_; });
+    if (reduced_ == launched_) {
+      return;
+    }
+    const Bucket bucket = buckets_[reduced_];
+    lock.unlock();
+    timer.Start();
+    reduce_(bucket.offset, bucket.count);
+    const double ms = timer.MilliSeconds();
+    lock.lock();
+    reduce_ms_ = reduced_ ? reduce_ms_ + ms : ms;
+    ++reduced_;
+    condition_.notify_all();
+  }
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > solver)
+  : CPUParams<Dtype>(solver), solver_(solver),
+    rank_(Caffe::solver_rank()), syncs_(), barrier_(), cancelled_(false),
+    buckets_(), compute_ms_(0), reduce_ms_(0), exposed_ms_(0),
+    iterations_(0), iterations_per_second_(0) {
+  this->Configure(solver.get());
+  const SolverParameter& param = solver->param();
+  if (param.layer_wise_reduce()) {
+    buckets_.reset(new GradientBuckets<Dtype>(solver->net(),
+        param.iter_size(), param.reduce_bucket_mb() * 1024 * 1024, size_,
+        [this](uint_tp offset, uint_tp count) { Reduce(offset, count); }));
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Join(vector<CPUSync<Dtype>*>* syncs,
+                          CancelableBarrier* barrier) {
+  syncs_ = syncs;
+  barrier_ = barrier;
+  (*syncs_)[rank_] = this;
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Broadcast() {
+  if (!barrier_->Wait()) {
+    return;
+  }
+  if (rank_ != 0) {
+    caffe_copy(size_, (*syncs_)[0]->data_, data_);
+  }
+  barrier_->Wait();
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_start() {
+  timer_.Start();
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Reduce(uint_tp offset, uint_tp count) {
+  // Wait for the gradients of all ranks
+  if (cancelled_ || !barrier_->Wait()) {
+    cancelled_ = true;
+    return;
+  }
+  const int ranks = static_cast<int>(syncs_->size());
+  // Chunks of whole cache lines, the last one may be shorter
+  const uint_tp align = std::max<uint_tp>(64 / sizeof(Dtype), 1);
+  const uint_tp chunk = (count + ranks * align - 1) / (ranks * align) * align;
+  const uint_tp begin = offset + std::min<uint_tp>(rank_ * chunk, count);
+  const uint_tp end = std::min<uint_tp>(begin + chunk, offset + count);
+  const int_tp n = end - begin;
+  if (n > 0) {
+    Dtype* reduced = diff_ + begin;
+    for (int i = 1; i < ranks; ++i) {
+      const CPUSync<Dtype>* other = (*syncs_)[(rank_ + i) % ranks];
+      caffe_axpy(n, Dtype(1), other->diff_ + begin, reduced);
+    }
+    caffe_scal(n, Dtype(1.0 / ranks), reduced);
+    for (int i = 1; i < ranks; ++i) {
+      CPUSync<Dtype>* other = (*syncs_)[(rank_ + i) % ranks];
+      caffe_copy(n, reduced, other->diff_ + begin);
+    }
+  }
+  // Wait for all chunks before the update reads them
+  if (!barrier_->Wait()) {
+    cancelled_ = true;
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_gradients_ready() {
+  compute_ms_ += timer_.MilliSeconds();
+  timer_.Start();
+  if (buckets_) {
+    buckets_->Wait();
+    reduce_ms_ += buckets_->reduce_ms();
+    exposed_ms_ += buckets_->exposed_ms();
+  } else {
+    Reduce(0, size_);
+    const double ms = timer_.MilliSeconds();
+    reduce_ms_ += ms;
+    exposed_ms_ += ms;
+  }
+  ++iterations_;
+}
+
+template<typename Dtype>
+class CPUWorker : public InternalThread {
+ public:
+  explicit CPUWorker(CPUSync<Dtype>* rank0, CancelableBarrier* barrier,
+                     vector<CPUSync<Dtype>*>* syncs, const char* restore)
+    : rank0_(rank0), barrier_(barrier), syncs_(syncs), restore_(restore),
+      compute_ms_(0), reduce_ms_(0), exposed_ms_(0), iterations_(0) {
+  }
+  virtual ~CPUWorker() {}
+
+ protected:
+  void InternalThreadEntry() {
+    // Create solver and install callbacks. Solvers are set up one at a
+    // time, as some layers read files with libraries that are not thread
+    // safe, e.g. HDF5.
+    static std::mutex setup_mutex;
+    SolverParameter param(rank0_->solver_->param());
+    param.set_type(rank0_->solver_->type());
+    shared_ptr<Solver<Dtype> > s;
+    {
+      std::lock_guard<std::mutex> lock(setup_mutex);
+      s.reset(SolverRegistry<Dtype>::CreateSolver(param,
+                                                  Caffe::GetDefaultDevice()));
+      CHECK_STREQ(s->type(), rank0_->solver_->type());
+      if (restore_) {
+        s->Restore(restore_);
+      }
+    }
+    CPUSync<Dtype> sync(s);
+    sync.Join(syncs_, barrier_);
+    s->add_callback(&sync);
+    // Stop with rank 0, which cancels the barrier when it is done
+    s->SetActionFunction([&sync]() {
+      return sync.cancelled_ ? SolverAction::STOP : SolverAction::NONE;
+    });
+    // Wait for other threads
+    barrier_->Wait();
+    // Broadcast rank 0 state
+    sync.Broadcast();
+    // Solve
+    s->Step(param.max_iter() - s->iter());
+    compute_ms_ = sync.compute_ms_;
+    reduce_ms_ = sync.reduce_ms_;
+    exposed_ms_ = sync.exposed_ms_;
+    iterations_ = sync.iterations_;
+  }
+
+  CPUSync<Dtype>* rank0_;
+  CancelableBarrier* barrier_;
+  vector<CPUSync<Dtype>*>* syncs_;
+  const char* restore_;
+
+ public:
+  // Statistics of the solver, once the thread stopped
+  double compute_ms_;
+  double reduce_ms_;
+  double exposed_ms_;
+  int_tp iterations_;
+};
+
+template<typename Dtype>
+void CPUSync<Dtype>::Run(const char* restore) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU)
+      << "CPU data parallel training requires solvers running on the CPU";
+  CHECK_EQ(rank_, 0);
+  const int count = Caffe::solver_count();
+  CancelableBarrier barrier(count);
+  vector<CPUSync<Dtype>*> syncs(count);
+  compute_ms_ = 0;
+  reduce_ms_ = 0;
+  exposed_ms_ = 0;
+  iterations_ = 0;
+  // Create workers
+  vector<shared_ptr<CPUWorker<Dtype> > > workers(count);
+  for (int i = 1; i < count; ++i) {
+    Caffe::set_solver_rank(i);
+    CPUWorker<Dtype>* w = new CPUWorker<Dtype>(this, &barrier, &syncs,
+                                               restore);
+    w->StartInternalThread(solver_->get_device());
+    workers[i].reset(w);
+  }
+  Caffe::set_solver_rank(0);
+  Join(&syncs, &barrier);
+  solver_->add_callback(this);
+  // Wait for workers
+  barrier.Wait();
+  // Run first solver on current thread
+  Broadcast();
+  const int_tp start_iter = solver_->iter();
+  CPUTimer timer;
+  timer.Start();
+  solver_->Solve();
+  const double seconds = timer.Seconds();
+  iterations_per_second_ = seconds > 0 ?
+      (solver_->iter() - start_iter) / seconds : 0;
+  // Release workers still waiting for rank 0 if it stopped early
+  barrier.Cancel();
+  for (int i = 1; i < count; ++i) {
+    workers[i]->StopInternalThread();
+    compute_ms_ += workers[i]->compute_ms_;
+    reduce_ms_ += workers[i]->reduce_ms_;
+    exposed_ms_ += workers[i]->exposed_ms_;
+    iterations_ += workers[i]->iterations_;
+  }
+  syncs_ = NULL;
+  barrier_ = NULL;
+}
+
+template<typename Dtype>
+Collective<Dtype>::Collective(shared_ptr<Transport> transport)
+  : transport_(transport), algorithm_(AUTO), buffer_() {
+}
+
+template<typename Dtype>
+void Collective<Dtype>::AllReduce(Dtype* data, uint_tp count) {
+  const int n = size();
+  if (n == 1 || count == 0) {
+    return;
+  }
+  const bool power_of_two = (n & (n - 1)) == 0;
+  Algorithm algorithm = algorithm_;
+  if (algorithm == AUTO) {
+    algorithm = power_of_two ? HALVING_DOUBLING : RING;
+  }
+  if (algorithm == HALVING_DOUBLING) {
+    CHECK(power_of_two)
+        << "Recursive halving and doubling needs a power of two processes";
+    HalvingDoublingAllReduce(data, count);
+  } else {
+    RingAllReduce(data, count);
+  }
+}
+
+template<typename Dtype>
+void Collective<Dtype>::RingAllReduce(Dtype* data, uint_tp count) {
+  const int n = size();
+  const int r = rank();
+  const int right = (r + 1) % n;
+  const int left = (r + n - 1) % n;
+  vector<uint_tp> offsets(n + 1);
+  for (int i = 0; i <= n; ++i) {
+    offsets[i] = count * i / n;
+  }
+  buffer_.resize(count / n + 1);
+  // Reduce-scatter, after which rank r holds the sum of chunk r + 1
+  for (int step = 0; step < n - 1; ++step) {
+    const int send = (r + n - step) % n;
+    const int recv = (r + n - step - 1) % n;
+    const uint_tp recv_count = offsets[recv + 1] - offsets[recv];
+    transport_->SendRecv(right, data + offsets[send],
+                         (offsets[send + 1] - offsets[send]) * sizeof(Dtype),
+                         left, &buffer_[0], recv_count * sizeof(Dtype));
+    if (recv_count > 0) {
+      caffe_axpy(recv_count, Dtype(1), &buffer_[0], data + offsets[recv]);
+    }
+  }
+  // All-gather of the summed chunks
+  for (int step = 0; step < n - 1; ++step) {
+    const int send = (r + 1 + n - step) % n;
+    const int recv = (r + n - step) % n;
+    transport_->SendRecv(right, data + offsets[send],
+                         (offsets[send + 1] - offsets[send]) * sizeof(Dtype),
+                         left, data + offsets[recv],
+                         (offsets[recv + 1] - offsets[recv]) * sizeof(Dtype));
+  }
+}
+
+template<typename Dtype>
+void Collective<Dtype>::HalvingDoublingAllReduce(Dtype* data, uint_tp count) {
+  const int n = size();
+  const int r = rank();
+  buffer_.resize(count / 2 + 1);
+  // Recursive halving: exchange half of the range with the peer at distance
+  // mask and sum the other half, after which rank r holds the sum of 1/n
+  uint_tp begin = 0;
+  uint_tp end = count;
+  vector<std::pair<uint_tp, uint_tp> > ranges;
+  for (int mask = n / 2; mask > 0; mask /= 2) {
+    const int peer = r ^ mask;
+    const uint_tp middle = begin + (end - begin) / 2;
+    const bool lower = (r & mask) == 0;
+    const uint_tp keep_begin = lower ? begin : middle;
+    const uint_tp keep_end = lower ? middle : end;
+    const uint_tp send_begin = lower ? middle : begin;
+    const uint_tp send_end = lower ? end : middle;
+    transport_->SendRecv(peer, data + send_begin,
+                         (send_end - send_begin) * sizeof(Dtype),
+                         peer, &buffer_[0],
+                         (keep_end - keep_begin) * sizeof(Dtype));
+    if (keep_end > keep_begin) {
+      caffe_axpy(keep_end - keep_begin, Dtype(1), &buffer_[0],
+                 data + keep_begin);
+    }
+    ranges.push_back(std::make_pair(begin, end));
+    begin = keep_begin;
+    end = keep_end;
+  }
+  // Recursive doubling: exchange the summed ranges in the reverse order
+  for (int mask = 1; mask < n; mask *= 2) {
+    const int peer = r ^ mask;
+    const std::pair<uint_tp, uint_tp> range = ranges.back();
+    ranges.pop_back();
+    const bool lower = (r & mask) == 0;
+    const uint_tp other_begin = lower ? end : range.first;
+    const uint_tp other_end = lower ? range.second : begin;
+    transport_->SendRecv(peer, data + begin, (end - begin) * sizeof(Dtype),
+                         peer, data + other_begin,
+                         (other_end - other_begin) * sizeof(Dtype));
+    begin = range.first;
+    end = range.second;
+  }
+}
+
+template<typename Dtype>
+void Collective<Dtype>::Broadcast(Dtype* data, uint_tp count, int root) {
+  const int n = size();
+  const int relative = (rank() + n - root) % n;
+  for (int mask = 1; mask < n; mask *= 2) {
+    if (relative < mask) {
+      if (relative + mask < n) {
+        transport_->Send((relative + mask + root) % n, data,
+                         count * sizeof(Dtype));
+      }
+    } else if (relative < 2 * mask) {
+      transport_->Recv((relative - mask + root) % n, data,
+                       count * sizeof(Dtype));
+    }
+  }
+}
+
+template<typename Dtype>
+void Collective<Dtype>::Barrier() {
+  // Dissemination barrier, log2(size) rounds of one byte messages
+  const int n = size();
+  const int r = rank();
+  for (int distance = 1; distance < n; distance *= 2) {
+    char send = 0;
+    char recv;
+    transport_->SendRecv((r + distance) % n, &send, 1,
+                         (r + n - distance) % n, &recv, 1);
+  }
+}
+
+template<typename Dtype>
+CollectiveSync<Dtype>::CollectiveSync(shared_ptr<Solver<Dtype> > solver,
+                                      shared_ptr<Transport> transport)
+  : CPUParams<Dtype>(solver, 1), solver_(solver), collective_(transport),
+    stop_requested_(false), stopping_(false), buckets_(), compute_ms_(0),
+    reduce_ms_(0), exposed_ms_(0), iterations_(0), iterations_per_second_(0) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU)
+      << "Training over several processes requires solvers on the CPU";
+  CHECK_EQ(transport->rank(), Caffe::solver_rank());
+  CHECK_EQ(transport->size(), Caffe::solver_count());
+  this->Configure(solver.get());
+  const SolverParameter& param = solver->param();
+  if (param.layer_wise_reduce()) {
+    buckets_.reset(new GradientBuckets<Dtype>(solver->net(),
+        param.iter_size(), param.reduce_bucket_mb() * 1024 * 1024,
+        size_ + 1,
+        [this](uint_tp offset, uint_tp count) { Reduce(offset, count); }));
+  }
+}
+
+template<typename Dtype>
+void CollectiveSync<Dtype>::Broadcast() {
+  collective_.Broadcast(data_, size_, 0);
+}
+
+template<typename Dtype>
+SolverAction::Enum CollectiveSync<Dtype>::GetRequestedAction() {
+  SolverAction::Enum request = SolverAction::NONE;
+  if (Caffe::root_solver() && action_) {
+    request = action_();
+    if (request == SolverAction::STOP) {
+      // Other processes would wait for this one in the next all-reduce
+      stop_requested_ = true;
+      request = SolverAction::NONE;
+    }
+  }
+  return stopping_ ? SolverAction::STOP : request;
+}
+
+template<typename Dtype>
+void CollectiveSync<Dtype>::on_start() {
+  // Set before the backward pass, which may already reduce it
+  diff_[size_] = stop_requested_ ? Dtype(1) : Dtype(0);
+  timer_.Start();
+}
+
+template<typename Dtype>
+void CollectiveSync<Dtype>::Reduce(uint_tp offset, uint_tp count) {
+  collective_.AllReduce(diff_ + offset, count);
+  const uint_tp end = std::min<uint_tp>(offset + count, size_);
+  if (end > offset) {
+    caffe_scal(end - offset, Dtype(1.0 / collective_.size()), diff_ + offset);
+  }
+}
+
+template<typename Dtype>
+void CollectiveSync<Dtype>::on_gradients_ready() {
+  compute_ms_ += timer_.MilliSeconds();
+  timer_.Start();
+  if (buckets_) {
+    buckets_->Wait();
+    reduce_ms_ += buckets_->reduce_ms();
+    exposed_ms_ += buckets_->exposed_ms();
+  } else {
+    Reduce(0, size_ + 1);
+    const double ms = timer_.MilliSeconds();
+    reduce_ms_ += ms;
+    exposed_ms_ += ms;
+  }
+  if (diff_[size_] > Dtype(0)) {
+    stopping_ = true;
+  }
+  ++iterations_;
+}
+
+template<typename Dtype>
+void CollectiveSync<Dtype>::Run(ActionCallback action) {
+  action_ = action;
+  stop_requested_ = false;
+  stopping_ = false;
+  compute_ms_ = 0;
+  reduce_ms_ = 0;
+  exposed_ms_ = 0;
+  iterations_ = 0;
+  solver_->add_callback(this);
+  solver_->SetActionFunction([this]() { return GetRequestedAction(); });
+  Broadcast();
+  const int_tp start_iter = solver_->iter();
+  CPUTimer timer;
+  timer.Start();
+  if (Caffe::root_solver()) {
+    solver_->Solve();
+  } else {
+    solver_->Step(solver_->param().max_iter() - solver_->iter());
+  }
+  const double seconds = timer.Seconds();
+  iterations_per_second_ = seconds > 0 ?
+      (solver_->iter() - start_iter) / seconds : 0;
+  // Rank 0 may still be testing or snapshotting
+  collective_.Barrier();
+}
+
+INSTANTIATE_CLASS_1T_GUARDED(Params, (half_fp)(float)(double));
+INSTANTIATE_CLASS_1T_GUARDED(CPUParams, (half_fp)(float)(double));
+INSTANTIATE_CLASS_1T_GUARDED(GradientBuckets, (half_fp)(float)(double));
+INSTANTIATE_CLASS_1T_GUARDED(CPUWorker, (half_fp)(float)(double));
+INSTANTIATE_CLASS_1T_GUARDED(CPUSync, (half_fp)(float)(double));
+INSTANTIATE_CLASS_1T_GUARDED(Collective, (half_fp)(float)(double));
+INSTANTIATE_CLASS_1T_GUARDED(CollectiveSync, (half_fp)(float)(double));
+
+#ifdef USE_CUDA
+#ifdef USE_NCCL
+
 template<typename Dtype>
 GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
   : Params<Dtype>(root_solver) {
@@ -88,7 +733,7 @@ GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
   CUDA_CHECK(cudaMalloc(&data_, size_ * sizeof(Dtype)));
 
   // Copy blob values
-  const vector<Blob<Dtype>*>& net =
+  const vector<BlobBase*>& net =
     root_solver->net()->learnable_params();
   apply_buffers(net, data_, size_, copy);
 
@@ -106,7 +751,7 @@ GPUParams<Dtype>::~GPUParams() {
 
 template<typename Dtype>
 void GPUParams<Dtype>::Configure(Solver<Dtype>* solver) const {
-  const vector<Blob<Dtype>*>& net =
+  const vector<BlobBase*>& net =
     solver->net()->learnable_params();
   apply_buffers(net, data_, size_, replace_gpu);
   apply_buffers(net, diff_, size_, replace_gpu_diff);
@@ -366,12 +1011,11 @@ void NCCL<Dtype>::Run(const vector<int>& gpus, const char* restore) {
   }
 }
 
-INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(Worker);
 INSTANTIATE_CLASS(NCCL);
 
-}  // namespace caffe
-
 #endif  // USE_NCCL
 #endif  // USE_CUDA
+
+}  // namespace caffe
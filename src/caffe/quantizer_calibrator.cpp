@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+#include "caffe/quantizer.hpp"
+#include "caffe/quantizer_calibrator.hpp"
+
+namespace caffe {
+
+bool AssignQuantizerIndices(NetParameter* param) {
+  for (int_tp i = 0; i < param->layer_size(); ++i) {
+    if (param->layer(i).has_quantizer_index()) {
+      return false;
+    }
+  }
+  for (int_tp i = 0; i < param->layer_size(); ++i) {
+    param->mutable_layer(i)->set_quantizer_index(i);
+  }
+  return true;
+}
+
+double HistogramPercentileRange(const vector<double>& hist, double bin_width,
+                                double percentile) {
+  double total = 0;
+  for (size_t i = 0; i < hist.size(); ++i) {
+    total += hist[i];
+  }
+  const double target = total * percentile / 100.0;
+  double sum = 0;
+  for (size_t i = 0; i < hist.size(); ++i) {
+    sum += hist[i];
+    if (sum >= target) {
+      return (i + 1) * bin_width;
+    }
+  }
+  return hist.size() * bin_width;
+}
+
+double HistogramEntropyRange(const vector<double>& hist, double bin_width,
+                             int_tp levels) {
+  const int_tp num_bins = hist.size();
+  if (num_bins <= levels) {
+    return num_bins * bin_width;
+  }
+  double outliers = 0;
+  for (int_tp i = levels; i < num_bins; ++i) {
+    outliers += hist[i];
+  }
+  int_tp best_bins = num_bins;
+  double best_divergence = type_max_val<double>();
+  vector<double> p(num_bins);
+  vector<double> q(num_bins);
+  for (int_tp bins = levels; bins <= num_bins; ++bins) {
+    // Reference distribution, clipped to the candidate range
+    std::copy(hist.begin(), hist.begin() + bins, p.begin());
+    p[bins - 1] += outliers;
+    if (bins < num_bins) {
+      outliers -= hist[bins];
+    }
+    // Quantized distribution, each level spread evenly over the non-empty
+    // bins it merges
+    for (int_tp j = 0; j < levels; ++j) {
+      const int_tp start = j * bins / levels;
+      const int_tp end = (j + 1) * bins / levels;
+      double sum = 0;
+      int_tp nonzero = 0;
+      for (int_tp k = start; k < end; ++k) {
+        sum += hist[k];
+        nonzero += hist[k] > 0;
+      }
+      for (int_tp k = start; k < end; ++k) {
+        q[k] = (hist[k] > 0) ? sum / nonzero : 0;
+      }
+    }
+    double p_sum = 0;
+    double q_sum = 0;
+    for (int_tp k = 0; k < bins; ++k) {
+      p_sum += p[k];
+      q_sum += q[k];
+    }
+    if (p_sum <= 0 || q_sum <= 0) {
+      continue;
+    }
+    double divergence = 0;
+    for (int_tp k = 0; k < bins; ++k) {
+      if (p[k] > 0) {
+        // Values the quantized distribution cannot represent
+        const double q_k = std::max(q[k] / q_sum, 1e-10);
+        divergence += p[k] / p_sum * std::log(p[k] / p_sum / q_k);
+      }
+    }
+    if (divergence < best_divergence) {
+      best_divergence = divergence;
+      best_bins = bins;
+    }
+  }
+  return best_bins * bin_width;
+}
+
+template<typename Dtype>
+QuantizerCalibrator<Dtype>::QuantizerCalibrator(Net<Dtype>* net,
+                                                int_tp num_bins)
+    : net_(net), num_bins_(num_bins), histogram_callback_(this),
+      collect_(false) {
+  CHECK_GT(num_bins_, 0);
+  net_->add_after_forward(&histogram_callback_);
+}
+
+template<typename Dtype>
+void QuantizerCalibrator<Dtype>::SetQuantizerMode(QuantizerMode mode,
+                                                  bool reset_range) {
+  const vector<shared_ptr<LayerBase> >& layers = net_->layers();
+  for (size_t i = 0; i < layers.size(); ++i) {
+    vector<shared_ptr<QuantizerBase> > quantizers =
+        layers[i]->get_all_quantizers();
+    for (size_t j = 0; j < quantizers.size(); ++j) {
+      QuantizerParameter param = quantizers[j]->quant_param();
+      param.set_mode(mode);
+      if (reset_range) {
+        param.set_observed_min(type_max_val<double>());
+        param.set_observed_max(type_min_val<double>());
+      } else {
+        param.clear_observed_min();
+        param.clear_observed_max();
+      }
+      quantizers[j]->update_param(param);
+    }
+  }
+}
+
+template<typename Dtype>
+void QuantizerCalibrator<Dtype>::Calibrate(int_tp iterations) {
+  // Pass 1: range of each quantizer index
+  SetQuantizerMode(OBSERVE, true);
+  for (int_tp i = 0; i < iterations; ++i) {
+    net_->Forward();
+  }
+  SetQuantizerMode(PASSIVE, false);
+  max_abs_.clear();
+  const vector<shared_ptr<LayerBase> >& layers = net_->layers();
+  for (size_t i = 0; i < layers.size(); ++i) {
+    vector<shared_ptr<QuantizerBase> > quantizers =
+        layers[i]->get_all_quantizers();
+    for (size_t j = 0; j < quantizers.size(); ++j) {
+      const double observed_min = quantizers[j]->get_observed_min();
+      const double observed_max = quantizers[j]->get_observed_max();
+      if (observed_min > observed_max) {
+        continue;
+      }
+      const double max_abs = std::max(std::abs(observed_min),
+                                      std::abs(observed_max));
+      double& index_max_abs = max_abs_[quantizers[j]->get_index()];
+      index_max_abs = std::max(index_max_abs, max_abs);
+    }
+  }
+
+  // Pass 2: histograms of the absolute values within that range
+  histograms_.clear();
+  for (map<int_tp, double>::iterator it = max_abs_.begin();
+       it != max_abs_.end(); ++it) {
+    histograms_[it->first].assign(num_bins_, 0.0);
+  }
+  collect_ = true;
+  for (int_tp i = 0; i < iterations; ++i) {
+    net_->Forward();
+  }
+  collect_ = false;
+}
+
+template<typename Dtype>
+void QuantizerCalibrator<Dtype>::AddToHistogram(
+    int_tp index, const vector<BlobBase*>& blobs) {
+  typename map<int_tp, vector<double> >::iterator hist_it =
+      histograms_.find(index);
+  if (hist_it == histograms_.end() || max_abs_[index] <= 0) {
+    return;
+  }
+  vector<double>& hist = hist_it->second;
+  const double scale = num_bins_ / max_abs_[index];
+  for (size_t i = 0; i < blobs.size(); ++i) {
+    if (blobs[i]->data_type() != proto_data_type<Dtype>()) {
+      continue;
+    }
+    Blob<Dtype>* blob = static_cast<Blob<Dtype>*>(blobs[i]);
+    const Dtype* data = blob->cpu_data();
+    for (int_tp j = 0; j < blob->count(); ++j) {
+      const int_tp bin = std::abs(static_cast<double>(data[j])) * scale;
+      hist[std::min(bin, num_bins_ - 1)] += 1;
+    }
+  }
+}
+
+template<typename Dtype>
+void QuantizerCalibrator<Dtype>::HistogramCallback::run(int layer) {
+  if (!calibrator_->collect_) {
+    return;
+  }
+  Net<Dtype>* net = calibrator_->net_;
+  const int_tp index = net->layers()[layer]->layer_param().quantizer_index();
+  calibrator_->AddToHistogram(index, net->bottom_vecs()[layer]);
+  calibrator_->AddToHistogram(index, net->top_vecs()[layer]);
+}
+
+template<typename Dtype>
+void QuantizerCalibrator<Dtype>::ComputeRanges(CalibrationMethod method,
+                                               double percentile) {
+  CHECK(method != CALIBRATION_PERCENTILE
+        || (percentile > 0 && percentile <= 100))
+      << "Percentile must be in (0, 100].";
+  ranges_.clear();
+  for (map<int_tp, double>::iterator it = max_abs_.begin();
+       it != max_abs_.end(); ++it) {
+    const double bin_width = it->second / num_bins_;
+    const vector<double>& hist = histograms_[it->first];
+    switch (method) {
+      case CALIBRATION_MAX:
+        ranges_[it->first] = it->second;
+        break;
+      case CALIBRATION_PERCENTILE:
+        ranges_[it->first] = HistogramPercentileRange(hist, bin_width,
+                                                      percentile);
+        break;
+      case CALIBRATION_ENTROPY:
+        ranges_[it->first] = HistogramEntropyRange(hist, bin_width);
+        break;
+    }
+  }
+}
+
+template<typename Dtype>
+void QuantizerCalibrator<Dtype>::RangesToProto(NetParameter* param) const {
+  param->clear_quantizer();
+  for (map<int_tp, double>::const_iterator it = ranges_.begin();
+       it != ranges_.end(); ++it) {
+    QuantizerParameter* quant_param = param->add_quantizer();
+    quant_param->set_index(it->first);
+    quant_param->set_observed_min(-it->second);
+    quant_param->set_observed_max(it->second);
+  }
+}
+
+template<typename Dtype>
+static double MaxAbs(const Blob<Dtype>* blob) {
+  const Dtype* data = blob->cpu_data();
+  double max_abs = 0;
+  for (int_tp i = 0; i < blob->count(); ++i) {
+    max_abs = std::max(max_abs, std::abs(static_cast<double>(data[i])));
+  }
+  return max_abs;
+}
+
+template<typename Dtype>
+static void FakeQuantize(Blob<Dtype>* blob, double range) {
+  if (range <= 0) {
+    return;
+  }
+  const double step = range / 127.0;
+  Dtype* data = blob->mutable_cpu_data();
+  for (int_tp i = 0; i < blob->count(); ++i) {
+    const double level = std::round(static_cast<double>(data[i]) / step);
+    data[i] = static_cast<Dtype>(std::max(-127.0, std::min(127.0, level))
+                                 * step);
+  }
+}
+
+template<typename Dtype>
+SimulatedQuantization<Dtype>::SimulatedQuantization(
+    Net<Dtype>* net, const map<int_tp, double>& ranges)
+    : net_(net), ranges_(ranges) {
+  net_->set_forward_threads(1);
+  net_->add_before_forward(this);
+  const vector<shared_ptr<LayerBase> >& layers = net_->layers();
+  for (size_t i = 0; i < layers.size(); ++i) {
+    vector<shared_ptr<BlobBase> > blobs = layers[i]->blob_bases();
+    if (blobs.size() == 0
+        || ranges_.find(layers[i]->layer_param().quantizer_index())
+           == ranges_.end()
+        || blobs[0]->data_type() != proto_data_type<Dtype>()) {
+      continue;
+    }
+    // Weights use their own (per tensor) range, biases stay at full
+    // precision as int8 kernels accumulate them in 32 bit.
+    Blob<Dtype>* weights = static_cast<Blob<Dtype>*>(blobs[0].get());
+    FakeQuantize(weights, MaxAbs(weights));
+  }
+}
+
+template<typename Dtype>
+void SimulatedQuantization<Dtype>::run(int layer) {
+  const shared_ptr<LayerBase>& layer_ptr = net_->layers()[layer];
+  map<int_tp, double>::const_iterator it =
+      ranges_.find(layer_ptr->layer_param().quantizer_index());
+  if (layer_ptr->blob_bases().size() == 0 || it == ranges_.end()) {
+    return;
+  }
+  const vector<BlobBase*>& bottom = net_->bottom_vecs()[layer];
+  for (size_t i = 0; i < bottom.size(); ++i) {
+    if (bottom[i]->data_type() == proto_data_type<Dtype>()) {
+      FakeQuantize(static_cast<Blob<Dtype>*>(bottom[i]), it->second);
+    }
+  }
+}
+
+INSTANTIATE_CLASS_1T_GUARDED(QuantizerCalibrator, (half_fp)(float)(double));
+INSTANTIATE_CLASS_1T_GUARDED(SimulatedQuantization,
+                             (half_fp)(float)(double));
+
+}  // namespace caffe
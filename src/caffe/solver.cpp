@@ -76,6 +76,40 @@ SolverParameter Solver<Dtype>::GetSolverParams() {
   return param_;
 }
 
+// In mixed precision training, layers without explicit data types compute
+// in half_fp
+static void SetMixedPrecision(NetParameter* net_param) {
+#ifdef USE_HALF
+  for (int_tp i = 0; i < net_param->layer_size(); ++i) {
+    LayerParameter* layer_param = net_param->mutable_layer(i);
+    if (!layer_param->has_bottom_data_type()
+        && !layer_param->has_compute_data_type()
+        && !layer_param->has_top_data_type()) {
+      layer_param->set_bottom_data_type(HALF);
+      layer_param->set_compute_data_type(HALF);
+      layer_param->set_top_data_type(HALF);
+    }
+  }
+#else  // USE_HALF
+  LOG(FATAL) << "Mixed precision training requires a build with USE_HALF";
+#endif  // USE_HALF
+}
+
+// The quantizer of a half_fp net output (mixed precision) does not convert
+// to Dtype, so these are cast here
+template<typename Dtype>
+static void OutputToDtype(BlobBase* blob, Dtype* out) {
+#ifdef USE_HALF
+  if (blob->data_type() == HALF) {
+    Quantizer<half_fp, Dtype> quant(blob->get_device());
+    quant.Forward_cpu(blob->count(),
+                      static_cast<Blob<half_fp>*>(blob)->cpu_data(), out);
+    return;
+  }
+#endif  // USE_HALF
+  blob->cpu_data(out);
+}
+
 template<typename Dtype>
 void Solver<Dtype>::InitTrainNet() {
   const int_tp num_train_nets = param_.has_net() + param_.has_net_param()
@@ -114,6 +148,9 @@ void Solver<Dtype>::InitTrainNet() {
   net_state.MergeFrom(net_param.state());
   net_state.MergeFrom(param_.train_state());
   net_param.mutable_state()->CopyFrom(net_state);
+  if (param_.mixed_precision()) {
+    SetMixedPrecision(&net_param);
+  }
   net_.reset(new Net<Dtype>(net_param, this->device_));
 }
 
@@ -188,6 +225,11 @@ void Solver<Dtype>::InitTestNets() {
       net_state.MergeFrom(param_.test_state(i));
     }
     net_params[i].mutable_state()->CopyFrom(net_state);
+    // Test nets share the unfolded weights of the training net.
+    net_params[i].set_fuse_layers(false);
+    if (param_.mixed_precision()) {
+      SetMixedPrecision(&net_params[i]);
+    }
     LOG(INFO)
         << "Creating test net (#" << i << ") specified by " << sources[i];
     test_nets_[i].reset(new Net<Dtype>(net_params[i], this->device_));
@@ -249,7 +291,7 @@ Dtype Solver<Dtype>::Step(int_tp iters) {
         } else {
           Dtype* temp_result_vec = this->device_->template Buffer<Dtype>(
             result[j]->shape(), &buffer_id)->mutable_cpu_data();
-          result[j]->cpu_data(temp_result_vec);
+          OutputToDtype(result[j], temp_result_vec);
           result_vec = temp_result_vec;
         }
         const string& output_name =
@@ -397,7 +439,7 @@ void Solver<Dtype>::Test(const int_tp test_net_id) {
         } else {
           Dtype* temp_result_vec = this->device_->template Buffer<Dtype>(
             result[j]->shape(), &buffer_id)->mutable_cpu_data();
-          result[j]->cpu_data(temp_result_vec);
+          OutputToDtype(result[j], temp_result_vec);
           result_vec = temp_result_vec;
         }
         for (int_tp k = 0; k < result[j]->count(); ++k) {
@@ -416,7 +458,7 @@ void Solver<Dtype>::Test(const int_tp test_net_id) {
         } else {
           Dtype* temp_result_vec = this->device_->template Buffer<Dtype>(
             result[j]->shape(), &buffer_id)->mutable_cpu_data();
-          result[j]->cpu_data(temp_result_vec);
+          OutputToDtype(result[j], temp_result_vec);
           result_vec = temp_result_vec;
         }
         for (int_tp k = 0; k < result[j]->count(); ++k) {
@@ -134,6 +134,24 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaDeltaSolver<Dtype>::ApplyFlatUpdate(Dtype rate) {
+  const Dtype delta = this->param_.delta();
+  const Dtype momentum = this->param_.momentum();
+  // History of gradients, then of updates
+  Dtype* gradients = this->flat_history(0);
+  Dtype* updates = this->flat_history(1);
+  this->FlatUpdate(rate, [delta, momentum, gradients, updates](
+      uint_tp i, Dtype g, Dtype local_rate) {
+    gradients[i] = momentum * gradients[i] + (Dtype(1) - momentum) * g * g;
+    const Dtype update = g * Dtype(std::sqrt((updates[i] + delta)
+                                             / (gradients[i] + delta)));
+    updates[i] = momentum * updates[i]
+                 + (Dtype(1) - momentum) * update * update;
+    return Dtype(local_rate * update);
+  });
+}
+
 INSTANTIATE_CLASS_1T_GUARDED(AdaDeltaSolver, (half_fp)(float)(double));
 REGISTER_SOLVER_CLASS(AdaDelta);
 REGISTER_SOLVER_CLASS_INST(AdaDelta, (half_fp)(float)(double));
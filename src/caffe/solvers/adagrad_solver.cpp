@@ -92,6 +92,17 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
     }
   }
 
+template <typename Dtype>
+void AdaGradSolver<Dtype>::ApplyFlatUpdate(Dtype rate) {
+  const Dtype delta = this->param_.delta();
+  Dtype* history = this->flat_history(0);
+  this->FlatUpdate(rate, [delta, history](uint_tp i, Dtype g,
+                                          Dtype local_rate) {
+    history[i] += g * g;
+    return Dtype(local_rate * g / (Dtype(std::sqrt(history[i])) + delta));
+  });
+}
+
 INSTANTIATE_CLASS_1T_GUARDED(AdaGradSolver, (half_fp)(float)(double));
 REGISTER_SOLVER_CLASS(AdaGrad);
 REGISTER_SOLVER_CLASS_INST(AdaGrad, (half_fp)(float)(double));
@@ -112,6 +112,25 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdamSolver<Dtype>::ApplyFlatUpdate(Dtype rate) {
+  const Dtype beta1 = this->param_.momentum();
+  const Dtype beta2 = this->param_.momentum2();
+  const Dtype eps_hat = this->param_.delta();
+  const uint_tp t = this->iter_  + 1;
+  const Dtype correction = sqrt(Dtype(1) - pow(beta2, Dtype(t))) /
+      (Dtype(1.) - pow(beta1, Dtype(t)));
+  Dtype* val_m = this->flat_history(0);
+  Dtype* val_v = this->flat_history(1);
+  this->FlatUpdate(rate, [beta1, beta2, eps_hat, correction, val_m, val_v](
+      uint_tp i, Dtype g, Dtype local_rate) {
+    val_m[i] = beta1 * val_m[i] + (Dtype(1) - beta1) * g;
+    val_v[i] = beta2 * val_v[i] + (Dtype(1) - beta2) * g * g;
+    return Dtype(local_rate * correction * val_m[i]
+                 / (Dtype(std::sqrt(val_v[i])) + eps_hat));
+  });
+}
+
 INSTANTIATE_CLASS_1T_GUARDED(AdamSolver, (half_fp)(float)(double));
 REGISTER_SOLVER_CLASS(Adam);
 REGISTER_SOLVER_CLASS_INST(Adam, (half_fp)(float)(double));
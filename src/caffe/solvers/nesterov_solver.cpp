@@ -87,6 +87,19 @@ void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::ApplyFlatUpdate(Dtype rate) {
+  const Dtype momentum = this->param_.momentum();
+  Dtype* history = this->flat_history(0);
+  this->FlatUpdate(rate, [momentum, history](uint_tp i, Dtype g,
+                                             Dtype local_rate) {
+    // Step back then over step
+    const Dtype previous = history[i];
+    history[i] = momentum * previous + local_rate * g;
+    return Dtype((Dtype(1) + momentum) * history[i] - momentum * previous);
+  });
+}
+
 INSTANTIATE_CLASS_1T_GUARDED(NesterovSolver, (half_fp)(float)(double));
 REGISTER_SOLVER_CLASS(Nesterov);
 REGISTER_SOLVER_CLASS_INST(Nesterov, (half_fp)(float)(double));
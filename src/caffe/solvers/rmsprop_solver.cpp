@@ -96,6 +96,18 @@ void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void RMSPropSolver<Dtype>::ApplyFlatUpdate(Dtype rate) {
+  const Dtype delta = this->param_.delta();
+  const Dtype rms_decay = this->param_.rms_decay();
+  Dtype* history = this->flat_history(0);
+  this->FlatUpdate(rate, [delta, rms_decay, history](uint_tp i, Dtype g,
+                                                     Dtype local_rate) {
+    history[i] = rms_decay * history[i] + (Dtype(1) - rms_decay) * g * g;
+    return Dtype(local_rate * g / (Dtype(std::sqrt(history[i])) + delta));
+  });
+}
+
 INSTANTIATE_CLASS_1T_GUARDED(RMSPropSolver, (half_fp)(float)(double));
 REGISTER_SOLVER_CLASS(RMSProp);
 REGISTER_SOLVER_CLASS_INST(RMSProp, (half_fp)(float)(double));
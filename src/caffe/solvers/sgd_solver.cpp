@@ -1,6 +1,9 @@
+#include <algorithm>
+#include <limits>
 #include <string>
 #include <vector>
 
+#include "caffe/parallel.hpp"
 #include "caffe/sgd_solvers.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
@@ -8,6 +11,14 @@
 
 namespace caffe {
 
+// Largest segment of the flat update, for the threads to share the work of
+// large parameter blobs
+static const uint_tp kFlatSegmentSize = 16384;
+
+// Largest power of two in half_fp, the dynamic loss scale is not doubled
+// beyond it
+static const float kMaxLossScale = 32768;
+
 // Return the current learning rate. The currently implemented learning rate
 // policies are as follows:
 //    - fixed: always return base_lr.
@@ -81,6 +92,189 @@ void SGDSolver<Dtype>::PreSolve() {
         shared_ptr<Blob<Dtype> >(
             new Blob<Dtype>(shape, this->device_)));
   }
+  flat_params_.reset();
+  flat_history_.reset();
+  flat_segments_.clear();
+  flat_data_ = NULL;
+  flat_diff_ = NULL;
+  flat_size_ = 0;
+  flat_master_.reset();
+  loss_scale_ = 1;
+  loss_scale_iter_ = 0;
+  skipped_updates_ = 0;
+  loss_scale_increases_ = 0;
+  loss_scale_decreases_ = 0;
+  const bool mixed = this->param_.mixed_precision();
+  if (mixed || (this->param_.flat_update() && Caffe::mode() == Caffe::CPU)) {
+    const string& regularization_type = this->param_.regularization_type();
+    CHECK(regularization_type == "L1" || regularization_type == "L2")
+        << "Unknown regularization type: " << regularization_type;
+  }
+  if (mixed) {
+    CHECK(Caffe::mode() == Caffe::CPU)
+        << "Mixed precision training is implemented for the CPU only";
+    CHECK(proto_data_type<Dtype>() != HALF)
+        << "Mixed precision training keeps the master copy of the parameters "
+        << "in the solver data type, which cannot be half_fp";
+    CHECK_GT(this->param_.loss_scale(), 0);
+    loss_scale_ = this->param_.loss_scale();
+  } else if (this->param_.flat_update() && Caffe::mode() == Caffe::CPU) {
+    bool flat = !net_params.empty();
+    for (uint_tp i = 0; i < net_params.size(); ++i) {
+      flat &= net_params[i]->data_type() == proto_data_type<Dtype>();
+    }
+    // Replace the parameter buffers by contiguous ones, unless data parallel
+    // training replaces them again later
+    if (flat) {
+      flat_params_.reset(new CPUParams<Dtype>(*this->net_, this->device_));
+      flat_params_->Configure(this->net_.get());
+    } else {
+      LOG(WARNING) << "Flat update requires learnable parameters of the "
+                   << "solver data type";
+    }
+  }
+  this->net_->set_loss_scale(loss_scale_);
+}
+
+template<typename Dtype>
+bool SGDSolver<Dtype>::FlatParams() {
+  const bool mixed = this->param_.mixed_precision();
+  if (!flat_params_ && !mixed) {
+    return false;
+  }
+  const vector<BlobBase*>& net_params = this->net_->learnable_params();
+  Dtype* data = NULL;
+  Dtype* diff = NULL;
+  uint_tp offset = 0;
+  if (mixed) {
+    if (!flat_master_) {
+      uint_tp size = 0;
+      for (uint_tp i = 0; i < net_params.size(); ++i) {
+        size += net_params[i]->count();
+      }
+      flat_master_.reset(new Blob<Dtype>(vector<int_tp>(1, size),
+                                         this->device_));
+      Dtype* master = flat_master_->mutable_cpu_data();
+      for (uint_tp i = 0; i < net_params.size(); ++i) {
+        net_params[i]->cpu_data(master);
+        master += net_params[i]->count();
+      }
+    }
+    data = flat_master_->mutable_cpu_data();
+    diff = flat_master_->mutable_cpu_diff();
+    offset = flat_master_->count();
+  } else {
+    for (uint_tp i = 0; i < net_params.size(); ++i) {
+      Blob<Dtype>* param = static_cast<Blob<Dtype>*>(net_params[i]);
+      Dtype* param_data = param->mutable_cpu_data();
+      Dtype* param_diff = param->mutable_cpu_diff();
+      if (i == 0) {
+        data = param_data;
+        diff = param_diff;
+      } else if (param_data != data + offset || param_diff != diff + offset) {
+        return false;
+      }
+      offset += param->count();
+    }
+  }
+  if (data != flat_data_ || diff != flat_diff_) {
+    flat_data_ = data;
+    flat_diff_ = diff;
+    flat_size_ = offset;
+    const vector<float>& net_params_lr = this->net_->params_lr();
+    const vector<float>& net_params_weight_decay =
+        this->net_->params_weight_decay();
+    flat_segments_.clear();
+    offset = 0;
+    for (uint_tp i = 0; i < net_params.size(); ++i) {
+      const uint_tp end = offset + net_params[i]->count();
+      for (; offset < end; offset += kFlatSegmentSize) {
+        FlatSegment segment;
+        segment.offset = offset;
+        segment.count = std::min(end - offset, kFlatSegmentSize);
+        segment.lr_mult = net_params_lr[i];
+        segment.decay_mult = net_params_weight_decay[i];
+        flat_segments_.push_back(segment);
+      }
+      offset = end;
+    }
+  }
+  if (!flat_history_) {
+    // Subclasses add their history after PreSolve, so it is moved here,
+    // restored values included
+    CHECK_EQ(history_.size() % net_params.size(), 0);
+    flat_history_.reset(new Blob<Dtype>(vector<int_tp>(1,
+        history_.size() / net_params.size() * flat_size_), this->device_));
+    Dtype* history = flat_history_->mutable_cpu_data();
+    for (uint_tp i = 0; i < history_.size(); ++i) {
+      caffe_copy(history_[i]->count(), history_[i]->cpu_data(), history);
+      history_[i]->set_cpu_data(history);
+      history += history_[i]->count();
+    }
+  }
+  return true;
+}
+
+template<typename Dtype>
+bool SGDSolver<Dtype>::MasterGradients() {
+  const vector<BlobBase*>& net_params = this->net_->learnable_params();
+  Dtype* master = flat_diff_;
+  for (uint_tp i = 0; i < net_params.size(); ++i) {
+    net_params[i]->cpu_diff(master);
+    master += net_params[i]->count();
+  }
+  // The sum is not finite if any gradient overflowed
+  const Dtype asum = caffe_asum(flat_size_, flat_diff_);
+  const int_tp window = this->param_.loss_scale_window();
+  if (!(asum <= std::numeric_limits<Dtype>::max())) {
+    ++skipped_updates_;
+    LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << this->iter_
+        << ", gradient overflow at loss scale " << loss_scale_
+        << ", skipping the update";
+    // Layers that scale their bottom diff by zero instead of overwriting it
+    // would turn the non-finite values left over into NaN in the next pass
+    const vector<shared_ptr<BlobBase> >& blobs = this->net_->blobs();
+    for (uint_tp i = 0; i < blobs.size(); ++i) {
+      blobs[i]->Clear();
+    }
+    if (window > 0) {
+      loss_scale_ /= 2;
+      loss_scale_iter_ = 0;
+      ++loss_scale_decreases_;
+      this->net_->set_loss_scale(loss_scale_);
+    }
+    return false;
+  }
+  caffe_scal(flat_size_, Dtype(1. / loss_scale_), flat_diff_);
+  if (window > 0 && ++loss_scale_iter_ == window) {
+    loss_scale_iter_ = 0;
+    if (loss_scale_ * 2 <= kMaxLossScale) {
+      loss_scale_ *= 2;
+      ++loss_scale_increases_;
+      this->net_->set_loss_scale(loss_scale_);
+    }
+  }
+  return true;
+}
+
+template<typename Dtype>
+void SGDSolver<Dtype>::CopyMasterParams() {
+  const vector<BlobBase*>& net_params = this->net_->learnable_params();
+  const Dtype* master = flat_data_;
+  for (uint_tp i = 0; i < net_params.size(); ++i) {
+    net_params[i]->set_cpu_data(master);
+    master += net_params[i]->count();
+  }
+}
+
+template<typename Dtype>
+void SGDSolver<Dtype>::ApplyFlatUpdate(Dtype rate) {
+  const Dtype momentum = this->param_.momentum();
+  Dtype* history = flat_history(0);
+  FlatUpdate(rate, [momentum, history](uint_tp i, Dtype g, Dtype local_rate) {
+    history[i] = momentum * history[i] + local_rate * g;
+    return history[i];
+  });
 }
 
 template<typename Dtype>
@@ -128,9 +322,25 @@ void SGDSolver<Dtype>::ClipGradients() {
 template<typename Dtype>
 void SGDSolver<Dtype>::ApplyUpdate() {
   Dtype rate = GetLearningRate();
+  const bool mixed = this->param_.mixed_precision();
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << this->iter_
         << ", lr = " << rate;
+    LOG_IF(INFO, Caffe::root_solver() && mixed) << "Iteration "
+        << this->iter_ << ", loss scale = " << loss_scale_ << " ("
+        << skipped_updates_ << " updates skipped, "
+        << loss_scale_increases_ << " increases, "
+        << loss_scale_decreases_ << " decreases)";
+  }
+  if (FlatParams()) {
+    if (mixed && !MasterGradients()) {
+      return;
+    }
+    ApplyFlatUpdate(rate);
+    if (mixed) {
+      CopyMasterParams();
+    }
+    return;
   }
   ClipGradients();
   for (uint_tp param_id = 0; param_id < this->net_->learnable_params().size();
@@ -403,6 +613,12 @@ void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
   state.set_iter(this->iter_);
   state.set_learned_net(model_filename);
   state.set_current_step(this->current_step_);
+  if (this->param_.mixed_precision()) {
+    state.set_loss_scale(loss_scale_);
+    if (flat_master_) {
+      flat_master_->ToProto(state.mutable_master());
+    }
+  }
   state.clear_history();
   for (uint_tp i = 0; i < history_.size(); ++i) {
     // Add history
@@ -430,6 +646,12 @@ void SGDSolver<Dtype>::SnapshotSolverStateToHDF5(
   hdf5_save_int(file_hid, "iter", this->iter_);
   hdf5_save_string(file_hid, "learned_net", model_filename);
   hdf5_save_int(file_hid, "current_step", this->current_step_);
+  if (this->param_.mixed_precision()) {
+    hdf5_save_float(file_hid, "loss_scale", loss_scale_);
+    if (flat_master_) {
+      hdf5_save_nd_dataset<Dtype>(file_hid, "master", *flat_master_);
+    }
+  }
   hid_t history_hid = H5Gcreate2(file_hid, "history", H5P_DEFAULT, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(history_hid, 0)
@@ -448,6 +670,31 @@ void SGDSolver<Dtype>::SnapshotSolverStateToHDF5(
 #endif  // USE_HDF5
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::RestoreMixedPrecision(float loss_scale,
+                                             shared_ptr<Blob<Dtype> > master) {
+  if (!this->param_.mixed_precision()) {
+    return;
+  }
+  if (loss_scale > 0) {
+    loss_scale_ = loss_scale;
+    loss_scale_iter_ = 0;
+    this->net_->set_loss_scale(loss_scale_);
+  }
+  if (master) {
+    const vector<BlobBase*>& net_params = this->net_->learnable_params();
+    int_tp size = 0;
+    for (uint_tp i = 0; i < net_params.size(); ++i) {
+      size += net_params[i]->count();
+    }
+    CHECK_EQ(master->count(), size)
+        << "Incorrect size of the master copy of the parameters.";
+  }
+  // Without a saved master copy, it is copied from the restored parameters
+  // again, losing the precision they do not have
+  flat_master_ = master;
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(
     const string& state_file) {
@@ -460,6 +707,13 @@ void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(
     this->net_->CopyTrainedLayersFrom(net_param);
   }
   this->current_step_ = state.current_step();
+  shared_ptr<Blob<Dtype> > master;
+  if (state.has_master()) {
+    master.reset(new Blob<Dtype>(this->device_));
+    master->FromProto(state.master());
+  }
+  RestoreMixedPrecision(state.has_loss_scale() ? state.loss_scale() : 0,
+                        master);
   CHECK_EQ(state.history_size(), history_.size())
       << "Incorrect length of history blobs.";
   LOG(INFO) << "SGDSolver: restoring history";
@@ -479,6 +733,13 @@ void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
     this->net_->CopyTrainedLayersFrom(learned_net);
   }
   this->current_step_ = hdf5_load_int(file_hid, "current_step");
+  shared_ptr<Blob<Dtype> > master;
+  if (H5LTfind_dataset(file_hid, "master")) {
+    master.reset(new Blob<Dtype>(this->device_));
+    hdf5_load_nd_dataset<Dtype>(file_hid, "master", 1, 1, master.get());
+  }
+  RestoreMixedPrecision(H5LTfind_dataset(file_hid, "loss_scale") ?
+                        hdf5_load_float(file_hid, "loss_scale") : 0, master);
   hid_t history_hid = H5Gopen2(file_hid, "history", H5P_DEFAULT);
   CHECK_GE(history_hid, 0) << "Error reading history from " << state_file;
   uint_tp state_history_size = hdf5_get_num_links(history_hid);
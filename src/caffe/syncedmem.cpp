@@ -17,9 +17,28 @@ SyncedMemory::~SyncedMemory() {
 #endif  // !CPU_ONLY
   // Free host memory
   if (cpu_ptr_ && (own_cpu_data_ || own_zero_copy_data_)) {
+    free_host();
+  }
+}
+
+void SyncedMemory::malloc_host() {
+  if (Caffe::host_memory_pool()) {
+    cpu_ptr_ = device_->host_memory_pool()->Allocate(size_);
+    own_pooled_data_ = true;
+  } else {
+    device_->MallocMemHost(size_, &cpu_ptr_);
+    own_pooled_data_ = false;
+  }
+}
+
+void SyncedMemory::free_host() {
+  if (own_pooled_data_) {
+    device_->host_memory_pool()->Release(cpu_ptr_, size_);
+  } else {
     device_->FreeMemHost(cpu_ptr_);
-    cpu_ptr_ = nullptr;
   }
+  cpu_ptr_ = nullptr;
+  own_pooled_data_ = false;
 }
 
 inline void SyncedMemory::to_cpu() {
@@ -41,7 +60,7 @@ inline void SyncedMemory::to_cpu() {
         head_ = SYNCED;
       } else {
 #endif  // !CPU_ONLY
-        device_->MallocMemHost(size_, &cpu_ptr_);
+        malloc_host();
         caffe_memset(size_, 0, cpu_ptr_);
         own_cpu_data_ = true;
         head_ = HEAD_AT_CPU;
@@ -53,7 +72,7 @@ inline void SyncedMemory::to_cpu() {
     case HEAD_AT_GPU: {
 #ifndef CPU_ONLY
       if (cpu_ptr_ == nullptr) {
-        device_->MallocMemHost(size_, &cpu_ptr_);
+        malloc_host();
         own_cpu_data_ = true;
       }
       if (own_zero_copy_data_) {
@@ -127,10 +146,11 @@ const void* SyncedMemory::cpu_data() {
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
   if (cpu_ptr_ && own_cpu_data_) {
-    device_->FreeMemHost(cpu_ptr_);
+    free_host();
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
+  ++version_;
   own_cpu_data_ = false;
   if (own_zero_copy_data_) {
     gpu_ptr_ = vptr<void>();
@@ -145,7 +165,7 @@ vptr<const void> SyncedMemory::gpu_data() {
   return gpu_ptr_;
 #else
   NO_GPU;
-  return NULL;
+  return vptr<const void>();
 #endif
 }
 
@@ -159,6 +179,7 @@ void SyncedMemory::set_gpu_data(vptr<void> data) {
   }
   gpu_ptr_ = data;
   head_ = HEAD_AT_GPU;
+  ++version_;
   own_gpu_data_ = false;
   if (own_zero_copy_data_) {
     cpu_ptr_ = nullptr;
@@ -173,6 +194,7 @@ void SyncedMemory::set_gpu_data(vptr<void> data) {
 void* SyncedMemory::mutable_cpu_data() {
   to_cpu();
   head_ = HEAD_AT_CPU;
+  ++version_;
   return cpu_ptr_;
 }
 
@@ -180,31 +202,37 @@ vptr<void> SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
   to_gpu();
   head_ = HEAD_AT_GPU;
+  ++version_;
   return gpu_ptr_;
 #else
   NO_GPU;
-  return NULL;
+  return vptr<void>();
 #endif
 }
 
-// TODO: Implement this function device abstracted
-/*
+void SyncedMemory::async_gpu_push(uint_tp queue) {
 #ifndef CPU_ONLY
-#ifdef USE_CUDA
-void SyncedMemory::async_gpu_push(const cudaStream_t& stream) {
   CHECK(head_ == HEAD_AT_CPU);
-  if (gpu_ptr_ == NULL) {
-    CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
+  if (own_zero_copy_data_) {
+    // Nothing to copy, the device reads the host memory
+    to_gpu();
+    return;
+  }
+  if (gpu_ptr_.get() == nullptr) {
+    gpu_ptr_ = device_->MallocMemDevice(size_, &cpu_ptr_, false);
+    device_->increase_memory_usage(size_);
     own_gpu_data_ = true;
   }
-  const cudaMemcpyKind put = cudaMemcpyHostToDevice;
-  CUDA_CHECK(cudaMemcpyAsync(gpu_ptr_, cpu_ptr_, size_, put, stream));
-  // Assume caller will synchronize on the stream before use
+  const uint_tp current_queue = device_->current_queue_id();
+  device_->SwitchQueue(queue);
+  device_->memcpy_async(size_, cpu_ptr_, gpu_ptr_);
+  device_->SwitchQueue(current_queue);
+  // Assume caller will synchronize on the queue before use
   head_ = SYNCED;
-}
-#endif  // USE_CUDA
+#else
+  NO_GPU;
 #endif  // !CPU_ONLY
-*/
+}
 
 }  // namespace caffe
 
@@ -84,6 +84,11 @@ bool caffe::isSupported<caffe::TypeLMDB>(void) {
 }
 #endif
 
+template<>
+bool caffe::isSupported<caffe::TypePacked>(void) {
+  return true;
+}
+
 
 #ifndef CPU_ONLY
 #ifdef USE_CUDA
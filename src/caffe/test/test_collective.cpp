@@ -0,0 +1,267 @@
+#if !defined(_MSC_VER)
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/sgd_solvers.hpp"
+#include "caffe/util/transport.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class CollectiveTest : public CPUDeviceTest<Dtype> {
+ protected:
+  typedef std::function<bool(shared_ptr<Transport>)> Body;
+
+  // Runs body in size processes on localhost, rank 0 in this one, and
+  // returns whether it succeeded in all of them.
+  bool RunProcesses(int size, const Body& body) {
+    const string master = "127.0.0.1:" + std::to_string(FreePort());
+    vector<pid_t> children;
+    for (int rank = 1; rank < size; ++rank) {
+      const pid_t pid = fork();
+      if (pid == 0) {
+        Caffe::set_solver_count(size);
+        Caffe::set_solver_rank(rank);
+        shared_ptr<Transport> transport(new TCPTransport(master, rank, size));
+        _exit(body(transport) ? 0 : 1);
+      }
+      CHECK_GT(pid, 0);
+      children.push_back(pid);
+    }
+    Caffe::set_solver_count(size);
+    Caffe::set_solver_rank(0);
+    bool success;
+    {
+      shared_ptr<Transport> transport(new TCPTransport(master, 0, size));
+      success = body(transport);
+    }
+    Caffe::set_solver_count(1);
+    for (int i = 0; i < children.size(); ++i) {
+      int status;
+      CHECK_EQ(waitpid(children[i], &status, 0), children[i]);
+      success &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return success;
+  }
+
+  static int FreePort() {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&address),
+                  sizeof(address)), 0);
+    socklen_t length = sizeof(address);
+    CHECK_EQ(getsockname(fd, reinterpret_cast<sockaddr*>(&address),
+                         &length), 0);
+    close(fd);
+    return ntohs(address.sin_port);
+  }
+
+  // Sums rank * 1000 + i over all ranks, for counts smaller and larger than
+  // the number of processes
+  static bool CheckAllReduce(shared_ptr<Transport> transport,
+      typename Collective<Dtype>::Algorithm algorithm) {
+    Collective<Dtype> collective(transport);
+    collective.set_algorithm(algorithm);
+    const int size = transport->size();
+    const int counts[] = {1, 3, 1000, 100003};
+    for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+      vector<Dtype> data(counts[c]);
+      for (int i = 0; i < data.size(); ++i) {
+        data[i] = transport->rank() * 1000 + i % 1000;
+      }
+      collective.AllReduce(&data[0], data.size());
+      for (int i = 0; i < data.size(); ++i) {
+        const Dtype expected = size * (size - 1) / 2 * 1000
+                               + size * (i % 1000);
+        if (data[i] != expected) {
+          LOG(ERROR) << "Rank " << transport->rank() << " got " << data[i]
+                     << " instead of " << expected << " at " << i;
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+};
+
+TYPED_TEST_CASE(CollectiveTest, TestDtypesFloatNoHalf);
+
+TYPED_TEST(CollectiveTest, TestAllReduceRing) {
+  for (int size = 2; size <= 4; ++size) {
+    EXPECT_TRUE(this->RunProcesses(size, [](shared_ptr<Transport> transport) {
+      return CollectiveTest<TypeParam>::CheckAllReduce(transport,
+          Collective<TypeParam>::RING);
+    })) << size << " processes";
+  }
+}
+
+TYPED_TEST(CollectiveTest, TestAllReduceHalvingDoubling) {
+  for (int size = 2; size <= 4; size *= 2) {
+    EXPECT_TRUE(this->RunProcesses(size, [](shared_ptr<Transport> transport) {
+      return CollectiveTest<TypeParam>::CheckAllReduce(transport,
+          Collective<TypeParam>::HALVING_DOUBLING);
+    })) << size << " processes";
+  }
+}
+
+TYPED_TEST(CollectiveTest, TestBroadcastBarrier) {
+  EXPECT_TRUE(this->RunProcesses(3, [](shared_ptr<Transport> transport) {
+    Collective<TypeParam> collective(transport);
+    vector<TypeParam> data(1000, transport->rank());
+    collective.Broadcast(&data[0], data.size(), 2);
+    collective.Barrier();
+    for (int i = 0; i < data.size(); ++i) {
+      if (data[i] != 2) {
+        return false;
+      }
+    }
+    return true;
+  }));
+}
+
+TYPED_TEST(CollectiveTest, TestGradientBuckets) {
+  typedef TypeParam Dtype;
+  const string proto =
+      "name: 'TestNetwork' "
+      "layer { name: 'data' type: 'DummyData' top: 'data' top: 'targets' "
+      "  dummy_data_param { shape { dim: 4 dim: 5 } shape { dim: 4 dim: 1 } "
+      "    data_filler { type: 'gaussian' std: 1.0 } "
+      "    data_filler { type: 'gaussian' std: 1.0 } } } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 10 "
+      "    weight_filler { type: 'gaussian' std: 1.0 } } } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+      "  inner_product_param { num_output: 1 "
+      "    weight_filler { type: 'gaussian' std: 1.0 } } } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip2' "
+      "  bottom: 'targets' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  shared_ptr<Net<Dtype> > net(new Net<Dtype>(param,
+                                             Caffe::GetDefaultDevice()));
+  const vector<BlobBase*>& params = net->learnable_params();
+  uint_tp size = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    size += params[i]->count();
+  }
+  std::mutex mutex;
+  vector<std::pair<uint_tp, uint_tp> > reduced;
+  auto reduce = [&mutex, &reduced](uint_tp offset, uint_tp count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    reduced.push_back(std::make_pair(offset, count));
+  };
+  auto num_reduced = [&mutex, &reduced]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return reduced.size();
+  };
+  // Buckets of one parameter, the last one first, with an extra element
+  // after the parameters, reduced once both passes of the iteration are done
+  GradientBuckets<Dtype> buckets(net, 2, 1, size + 1, reduce);
+  EXPECT_EQ(buckets.num_buckets(), params.size());
+  for (int iter = 0; iter < 2; ++iter) {
+    net->Forward();
+    net->Backward();
+    usleep(10000);
+    EXPECT_EQ(num_reduced(), 0);
+    net->Forward();
+    net->Backward();
+    // All layers are done, so all buckets are reduced without Wait
+    for (int i = 0; i < 1000 && num_reduced() < params.size(); ++i) {
+      usleep(1000);
+    }
+    EXPECT_EQ(num_reduced(), params.size());
+    buckets.Wait();
+    ASSERT_EQ(reduced.size(), params.size());
+    uint_tp end = size + 1;
+    for (int i = 0; i < reduced.size(); ++i) {
+      const int id = params.size() - 1 - i;
+      EXPECT_EQ(reduced[i].first + reduced[i].second, end);
+      EXPECT_EQ(reduced[i].second, params[id]->count() + (i == 0));
+      end = reduced[i].first;
+    }
+    EXPECT_EQ(end, 0);
+    EXPECT_GE(buckets.reduce_ms(), 0);
+    EXPECT_GE(buckets.exposed_ms(), 0);
+    reduced.clear();
+  }
+}
+
+// Every process fills its data with other random values, the weights must
+// still be the same in all of them after training
+template <typename Dtype>
+static bool TrainCollectiveSync(shared_ptr<Transport> transport,
+                                const string& reduce_param) {
+  const string proto =
+      "max_iter: 4 base_lr: 0.01 lr_policy: 'fixed' momentum: 0.9 "
+      "random_seed: 1701 snapshot_after_train: false solver_mode: CPU "
+      "net_param { name: 'TestNetwork' "
+      "  layer { name: 'data' type: 'DummyData' top: 'data' top: 'targets' "
+      "    dummy_data_param { shape { dim: 4 dim: 5 } shape { dim: 4 } "
+      "      data_filler { type: 'gaussian' std: 1.0 } "
+      "      data_filler { type: 'gaussian' std: 1.0 } } } "
+      "  layer { name: 'innerprod' type: 'InnerProduct' bottom: 'data' "
+      "    top: 'innerprod' inner_product_param { num_output: 1 "
+      "      weight_filler { type: 'gaussian' std: 1.0 } "
+      "      bias_filler { type: 'gaussian' std: 1.0 } } } "
+      "  layer { name: 'loss' type: 'EuclideanLoss' bottom: 'innerprod' "
+      "    bottom: 'targets' } } " + reduce_param;
+  SolverParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  shared_ptr<Solver<Dtype> > solver(
+      SolverRegistry<Dtype>::CreateSolver(param, Caffe::GetDefaultDevice()));
+  CollectiveSync<Dtype> sync(solver, transport);
+  sync.Run();
+  if (solver->iter() != 4) {
+    return false;
+  }
+  vector<Dtype> weights(sync.data(), sync.data() + sync.size());
+  vector<Dtype> sum(weights);
+  sync.collective()->AllReduce(&sum[0], sum.size());
+  for (int i = 0; i < weights.size(); ++i) {
+    if (std::fabs(sum[i] - transport->size() * weights[i])
+        > 1e-5 * std::fabs(sum[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TYPED_TEST(CollectiveTest, TestCollectiveSync) {
+  EXPECT_TRUE(this->RunProcesses(3, [](shared_ptr<Transport> transport) {
+    return TrainCollectiveSync<TypeParam>(transport,
+                                          "layer_wise_reduce: false");
+  }));
+}
+
+TYPED_TEST(CollectiveTest, TestCollectiveSyncBuckets) {
+  // One bucket per parameter blob
+  EXPECT_TRUE(this->RunProcesses(3, [](shared_ptr<Transport> transport) {
+    return TrainCollectiveSync<TypeParam>(transport,
+        "layer_wise_reduce: true reduce_bucket_mb: 0");
+  }));
+}
+
+}  // namespace caffe
+#endif  // !_MSC_VER
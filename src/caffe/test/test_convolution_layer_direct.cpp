@@ -0,0 +1,445 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/direct_conv_layer.hpp"
+#include "caffe/layers/eltwise_layer.hpp"
+#include "caffe/layers/relu_layer.hpp"
+#include "caffe/layers/reorder_layer.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/insert_conversions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class DirectConvolutionLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  DirectConvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 8, 11, 13)),
+        blob_top_(new Blob<Dtype>()),
+        ref_blob_top_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    ref_blob_top_vec_.push_back(ref_blob_top_);
+  }
+  virtual ~DirectConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_top_;
+  }
+
+  LayerParameter MakeParam(int kernel, int stride, int pad, int num_output) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(kernel);
+    convolution_param->add_stride(stride);
+    convolution_param->add_pad(pad);
+    convolution_param->set_num_output(num_output);
+    convolution_param->set_channel_block(0);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    return layer_param;
+  }
+
+  // Converts between channel block sizes with a ReorderLayer.
+  void Reorder(Blob<Dtype>* bottom, int bottom_block, int top_block,
+               Blob<Dtype>* top) {
+    LayerParameter layer_param;
+    layer_param.mutable_reorder_param()->set_bottom_channel_block(
+        bottom_block);
+    layer_param.mutable_reorder_param()->set_top_channel_block(top_block);
+    ReorderLayer<Dtype, Dtype, Dtype> layer(layer_param);
+    vector<Blob<Dtype>*> bottom_vec(1, bottom);
+    vector<Blob<Dtype>*> top_vec(1, top);
+    layer.SetUp(bottom_vec, top_vec);
+    layer.Forward(bottom_vec, top_vec);
+  }
+
+  // Runs the DIRECT layer on the bottom reordered to bottom_block and the
+  // im2col layer with the same weights on the plain bottom, and compares
+  // the plain tops.
+  void CompareToIm2col(const LayerParameter& layer_param, int bottom_block,
+                       int top_block) {
+    LayerParameter direct_param = layer_param;
+    direct_param.mutable_convolution_param()->set_bottom_channel_block(
+        bottom_block);
+    direct_param.mutable_convolution_param()->set_channel_block(top_block);
+    Blob<Dtype> bottom;
+    Reorder(this->blob_bottom_, 0, bottom_block, &bottom);
+    vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+    DirectConvolutionLayer<Dtype, Dtype, Dtype> layer(direct_param);
+    layer.SetUp(bottom_vec, this->blob_top_vec_);
+    ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+    ref_layer.SetUp(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    layer.Forward(bottom_vec, this->blob_top_vec_);
+    ref_layer.Forward(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+    Blob<Dtype> top;
+    Reorder(this->blob_top_, top_block, 0, &top);
+    CompareTops(top);
+  }
+
+  void CompareTops(const Blob<Dtype>& top) {
+    ASSERT_EQ(this->ref_blob_top_->shape(), top.shape());
+    const Dtype delta = std::is_same<Dtype, float>::value ? 1e-4 : 1e-10;
+    for (int i = 0; i < top.count(); ++i) {
+      EXPECT_NEAR(this->ref_blob_top_->cpu_data()[i], top.cpu_data()[i],
+                  delta);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const ref_blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> ref_blob_top_vec_;
+};
+
+TYPED_TEST_CASE(DirectConvolutionLayerTest, TestDtypesFloatNoHalf);
+
+TYPED_TEST(DirectConvolutionLayerTest, TestSetup) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 1, 1, 16);
+  layer_param.mutable_convolution_param()->set_channel_block(8);
+  DirectConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<int_tp> top_shape;
+  top_shape.push_back(2);
+  top_shape.push_back(2);
+  top_shape.push_back(11);
+  top_shape.push_back(13);
+  top_shape.push_back(8);
+  EXPECT_EQ(top_shape, this->blob_top_->shape());
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestFactory) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 1, 1, 16);
+  layer_param.set_type("Convolution");
+  layer_param.mutable_convolution_param()->set_engine(
+      ConvolutionParameter_Engine_DIRECT);
+  shared_ptr<Layer<Dtype, Dtype, Dtype> > layer =
+      LayerRegistry<Dtype, Dtype, Dtype>::CreateLayer(layer_param);
+  typedef DirectConvolutionLayer<Dtype, Dtype, Dtype> DirectLayer;
+  EXPECT_TRUE(dynamic_cast<DirectLayer*>(layer.get()) != NULL);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestReorderRoundTrip) {
+  typedef TypeParam Dtype;
+  Blob<Dtype> blocked8;
+  Blob<Dtype> blocked4;
+  Blob<Dtype> plain;
+  this->Reorder(this->blob_bottom_, 0, 8, &blocked8);
+  EXPECT_EQ(5, blocked8.num_axes());
+  EXPECT_EQ(1, blocked8.shape(1));
+  EXPECT_EQ(8, blocked8.shape(4));
+  // The first values of a blocked blob are all channels of pixel (0, 0).
+  for (int c = 0; c < 8; ++c) {
+    EXPECT_EQ(this->blob_bottom_->data_at(0, c, 0, 0),
+              blocked8.cpu_data()[c]);
+  }
+  this->Reorder(&blocked8, 8, 4, &blocked4);
+  EXPECT_EQ(2, blocked4.shape(1));
+  this->Reorder(&blocked4, 4, 0, &plain);
+  ASSERT_EQ(this->blob_bottom_->shape(), plain.shape());
+  for (int i = 0; i < plain.count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_->cpu_data()[i], plain.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestPlain) {
+  this->CompareToIm2col(this->MakeParam(3, 1, 1, 16), 0, 0);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestPlainOddOutputs) {
+  // Partial output channel blocks and register tiles
+  this->CompareToIm2col(this->MakeParam(3, 1, 1, 5), 0, 0);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestBlocked) {
+  this->CompareToIm2col(this->MakeParam(3, 1, 1, 16), 8, 8);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestBlocked16) {
+  this->CompareToIm2col(this->MakeParam(3, 1, 1, 32), 8, 16);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestBlockedToPlain) {
+  this->CompareToIm2col(this->MakeParam(3, 1, 1, 12), 8, 0);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestStride2) {
+  this->CompareToIm2col(this->MakeParam(3, 2, 1, 16), 0, 8);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, Test1x1) {
+  this->CompareToIm2col(this->MakeParam(1, 1, 0, 16), 8, 8);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestGroup) {
+  LayerParameter layer_param = this->MakeParam(3, 1, 1, 16);
+  layer_param.mutable_convolution_param()->set_group(2);
+  this->CompareToIm2col(layer_param, 0, 0);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestFusedReLU) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 1, 1, 16);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_fuse_type(
+      ConvolutionParameter_FuseType_FUSED_CONV_RELU);
+  convolution_param->mutable_relu_param()->set_negative_slope(0.1);
+  DirectConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  LayerParameter ref_param = this->MakeParam(3, 1, 1, 16);
+  ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(ref_param);
+  ref_layer.SetUp(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  LayerParameter relu_param;
+  relu_param.mutable_relu_param()->set_negative_slope(0.1);
+  ReLULayer<Dtype, Dtype, Dtype> relu_layer(relu_param);
+  relu_layer.SetUp(this->ref_blob_top_vec_, this->ref_blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ref_layer.Forward(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+  relu_layer.Forward(this->ref_blob_top_vec_, this->ref_blob_top_vec_);
+  this->CompareTops(*this->blob_top_);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestFusedEltwiseReLU) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 1, 1, 16);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_fuse_type(
+      ConvolutionParameter_FuseType_FUSED_CONV_ELTWISE_RELU);
+  convolution_param->set_bottom_channel_block(8);
+  convolution_param->set_channel_block(8);
+  Blob<Dtype> summand(2, 16, 11, 13);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&summand);
+  Blob<Dtype> bottom;
+  Blob<Dtype> blocked_summand;
+  this->Reorder(this->blob_bottom_, 0, 8, &bottom);
+  this->Reorder(&summand, 0, 8, &blocked_summand);
+  vector<Blob<Dtype>*> bottom_vec;
+  bottom_vec.push_back(&bottom);
+  bottom_vec.push_back(&blocked_summand);
+  DirectConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(bottom_vec, this->blob_top_vec_);
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+
+  LayerParameter ref_param = this->MakeParam(3, 1, 1, 16);
+  ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(ref_param);
+  Blob<Dtype> ref_conv_top;
+  vector<Blob<Dtype>*> ref_conv_top_vec(1, &ref_conv_top);
+  ref_layer.SetUp(this->blob_bottom_vec_, ref_conv_top_vec);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  vector<Blob<Dtype>*> eltwise_bottom_vec;
+  eltwise_bottom_vec.push_back(&ref_conv_top);
+  eltwise_bottom_vec.push_back(&summand);
+  LayerParameter eltwise_param;
+  EltwiseLayer<Dtype, Dtype, Dtype> eltwise_layer(eltwise_param);
+  eltwise_layer.SetUp(eltwise_bottom_vec, this->ref_blob_top_vec_);
+  LayerParameter relu_param;
+  ReLULayer<Dtype, Dtype, Dtype> relu_layer(relu_param);
+  relu_layer.SetUp(this->ref_blob_top_vec_, this->ref_blob_top_vec_);
+  ref_layer.Forward(this->blob_bottom_vec_, ref_conv_top_vec);
+  eltwise_layer.Forward(eltwise_bottom_vec, this->ref_blob_top_vec_);
+  relu_layer.Forward(this->ref_blob_top_vec_, this->ref_blob_top_vec_);
+  Blob<Dtype> top;
+  this->Reorder(this->blob_top_, 8, 0, &top);
+  this->CompareTops(top);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestWeightUpdate) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 1, 1, 16);
+  DirectConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The packed filters follow the new weights.
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(layer.blobs()[0].get());
+  ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+  ref_layer.SetUp(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ref_layer.Forward(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+  this->CompareTops(*this->blob_top_);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestNet) {
+  typedef TypeParam Dtype;
+  // conv1 is read by conv3 and conv2 by a pooling layer, so Net::Init
+  // splits both, keeping the splits blocked.
+  const string input_proto =
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 2 dim: 8 dim: 11 dim: 13 } } } ";
+  const string conv_proto =
+      "  convolution_param { num_output: 16 kernel_size: 3 pad: 1 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } ENGINE_AND_FUSION } } ";
+  string direct_proto = input_proto +
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' "
+      + conv_proto + "layer { name: 'conv2' type: 'Convolution' "
+      "  bottom: 'conv1' top: 'conv2' "
+      + conv_proto + "layer { name: 'conv3' type: 'Convolution' "
+      "  bottom: 'conv2' bottom: 'conv1' top: 'conv3' "
+      + conv_proto + "layer { name: 'pool' type: 'Pooling' bottom: 'conv2' "
+      "  top: 'pool' pooling_param { pool: MAX kernel_size: 2 stride: 2 } } ";
+  string ref_proto = input_proto +
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' "
+      + conv_proto + "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' "
+      "  top: 'conv1' } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'conv1' "
+      "  top: 'conv2' "
+      + conv_proto + "layer { name: 'conv3' type: 'Convolution' "
+      "  bottom: 'conv2' top: 'conv3_conv' "
+      + conv_proto + "layer { name: 'sum' type: 'Eltwise' "
+      "  bottom: 'conv3_conv' bottom: 'conv1' top: 'conv3' } "
+      "layer { name: 'relu3' type: 'ReLU' bottom: 'conv3' top: 'conv3' } "
+      "layer { name: 'pool' type: 'Pooling' bottom: 'conv2' "
+      "  top: 'pool' pooling_param { pool: MAX kernel_size: 2 stride: 2 } } ";
+  const string direct = "engine: DIRECT ";
+  const string fusions[3] = {"fuse_type: FUSED_CONV_RELU ", "",
+                             "fuse_type: FUSED_CONV_ELTWISE_RELU "};
+  const string placeholder = "ENGINE_AND_FUSION";
+  for (int i = 0; i < 3; ++i) {
+    direct_proto.replace(direct_proto.find(placeholder), placeholder.size(),
+                         direct + fusions[i]);
+    ref_proto.replace(ref_proto.find(placeholder), placeholder.size(), "");
+  }
+  NetParameter direct_param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(direct_proto,
+                                                      &direct_param));
+  NetParameter ref_param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(ref_proto, &ref_param));
+  Net<Dtype> net(direct_param, Caffe::GetDefaultDevice());
+  Net<Dtype> ref_net(ref_param, Caffe::GetDefaultDevice());
+  NetParameter weights;
+  net.ToProto(&weights);
+  ref_net.CopyTrainedLayersFrom(weights);
+
+  // The convolutions exchange blocked blobs only, the pooling layer and
+  // the net output get reorders.
+  EXPECT_TRUE(net.has_blob(BlockedBlobName("conv2", 8)));
+  EXPECT_TRUE(net.has_blob(BlockedBlobName("conv3", 8)));
+  EXPECT_TRUE(net.has_layer("conv3_reorder"));
+  int reorders = 0;
+  for (int i = 0; i < net.layers().size(); ++i) {
+    if (string(net.layers()[i]->type()) == "Reorder") {
+      ++reorders;
+    }
+  }
+  // conv1 reads the plain data, so only the pooling input and the output
+  EXPECT_EQ(2, reorders);
+
+  shared_ptr<Blob<Dtype> > data =
+      static_pointer_cast<Blob<Dtype> >(net.blob_by_name("data"));
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(data.get());
+  static_pointer_cast<Blob<Dtype> >(ref_net.blob_by_name("data"))->CopyFrom(
+      *data);
+  net.Forward();
+  ref_net.Forward();
+  // Three stacked convolutions reach magnitudes in the hundreds, so the
+  // tolerance is relative
+  const Dtype delta = std::is_same<Dtype, float>::value ? 1e-3 : 1e-9;
+  const char* outputs[2] = {"conv3", "pool"};
+  for (int i = 0; i < 2; ++i) {
+    shared_ptr<Blob<Dtype> > top =
+        static_pointer_cast<Blob<Dtype> >(net.blob_by_name(outputs[i]));
+    shared_ptr<Blob<Dtype> > ref_top =
+        static_pointer_cast<Blob<Dtype> >(ref_net.blob_by_name(outputs[i]));
+    ASSERT_EQ(ref_top->shape(), top->shape());
+    for (int j = 0; j < top->count(); ++j) {
+      const Dtype ref = ref_top->cpu_data()[j];
+      EXPECT_NEAR(ref, top->cpu_data()[j],
+                  delta * std::max(Dtype(1), std::fabs(ref)));
+    }
+  }
+}
+
+// Timing only; run with --gtest_also_run_disabled_tests.
+TYPED_TEST(DirectConvolutionLayerTest, DISABLED_TestSpeedBenchmark) {
+  typedef TypeParam Dtype;
+  // A VGG-like layer
+  this->blob_bottom_->Reshape(4, 64, 56, 56);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param = this->MakeParam(3, 1, 1, 64);
+  LayerParameter direct_param = layer_param;
+  direct_param.mutable_convolution_param()->set_bottom_channel_block(8);
+  direct_param.mutable_convolution_param()->set_channel_block(8);
+  Blob<Dtype> bottom;
+  this->Reorder(this->blob_bottom_, 0, 8, &bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  DirectConvolutionLayer<Dtype, Dtype, Dtype> layer(direct_param);
+  layer.SetUp(bottom_vec, this->blob_top_vec_);
+  ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+  ref_layer.SetUp(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+  ref_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  ref_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  const int kIterations = 5;
+  CPUTimer timer;
+  // Warm up, this also packs the filters once.
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  timer.Start();
+  for (int j = 0; j < kIterations; ++j) {
+    layer.Forward(bottom_vec, this->blob_top_vec_);
+  }
+  const double direct_ms = timer.MilliSeconds() / kIterations;
+  ref_layer.Forward(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+  timer.Start();
+  for (int j = 0; j < kIterations; ++j) {
+    ref_layer.Forward(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+  }
+  const double im2col_ms = timer.MilliSeconds() / kIterations;
+  std::cout << "DIRECT NCHW8c forward: " << direct_ms << " ms" << std::endl;
+  std::cout << "im2col forward: " << im2col_ms << " ms" << std::endl;
+  Blob<Dtype> top;
+  this->Reorder(this->blob_top_, 8, 0, &top);
+  const Dtype delta = std::is_same<Dtype, float>::value ? 1e-2 : 1e-8;
+  ASSERT_EQ(this->ref_blob_top_->shape(), top.shape());
+  for (int i = 0; i < top.count(); ++i) {
+    EXPECT_NEAR(this->ref_blob_top_->cpu_data()[i], top.cpu_data()[i],
+                delta);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,267 @@
+#include <type_traits>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/winograd_conv_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class WinogradConvolutionLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  WinogradConvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 4, 13, 11)),
+        blob_top_(new Blob<Dtype>()),
+        ref_blob_top_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    ref_blob_top_vec_.push_back(ref_blob_top_);
+  }
+  virtual ~WinogradConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_top_;
+  }
+
+  LayerParameter MakeParam(int tile, int pad, int group) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_pad(pad);
+    convolution_param->set_num_output(6);
+    convolution_param->set_group(group);
+    convolution_param->set_winograd_tile(tile);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    return layer_param;
+  }
+
+  // Runs the Winograd layer and the im2col layer with the same weights on
+  // the same input, forward and backward, and compares all results.
+  void CompareToIm2col(const LayerParameter& layer_param, int tile,
+                       Dtype delta) {
+    WinogradConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_TRUE(layer.winograd());
+    EXPECT_EQ(tile, layer.tile());
+    ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+    ref_layer.SetUp(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ref_layer.Forward(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+    ASSERT_EQ(this->ref_blob_top_->shape(), this->blob_top_->shape());
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], delta);
+    }
+
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+               this->blob_top_->mutable_cpu_diff());
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_diff(),
+               this->ref_blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    Blob<Dtype> bottom_diff;
+    layer.Backward(this->blob_top_vec_, propagate_down,
+                   this->blob_bottom_vec_);
+    bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+    vector<Blob<Dtype>*> weight_diffs;
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      weight_diffs.push_back(new Blob<Dtype>());
+      weight_diffs[i]->CopyFrom(*layer.blobs()[i], true, true);
+    }
+    ref_layer.Backward(this->ref_blob_top_vec_, propagate_down,
+                       this->blob_bottom_vec_);
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(bottom_diff.cpu_diff()[i],
+                  this->blob_bottom_->cpu_diff()[i], delta);
+    }
+    for (int i = 0; i < weight_diffs.size(); ++i) {
+      for (int j = 0; j < weight_diffs[i]->count(); ++j) {
+        EXPECT_NEAR(weight_diffs[i]->cpu_diff()[j],
+                    ref_layer.blobs()[i]->cpu_diff()[j], delta);
+      }
+      delete weight_diffs[i];
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const ref_blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> ref_blob_top_vec_;
+};
+
+TYPED_TEST_CASE(WinogradConvolutionLayerTest, TestDtypesFloatNoHalf);
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestSetup) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(0, 1, 1);
+  WinogradConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_TRUE(layer.winograd());
+  EXPECT_EQ(4, layer.tile());
+  EXPECT_EQ(2, this->blob_top_->num());
+  EXPECT_EQ(6, this->blob_top_->channels());
+  EXPECT_EQ(13, this->blob_top_->height());
+  EXPECT_EQ(11, this->blob_top_->width());
+  // Small outputs use the smaller tile.
+  this->blob_bottom_->Reshape(2, 4, 6, 6);
+  layer.Reshape(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_TRUE(layer.winograd());
+  EXPECT_EQ(2, layer.tile());
+  // Strided convolution falls back to im2col.
+  layer_param.mutable_convolution_param()->add_stride(2);
+  WinogradConvolutionLayer<Dtype, Dtype, Dtype> strided_layer(layer_param);
+  strided_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_FALSE(strided_layer.winograd());
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestFactory) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(0, 1, 1);
+  layer_param.set_type("Convolution");
+  layer_param.mutable_convolution_param()->set_engine(
+      ConvolutionParameter_Engine_WINOGRAD);
+  shared_ptr<Layer<Dtype, Dtype, Dtype> > layer =
+      LayerRegistry<Dtype, Dtype, Dtype>::CreateLayer(layer_param);
+  typedef WinogradConvolutionLayer<Dtype, Dtype, Dtype> WinogradLayer;
+  EXPECT_TRUE(dynamic_cast<WinogradLayer*>(layer.get()) != NULL);
+  // The engine is opt-in
+  layer_param.mutable_convolution_param()->set_engine(
+      ConvolutionParameter_Engine_DEFAULT);
+  layer = LayerRegistry<Dtype, Dtype, Dtype>::CreateLayer(layer_param);
+  EXPECT_TRUE(dynamic_cast<WinogradLayer*>(layer.get()) == NULL);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestF2x2) {
+  const TypeParam delta = std::is_same<TypeParam, float>::value ? 1e-4 : 1e-9;
+  this->CompareToIm2col(this->MakeParam(2, 1, 1), 2, delta);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestF4x4) {
+  const TypeParam delta = std::is_same<TypeParam, float>::value ? 1e-3 : 1e-9;
+  this->CompareToIm2col(this->MakeParam(4, 1, 1), 4, delta);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestNoPadding) {
+  const TypeParam delta = std::is_same<TypeParam, float>::value ? 1e-3 : 1e-9;
+  this->CompareToIm2col(this->MakeParam(4, 0, 1), 4, delta);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestPadding2) {
+  const TypeParam delta = std::is_same<TypeParam, float>::value ? 1e-3 : 1e-9;
+  this->CompareToIm2col(this->MakeParam(4, 2, 1), 4, delta);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestGroup) {
+  const TypeParam delta = std::is_same<TypeParam, float>::value ? 1e-3 : 1e-9;
+  this->CompareToIm2col(this->MakeParam(4, 1, 2), 4, delta);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestWeightUpdate) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(2, 1, 1);
+  layer_param.mutable_convolution_param()->set_bias_term(false);
+  WinogradConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<Dtype> first(this->blob_top_->cpu_data(),
+                      this->blob_top_->cpu_data() + this->blob_top_->count());
+  // Changed weights must not be served from the cached filters.
+  caffe_scal(layer.blobs()[0]->count(), Dtype(2),
+             layer.blobs()[0]->mutable_cpu_data());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype delta = std::is_same<Dtype, float>::value ? 1e-4 : 1e-9;
+  for (int i = 0; i < first.size(); ++i) {
+    EXPECT_NEAR(2 * first[i], this->blob_top_->cpu_data()[i], delta);
+  }
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestGradient) {
+  typedef TypeParam Dtype;
+  this->blob_bottom_->Reshape(2, 3, 6, 5);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param = this->MakeParam(2, 1, 1);
+  layer_param.mutable_convolution_param()->set_num_output(2);
+  WinogradConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+// Timing only; run with --gtest_also_run_disabled_tests.
+TYPED_TEST(WinogradConvolutionLayerTest, DISABLED_TestSpeedBenchmark) {
+  typedef TypeParam Dtype;
+  // A VGG-like layer
+  this->blob_bottom_->Reshape(4, 64, 56, 56);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param = this->MakeParam(0, 1, 1);
+  layer_param.mutable_convolution_param()->set_num_output(64);
+  WinogradConvolutionLayer<Dtype, Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ConvolutionLayer<Dtype, Dtype, Dtype> ref_layer(layer_param);
+  ref_layer.SetUp(this->blob_bottom_vec_, this->ref_blob_top_vec_);
+  ref_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  ref_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  vector<bool> propagate_down(1, true);
+  const int kIterations = 5;
+  CPUTimer timer;
+  double forward_ms[2];
+  double backward_ms[2];
+  for (int i = 0; i < 2; ++i) {
+    Layer<Dtype, Dtype, Dtype>* current = i == 0 ?
+        static_cast<Layer<Dtype, Dtype, Dtype>*>(&layer) : &ref_layer;
+    vector<Blob<Dtype>*>& top = i == 0 ? this->blob_top_vec_ :
+        this->ref_blob_top_vec_;
+    // Warm up, this also transforms the filters once.
+    current->Forward(this->blob_bottom_vec_, top);
+    timer.Start();
+    for (int j = 0; j < kIterations; ++j) {
+      current->Forward(this->blob_bottom_vec_, top);
+    }
+    forward_ms[i] = timer.MilliSeconds() / kIterations;
+    timer.Start();
+    for (int j = 0; j < kIterations; ++j) {
+      current->Backward(top, propagate_down, this->blob_bottom_vec_);
+    }
+    backward_ms[i] = timer.MilliSeconds() / kIterations;
+  }
+  std::cout << "Winograd F(" << layer.tile() << "x" << layer.tile()
+            << ", 3x3) forward: " << forward_ms[0] << " ms, backward: "
+            << backward_ms[0] << " ms" << std::endl;
+  std::cout << "im2col forward: " << forward_ms[1] << " ms, backward: "
+            << backward_ms[1] << " ms" << std::endl;
+  const Dtype delta = std::is_same<Dtype, float>::value ? 1e-2 : 1e-8;
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(this->ref_blob_top_->cpu_data()[i],
+                this->blob_top_->cpu_data()[i], delta);
+  }
+}
+
+}  // namespace caffe
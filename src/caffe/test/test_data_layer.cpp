@@ -363,6 +363,183 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  void TestReadCropTrainDecodeThreads() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_crop_size(1);
+    transform_param->set_mirror(true);
+
+    // Get crop sequence with Caffe seed 1701 on a single decode thread.
+    Caffe::set_random_seed(seed_, Caffe::GetDefaultDevice());
+    vector<vector<Dtype> > crop_sequence;
+    {
+      DataLayer<Dtype, Dtype, Dtype> layer1(param);
+      layer1.SetUp(blob_bottom_vec_, blob_top_vec_);
+      for (int_tp iter = 0; iter < 2; ++iter) {
+        layer1.Forward(blob_bottom_vec_, blob_top_vec_);
+        vector<Dtype> iter_crop_sequence;
+        for (int_tp i = 0; i < 5; ++i) {
+          for (int_tp j = 0; j < 2; ++j) {
+            iter_crop_sequence.push_back(
+                blob_top_data_->cpu_data()[i * 2 + j]);
+          }
+        }
+        crop_sequence.push_back(iter_crop_sequence);
+      }
+    }  // destroy 1st data layer and unlock the db
+
+    // Get crop sequence after reseeding Caffe with 1701, with the items
+    // spread over three decode threads. Check that the sequence is the same.
+    Caffe::set_random_seed(seed_, Caffe::GetDefaultDevice());
+    data_param->set_decode_threads(3);
+    DataLayer<Dtype, Dtype, Dtype> layer2(param);
+    layer2.SetUp(blob_bottom_vec_, blob_top_vec_);
+    for (int_tp iter = 0; iter < 2; ++iter) {
+      layer2.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int_tp i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+      }
+      for (int_tp i = 0; i < 5; ++i) {
+        for (int_tp j = 0; j < 2; ++j) {
+          EXPECT_EQ(crop_sequence[iter][i * 2 + j],
+                    blob_top_data_->cpu_data()[i * 2 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  // Expects images of the same pixels, equal to the label
+  void TestShuffleBuffer() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle_buffer_size(3);
+
+    Caffe::set_random_seed(seed_, Caffe::GetDefaultDevice());
+    DataLayer<Dtype, Dtype, Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    vector<int_tp> label_count(5, 0);
+    int_tp num_in_order = 0;
+    const int_tp num_iter = 20;
+    for (int_tp iter = 0; iter < num_iter; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      bool in_order = true;
+      for (int_tp i = 0; i < 5; ++i) {
+        const int_tp label = blob_top_label_->cpu_data()[i];
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, 5);
+        ++label_count[label];
+        in_order = in_order && label == i;
+        for (int_tp j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+      num_in_order += in_order;
+    }
+    for (int_tp i = 0; i < 5; ++i) {
+      EXPECT_GT(label_count[i], 0);
+    }
+    EXPECT_LT(num_in_order, num_iter);
+  }
+
+  // With a buffer of one item, the items come in the order the ranges are
+  // read in, so every epoch is a permutation of the database.
+  void TestShuffleRanges() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle_buffer_size(1);
+    data_param->set_shuffle_ranges(2);
+
+    DataLayer<Dtype, Dtype, Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    for (int_tp iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      vector<bool> seen(5, false);
+      for (int_tp i = 0; i < 5; ++i) {
+        const int_tp label = blob_top_label_->cpu_data()[i];
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, 5);
+        EXPECT_FALSE(seen[label]) << "debug: iter " << iter << " i " << i;
+        seen[label] = true;
+      }
+    }
+  }
+
+  // Fill the DB with the same JPEG encoded image five times, labeled 0 to 4.
+  void FillEncoded(DataParameter_DB backend) {
+    backend_ = backend;
+    scoped_ptr<db::DB> db(db::GetDB(backend));
+    db->Open(*filename_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int_tp i = 0; i < 5; ++i) {
+      Datum datum;
+      CHECK(ReadImageToDatum(EXAMPLES_SOURCE_DIR "images/cat.jpg", i, 0, 0,
+                             true, "jpg", &datum));
+      stringstream ss;
+      ss << i;
+      string out;
+      CHECK(datum.SerializeToString(&out));
+      txn->Put(ss.str(), out);
+    }
+    txn->Commit();
+    db->Close();
+  }
+
+  // Later epochs of encoded items come from the decoded cache, raw items
+  // are neither looked up nor cached.
+  void TestDecodedCache(const bool encoded) {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_decoded_cache_mb(16);
+
+    DataLayer<Dtype, Dtype, Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    Blob<Dtype> expected;
+    for (int_tp iter = 0; iter < 3; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int_tp i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+      }
+      if (iter == 0) {
+        expected.CopyFrom(*blob_top_data_, false, true);
+      }
+      for (int_tp i = 0; i < expected.count(); ++i) {
+        EXPECT_EQ(expected.cpu_data()[i], blob_top_data_->cpu_data()[i]);
+      }
+    }
+    ASSERT_TRUE(layer.decoded_cache() != NULL);
+    if (encoded) {
+      EXPECT_EQ(5, layer.decoded_cache()->size());
+      EXPECT_EQ(5, layer.decoded_cache()->misses());
+      // The third batch has been loaded, the prefetch may have read more
+      EXPECT_GE(layer.decoded_cache()->hits(), 10);
+    } else {
+      EXPECT_EQ(0, layer.decoded_cache()->size());
+      EXPECT_EQ(0, layer.decoded_cache()->misses());
+      EXPECT_EQ(0, layer.decoded_cache()->hits());
+    }
+  }
+
   virtual ~DataLayerTest() { delete blob_top_data_; delete blob_top_label_; }
 
   DataParameter_DB backend_;
@@ -414,6 +591,14 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
   this->TestReadCropTrainSequenceUnseeded();
 }
 
+// Test that the sequence of random crops does not depend on the number of
+// decode threads.
+TYPED_TEST(DataLayerTest, TestReadCropTrainDecodeThreadsLevelDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadCropTrainDecodeThreads();
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTestLevelDB) {
   const bool unique_pixels = true;  // all images the same; pixels different
   this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
@@ -459,6 +644,19 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
   this->TestReadCropTrainSequenceUnseeded();
 }
 
+// Test that the sequence of random crops does not depend on the number of
+// decode threads.
+TYPED_TEST(DataLayerTest, TestReadCropTrainDecodeThreadsLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainDecodeThreads();
+}
+
+TYPED_TEST(DataLayerTest, TestShuffleBufferLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestShuffleBuffer();
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
   const bool unique_pixels = true;  // all images the same; pixels different
   this->Fill(unique_pixels, DataParameter_DB_LMDB);
@@ -466,5 +664,47 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
 }
 
 #endif  // USE_LMDB
+
+TYPED_TEST(DataLayerTest, TestReadPacked) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_PACKED);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestSkipPacked) {
+  this->Fill(false, DataParameter_DB_PACKED);
+  this->TestSkip();
+}
+
+TYPED_TEST(DataLayerTest, TestReshapePacked) {
+  this->TestReshape(DataParameter_DB_PACKED);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTrainDecodeThreadsPacked) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_PACKED);
+  this->TestReadCropTrainDecodeThreads();
+}
+
+TYPED_TEST(DataLayerTest, TestShuffleBufferPacked) {
+  this->Fill(false, DataParameter_DB_PACKED);
+  this->TestShuffleBuffer();
+}
+
+TYPED_TEST(DataLayerTest, TestShuffleRangesPacked) {
+  this->Fill(false, DataParameter_DB_PACKED);
+  this->TestShuffleRanges();
+}
+
+TYPED_TEST(DataLayerTest, TestDecodedCachePacked) {
+  this->FillEncoded(DataParameter_DB_PACKED);
+  this->TestDecodedCache(true);
+}
+
+TYPED_TEST(DataLayerTest, TestDecodedCacheRawPacked) {
+  this->Fill(false, DataParameter_DB_PACKED);
+  this->TestDecodedCache(false);
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
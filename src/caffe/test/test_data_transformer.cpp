@@ -1,4 +1,6 @@
 #ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+
 #include <string>
 #include <vector>
 
@@ -9,6 +11,7 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -70,6 +73,55 @@ class DataTransformTest : public ::testing::Test {
     return num_sequence_matches;
   }
 
+  // Checks that the fused uint8 path gives the same results as the
+  // float_data path, and as the cv::Mat path for the same image, over
+  // several random crops and mirrors.
+  void CheckFusedTransform(const TransformationParameter& transform_param) {
+    const int_tp channels = 3;
+    const int_tp height = 13;
+    const int_tp width = 21;
+    const int_tp crop_size = transform_param.crop_size();
+    Datum datum;
+    FillDatum(0, channels, height, width, true, &datum);
+    Datum float_datum;
+    float_datum.set_channels(channels);
+    float_datum.set_height(height);
+    float_datum.set_width(width);
+    for (int_tp j = 0; j < datum.data().size(); ++j) {
+      float_datum.add_float_data(static_cast<uint8_t>(datum.data()[j]));
+    }
+    cv::Mat cv_img(height, width, CV_8UC3);
+    for (int_tp h = 0; h < height; ++h) {
+      for (int_tp w = 0; w < width; ++w) {
+        for (int_tp c = 0; c < channels; ++c) {
+          cv_img.at<cv::Vec3b>(h, w)[c] =
+              datum.data()[(c * height + h) * width + w];
+        }
+      }
+    }
+    DataTransformer<Dtype> fused(transform_param, TRAIN,
+                                 Caffe::GetDefaultDevice());
+    DataTransformer<Dtype> generic(transform_param, TRAIN,
+                                   Caffe::GetDefaultDevice());
+    DataTransformer<Dtype> mat(transform_param, TRAIN,
+                               Caffe::GetDefaultDevice());
+    fused.InitRand(seed_);
+    generic.InitRand(seed_);
+    mat.InitRand(seed_);
+    Blob<Dtype> blob(1, channels, crop_size, crop_size);
+    Blob<Dtype> expected(1, channels, crop_size, crop_size);
+    Blob<Dtype> mat_blob(1, channels, crop_size, crop_size);
+    for (int_tp iter = 0; iter < num_iter_; ++iter) {
+      fused.Transform(datum, &blob);
+      generic.Transform(float_datum, &expected);
+      mat.Transform(cv_img, &mat_blob);
+      for (int_tp j = 0; j < blob.count(); ++j) {
+        EXPECT_EQ(expected.cpu_data()[j], blob.cpu_data()[j]);
+        EXPECT_EQ(expected.cpu_data()[j], mat_blob.cpu_data()[j]);
+      }
+    }
+  }
+
   int_tp seed_;
   int_tp num_iter_;
 };
@@ -348,5 +400,115 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestFusedMeanValues) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(11);
+  transform_param.set_mirror(true);
+  transform_param.set_scale(0.5);
+  transform_param.add_mean_value(3);
+  transform_param.add_mean_value(1);
+  transform_param.add_mean_value(2);
+  this->CheckFusedTransform(transform_param);
+}
+
+TYPED_TEST(DataTransformTest, TestFusedMeanFile) {
+  const int_tp channels = 3;
+  const int_tp height = 13;
+  const int_tp width = 21;
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(height);
+  blob_mean.set_width(width);
+  for (int_tp j = 0; j < channels * height * width; ++j) {
+    blob_mean.add_data(j % 7);
+  }
+  WriteProtoToBinaryFile(blob_mean, mean_file);
+
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(9);
+  transform_param.set_mirror(true);
+  transform_param.set_scale(0.25);
+  transform_param.set_mean_file(mean_file);
+  this->CheckFusedTransform(transform_param);
+}
+
+// The per element loop the uint8 Datum path used before it was fused, with
+// the mean values and a center crop.
+void PerElementTransform(const Datum& datum, const int_tp crop_size,
+                         const bool do_mirror, const float scale,
+                         const vector<float>& mean_values, float* out) {
+  const string& data = datum.data();
+  const int_tp datum_height = datum.height();
+  const int_tp datum_width = datum.width();
+  const int_tp h_off = (datum_height - crop_size) / 2;
+  const int_tp w_off = (datum_width - crop_size) / 2;
+  float datum_element;
+  int_tp top_index, data_index;
+  for (int_tp c = 0; c < datum.channels(); ++c) {
+    for (int_tp h = 0; h < crop_size; ++h) {
+      for (int_tp w = 0; w < crop_size; ++w) {
+        data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
+        if (do_mirror) {
+          top_index = (c * crop_size + h) * crop_size + (crop_size - 1 - w);
+        } else {
+          top_index = (c * crop_size + h) * crop_size + w;
+        }
+        datum_element =
+            static_cast<float>(static_cast<uint8_t>(data[data_index]));
+        out[top_index] = (datum_element - mean_values[c]) * scale;
+      }
+    }
+  }
+}
+
+// Timing only; run with --gtest_also_run_disabled_tests.
+TEST(DataTransformBenchmarkTest, DISABLED_TestFusedBenchmark) {
+  // ImageNet sized input with the usual training transformation
+  const int_tp channels = 3;
+  const int_tp size = 256;
+  const int_tp crop_size = 227;
+  const int_tp num_iter = 100;
+  const float scale = 0.017;
+  vector<float> mean_values;
+  mean_values.push_back(104);
+  mean_values.push_back(117);
+  mean_values.push_back(123);
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  transform_param.set_scale(scale);
+  for (int_tp c = 0; c < channels; ++c) {
+    transform_param.add_mean_value(mean_values[c]);
+  }
+  Datum datum;
+  FillDatum(0, channels, size, size, true, &datum);
+  DataTransformer<float> transformer(transform_param, TRAIN,
+                                     Caffe::GetDefaultDevice());
+  transformer.InitRand(1701);
+  Blob<float> blob(1, channels, crop_size, crop_size);
+
+  CPUTimer timer;
+  timer.Start();
+  for (int_tp iter = 0; iter < num_iter; ++iter) {
+    PerElementTransform(datum, crop_size, iter % 2, scale, mean_values,
+                        blob.mutable_cpu_data());
+  }
+  timer.Stop();
+  std::cout << "Per element uint8 transform (" << channels << "x" << size
+            << "x" << size << ", crop " << crop_size << ") time is: "
+            << timer.MilliSeconds() / num_iter << " ms" << std::endl;
+
+  timer.Start();
+  for (int_tp iter = 0; iter < num_iter; ++iter) {
+    transformer.Transform(datum, &blob);
+  }
+  timer.Stop();
+  std::cout << "Fused uint8 transform time is: "
+            << timer.MilliSeconds() / num_iter << " ms" << std::endl;
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
@@ -7,6 +7,8 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_packed.hpp"
+#include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -49,8 +51,9 @@ class DBTest : public ::testing::Test {
 
 DataParameter_DB TypeLevelDB::backend = DataParameter_DB_LEVELDB;
 DataParameter_DB TypeLMDB::backend = DataParameter_DB_LMDB;
+DataParameter_DB TypePacked::backend = DataParameter_DB_PACKED;
 
-typedef ::testing::Types<TypeLevelDB, TypeLMDB> TestTypes;
+typedef ::testing::Types<TypeLevelDB, TypeLMDB, TypePacked> TestTypes;
 
 TYPED_TEST_CASE(DBTest, TestTypes);
 
@@ -109,6 +112,57 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestValueView) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  EXPECT_TRUE(cursor->valid());
+  const string value = cursor->value();
+  const char* data;
+  size_t size;
+  cursor->value(&data, &size);
+  EXPECT_EQ(value, string(data, size));
+  DatumView datum;
+  EXPECT_TRUE(ParseDatumView(data, size, &datum));
+  EXPECT_EQ(datum.channels, 3);
+  EXPECT_EQ(datum.height, 360);
+  EXPECT_EQ(datum.width, 480);
+  EXPECT_EQ(datum.label, 0);
+  EXPECT_EQ(datum.data_size, 3 * 360 * 480);
+  // The view points into the value
+  const int_tp offset = datum.data - data;
+  EXPECT_GE(offset, 0);
+  EXPECT_LE(offset + static_cast<int_tp>(datum.data_size),
+            static_cast<int_tp>(size));
+  cursor->Next();
+  if (cursor->stable_values()) {
+    EXPECT_EQ(value, string(data, size));
+  }
+  cursor->value(&data, &size);
+  EXPECT_EQ(cursor->value(), string(data, size));
+}
+
+TYPED_TEST(DBTest, TestRandomAccess) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  if (!cursor->random_access()) {
+    return;
+  }
+  EXPECT_EQ(2, cursor->num_records());
+  cursor->Seek(1);
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ("fish-bike.jpg", cursor->key());
+  Datum datum;
+  datum.ParseFromString(cursor->value());
+  EXPECT_EQ(datum.label(), 1);
+  EXPECT_EQ(datum.height(), 323);
+  cursor->Seek(0);
+  EXPECT_EQ("cat.jpg", cursor->key());
+  cursor->Seek(2);
+  EXPECT_FALSE(cursor->valid());
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
@@ -124,5 +178,81 @@ TYPED_TEST(DBTest, TestWrite) {
   txn->Commit();
 }
 
+TYPED_TEST(DBTest, TestAppend) {
+  {
+    scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+    db->Open(this->source_, db::WRITE);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    Datum datum;
+    ReadImageToDatum(this->root_images_ + "cat.jpg", 2, &datum);
+    string out;
+    CHECK(datum.SerializeToString(&out));
+    txn->Put("cat2.jpg", out);
+    txn->Commit();
+  }
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  int_tp count = 0;
+  for (; cursor->valid(); cursor->Next()) {
+    Datum datum;
+    EXPECT_TRUE(datum.ParseFromString(cursor->value()));
+    ++count;
+  }
+  EXPECT_EQ(3, count);
+}
+
+class PackedDBTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempFilename(&source_);
+  }
+
+  // Writes count records of the given size, and label i for record i
+  void Fill(int_tp count, int_tp size) {
+    db::PackedDB db;
+    db.Open(source_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db.NewTransaction());
+    for (int_tp i = 0; i < count; ++i) {
+      txn->Put(format_int(i, 4), string(size, static_cast<char>(i)));
+    }
+    txn->Commit();
+  }
+
+  string source_;
+};
+
+TEST_F(PackedDBTest, TestFixedStride) {
+  Fill(5, 7);
+  db::PackedDB db;
+  db.Open(source_, db::READ);
+  scoped_ptr<db::PackedCursor> cursor(db.NewCursor());
+  EXPECT_TRUE(cursor->stable_values());
+  const char* data[5];
+  size_t size;
+  // Visit the records out of order, values stay valid
+  for (int_tp i = 4; i >= 0; --i) {
+    cursor->Seek(i);
+    EXPECT_EQ(format_int(i, 4), cursor->key());
+    cursor->value(&data[i], &size);
+    EXPECT_EQ(7, size);
+  }
+  for (int_tp i = 0; i < 5; ++i) {
+    EXPECT_EQ(string(7, static_cast<char>(i)), string(data[i], 7));
+    if (i > 0) {
+      EXPECT_EQ(data[i - 1] + 7, data[i]);
+    }
+  }
+}
+
+TEST_F(PackedDBTest, TestEmpty) {
+  Fill(0, 0);
+  db::PackedDB db;
+  db.Open(source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db.NewCursor());
+  EXPECT_FALSE(cursor->valid());
+  EXPECT_EQ(0, cursor->num_records());
+}
+
 }  // namespace caffe
 #endif  // USE_LEVELDB, USE_LMDB and USE_OPENCV
@@ -0,0 +1,72 @@
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/decoded_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DecodedCacheTest : public ::testing::Test {
+ protected:
+  // 10x10 color image of 300 bytes
+  cv::Mat MakeImage(uchar value) {
+    cv::Mat image(10, 10, CV_8UC3);
+    image.setTo(cv::Scalar::all(value));
+    return image;
+  }
+};
+
+TEST_F(DecodedCacheTest, TestLookup) {
+  DecodedCache cache(1000);
+  cv::Mat image;
+  int_tp label;
+  EXPECT_FALSE(cache.Lookup("a", &image, &label));
+  cache.Insert("a", MakeImage(1), 7);
+  ASSERT_TRUE(cache.Lookup("a", &image, &label));
+  EXPECT_EQ(7, label);
+  EXPECT_EQ(1, image.at<cv::Vec3b>(9, 9)[2]);
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(1, cache.misses());
+  EXPECT_DOUBLE_EQ(0.5, cache.hit_rate());
+  EXPECT_EQ(300, cache.bytes());
+  EXPECT_EQ(1, cache.size());
+}
+
+TEST_F(DecodedCacheTest, TestEvictLeastRecentlyUsed) {
+  DecodedCache cache(700);
+  cv::Mat image;
+  int_tp label;
+  cache.Insert("a", MakeImage(1), 0);
+  cache.Insert("b", MakeImage(2), 1);
+  // Use a, so that b is evicted for c
+  ASSERT_TRUE(cache.Lookup("a", &image, &label));
+  cache.Insert("c", MakeImage(3), 2);
+  EXPECT_EQ(2, cache.size());
+  EXPECT_EQ(600, cache.bytes());
+  EXPECT_TRUE(cache.Lookup("a", &image, &label));
+  EXPECT_FALSE(cache.Lookup("b", &image, &label));
+  EXPECT_TRUE(cache.Lookup("c", &image, &label));
+  EXPECT_EQ(3, image.at<cv::Vec3b>(0, 0)[0]);
+  // Images larger than the cache are not kept
+  cache.Insert("d", cv::Mat(20, 20, CV_8UC3), 3);
+  EXPECT_FALSE(cache.Lookup("d", &image, &label));
+  EXPECT_EQ(2, cache.size());
+}
+
+TEST_F(DecodedCacheTest, TestShared) {
+  shared_ptr<DecodedCache> cache = DecodedCache::Shared("test source", 1000);
+  EXPECT_TRUE(cache == DecodedCache::Shared("test source", 2000));
+  EXPECT_TRUE(cache != DecodedCache::Shared("other source", 1000));
+  EXPECT_EQ(1000, cache->capacity());
+  cache.reset();
+  EXPECT_EQ(2000, DecodedCache::Shared("test source", 2000)->capacity());
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FuseLayersTest : public ::testing::Test {
+ protected:
+  void RunFusionTest(const string& input_param_string,
+                     const string& output_param_string,
+                     int num_folded = 0) {
+    // Test that FuseLayers called on the proto specified by
+    // input_param_string results in the proto specified by
+    // output_param_string.
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    map<string, vector<LayerParameter> > folded_layers;
+    FuseLayers(input_param, &actual_output_param, &folded_layers);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+    int folded = 0;
+    for (map<string, vector<LayerParameter> >::const_iterator it =
+         folded_layers.begin(); it != folded_layers.end(); ++it) {
+      folded += it->second.size();
+    }
+    EXPECT_EQ(num_folded, folded);
+    // Also test idempotence.
+    NetParameter double_fused_param;
+    map<string, vector<LayerParameter> > double_folded_layers;
+    FuseLayers(actual_output_param, &double_fused_param,
+               &double_folded_layers);
+    EXPECT_EQ(actual_output_param.DebugString(),
+        double_fused_param.DebugString());
+    EXPECT_TRUE(double_folded_layers.empty());
+  }
+};
+
+TEST_F(FuseLayersTest, TestTrainPhase) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TRAIN } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv' } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'conv' top: 'conv' } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'conv' top: 'conv' } ";
+  this->RunFusionTest(input_proto, input_proto);
+}
+
+TEST_F(FuseLayersTest, TestNotEnabled) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv' } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'conv' top: 'conv' } ";
+  this->RunFusionTest(input_proto, input_proto);
+}
+
+TEST_F(FuseLayersTest, TestFoldBatchNormScale) {
+  // The default engine does not fuse the ReLU.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv' convolution_param { bias_term: false } } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'conv' top: 'bn' } "
+      "layer { name: 'scale' type: 'Scale' bottom: 'bn' top: 'bn' "
+      "  scale_param { bias_term: true } } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'bn' top: 'bn' } ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  top: 'bn' convolution_param { bias_term: true } } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'bn' top: 'bn' } ";
+  this->RunFusionTest(input_proto, expected_output_proto, 2);
+}
+
+TEST_F(FuseLayersTest, TestFuseReLU) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv' convolution_param { engine: DIRECT } } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'conv' top: 'conv' } "
+      "layer { name: 'scale' type: 'Scale' bottom: 'conv' top: 'conv' } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'conv' top: 'conv' "
+      "  relu_param { negative_slope: 0.5 } } "
+      "layer { name: 'drop' type: 'Dropout' bottom: 'conv' top: 'conv' } "
+      "layer { name: 'pool' type: 'Pooling' bottom: 'conv' top: 'pool' } ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv' convolution_param { engine: DIRECT bias_term: true "
+      "  fuse_type: FUSED_CONV_RELU "
+      "  relu_param { negative_slope: 0.5 } } } "
+      "layer { name: 'pool' type: 'Pooling' bottom: 'conv' top: 'pool' } ";
+  this->RunFusionTest(input_proto, expected_output_proto, 2);
+}
+
+TEST_F(FuseLayersTest, TestFuseEltwiseReLU) {
+  // A residual block, the summand is computed after the convolution.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv' convolution_param { engine: DIRECT } } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'conv' top: 'conv' } "
+      "layer { name: 'shortcut' type: 'Pooling' bottom: 'data' "
+      "  top: 'shortcut' } "
+      "layer { name: 'sum' type: 'Eltwise' bottom: 'shortcut' "
+      "  bottom: 'conv' top: 'sum' } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'sum' top: 'sum' } ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'shortcut' type: 'Pooling' bottom: 'data' "
+      "  top: 'shortcut' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  bottom: 'shortcut' top: 'sum' convolution_param { engine: DIRECT "
+      "  bias_term: true fuse_type: FUSED_CONV_ELTWISE_RELU "
+      "  eltwise_param { } relu_param { } } } ";
+  this->RunFusionTest(input_proto, expected_output_proto, 1);
+}
+
+TEST_F(FuseLayersTest, TestNoFusionOfSharedBlobs) {
+  // The convolution output is read twice, and the ReLU is not in place.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv' convolution_param { engine: DIRECT } } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'conv' top: 'relu' } "
+      "layer { name: 'pool' type: 'Pooling' bottom: 'conv' top: 'pool' } ";
+  this->RunFusionTest(input_proto, input_proto);
+}
+
+TEST_F(FuseLayersTest, TestRemoveSplit) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'split' type: 'Split' bottom: 'data' top: 'copy' } "
+      "layer { name: 'pool' type: 'Pooling' bottom: 'copy' top: 'pool' } "
+      "layer { name: 'out' type: 'Split' bottom: 'pool' top: 'out' } ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "fuse_layers: true "
+      "state { phase: TEST } "
+      "layer { name: 'data' type: 'Input' top: 'data' } "
+      "layer { name: 'pool' type: 'Pooling' bottom: 'data' top: 'pool' } "
+      "layer { name: 'out' type: 'Split' bottom: 'pool' top: 'out' } ";
+  this->RunFusionTest(input_proto, expected_output_proto);
+}
+
+template <typename Dtype>
+class FusedNetTest : public CPUDeviceTest<Dtype> {
+ protected:
+  // A convolution with BatchNorm, Scale and ReLU, a residual block and a
+  // convolution with only BatchNorm and Scale on the default engine.
+  string NetProto(bool fuse_layers) {
+    const string conv_param =
+        "num_output: 16 kernel_size: 3 pad: 1 bias_term: false "
+        "weight_filler { type: 'gaussian' std: 0.1 } ";
+    return string("name: 'TestNetwork' state { phase: TEST } ") +
+        (fuse_layers ? "fuse_layers: true " : "") +
+        "layer { name: 'data' type: 'Input' top: 'data' "
+        "  input_param { shape { dim: 2 dim: 16 dim: 9 dim: 9 } } } "
+        "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+        "  top: 'conv1' convolution_param { engine: DIRECT " + conv_param +
+        "  } } "
+        "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' "
+        "  top: 'conv1' } "
+        "layer { name: 'scale1' type: 'Scale' bottom: 'conv1' top: 'conv1' "
+        "  scale_param { bias_term: true } } "
+        "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+        "layer { name: 'conv2' type: 'Convolution' bottom: 'conv1' "
+        "  top: 'conv2' convolution_param { engine: DIRECT " + conv_param +
+        "  } } "
+        "layer { name: 'bn2' type: 'BatchNorm' bottom: 'conv2' "
+        "  top: 'conv2' } "
+        "layer { name: 'scale2' type: 'Scale' bottom: 'conv2' top: 'conv2' "
+        "  scale_param { bias_term: true } } "
+        "layer { name: 'sum' type: 'Eltwise' bottom: 'conv2' "
+        "  bottom: 'conv1' top: 'sum' } "
+        "layer { name: 'relu2' type: 'ReLU' bottom: 'sum' top: 'sum' } "
+        "layer { name: 'drop' type: 'Dropout' bottom: 'sum' top: 'sum' } "
+        "layer { name: 'conv3' type: 'Convolution' bottom: 'sum' "
+        "  top: 'conv3' convolution_param { engine: CAFFE " + conv_param +
+        "  } } "
+        "layer { name: 'bn3' type: 'BatchNorm' bottom: 'conv3' "
+        "  top: 'bn3' } "
+        "layer { name: 'scale3' type: 'Scale' bottom: 'bn3' top: 'out' "
+        "  scale_param { bias_term: true } } ";
+  }
+
+  shared_ptr<Net<Dtype> > CreateNet(bool fuse_layers) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        NetProto(fuse_layers), &param));
+    return shared_ptr<Net<Dtype> >(
+        new Net<Dtype>(param, Caffe::GetDefaultDevice()));
+  }
+
+  shared_ptr<Blob<Dtype> > NetBlob(const Net<Dtype>& net,
+                                   const string& name) {
+    return static_pointer_cast<Blob<Dtype> >(net.blob_by_name(name));
+  }
+
+  void Fill(Blob<Dtype>* blob, Dtype min, Dtype max) {
+    FillerParameter filler_param;
+    filler_param.set_min(min);
+    filler_param.set_max(max);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob);
+  }
+
+  void ExpectNear(const Blob<Dtype>& ref, const Blob<Dtype>& blob) {
+    ASSERT_EQ(ref.shape(), blob.shape());
+    const Dtype delta = std::is_same<Dtype, float>::value ? 1e-4 : 1e-10;
+    for (int i = 0; i < ref.count(); ++i) {
+      EXPECT_NEAR(ref.cpu_data()[i], blob.cpu_data()[i],
+                  delta * std::max(Dtype(1), std::fabs(ref.cpu_data()[i])));
+    }
+  }
+};
+
+TYPED_TEST_CASE(FusedNetTest, TestDtypesFloatNoHalf);
+
+TYPED_TEST(FusedNetTest, TestFusedForward) {
+  typedef TypeParam Dtype;
+  shared_ptr<Net<Dtype> > net = this->CreateNet(false);
+  // Trained statistics, scales and shifts
+  for (int i = 1; i <= 3; ++i) {
+    std::ostringstream index;
+    index << i;
+    const vector<shared_ptr<BlobBase> >& bn_blobs =
+        net->layer_by_name("bn" + index.str())->blob_bases();
+    this->Fill(static_cast<Blob<Dtype>*>(bn_blobs[0].get()), -1, 1);
+    this->Fill(static_cast<Blob<Dtype>*>(bn_blobs[1].get()), 0.5, 2);
+    static_cast<Blob<Dtype>*>(bn_blobs[2].get())->mutable_cpu_data()[0] = 2;
+    const vector<shared_ptr<BlobBase> >& scale_blobs =
+        net->layer_by_name("scale" + index.str())->blob_bases();
+    this->Fill(static_cast<Blob<Dtype>*>(scale_blobs[0].get()), 0.5, 2);
+    this->Fill(static_cast<Blob<Dtype>*>(scale_blobs[1].get()), -1, 1);
+  }
+  NetParameter weights;
+  net->ToProto(&weights);
+
+  shared_ptr<Net<Dtype> > fused_net = this->CreateNet(true);
+  fused_net->CopyTrainedLayersFrom(weights);
+  const char* removed[5] = {"BatchNorm", "Scale", "ReLU", "Eltwise",
+                            "Dropout"};
+  for (int i = 0; i < fused_net->layers().size(); ++i) {
+    for (int j = 0; j < 5; ++j) {
+      EXPECT_NE(string(removed[j]), fused_net->layers()[i]->type());
+    }
+  }
+  EXPECT_FALSE(fused_net->has_blob("bn3"));
+
+  shared_ptr<Blob<Dtype> > data = this->NetBlob(*net, "data");
+  this->Fill(data.get(), -1, 1);
+  this->NetBlob(*fused_net, "data")->CopyFrom(*data);
+  net->Forward();
+  fused_net->Forward();
+  this->ExpectNear(*this->NetBlob(*net, "out"),
+                   *this->NetBlob(*fused_net, "out"));
+
+  // The fused net writes the folded weights, which load into a fused net
+  // without folding them again.
+  NetParameter fused_weights;
+  fused_net->ToProto(&fused_weights);
+  EXPECT_EQ(2, fused_net->layer_by_name("conv1")->blob_bases().size());
+  shared_ptr<Net<Dtype> > reloaded_net = this->CreateNet(true);
+  reloaded_net->CopyTrainedLayersFrom(fused_weights);
+  this->NetBlob(*reloaded_net, "data")->CopyFrom(*data);
+  reloaded_net->Forward();
+  this->ExpectNear(*this->NetBlob(*net, "out"),
+                   *this->NetBlob(*reloaded_net, "out"));
+}
+
+}  // namespace caffe
@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <cmath>
+#include <iostream>
 #include <memory>
 #include <string>
 #include <utility>
@@ -12,6 +14,7 @@
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/sgd_solvers.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -27,7 +30,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), flat_(false) {
         input_file_ = new string(
         ABS_TEST_DATA_DIR "/solver_data_list.txt");
       }
@@ -45,6 +48,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool flat_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -99,6 +103,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "iter_size: " << iter_size << " "
        "device_id: " << device_id << " "
        "layer_wise_reduce: " << (!share_) << " "
+       "flat_update: " << flat_ << " "
        "net_param { "
        "  name: 'TestNetwork' "
        "  layer { "
@@ -208,6 +213,12 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO) << "Multi-worker CPU test on " << devices << " workers";
+      Caffe::set_solver_count(devices);
+      CPUSync<Dtype> sync(this->solver_);
+      sync.Run(from_snapshot);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO)<< "Multi-GPU test on " << devices << " devices";
       vector<Device*> gpus;
@@ -515,6 +526,10 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
 #endif  // USE_NCCL
 #endif  // USE_CUDA
+    // Solvers running on the CPU use worker threads instead of devices
+    if (Caffe::mode() == Caffe::CPU && !std::is_same<Dtype, half_fp>::value) {
+      available_devices = 3;
+    }
     // Takes a while to test all sizes for each test so sparse
     vector<int> sizes;
     sizes.push_back(1);
@@ -714,6 +729,18 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->flat_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -737,6 +764,18 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
       kIterSize);
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccumFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->flat_ = true;
+  this->CheckAccumulation(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -760,6 +799,18 @@ TYPED_TEST(SGDSolverTest, TestSnapshot) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSnapshotFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->flat_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -814,6 +865,19 @@ TYPED_TEST(AdaGradSolverTest, TestAdaGradLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdaGradSolverTest,
+    TestAdaGradLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  this->flat_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdaGradSolverTest,
     TestAdaGradLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
@@ -948,6 +1012,19 @@ TYPED_TEST(NesterovSolverTest, TestNesterovLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(NesterovSolverTest,
+    TestNesterovLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->flat_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(NesterovSolverTest,
     TestNesterovLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
@@ -1078,6 +1155,19 @@ TYPED_TEST(AdaDeltaSolverTest, TestAdaDeltaLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdaDeltaSolverTest,
+    TestAdaDeltaLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  this->flat_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdaDeltaSolverTest,
     TestAdaDeltaLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
@@ -1182,6 +1272,18 @@ TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->flat_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1228,6 +1330,18 @@ TYPED_TEST(AdamSolverTest, TestSnapshot) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestSnapshotFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->flat_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdamSolverTest, TestSnapshotShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1285,6 +1399,19 @@ TYPED_TEST(RMSPropSolverTest, TestRMSPropLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(RMSPropSolverTest,
+    TestRMSPropLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.0;
+  const int kNumIters = 4;
+  this->flat_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(RMSPropSolverTest,
     TestRMSPropLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
@@ -1344,4 +1471,283 @@ TYPED_TEST(RMSPropSolverTest, TestSnapshotShare) {
   }
 }
 
+// Exposes ApplyUpdate, to compare and time updates without the net
+template <typename SolverType>
+class UpdateOnlySolver : public SolverType {
+ public:
+  UpdateOnlySolver(const SolverParameter& param, Device* dev)
+      : SolverType(param, dev) {
+  }
+  void Update() {
+    this->ApplyUpdate();
+  }
+};
+
+template <typename Dtype>
+class FlatUpdateTest : public CPUDeviceTest<Dtype> {
+ protected:
+  // Many small parameter blobs with different multipliers, as in deep nets
+  SolverParameter MakeParam(bool flat, Dtype momentum, int num_layers,
+                            int num_output) {
+    ostringstream proto;
+    proto << "base_lr: 0.01 lr_policy: 'fixed' weight_decay: 0.001 "
+          << "clip_gradients: 1 iter_size: 2 random_seed: 1701 "
+          << "momentum: " << momentum << " flat_update: " << flat << " "
+          << "net_param { name: 'TestNetwork' "
+          << "  layer { name: 'data' type: 'DummyData' top: 'ip0' "
+          << "    dummy_data_param { shape { dim: 1 dim: " << num_output
+          << "    } } } ";
+    for (int i = 1; i <= num_layers; ++i) {
+      proto << "  layer { name: 'ip" << i << "' type: 'InnerProduct' "
+            << "    bottom: 'ip" << i - 1 << "' top: 'ip" << i << "' "
+            << "    param { lr_mult: 1 decay_mult: 1 } "
+            << "    param { lr_mult: 2 decay_mult: 0 } "
+            << "    inner_product_param { num_output: " << num_output
+            << "      weight_filler { type: 'gaussian' std: 0.1 } "
+            << "      bias_filler { type: 'gaussian' std: 0.1 } } } ";
+    }
+    proto << "} ";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+    return param;
+  }
+
+  void FillGradients(Net<Dtype>* net, int iter) {
+    const vector<BlobBase*>& params = net->learnable_params();
+    for (int i = 0; i < params.size(); ++i) {
+      Dtype* diff = static_cast<Blob<Dtype>*>(params[i])->mutable_cpu_diff();
+      for (int j = 0; j < params[i]->count(); ++j) {
+        diff[j] = 0.1 * std::sin(0.37 * i + 0.11 * j + iter);
+      }
+    }
+  }
+
+  // Checks the flat update computes the same parameters and history as the
+  // update per parameter blob
+  template <typename SolverType>
+  void CheckFlatUpdate(Dtype momentum) {
+    shared_ptr<UpdateOnlySolver<SolverType> > solvers[2];
+    for (int flat = 0; flat < 2; ++flat) {
+      solvers[flat].reset(new UpdateOnlySolver<SolverType>(
+          MakeParam(flat, momentum, 3, 16), Caffe::GetDefaultDevice()));
+    }
+    for (int iter = 0; iter < 5; ++iter) {
+      for (int flat = 0; flat < 2; ++flat) {
+        FillGradients(solvers[flat]->net().get(), iter);
+        solvers[flat]->Update();
+      }
+    }
+    const vector<BlobBase*>& params = solvers[0]->net()->learnable_params();
+    const vector<BlobBase*>& flat_params =
+        solvers[1]->net()->learnable_params();
+    ASSERT_EQ(params.size(), flat_params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      const Blob<Dtype>* param = static_cast<Blob<Dtype>*>(params[i]);
+      const Blob<Dtype>* flat_param = static_cast<Blob<Dtype>*>(flat_params[i]);
+      for (int j = 0; j < param->count(); ++j) {
+        EXPECT_NEAR(param->cpu_data()[j], flat_param->cpu_data()[j],
+                    1e-5 + 1e-4 * fabs(param->cpu_data()[j]));
+        EXPECT_NEAR(param->cpu_diff()[j], flat_param->cpu_diff()[j],
+                    1e-5 + 1e-4 * fabs(param->cpu_diff()[j]));
+      }
+    }
+    const vector<shared_ptr<Blob<Dtype> > >& history = solvers[0]->history();
+    const vector<shared_ptr<Blob<Dtype> > >& flat_history =
+        solvers[1]->history();
+    ASSERT_EQ(history.size(), flat_history.size());
+    for (int i = 0; i < history.size(); ++i) {
+      for (int j = 0; j < history[i]->count(); ++j) {
+        EXPECT_NEAR(history[i]->cpu_data()[j], flat_history[i]->cpu_data()[j],
+                    1e-5 + 1e-4 * fabs(history[i]->cpu_data()[j]));
+      }
+    }
+  }
+
+  // Times the update per parameter blob and the flat update of a net with
+  // 200 parameter blobs
+  template <typename SolverType>
+  void TimeFlatUpdate(Dtype momentum) {
+    const int kIterations = 20;
+    double ms[2];
+    string type;
+    for (int flat = 0; flat < 2; ++flat) {
+      UpdateOnlySolver<SolverType> solver(MakeParam(flat, momentum, 100, 64),
+                                          Caffe::GetDefaultDevice());
+      type = solver.type();
+      FillGradients(solver.net().get(), 0);
+      solver.Update();
+      CPUTimer timer;
+      timer.Start();
+      for (int iter = 0; iter < kIterations; ++iter) {
+        solver.Update();
+      }
+      ms[flat] = timer.MilliSeconds() / kIterations;
+    }
+    std::cout << type << " update per parameter blob: " << ms[0] << " ms, "
+              << "flat update: " << ms[1] << " ms" << std::endl;
+  }
+};
+
+TYPED_TEST_CASE(FlatUpdateTest, TestDtypesFloatNoHalf);
+
+TYPED_TEST(FlatUpdateTest, TestSGD) {
+  this->template CheckFlatUpdate<SGDSolver<TypeParam> >(0.9);
+}
+
+TYPED_TEST(FlatUpdateTest, TestNesterov) {
+  this->template CheckFlatUpdate<NesterovSolver<TypeParam> >(0.9);
+}
+
+TYPED_TEST(FlatUpdateTest, TestAdaGrad) {
+  this->template CheckFlatUpdate<AdaGradSolver<TypeParam> >(0);
+}
+
+TYPED_TEST(FlatUpdateTest, TestRMSProp) {
+  this->template CheckFlatUpdate<RMSPropSolver<TypeParam> >(0);
+}
+
+TYPED_TEST(FlatUpdateTest, TestAdaDelta) {
+  this->template CheckFlatUpdate<AdaDeltaSolver<TypeParam> >(0.95);
+}
+
+TYPED_TEST(FlatUpdateTest, TestAdam) {
+  this->template CheckFlatUpdate<AdamSolver<TypeParam> >(0.9);
+}
+
+// Timing only; run with --gtest_also_run_disabled_tests.
+TYPED_TEST(FlatUpdateTest, DISABLED_TestSGDBenchmark) {
+  this->template TimeFlatUpdate<SGDSolver<TypeParam> >(0.9);
+}
+
+TYPED_TEST(FlatUpdateTest, DISABLED_TestNesterovBenchmark) {
+  this->template TimeFlatUpdate<NesterovSolver<TypeParam> >(0.9);
+}
+
+TYPED_TEST(FlatUpdateTest, DISABLED_TestAdaGradBenchmark) {
+  this->template TimeFlatUpdate<AdaGradSolver<TypeParam> >(0);
+}
+
+TYPED_TEST(FlatUpdateTest, DISABLED_TestRMSPropBenchmark) {
+  this->template TimeFlatUpdate<RMSPropSolver<TypeParam> >(0);
+}
+
+TYPED_TEST(FlatUpdateTest, DISABLED_TestAdaDeltaBenchmark) {
+  this->template TimeFlatUpdate<AdaDeltaSolver<TypeParam> >(0.95);
+}
+
+TYPED_TEST(FlatUpdateTest, DISABLED_TestAdamBenchmark) {
+  this->template TimeFlatUpdate<AdamSolver<TypeParam> >(0.9);
+}
+
+#ifdef USE_HALF
+template <typename Dtype>
+class MixedPrecisionTest : public CPUDeviceTest<Dtype> {
+ protected:
+  // Constant data and initial weights, the same in float and half_fp
+  shared_ptr<SGDSolver<Dtype> > Train(const string& mixed_param, int iters) {
+    const string proto =
+        "base_lr: 0.01 lr_policy: 'fixed' momentum: 0.9 weight_decay: 0.001 "
+        "random_seed: 1701 solver_mode: CPU "
+        "net_param { name: 'TestNetwork' "
+        "  layer { name: 'data' type: 'DummyData' top: 'data' top: 'targets' "
+        "    dummy_data_param { shape { dim: 4 dim: 5 } shape { dim: 4 } "
+        "      data_filler { type: 'constant' value: 0.5 } "
+        "      data_filler { type: 'constant' value: 1.0 } } } "
+        "  layer { name: 'innerprod' type: 'InnerProduct' bottom: 'data' "
+        "    top: 'innerprod' inner_product_param { num_output: 1 "
+        "      weight_filler { type: 'constant' value: 0.1 } "
+        "      bias_filler { type: 'constant' value: 0.2 } } } "
+        "  layer { name: 'loss' type: 'EuclideanLoss' bottom: 'innerprod' "
+        "    bottom: 'targets' } } " + mixed_param;
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    shared_ptr<SGDSolver<Dtype> > solver(
+        new SGDSolver<Dtype>(param, Caffe::GetDefaultDevice()));
+    solver->Step(iters);
+    return solver;
+  }
+
+  vector<Dtype> Weights(SGDSolver<Dtype>* solver) {
+    const vector<BlobBase*>& params = solver->net()->learnable_params();
+    vector<Dtype> weights;
+    for (int i = 0; i < params.size(); ++i) {
+      vector<Dtype> values(params[i]->count());
+      params[i]->cpu_data(&values[0]);
+      weights.insert(weights.end(), values.begin(), values.end());
+    }
+    return weights;
+  }
+};
+
+TYPED_TEST_CASE(MixedPrecisionTest, TestDtypesFloatNoHalf);
+
+TYPED_TEST(MixedPrecisionTest, TestMatchesFullPrecision) {
+  shared_ptr<SGDSolver<TypeParam> > solver = this->Train("", 10);
+  shared_ptr<SGDSolver<TypeParam> > mixed_solver =
+      this->Train("mixed_precision: true loss_scale_window: 0", 10);
+  EXPECT_EQ(mixed_solver->net()->learnable_params()[0]->data_type(), HALF);
+  EXPECT_EQ(mixed_solver->skipped_updates(), 0);
+  const vector<TypeParam> weights = this->Weights(solver.get());
+  const vector<TypeParam> mixed_weights = this->Weights(mixed_solver.get());
+  ASSERT_EQ(weights.size(), mixed_weights.size());
+  for (int i = 0; i < weights.size(); ++i) {
+    EXPECT_NE(weights[i], TypeParam(i < 5 ? 0.1 : 0.2));
+    EXPECT_NEAR(weights[i], mixed_weights[i], 1e-2);
+  }
+}
+
+TYPED_TEST(MixedPrecisionTest, TestStaticLossScaleOverflow) {
+  // The loss gradient overflows half_fp, every update is skipped
+  shared_ptr<SGDSolver<TypeParam> > solver = this->Train(
+      "mixed_precision: true loss_scale: 65536 loss_scale_window: 0", 3);
+  EXPECT_EQ(solver->skipped_updates(), 3);
+  EXPECT_EQ(solver->loss_scale(), 65536);
+  EXPECT_EQ(solver->loss_scale_decreases(), 0);
+  const vector<TypeParam> weights = this->Weights(solver.get());
+  for (int i = 0; i < weights.size(); ++i) {
+    EXPECT_NEAR(weights[i], i < 5 ? 0.1 : 0.2, 1e-3);
+  }
+}
+
+TYPED_TEST(MixedPrecisionTest, TestDynamicLossScale) {
+  // Overflows at 65536 and halves, then stays at 32768 because doubling it
+  // again would overflow half_fp
+  shared_ptr<SGDSolver<TypeParam> > solver = this->Train(
+      "mixed_precision: true loss_scale: 65536 loss_scale_window: 2", 6);
+  EXPECT_EQ(solver->skipped_updates(), 1);
+  EXPECT_EQ(solver->loss_scale_decreases(), 1);
+  EXPECT_EQ(solver->loss_scale_increases(), 0);
+  EXPECT_EQ(solver->loss_scale(), 32768);
+  EXPECT_EQ(solver->net()->loss_scale(), 32768);
+  const vector<TypeParam> weights = this->Weights(solver.get());
+  for (int i = 0; i < weights.size(); ++i) {
+    EXPECT_TRUE(std::isfinite(weights[i]));
+    EXPECT_NE(weights[i], TypeParam(i < 5 ? 0.1 : 0.2));
+  }
+}
+
+TYPED_TEST(MixedPrecisionTest, TestSnapshot) {
+  // Resuming continues from the saved master copy, the same as training
+  // without interruption
+  string snapshot_prefix;
+  MakeTempDir(&snapshot_prefix);
+#if defined(_MSC_VER)
+  std::replace(snapshot_prefix.begin(), snapshot_prefix.end(), '\\', '/');
+#endif
+  const string mixed_param = "mixed_precision: true loss_scale_window: 0 "
+      "snapshot_prefix: '" + snapshot_prefix + "/' ";
+  const vector<TypeParam> weights =
+      this->Weights(this->Train(mixed_param, 10).get());
+  this->Train(mixed_param, 5)->Snapshot();
+  shared_ptr<SGDSolver<TypeParam> > solver = this->Train(mixed_param, 0);
+  solver->Restore((snapshot_prefix + "/_iter_5.solverstate").c_str());
+  solver->Step(5);
+  const vector<TypeParam> resumed_weights = this->Weights(solver.get());
+  ASSERT_EQ(weights.size(), resumed_weights.size());
+  for (int i = 0; i < weights.size(); ++i) {
+    EXPECT_EQ(weights[i], resumed_weights[i]);
+  }
+}
+#endif  // USE_HALF
+
 }  // namespace caffe
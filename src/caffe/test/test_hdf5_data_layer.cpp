@@ -44,6 +44,108 @@ class HDF5DataLayerTest : public MultiDeviceTest<TypeParam> {
     delete filename;
   }
 
+  // Reads the sample data in order, streaming it if chunk_size > 0
+  void TestRead(uint32_t chunk_size) {
+    blob_top_vec_.push_back(blob_top_label2_);
+    blob_top_base_vec_.push_back(blob_top_label2_);
+
+
+    // Create LayerParameter with the known parameters.
+    // The data file we are reading has 10 rows and 8 columns,
+    // with values from 0 to 10*8 reshaped in row-major order.
+    LayerParameter param;
+    param.set_type("HDF5Data");
+    param.add_top("data");
+    param.add_top("label");
+    param.add_top("label2");
+
+    if (std::is_same<Dtype, half_fp>::value) {
+      param.set_bottom_data_type(FLOAT);
+      param.set_compute_data_type(FLOAT);
+      param.set_top_data_type(proto_data_type<Dtype>());
+    }
+
+    HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+    int_tp batch_size = 5;
+    hdf5_data_param->set_batch_size(batch_size);
+    hdf5_data_param->set_source(*(filename));
+    hdf5_data_param->set_chunk_size(chunk_size);
+    int_tp num_cols = 8;
+    int_tp height = 6;
+    int_tp width = 5;
+
+    // Test that the layer setup gives correct parameters.
+    shared_ptr<LayerBase> layer = CreateLayer(param);
+    layer->SetUp(blob_bottom_base_vec_, blob_top_base_vec_);
+
+    EXPECT_EQ(blob_top_data_->num(), batch_size);
+    EXPECT_EQ(blob_top_data_->channels(), num_cols);
+    EXPECT_EQ(blob_top_data_->height(), height);
+    EXPECT_EQ(blob_top_data_->width(), width);
+
+    EXPECT_EQ(blob_top_label_->num_axes(), 2);
+    EXPECT_EQ(blob_top_label_->shape(0), batch_size);
+    EXPECT_EQ(blob_top_label_->shape(1), 1);
+
+    EXPECT_EQ(blob_top_label2_->num_axes(), 2);
+    EXPECT_EQ(blob_top_label2_->shape(0), batch_size);
+    EXPECT_EQ(blob_top_label2_->shape(1), 1);
+
+    layer->SetUp(blob_bottom_base_vec_, blob_top_base_vec_);
+
+    // Go through the data 10 times (5 batches).
+    const int_tp data_size = num_cols * height * width;
+    for (int_tp iter = 0; iter < 10; ++iter) {
+      layer->Forward(blob_bottom_base_vec_,
+                     blob_top_base_vec_, nullptr);
+
+      // On even iterations, we're reading the first half_fp of the data.
+      // On odd iterations, we're reading the second half_fp of the data.
+      // NB: label is 1-indexed
+      int_tp label_offset = 1 + ((iter % 2 == 0) ? 0 : batch_size);
+      int_tp label2_offset = 1 + label_offset;
+      int_tp data_offset = (iter % 2 == 0) ? 0 : batch_size * data_size;
+
+      // Every two iterations we are reading the second file,
+      // which has the same labels, but data is offset by total data size,
+      // which is 2400 (see generate_sample_data).
+      int_tp file_offset = (iter % 4 < 2) ? 0 : 2400;
+
+      for (int_tp i = 0; i < batch_size; ++i) {
+        if (label_offset + i <= type_max_integer_representable<Dtype>()) {
+          EXPECT_EQ(
+            label_offset + i,
+            blob_top_label_->cpu_data()[i]);
+        }
+        if (label2_offset + i <= type_max_integer_representable<Dtype>()) {
+          EXPECT_EQ(
+            label2_offset + i,
+            blob_top_label2_->cpu_data()[i]);
+        }
+      }
+      for (int_tp i = 0; i < batch_size; ++i) {
+        for (int_tp j = 0; j < num_cols; ++j) {
+          for (int_tp h = 0; h < height; ++h) {
+            for (int_tp w = 0; w < width; ++w) {
+              int_tp idx = (
+                i * num_cols * height * width +
+                j * height * width +
+                h * width + w);
+              if (file_offset + data_offset + idx
+                  <= type_max_integer_representable<Dtype>()) {
+                EXPECT_EQ(
+                  file_offset + data_offset + idx,
+                  blob_top_data_->cpu_data()[idx])
+                  << "debug: i " << i << " j " << j
+                  << " iter " << iter;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
   string* filename;
   Blob<Dtype>* const blob_top_data_;
   Blob<Dtype>* const blob_top_label_;
@@ -57,19 +159,20 @@ class HDF5DataLayerTest : public MultiDeviceTest<TypeParam> {
 TYPED_TEST_CASE(HDF5DataLayerTest, TestDtypesAndDevices);
 
 TYPED_TEST(HDF5DataLayerTest, TestRead) {
-  typedef typename TypeParam::Dtype Dtype;
-  this->blob_top_vec_.push_back(this->blob_top_label2_);
-  this->blob_top_base_vec_.push_back(this->blob_top_label2_);
+  this->TestRead(0);
+}
 
+TYPED_TEST(HDF5DataLayerTest, TestReadStreaming) {
+  // The chunks of 3 rows do not line up with the batches of 5
+  this->TestRead(3);
+}
 
-  // Create LayerParameter with the known parameters.
-  // The data file we are reading has 10 rows and 8 columns,
-  // with values from 0 to 10*8 reshaped in row-major order.
+TYPED_TEST(HDF5DataLayerTest, TestReadStreamingShuffle) {
+  typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
   param.set_type("HDF5Data");
   param.add_top("data");
   param.add_top("label");
-  param.add_top("label2");
 
   if (std::is_same<Dtype, half_fp>::value) {
     param.set_bottom_data_type(FLOAT);
@@ -81,80 +184,32 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   int_tp batch_size = 5;
   hdf5_data_param->set_batch_size(batch_size);
   hdf5_data_param->set_source(*(this->filename));
-  int_tp num_cols = 8;
-  int_tp height = 6;
-  int_tp width = 5;
+  hdf5_data_param->set_chunk_size(4);
+  hdf5_data_param->set_shuffle(true);
+  const int_tp data_size = 8 * 6 * 5;
 
-  // Test that the layer setup gives correct parameters.
   shared_ptr<LayerBase> layer = CreateLayer(param);
   layer->SetUp(this->blob_bottom_base_vec_, this->blob_top_base_vec_);
-
-  EXPECT_EQ(this->blob_top_data_->num(), batch_size);
-  EXPECT_EQ(this->blob_top_data_->channels(), num_cols);
-  EXPECT_EQ(this->blob_top_data_->height(), height);
-  EXPECT_EQ(this->blob_top_data_->width(), width);
-
-  EXPECT_EQ(this->blob_top_label_->num_axes(), 2);
-  EXPECT_EQ(this->blob_top_label_->shape(0), batch_size);
-  EXPECT_EQ(this->blob_top_label_->shape(1), 1);
-
-  EXPECT_EQ(this->blob_top_label2_->num_axes(), 2);
-  EXPECT_EQ(this->blob_top_label2_->shape(0), batch_size);
-  EXPECT_EQ(this->blob_top_label2_->shape(1), 1);
-
-  layer->SetUp(this->blob_bottom_base_vec_, this->blob_top_base_vec_);
-
-  // Go through the data 10 times (5 batches).
-  const int_tp data_size = num_cols * height * width;
-  for (int_tp iter = 0; iter < 10; ++iter) {
+  // One epoch over both files of 10 rows serves every row once, and rows
+  // keep their data
+  vector<int_tp> label_count(10, 0);
+  for (int_tp iter = 0; iter < 4; ++iter) {
     layer->Forward(this->blob_bottom_base_vec_,
                    this->blob_top_base_vec_, nullptr);
-
-    // On even iterations, we're reading the first half_fp of the data.
-    // On odd iterations, we're reading the second half_fp of the data.
-    // NB: label is 1-indexed
-    int_tp label_offset = 1 + ((iter % 2 == 0) ? 0 : batch_size);
-    int_tp label2_offset = 1 + label_offset;
-    int_tp data_offset = (iter % 2 == 0) ? 0 : batch_size * data_size;
-
-    // Every two iterations we are reading the second file,
-    // which has the same labels, but data is offset by total data size,
-    // which is 2400 (see generate_sample_data).
-    int_tp file_offset = (iter % 4 < 2) ? 0 : 2400;
-
     for (int_tp i = 0; i < batch_size; ++i) {
-      if (label_offset + i <= type_max_integer_representable<Dtype>()) {
-        EXPECT_EQ(
-          label_offset + i,
-          this->blob_top_label_->cpu_data()[i]);
-      }
-      if (label2_offset + i <= type_max_integer_representable<Dtype>()) {
-        EXPECT_EQ(
-          label2_offset + i,
-          this->blob_top_label2_->cpu_data()[i]);
-      }
-    }
-    for (int_tp i = 0; i < batch_size; ++i) {
-      for (int_tp j = 0; j < num_cols; ++j) {
-        for (int_tp h = 0; h < height; ++h) {
-          for (int_tp w = 0; w < width; ++w) {
-            int_tp idx = (
-              i * num_cols * height * width +
-              j * height * width +
-              h * width + w);
-            if (file_offset + data_offset + idx
-                                   <= type_max_integer_representable<Dtype>()) {
-              EXPECT_EQ(
-                file_offset + data_offset + idx,
-                this->blob_top_data_->cpu_data()[idx])
-                << "debug: i " << i << " j " << j
-                << " iter " << iter;
-            }
-          }
-        }
+      const int_tp label = this->blob_top_label_->cpu_data()[i];
+      ASSERT_GE(label, 1);
+      ASSERT_LE(label, 10);
+      ++label_count[label - 1];
+      const int_tp data = this->blob_top_data_->cpu_data()[i * data_size];
+      if (data <= type_max_integer_representable<Dtype>()) {
+        EXPECT_EQ((label - 1) * data_size, data % 2400);
       }
     }
   }
+  for (int_tp i = 0; i < 10; ++i) {
+    EXPECT_EQ(2, label_count[i]);
+  }
 }
 
 TYPED_TEST(HDF5DataLayerTest, TestSkip) {
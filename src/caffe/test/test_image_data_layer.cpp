@@ -97,6 +97,39 @@ TYPED_TEST(ImageDataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestReadDecodedCache) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_shuffle(false);
+  Blob<Dtype> expected;
+  {
+    ImageDataLayer<Dtype, Dtype, Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    expected.CopyFrom(*this->blob_top_data_, false, true);
+  }
+  image_data_param->set_decoded_cache_mb(16);
+  ImageDataLayer<Dtype, Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int_tp iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int_tp i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+    }
+    for (int_tp i = 0; i < expected.count(); ++i) {
+      EXPECT_EQ(expected.cpu_data()[i], this->blob_top_data_->cpu_data()[i]);
+    }
+  }
+  // All the lines are the same file
+  ASSERT_TRUE(layer.decoded_cache() != NULL);
+  EXPECT_EQ(1, layer.decoded_cache()->size());
+  EXPECT_EQ(360 * 480 * 3, layer.decoded_cache()->bytes());
+  EXPECT_GT(layer.decoded_cache()->hits(), 0);
+}
+
 TYPED_TEST(ImageDataLayerTest, TestResize) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
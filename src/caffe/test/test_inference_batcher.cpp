@@ -0,0 +1,163 @@
+#include <boost/thread.hpp>
+#include <future>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/inference_batcher.hpp"
+#include "caffe/inference_session.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class InferenceBatcherTest : public ::testing::Test {
+ public:
+  InferenceBatcherTest() {
+    Caffe::set_mode(Caffe::CPU);
+    const string proto =
+        "name: 'BatchedNet' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { shape: { dim: 1 dim: 64 } } "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 256 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layer { "
+        "  name: 'ip2' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'ip2' "
+        "  top: 'prob' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    Caffe::set_random_seed(1701, Caffe::GetDefaultDevice());
+    model_.reset(new InferenceModel<float>(param, Caffe::GetDefaultDevice()));
+  }
+
+  vector<vector<float> > MakeSample(int seed) {
+    vector<vector<float> > sample(1, vector<float>(64));
+    for (int i = 0; i < 64; ++i) {
+      sample[0][i] = ((seed * 31 + i * 17) % 23) / 23.0f - 0.5f;
+    }
+    return sample;
+  }
+
+  // Output of the unbatched net for one sample
+  vector<float> Reference(const vector<vector<float> >& sample) {
+    Net<float>* net = model_->net().get();
+    Blob<float>* input = static_cast<Blob<float>*>(net->input_blobs()[0]);
+    caffe_copy(input->count(), &sample[0][0], input->mutable_cpu_data());
+    const Blob<float>* output = static_cast<Blob<float>*>(net->Forward()[0]);
+    return vector<float>(output->cpu_data(),
+                         output->cpu_data() + output->count());
+  }
+
+  // Closed loop client: waits for each result before the next request
+  void Client(InferenceBatcher<float>* batcher, int num_requests, int seed) {
+    for (int i = 0; i < num_requests; ++i) {
+      vector<vector<float> > result =
+          batcher->Submit(MakeSample(seed + i)).get();
+      EXPECT_EQ(result.size(), 1);
+      EXPECT_EQ(result[0].size(), 10);
+    }
+  }
+
+  shared_ptr<InferenceModel<float> > model_;
+};
+
+TEST_F(InferenceBatcherTest, TestResults) {
+  const int kRequests = 20;
+  vector<vector<float> > expected;
+  for (int i = 0; i < kRequests; ++i) {
+    expected.push_back(Reference(MakeSample(i)));
+  }
+  InferenceBatcher<float> batcher(model_->CreateSession()->net(), 8, 10000);
+  vector<std::future<vector<vector<float> > > > results;
+  for (int i = 0; i < kRequests; ++i) {
+    results.push_back(batcher.Submit(MakeSample(i)));
+  }
+  for (int i = 0; i < kRequests; ++i) {
+    vector<vector<float> > result = results[i].get();
+    ASSERT_EQ(result.size(), 1);
+    ASSERT_EQ(result[0].size(), expected[i].size());
+    for (int j = 0; j < expected[i].size(); ++j) {
+      EXPECT_NEAR(expected[i][j], result[0][j], 1e-5);
+    }
+  }
+  InferenceBatcherStats stats = batcher.stats();
+  EXPECT_EQ(stats.requests, kRequests);
+  EXPECT_GE(stats.batches, 3);
+  EXPECT_LE(stats.batches, kRequests);
+}
+
+TEST_F(InferenceBatcherTest, TestDeadline) {
+  // A lone request is run once its deadline passed.
+  InferenceBatcher<float> batcher(model_->CreateSession()->net(), 64, 1000);
+  vector<vector<float> > result = batcher.Submit(MakeSample(0)).get();
+  EXPECT_EQ(result[0].size(), 10);
+  InferenceBatcherStats stats = batcher.stats();
+  EXPECT_EQ(stats.requests, 1);
+  EXPECT_EQ(stats.batch_sizes[1], 1);
+  EXPECT_GE(stats.p50_latency_ms, 1.0);
+}
+
+// Timing only; run with --gtest_also_run_disabled_tests.
+TEST_F(InferenceBatcherTest, DISABLED_TestLoadBenchmark) {
+  const int kRequestsPerClient = 200;
+  const int kClients[] = {1, 4, 16, 64};
+  for (int c = 0; c < 4; ++c) {
+    InferenceBatcher<float> batcher(model_->CreateSession()->net(), 32, 500);
+    CPUTimer timer;
+    timer.Start();
+    boost::thread_group clients;
+    for (int i = 0; i < kClients[c]; ++i) {
+      clients.create_thread(boost::bind(&InferenceBatcherTest::Client, this,
+                                        &batcher, kRequestsPerClient,
+                                        i * kRequestsPerClient));
+    }
+    clients.join_all();
+    const double seconds = timer.Seconds();
+    InferenceBatcherStats stats = batcher.stats();
+    EXPECT_EQ(stats.requests, kClients[c] * kRequestsPerClient);
+    std::cout << kClients[c] << " clients: "
+              << stats.requests / seconds << " requests/s, p50 "
+              << stats.p50_latency_ms << " ms, p99 " << stats.p99_latency_ms
+              << " ms, mean batch " << stats.mean_batch_size << " ("
+              << stats.batch_fill * 100 << "% full)" << std::endl;
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,272 @@
+#include <boost/thread.hpp>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/inference_session.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+static const char* kInferenceNetProto =
+    "name: 'InferenceNet' "
+    "layer { "
+    "  name: 'data' "
+    "  type: 'Input' "
+    "  top: 'data' "
+    "  input_param { "
+    "    shape: { dim: 2 dim: 3 dim: 16 dim: 16 } "
+    "  } "
+    "} "
+    "layer { "
+    "  name: 'conv1' "
+    "  type: 'Convolution' "
+    "  bottom: 'data' "
+    "  top: 'conv1' "
+    "  convolution_param { "
+    "    num_output: 16 "
+    "    kernel_size: 3 "
+    "    pad: 1 "
+    "    weight_filler { type: 'gaussian' std: 0.1 } "
+    "    bias_filler { type: 'gaussian' std: 0.1 } "
+    "  } "
+    "} "
+    "layer { "
+    "  name: 'relu1' "
+    "  type: 'ReLU' "
+    "  bottom: 'conv1' "
+    "  top: 'conv1' "
+    "} "
+    "layer { "
+    "  name: 'pool1' "
+    "  type: 'Pooling' "
+    "  bottom: 'conv1' "
+    "  top: 'pool1' "
+    "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+    "} "
+    "layer { "
+    "  name: 'conv2' "
+    "  type: 'Convolution' "
+    "  bottom: 'pool1' "
+    "  top: 'conv2' "
+    "  convolution_param { "
+    "    num_output: 32 "
+    "    kernel_size: 3 "
+    "    pad: 1 "
+    "    weight_filler { type: 'gaussian' std: 0.1 } "
+    "    bias_filler { type: 'gaussian' std: 0.1 } "
+    "  } "
+    "} "
+    "layer { "
+    "  name: 'relu2' "
+    "  type: 'ReLU' "
+    "  bottom: 'conv2' "
+    "  top: 'conv2' "
+    "} "
+    "layer { "
+    "  name: 'ip' "
+    "  type: 'InnerProduct' "
+    "  bottom: 'conv2' "
+    "  top: 'ip' "
+    "  inner_product_param { "
+    "    num_output: 10 "
+    "    weight_filler { type: 'gaussian' std: 0.1 } "
+    "    bias_filler { type: 'gaussian' std: 0.1 } "
+    "  } "
+    "} "
+    "layer { "
+    "  name: 'prob' "
+    "  type: 'Softmax' "
+    "  bottom: 'ip' "
+    "  top: 'prob' "
+    "} ";
+
+template <typename TypeParam>
+class InferenceSessionTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  InferenceSessionTest() {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(kInferenceNetProto,
+                                                        &param));
+    Caffe::set_random_seed(1701, Caffe::GetDefaultDevice());
+    model_.reset(new InferenceModel<Dtype>(param,
+                                           Caffe::GetDefaultDevice()));
+  }
+
+  void FillInput(InferenceSession<Dtype>* session, const Dtype value) {
+    Blob<Dtype>* input = static_cast<Blob<Dtype>*>(session->input_blobs()[0]);
+    FillerParameter filler_param;
+    filler_param.set_min(-value);
+    filler_param.set_max(value);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(input);
+  }
+
+  shared_ptr<InferenceModel<Dtype> > model_;
+};
+
+TYPED_TEST_CASE(InferenceSessionTest, TestDtypesFloatAndDevices);
+
+TYPED_TEST(InferenceSessionTest, TestSharedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  shared_ptr<InferenceSession<Dtype> > session1 =
+      this->model_->CreateSession();
+  shared_ptr<InferenceSession<Dtype> > session2 =
+      this->model_->CreateSession();
+  const vector<shared_ptr<BlobBase> >& params =
+      this->model_->net()->params();
+  ASSERT_EQ(params.size(), session1->net()->params().size());
+  ASSERT_EQ(params.size(), session2->net()->params().size());
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(params[i], session1->net()->params()[i]);
+    EXPECT_EQ(params[i], session2->net()->params()[i]);
+  }
+  // Activations are per session.
+  EXPECT_NE(session1->input_blobs()[0], session2->input_blobs()[0]);
+  EXPECT_NE(session1->output_blobs()[0]->data(),
+            session2->output_blobs()[0]->data());
+}
+
+TYPED_TEST(InferenceSessionTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  shared_ptr<InferenceSession<Dtype> > session1 =
+      this->model_->CreateSession();
+  shared_ptr<InferenceSession<Dtype> > session2 =
+      this->model_->CreateSession();
+  this->FillInput(session1.get(), Dtype(1));
+  Net<Dtype>* reference = this->model_->net().get();
+  Blob<Dtype>* reference_input =
+      static_cast<Blob<Dtype>*>(reference->input_blobs()[0]);
+  Blob<Dtype>* input1 = static_cast<Blob<Dtype>*>(session1->input_blobs()[0]);
+  Blob<Dtype>* input2 = static_cast<Blob<Dtype>*>(session2->input_blobs()[0]);
+  caffe_copy(input1->count(), input1->cpu_data(),
+             reference_input->mutable_cpu_data());
+  caffe_copy(input1->count(), input1->cpu_data(), input2->mutable_cpu_data());
+  reference->Forward();
+  session1->Forward();
+  session2->Forward();
+  const Blob<Dtype>* expected =
+      static_cast<Blob<Dtype>*>(reference->output_blobs()[0]);
+  const Blob<Dtype>* output1 =
+      static_cast<Blob<Dtype>*>(session1->output_blobs()[0]);
+  const Blob<Dtype>* output2 =
+      static_cast<Blob<Dtype>*>(session2->output_blobs()[0]);
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_EQ(expected->cpu_data()[i], output1->cpu_data()[i]);
+    EXPECT_EQ(expected->cpu_data()[i], output2->cpu_data()[i]);
+  }
+}
+
+class InferenceSessionCPUTest : public ::testing::Test {
+ public:
+  InferenceSessionCPUTest() {
+    Caffe::set_mode(Caffe::CPU);
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(kInferenceNetProto,
+                                                        &param));
+    Caffe::set_random_seed(1701, Caffe::GetDefaultDevice());
+    model_.reset(new InferenceModel<float>(param,
+                                           Caffe::GetDefaultDevice()));
+  }
+
+  // Runs iterations forward passes, each on a fresh input with a
+  // known expected output.
+  void Worker(InferenceSession<float>* session, int iterations,
+              const vector<vector<float> >* inputs,
+              const vector<vector<float> >* outputs) {
+    Blob<float>* input = static_cast<Blob<float>*>(session->input_blobs()[0]);
+    for (int i = 0; i < iterations; ++i) {
+      const int sample = i % inputs->size();
+      caffe_copy(input->count(), &(*inputs)[sample][0],
+                 input->mutable_cpu_data());
+      const Blob<float>* output =
+          static_cast<Blob<float>*>(session->Forward()[0]);
+      if (outputs) {
+        for (int j = 0; j < output->count(); ++j) {
+          EXPECT_EQ((*outputs)[sample][j], output->cpu_data()[j]);
+        }
+      }
+    }
+  }
+
+  void MakeSamples(int num_samples, vector<vector<float> >* inputs,
+                   vector<vector<float> >* outputs) {
+    Net<float>* net = model_->net().get();
+    Blob<float>* input = static_cast<Blob<float>*>(net->input_blobs()[0]);
+    FillerParameter filler_param;
+    GaussianFiller<float> filler(filler_param);
+    for (int i = 0; i < num_samples; ++i) {
+      filler.Fill(input);
+      inputs->push_back(vector<float>(input->cpu_data(),
+                                      input->cpu_data() + input->count()));
+      const Blob<float>* output =
+          static_cast<Blob<float>*>(net->Forward()[0]);
+      outputs->push_back(vector<float>(output->cpu_data(),
+                                       output->cpu_data() + output->count()));
+    }
+  }
+
+  shared_ptr<InferenceModel<float> > model_;
+};
+
+TEST_F(InferenceSessionCPUTest, TestConcurrentForward) {
+  vector<vector<float> > inputs;
+  vector<vector<float> > outputs;
+  this->MakeSamples(8, &inputs, &outputs);
+  const int kWorkers = 4;
+  vector<shared_ptr<InferenceSession<float> > > sessions;
+  for (int i = 0; i < kWorkers; ++i) {
+    sessions.push_back(model_->CreateSession());
+  }
+  boost::thread_group workers;
+  for (int i = 0; i < kWorkers; ++i) {
+    workers.create_thread(boost::bind(&InferenceSessionCPUTest::Worker, this,
+                                      sessions[i].get(), 32, &inputs,
+                                      &outputs));
+  }
+  workers.join_all();
+}
+
+// Timing only; run with --gtest_also_run_disabled_tests.
+TEST_F(InferenceSessionCPUTest, DISABLED_TestThroughputBenchmark) {
+  vector<vector<float> > inputs;
+  vector<vector<float> > outputs;
+  this->MakeSamples(4, &inputs, &outputs);
+  const int kIterations = 64;
+  const int kWorkers[] = {1, 2, 4, 8};
+  const int batch_size = model_->net()->input_blobs()[0]->shape(0);
+  for (int w = 0; w < 4; ++w) {
+    CPUTimer timer;
+    timer.Start();
+    vector<shared_ptr<InferenceSession<float> > > sessions;
+    for (int i = 0; i < kWorkers[w]; ++i) {
+      sessions.push_back(model_->CreateSession());
+    }
+    const double setup_ms = timer.MilliSeconds();
+    timer.Start();
+    boost::thread_group workers;
+    for (int i = 0; i < kWorkers[w]; ++i) {
+      workers.create_thread(boost::bind(&InferenceSessionCPUTest::Worker,
+                                        this, sessions[i].get(), kIterations,
+                                        &inputs,
+                                        static_cast<const vector<
+                                            vector<float> >*>(NULL)));
+    }
+    workers.join_all();
+    const double seconds = timer.Seconds();
+    std::cout << kWorkers[w] << " sessions: setup " << setup_ms << " ms, "
+              << kWorkers[w] * kIterations * batch_size / seconds
+              << " images/s" << std::endl;
+  }
+}
+
+}  // namespace caffe
@@ -421,5 +421,52 @@ TEST_F(IOTest, TestDecodeDatumToCVMatContentNative) {
   }
 }
 
+TEST_F(IOTest, TestParseDatumView) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  Datum datum;
+  EXPECT_TRUE(ReadImageToDatum(filename, 7, &datum));
+  string serialized;
+  datum.SerializeToString(&serialized);
+  DatumView view;
+  EXPECT_TRUE(ParseDatumView(serialized.data(), serialized.size(), &view));
+  EXPECT_EQ(view.channels, datum.channels());
+  EXPECT_EQ(view.height, datum.height());
+  EXPECT_EQ(view.width, datum.width());
+  EXPECT_EQ(view.label, 7);
+  EXPECT_FALSE(view.encoded);
+  EXPECT_EQ(datum.data(), string(view.data, view.data_size));
+  // The data is not copied
+  const int_tp offset = view.data - serialized.data();
+  EXPECT_GE(offset, 0);
+  EXPECT_LT(offset, static_cast<int_tp>(serialized.size()));
+
+  datum.add_float_data(1);
+  datum.SerializeToString(&serialized);
+  EXPECT_FALSE(ParseDatumView(serialized.data(), serialized.size(), &view));
+  EXPECT_FALSE(ParseDatumView(serialized.data(), serialized.size() / 2,
+                              &view));
+}
+
+TEST_F(IOTest, TestDecodeDatumViewToCVMat) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  Datum datum;
+  EXPECT_TRUE(ReadFileToDatum(filename, &datum));
+  string serialized;
+  datum.SerializeToString(&serialized);
+  DatumView view;
+  EXPECT_TRUE(ParseDatumView(serialized.data(), serialized.size(), &view));
+  EXPECT_TRUE(view.encoded);
+  cv::Mat cv_img = DecodeDatumToCVMat(view, true);
+  cv::Mat cv_img_ref = DecodeDatumToCVMat(datum, true);
+  EXPECT_EQ(cv_img_ref.channels(), cv_img.channels());
+  EXPECT_EQ(cv_img_ref.rows, cv_img.rows);
+  EXPECT_EQ(cv_img_ref.cols, cv_img.cols);
+  EXPECT_EQ(0, cv::norm(cv_img, cv_img_ref, cv::NORM_L1));
+  cv_img = DecodeDatumToCVMatNative(view);
+  EXPECT_EQ(cv_img.channels(), 3);
+  EXPECT_EQ(cv_img.rows, 360);
+  EXPECT_EQ(cv_img.cols, 480);
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
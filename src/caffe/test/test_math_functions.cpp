@@ -1,12 +1,15 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
+#include <algorithm>
 #include <cmath>  // for std::fabs
+#include <vector>
 
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -119,6 +122,146 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+// Reference for the packed caffe_gemm fallback: the naive triple loop it
+// replaced, accumulating in Dtype.
+template <typename Dtype>
+void naive_gemm(const CBLAS_TRANSPOSE trans_A, const CBLAS_TRANSPOSE trans_B,
+                const int_tp M, const int_tp N, const int_tp K,
+                const Dtype alpha, const Dtype* A, const Dtype* B,
+                const Dtype beta, Dtype* C) {
+  for (int_tp m = 0; m < M; ++m) {
+    for (int_tp n = 0; n < N; ++n) {
+      Dtype acc = 0;
+      for (int_tp k = 0; k < K; ++k) {
+        acc += (trans_A == CblasNoTrans ? A[m * K + k] : A[k * M + m])
+             * (trans_B == CblasNoTrans ? B[k * N + n] : B[n * K + k]);
+      }
+      if (beta != Dtype(0)) {
+        C[m * N + n] = acc * alpha + beta * C[m * N + n];
+      } else {
+        C[m * N + n] = acc * alpha;
+      }
+    }
+  }
+}
+
+class CPUGemmTest : public ::testing::Test {
+ protected:
+  template <typename Dtype>
+  void Fill(vector<Dtype>* data, const int_tp range) {
+    for (int_tp i = 0; i < data->size(); ++i) {
+      (*data)[i] = Dtype(static_cast<int_tp>(caffe_rng_rand() % range)
+                         - range / 2);
+    }
+  }
+
+  template <typename Dtype>
+  void CompareWithNaive(const int_tp M, const int_tp N, const int_tp K,
+                        const float eps) {
+    const CBLAS_TRANSPOSE trans[2] = { CblasNoTrans, CblasTrans };
+    for (int_tp ta = 0; ta < 2; ++ta) {
+      for (int_tp tb = 0; tb < 2; ++tb) {
+        vector<Dtype> A(M * K), B(K * N), C(M * N), C_ref(M * N);
+        Fill(&A, 7);
+        Fill(&B, 7);
+        Fill(&C, 5);
+        C_ref = C;
+        naive_gemm<Dtype>(trans[ta], trans[tb], M, N, K, Dtype(2),
+                          &A[0], &B[0], Dtype(1), &C_ref[0]);
+        caffe_gemm<Dtype>(trans[ta], trans[tb], M, N, K, Dtype(2),
+                          &A[0], &B[0], Dtype(1), &C[0]);
+        for (int_tp i = 0; i < M * N; ++i) {
+          const float ref = static_cast<float>(C_ref[i]);
+          EXPECT_NEAR(static_cast<float>(C[i]), ref,
+                      eps * std::max(1.f, std::fabs(ref)));
+        }
+      }
+    }
+  }
+};
+
+TEST_F(CPUGemmTest, TestGemmInt8) {
+  // Sizes straddle the register and cache block boundaries.
+  CompareWithNaive<int8_t>(7, 13, 5, 0);
+  CompareWithNaive<int8_t>(97, 300, 270, 0);
+}
+
+TEST_F(CPUGemmTest, TestGemmInt16) {
+  CompareWithNaive<int16_t>(7, 13, 5, 0);
+  CompareWithNaive<int16_t>(97, 300, 270, 0);
+}
+
+TEST_F(CPUGemmTest, TestGemmInt32) {
+  CompareWithNaive<int32_t>(7, 13, 5, 0);
+  CompareWithNaive<int32_t>(97, 300, 270, 0);
+}
+
+TEST_F(CPUGemmTest, TestGemmHalf) {
+  // The packed GEMM accumulates in fp32, so it is at least as accurate as the
+  // naive loop; allow for the half_fp rounding of the reference.
+  CompareWithNaive<half_fp>(7, 13, 5, 1e-2);
+  CompareWithNaive<half_fp>(97, 300, 270, 2e-2);
+}
+
+// Timing only; run with --gtest_also_run_disabled_tests.
+TEST_F(CPUGemmTest, DISABLED_TestGemmBenchmark) {
+  // Shape of the 3x3 conv GEMM in a 56x56 ResNet stage.
+  const int_tp M = 64;
+  const int_tp N = 56 * 56;
+  const int_tp K = 64 * 9;
+  vector<half_fp> A_half(M * K), B_half(K * N), C_half(M * N);
+  vector<int8_t> A_int8(M * K), B_int8(K * N), C_int8(M * N),
+      C_int8_ref(M * N);
+  vector<float> A_float(M * K), B_float(K * N), C_float(M * N);
+  Fill(&A_half, 3);
+  Fill(&B_half, 3);
+  Fill(&A_int8, 3);
+  Fill(&B_int8, 3);
+  Fill(&A_float, 3);
+  Fill(&B_float, 3);
+
+  CPUTimer timer;
+  timer.Start();
+  naive_gemm<half_fp>(CblasNoTrans, CblasNoTrans, M, N, K, half_fp(1),
+                      &A_half[0], &B_half[0], half_fp(0), &C_half[0]);
+  timer.Stop();
+  std::cout << "Naive half_fp GEMM (" << M << "x" << N << "x" << K
+            << ") time is: " << timer.MilliSeconds() << " ms" << std::endl;
+
+  timer.Start();
+  caffe_gemm<half_fp>(CblasNoTrans, CblasNoTrans, M, N, K, half_fp(1),
+                      &A_half[0], &B_half[0], half_fp(0), &C_half[0]);
+  timer.Stop();
+  std::cout << "Packed half_fp GEMM time is: " << timer.MilliSeconds()
+            << " ms" << std::endl;
+
+  timer.Start();
+  naive_gemm<int8_t>(CblasNoTrans, CblasNoTrans, M, N, K, int8_t(1),
+                     &A_int8[0], &B_int8[0], int8_t(0), &C_int8_ref[0]);
+  timer.Stop();
+  std::cout << "Naive int8_t GEMM time is: " << timer.MilliSeconds()
+            << " ms" << std::endl;
+
+  timer.Start();
+  caffe_gemm<int8_t>(CblasNoTrans, CblasNoTrans, M, N, K, int8_t(1),
+                     &A_int8[0], &B_int8[0], int8_t(0), &C_int8[0]);
+  timer.Stop();
+  std::cout << "Packed int8_t GEMM time is: " << timer.MilliSeconds()
+            << " ms" << std::endl;
+
+  timer.Start();
+  caffe_gemm<float>(CblasNoTrans, CblasNoTrans, M, N, K, 1.f,
+                    &A_float[0], &B_float[0], 0.f, &C_float[0]);
+  timer.Stop();
+  std::cout << "BLAS float GEMM time is: " << timer.MilliSeconds()
+            << " ms" << std::endl;
+
+  for (int_tp i = 0; i < M * N; ++i) {
+    EXPECT_EQ(static_cast<float>(C_half[i]), C_float[i]);
+    EXPECT_EQ(C_int8[i], C_int8_ref[i]);
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -1,3 +1,4 @@
+#include <map>
 #include <string>
 #include <memory>
 #include <utility>
@@ -10,8 +11,10 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -843,10 +846,180 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoFileWithState(proto, phase, level, stages);
   }
 
+  static string InnerProductLayer(const string& name, const string& bottom) {
+    return
+        "layer { "
+        "  name: '" + name + "' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "  bottom: '" + bottom + "' "
+        "  top: '" + name + "' "
+        "} ";
+  }
+
+  virtual void InitMemoryOptimizedNet(const bool optimize_memory) {
+    string proto =
+        "name: 'MemoryOptimizedNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape: { dim: 2 dim: 3 dim: 4 dim: 5 } "
+        "  } "
+        "} ";
+    proto += InnerProductLayer("ip1", "data");
+    proto +=
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} ";
+    proto += InnerProductLayer("ip2", "ip1");
+    proto += InnerProductLayer("ip3", "ip2");
+    proto += InnerProductLayer("ip4", "ip3");
+    // ip1 is split and stays alive until the sum
+    proto +=
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'ip1' "
+        "  bottom: 'ip4' "
+        "  top: 'sum' "
+        "} ";
+    if (optimize_memory) {
+      proto += "optimize_memory: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitMemoryOptimizedRecurrentNet(const bool optimize_memory) {
+    string proto =
+        "name: 'MemoryOptimizedRecurrentNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  top: 'cont' "
+        "  input_param { "
+        "    shape: { dim: 3 dim: 2 dim: 5 } "
+        "    shape: { dim: 3 dim: 2 } "
+        "  } "
+        "} ";
+    const string ip_layers[][2] = { { "ip1", "data" }, { "ip2", "lstm" },
+                                    { "ip3", "ip2" }, { "ip4", "ip3" },
+                                    { "ip5", "ip4" } };
+    for (int_tp i = 0; i < 5; ++i) {
+      string layer = InnerProductLayer(ip_layers[i][0], ip_layers[i][1]);
+      layer.replace(layer.find("num_output"), 0, "axis: 2 ");
+      proto += layer;
+      if (i == 0) {
+        // The LSTM's unrolled net shares the memory of its bottoms and tops
+        proto +=
+            "layer { "
+            "  name: 'lstm' "
+            "  type: 'LSTM' "
+            "  bottom: 'ip1' "
+            "  bottom: 'cont' "
+            "  top: 'lstm' "
+            "  recurrent_param { "
+            "    num_output: 7 "
+            "    weight_filler { "
+            "      type: 'gaussian' "
+            "      std: 0.1 "
+            "    } "
+            "  } "
+            "} ";
+      }
+    }
+    if (optimize_memory) {
+      proto += "optimize_memory: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitBranchedNet(const int forward_threads) {
+    string proto =
+        "name: 'BranchedNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape: { dim: 4 dim: 3 dim: 4 dim: 5 } "
+        "  } "
+        "} ";
+    // Four towers on the same input, the last one starting in-place
+    const char* towers[] = {"a", "b", "c", "d"};
+    for (int_tp i = 0; i < 4; ++i) {
+      const string tower(towers[i]);
+      if (i == 3) {
+        proto +=
+            "layer { "
+            "  name: 'relu_d' "
+            "  type: 'ReLU' "
+            "  bottom: 'data' "
+            "  top: 'data' "
+            "} ";
+      }
+      proto += InnerProductLayer("ip1_" + tower, "data");
+      proto +=
+          "layer { "
+          "  name: 'relu_" + tower + "' "
+          "  type: 'ReLU' "
+          "  bottom: 'ip1_" + tower + "' "
+          "  top: 'ip1_" + tower + "' "
+          "} ";
+      proto += InnerProductLayer("ip2_" + tower, "ip1_" + tower);
+    }
+    proto +=
+        "layer { "
+        "  name: 'concat' "
+        "  type: 'Concat' "
+        "  bottom: 'ip2_a' "
+        "  bottom: 'ip2_b' "
+        "  bottom: 'ip2_c' "
+        "  bottom: 'ip2_d' "
+        "  top: 'concat' "
+        "} ";
+    proto += "forward_threads: " + std::to_string(forward_threads) + " ";
+    InitNetFromProtoString(proto);
+  }
+
   int_tp seed_;
   shared_ptr<Net<Dtype> > net_;
 };
 
+// Records the order of the forward callbacks.
+template <typename Dtype>
+class ForwardOrderCallback : public Net<Dtype>::Callback {
+ public:
+  explicit ForwardOrderCallback(vector<int>* events, bool after)
+      : events_(events), after_(after) {}
+
+ protected:
+  virtual void run(int layer) {
+    events_->push_back(after_ ? -layer - 1 : layer);
+  }
+
+  vector<int>* events_;
+  bool after_;
+};
+
 TYPED_TEST_CASE(NetTest, TestDtypesAndDevices);
 
 TYPED_TEST(NetTest, TestHasBlob) {
@@ -2414,6 +2587,199 @@ TEST_F(FilterNetTest, TestFilterInOutByExcludeMultiRule) {
   this->RunFilterNetTest(input_proto_test, output_proto_test);
 }
 
+TYPED_TEST(NetTest, TestMemoryOptimizedInference) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input1(2, 3, 4, 5);
+  Blob<Dtype> input2(7, 3, 4, 5);
+  filler.Fill(&input1);
+  filler.Fill(&input2);
+
+  vector<shared_ptr<Blob<Dtype> > > outputs(4);
+  for (int_tp optimize = 0; optimize < 2; ++optimize) {
+    Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+    this->InitMemoryOptimizedNet(optimize);
+    Net<Dtype>* net = this->net_.get();
+    if (optimize) {
+      // ip2 is dead before ip4 is computed, ip1 is alive until the end.
+      EXPECT_EQ(net->blob_by_name("ip2")->data(),
+                net->blob_by_name("ip4")->data());
+      EXPECT_NE(net->blob_by_name("ip1")->data(),
+                net->blob_by_name("ip2")->data());
+      EXPECT_NE(net->blob_by_name("ip1")->data(),
+                net->blob_by_name("ip3")->data());
+      EXPECT_NE(net->blob_by_name("ip3")->data(),
+                net->blob_by_name("ip4")->data());
+      EXPECT_GT(net->memory_optimized(), size_t(0));
+    } else {
+      EXPECT_EQ(net->memory_optimized(), size_t(0));
+    }
+    shared_ptr<Blob<Dtype> > input_blob =
+        static_pointer_cast<Blob<Dtype> >(net->blob_by_name("data"));
+    Blob<Dtype>* output_blob = static_cast<Blob<Dtype>*>(
+        net->output_blobs()[0]);
+    for (int_tp pass = 0; pass < 2; ++pass) {
+      Blob<Dtype>* input = pass == 0 ? &input1 : &input2;
+      input_blob->ReshapeLike(*input);
+      net->Reshape();
+      caffe_copy(input->count(), input->cpu_data(),
+                 input_blob->mutable_cpu_data());
+      net->Forward();
+      shared_ptr<Blob<Dtype> >& output = outputs[optimize * 2 + pass];
+      output.reset(new Blob<Dtype>());
+      output->CopyFrom(*output_blob, false, true);
+    }
+  }
+  for (int_tp pass = 0; pass < 2; ++pass) {
+    ASSERT_EQ(outputs[pass]->count(), outputs[2 + pass]->count());
+    for (int_tp i = 0; i < outputs[pass]->count(); ++i) {
+      EXPECT_EQ(outputs[pass]->cpu_data()[i], outputs[2 + pass]->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestMemoryOptimizedRecurrent) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input1(3, 2, 5, 1);
+  Blob<Dtype> input2(3, 4, 5, 1);
+  filler.Fill(&input1);
+  filler.Fill(&input2);
+
+  vector<shared_ptr<Blob<Dtype> > > outputs(4);
+  for (int_tp optimize = 0; optimize < 2; ++optimize) {
+    Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+    this->InitMemoryOptimizedRecurrentNet(optimize);
+    Net<Dtype>* net = this->net_.get();
+    if (optimize) {
+      // ip1 and lstm are shared with the unrolled net and keep their memory,
+      // ip2 is dead before ip4 is computed.
+      EXPECT_NE(net->blob_by_name("ip1")->data(),
+                net->blob_by_name("ip3")->data());
+      EXPECT_NE(net->blob_by_name("lstm")->data(),
+                net->blob_by_name("ip3")->data());
+      EXPECT_EQ(net->blob_by_name("ip2")->data(),
+                net->blob_by_name("ip4")->data());
+    }
+    shared_ptr<Blob<Dtype> > input_blob =
+        static_pointer_cast<Blob<Dtype> >(net->blob_by_name("data"));
+    shared_ptr<Blob<Dtype> > cont_blob =
+        static_pointer_cast<Blob<Dtype> >(net->blob_by_name("cont"));
+    Blob<Dtype>* output_blob = static_cast<Blob<Dtype>*>(
+        net->output_blobs()[0]);
+    for (int_tp pass = 0; pass < 2; ++pass) {
+      // The second pass re-plans the memory after the reshape
+      Blob<Dtype>* input = pass == 0 ? &input1 : &input2;
+      vector<int_tp> shape(input->shape().begin(), input->shape().end() - 1);
+      input_blob->Reshape(shape);
+      shape.pop_back();
+      cont_blob->Reshape(shape);
+      net->Reshape();
+      caffe_copy(input->count(), input->cpu_data(),
+                 input_blob->mutable_cpu_data());
+      Dtype* cont = cont_blob->mutable_cpu_data();
+      for (int_tp i = 0; i < cont_blob->count(); ++i) {
+        cont[i] = i < cont_blob->shape(1) ? 0 : 1;
+      }
+      net->Forward();
+      shared_ptr<Blob<Dtype> >& output = outputs[optimize * 2 + pass];
+      output.reset(new Blob<Dtype>());
+      output->CopyFrom(*output_blob, false, true);
+    }
+  }
+  for (int_tp pass = 0; pass < 2; ++pass) {
+    ASSERT_EQ(outputs[pass]->count(), outputs[2 + pass]->count());
+    for (int_tp i = 0; i < outputs[pass]->count(); ++i) {
+      EXPECT_EQ(outputs[pass]->cpu_data()[i], outputs[2 + pass]->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestHostMemoryStats) {
+#ifndef CPU_ONLY
+  // Host memory of zero copy devices does not come from the pool
+  if (Caffe::GetDefaultDevice()->is_host_unified()) {
+    return;
+  }
+#endif  // !CPU_ONLY
+  Caffe::set_host_memory_pool(true);
+  this->InitTinyNet();
+  this->net_->Forward();
+  Caffe::set_host_memory_pool(false);
+  const HostMemoryStats& stats = this->net_->host_memory_stats();
+  EXPECT_GT(stats.allocations, uint64_t(0));
+  EXPECT_GT(stats.bytes_in_use, uint64_t(0));
+  EXPECT_GE(stats.peak_bytes_in_use, stats.bytes_in_use);
+}
+
+TYPED_TEST(NetTest, TestParallelForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(4, 3, 4, 5);
+  filler.Fill(&input);
+
+  vector<shared_ptr<Blob<Dtype> > > outputs(2);
+  for (int_tp run = 0; run < 2; ++run) {
+    const int forward_threads = run == 0 ? 1 : 4;
+    Caffe::set_random_seed(this->seed_, Caffe::GetDefaultDevice());
+    this->InitBranchedNet(forward_threads);
+    Net<Dtype>* net = this->net_.get();
+    EXPECT_EQ(net->forward_threads(), forward_threads);
+    vector<int> events;
+    ForwardOrderCallback<Dtype> before(&events, false);
+    ForwardOrderCallback<Dtype> after(&events, true);
+    net->add_before_forward(&before);
+    net->add_after_forward(&after);
+    shared_ptr<Blob<Dtype> > input_blob =
+        static_pointer_cast<Blob<Dtype> >(net->blob_by_name("data"));
+    caffe_copy(input.count(), input.cpu_data(),
+               input_blob->mutable_cpu_data());
+    net->Forward();
+    outputs[run].reset(new Blob<Dtype>());
+    outputs[run]->CopyFrom(*static_cast<Blob<Dtype>*>(
+        net->output_blobs()[0]), false, true);
+
+    // Every layer gets both callbacks, in order, and only after the
+    // after_forward callbacks of all layers it reads from.
+    const int num_layers = net->layers().size();
+    vector<int> before_pos(num_layers, -1);
+    vector<int> after_pos(num_layers, -1);
+    ASSERT_EQ(events.size(), 2 * net->layers().size());
+    for (int i = 0; i < events.size(); ++i) {
+      if (events[i] >= 0) {
+        before_pos[events[i]] = i;
+      } else {
+        after_pos[-events[i] - 1] = i;
+      }
+    }
+    map<const BlobBase*, int> producer;
+    for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+      ASSERT_GE(before_pos[layer_id], 0);
+      EXPECT_LT(before_pos[layer_id], after_pos[layer_id]);
+      const vector<BlobBase*>& bottoms = net->bottom_vecs()[layer_id];
+      for (int i = 0; i < bottoms.size(); ++i) {
+        if (producer.count(bottoms[i])) {
+          EXPECT_LT(after_pos[producer[bottoms[i]]], before_pos[layer_id]);
+        }
+      }
+      const vector<BlobBase*>& tops = net->top_vecs()[layer_id];
+      for (int i = 0; i < tops.size(); ++i) {
+        producer[tops[i]] = layer_id;
+      }
+    }
+  }
+  ASSERT_EQ(outputs[0]->count(), outputs[1]->count());
+  for (int_tp i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_EQ(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i]);
+  }
+}
+
 TYPED_TEST(NetTest, TestReshape) {
   typedef typename TypeParam::Dtype Dtype;
   // We set up bottom blobs of two different sizes, switch between
@@ -2645,4 +3011,47 @@ TYPED_TEST(NetTest, TestAllInOneNetDeploy) {
   ASSERT_TRUE(found_data);
 }
 
+// Timing only; run with --gtest_also_run_disabled_tests.
+TEST(NetParallelForwardTest, DISABLED_TestGoogLeNetBenchmark) {
+  Caffe::set_mode(Caffe::CPU);
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(
+      EXAMPLES_SOURCE_DIR "../models/bvlc_googlenet/deploy.prototxt", &param);
+  param.mutable_state()->set_phase(TEST);
+  param.mutable_layer(0)->mutable_input_param()->mutable_shape(0)->set_dim(
+      0, 1);
+  const int kIterations = 5;
+  const int kThreads[] = {1, 2, 4, 8};
+  double sequential_ms = 0;
+  vector<float> reference;
+  for (int t = 0; t < 4; ++t) {
+    Caffe::set_random_seed(1701, Caffe::GetDefaultDevice());
+    param.set_forward_threads(kThreads[t]);
+    Net<float> net(param, Caffe::GetDefaultDevice());
+    Blob<float>* input = static_cast<Blob<float>*>(net.input_blobs()[0]);
+    caffe_set(input->count(), 1.0f, input->mutable_cpu_data());
+    net.Forward();
+    CPUTimer timer;
+    timer.Start();
+    for (int i = 0; i < kIterations; ++i) {
+      net.Forward();
+    }
+    const double ms = timer.MilliSeconds() / kIterations;
+    const Blob<float>* output =
+        static_cast<Blob<float>*>(net.output_blobs()[0]);
+    if (t == 0) {
+      sequential_ms = ms;
+      reference.assign(output->cpu_data(),
+                       output->cpu_data() + output->count());
+    } else {
+      for (int i = 0; i < output->count(); ++i) {
+        EXPECT_NEAR(reference[i], output->cpu_data()[i], 1e-5);
+      }
+    }
+    std::cout << "GoogLeNet forward, " << kThreads[t] << " threads: "
+              << ms << " ms (speedup " << sequential_ms / ms << ")"
+              << std::endl;
+  }
+}
+
 }  // namespace caffe
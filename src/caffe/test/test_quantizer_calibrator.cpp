@@ -0,0 +1,134 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/quantizer_calibrator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class CalibrationRangeTest : public ::testing::Test {};
+
+TEST_F(CalibrationRangeTest, TestPercentile) {
+  vector<double> hist(100, 1.0);
+  EXPECT_DOUBLE_EQ(50 * 0.1, HistogramPercentileRange(hist, 0.1, 50));
+  EXPECT_DOUBLE_EQ(100 * 0.1, HistogramPercentileRange(hist, 0.1, 100));
+  hist[99] = 0;
+  EXPECT_DOUBLE_EQ(99 * 0.1, HistogramPercentileRange(hist, 0.1, 100));
+}
+
+TEST_F(CalibrationRangeTest, TestEntropyClipsOutliers) {
+  // Values up to 256 bins and a single far outlier
+  vector<double> hist(2048, 0.0);
+  for (int i = 0; i < 256; ++i) {
+    hist[i] = 1000 - 3 * i;
+  }
+  hist[2047] = 1;
+  const double range = HistogramEntropyRange(hist, 1.0);
+  EXPECT_GE(range, 128);
+  EXPECT_LE(range, 512);
+}
+
+TEST_F(CalibrationRangeTest, TestEntropyUniform) {
+  // Clipping a uniform distribution only loses information
+  vector<double> hist(1024, 10.0);
+  const double range = HistogramEntropyRange(hist, 1.0);
+  EXPECT_GE(range, 0.9 * 1024);
+}
+
+TEST_F(CalibrationRangeTest, TestAssignQuantizerIndices) {
+  NetParameter param;
+  param.add_layer()->set_name("a");
+  param.add_layer()->set_name("b");
+  EXPECT_TRUE(AssignQuantizerIndices(&param));
+  EXPECT_EQ(0, param.layer(0).quantizer_index());
+  EXPECT_EQ(1, param.layer(1).quantizer_index());
+  param.mutable_layer(0)->set_quantizer_index(3);
+  param.mutable_layer(1)->clear_quantizer_index();
+  EXPECT_FALSE(AssignQuantizerIndices(&param));
+  EXPECT_EQ(0, param.layer(1).quantizer_index());
+  EXPECT_FALSE(param.layer(1).has_quantizer_index());
+}
+
+template <typename Dtype>
+class QuantizerCalibratorTest : public CPUDeviceTest<Dtype> {
+ protected:
+  // Constant input of 0.5 and weights of 1, so the inner product computes
+  // 8 * 0.5 = 4 for every output.
+  shared_ptr<Net<Dtype> > CreateNet() {
+    const string proto =
+        "name: 'TestNetwork' state { phase: TEST } "
+        "layer { name: 'data' type: 'DummyData' top: 'data' "
+        "  dummy_data_param { shape { dim: 4 dim: 8 } "
+        "    data_filler { type: 'constant' value: 0.5 } } } "
+        "layer { name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+        "  inner_product_param { num_output: 6 "
+        "    weight_filler { type: 'constant' value: 1 } "
+        "    bias_filler { type: 'constant' value: 0 } } } "
+        "layer { name: 'relu' type: 'ReLU' bottom: 'ip' top: 'relu' } ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    CHECK(AssignQuantizerIndices(&param));
+    return shared_ptr<Net<Dtype> >(
+        new Net<Dtype>(param, Caffe::GetDefaultDevice()));
+  }
+};
+
+TYPED_TEST_CASE(QuantizerCalibratorTest, TestDtypesFloatNoHalf);
+
+TYPED_TEST(QuantizerCalibratorTest, TestCalibrate) {
+  typedef TypeParam Dtype;
+  shared_ptr<Net<Dtype> > net = this->CreateNet();
+  QuantizerCalibrator<Dtype> calibrator(net.get());
+  calibrator.Calibrate(2);
+  ASSERT_EQ(3, calibrator.histograms().size());
+  // The inner product sees 32 inputs of 0.5 and 24 outputs of 4 per batch
+  const vector<double>& hist = calibrator.histograms().at(1);
+  EXPECT_EQ(2 * 32, hist[256]);
+  EXPECT_EQ(2 * 24, hist[2047]);
+
+  calibrator.ComputeRanges(CALIBRATION_MAX);
+  EXPECT_NEAR(0.5, calibrator.ranges().at(0), 1e-6);
+  EXPECT_NEAR(4, calibrator.ranges().at(1), 1e-6);
+  EXPECT_NEAR(4, calibrator.ranges().at(2), 1e-6);
+
+  calibrator.ComputeRanges(CALIBRATION_PERCENTILE, 50);
+  EXPECT_NEAR(4.0 * 257 / 2048, calibrator.ranges().at(1), 1e-6);
+
+  NetParameter param;
+  net->ToProto(&param);
+  calibrator.RangesToProto(&param);
+  ASSERT_EQ(3, param.quantizer_size());
+  for (int i = 0; i < param.quantizer_size(); ++i) {
+    const QuantizerParameter& quant_param = param.quantizer(i);
+    EXPECT_EQ(i, quant_param.index());
+    EXPECT_DOUBLE_EQ(calibrator.ranges().at(i), quant_param.observed_max());
+    EXPECT_DOUBLE_EQ(-calibrator.ranges().at(i), quant_param.observed_min());
+  }
+}
+
+TYPED_TEST(QuantizerCalibratorTest, TestSimulatedQuantization) {
+  typedef TypeParam Dtype;
+  shared_ptr<Net<Dtype> > net = this->CreateNet();
+  map<int_tp, double> ranges;
+  ranges[1] = 4;
+  SimulatedQuantization<Dtype> simulation(net.get(), ranges);
+  net->Forward();
+  // 0.5 is rounded to the nearest of 127 levels in [0, 4]
+  const double step = 4.0 / 127;
+  const double expected = 8 * std::round(0.5 / step) * step;
+  const Blob<Dtype>* ip = static_cast<Blob<Dtype>*>(
+      net->blob_by_name("ip").get());
+  for (int i = 0; i < ip->count(); ++i) {
+    EXPECT_NEAR(expected, ip->cpu_data()[i], 1e-5);
+  }
+}
+
+}  // namespace caffe
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/common.hpp"
+#include "caffe/backend/host_memory_pool.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
 
@@ -69,6 +71,96 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestHostMemoryPoolSizeClasses) {
+  size_t class_size;
+  EXPECT_EQ(HostMemoryPool::size_class(1, &class_size), 0);
+  EXPECT_EQ(class_size, 64);
+  EXPECT_EQ(HostMemoryPool::size_class(256, &class_size), 3);
+  EXPECT_EQ(class_size, 256);
+  EXPECT_EQ(HostMemoryPool::size_class(257, &class_size), 4);
+  EXPECT_EQ(class_size, 320);
+  EXPECT_EQ(HostMemoryPool::size_class(512, &class_size), 7);
+  EXPECT_EQ(class_size, 512);
+  EXPECT_EQ(HostMemoryPool::size_class(1000, &class_size), 11);
+  EXPECT_EQ(class_size, 1024);
+  for (size_t size = 1; size < (1 << 20); size = size * 3 / 2 + 1) {
+    const size_t cls = HostMemoryPool::size_class(size, &class_size);
+    EXPECT_GE(class_size, size);
+    EXPECT_LE(class_size, size + std::max<size_t>(63, size / 4));
+    EXPECT_EQ(HostMemoryPool::class_size_of(cls), class_size);
+  }
+}
+
+TEST_F(SyncedMemoryTest, TestHostMemoryPoolReuse) {
+  shared_ptr<HostMemoryPool> pool = make_shared<HostMemoryPool>();
+  void* ptr = pool->Allocate(1000);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % CAFFE_MALLOC_CACHE_ALIGN, 0);
+  pool->Release(ptr, 1000);
+  // Same size class, served from the thread cache
+  EXPECT_EQ(pool->Allocate(900), ptr);
+  HostMemoryStats stats = pool->stats();
+  EXPECT_EQ(stats.allocations, 2);
+  EXPECT_EQ(stats.cache_hits, 1);
+  EXPECT_EQ(stats.bytes_in_use, 1024);
+  EXPECT_EQ(stats.peak_bytes_in_use, 1024);
+  pool->Release(ptr, 900);
+  stats = pool->stats();
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_EQ(stats.bytes_cached, 1024);
+  pool->Trim();
+  EXPECT_EQ(pool->stats().bytes_cached, 0);
+}
+
+TEST_F(SyncedMemoryTest, TestHostMemoryPoolAlignment) {
+  shared_ptr<HostMemoryPool> pool = make_shared<HostMemoryPool>();
+  const size_t page_size = 10000;
+  const size_t huge_size = 3 * CAFFE_MALLOC_HUGE_PAGE_ALIGN;
+  void* page_ptr = pool->Allocate(page_size);
+  void* huge_ptr = pool->Allocate(huge_size);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(page_ptr) % CAFFE_MALLOC_PAGE_ALIGN,
+            0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(huge_ptr)
+            % CAFFE_MALLOC_HUGE_PAGE_ALIGN, 0);
+  caffe_memset(huge_size, 1, huge_ptr);
+  pool->Release(page_ptr, page_size);
+  pool->Release(huge_ptr, huge_size);
+  // Large blocks go through the shared free lists
+  EXPECT_EQ(pool->Allocate(huge_size), huge_ptr);
+  pool->Release(huge_ptr, huge_size);
+}
+
+TEST_F(SyncedMemoryTest, TestPooledCPUWrite) {
+#ifndef CPU_ONLY
+  // Skip the test on zero copy devices, their host memory is allocated by
+  // the device and not by the pool
+  if (Caffe::GetDefaultDevice()->is_host_unified()) {
+    return;
+  }
+#endif  // !CPU_ONLY
+  Caffe::set_host_memory_pool(true);
+  const HostMemoryStats start = HostMemoryPool::thread_stats();
+  void* first_ptr;
+  {
+    SyncedMemory mem(4096, Caffe::GetDefaultDevice());
+    first_ptr = mem.mutable_cpu_data();
+    caffe_memset(mem.size(), 1, first_ptr);
+  }
+  {
+    SyncedMemory mem(4000, Caffe::GetDefaultDevice());
+    const void* cpu_data = mem.cpu_data();
+    // Pooled memory is handed out zero initialized like fresh memory
+    for (int_tp i = 0; i < mem.size(); ++i) {
+      EXPECT_EQ((static_cast<const char*>(cpu_data))[i], 0);
+    }
+  }
+  Caffe::set_host_memory_pool(false);
+  const HostMemoryStats& stats = HostMemoryPool::thread_stats();
+  // Both requests fall into the same size class, the second one reuses the
+  // block released by the first
+  EXPECT_EQ(stats.allocations - start.allocations, 2);
+  EXPECT_EQ(stats.cache_hits - start.cache_hits, 1);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
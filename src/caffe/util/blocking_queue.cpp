@@ -1,6 +1,7 @@
 #include <boost/thread.hpp>
 #include <string>
 
+#include "caffe/inference_batcher.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/util/blocking_queue.hpp"
@@ -56,6 +57,26 @@ T BlockingQueue<T>::pop(const string& log_on_wait) {
   return t;
 }
 
+template<typename T>
+bool BlockingQueue<T>::pop_for(T* t, int64_t microseconds) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  const boost::system_time timeout = boost::get_system_time()
+      + boost::posix_time::microseconds(microseconds);
+
+  while (queue_.empty()) {
+    if (!sync_->condition_.timed_wait(lock, timeout)) {
+      if (queue_.empty()) {
+        return false;
+      }
+      break;
+    }
+  }
+
+  *t = queue_.front();
+  queue_.pop();
+  return true;
+}
+
 template<typename T>
 bool BlockingQueue<T>::try_peek(T* t) {
   boost::mutex::scoped_lock lock(sync_->mutex_);
@@ -87,12 +108,15 @@ uint_tp BlockingQueue<T>::size() const {
 
 #ifdef USE_HALF
 template class BlockingQueue<Batch<half_fp>*>;
+template class BlockingQueue<InferenceRequest<half_fp>*>;
 #endif
 #ifdef USE_SINGLE
 template class BlockingQueue<Batch<float>*>;
+template class BlockingQueue<InferenceRequest<float>*>;
 #endif
 #ifdef USE_DOUBLE
 template class BlockingQueue<Batch<double>*>;
+template class BlockingQueue<InferenceRequest<double>*>;
 #endif
 
 }  // namespace caffe
@@ -0,0 +1,251 @@
+#include "caffe/util/db_packed.hpp"
+
+#if defined(_MSC_VER)
+#include <fstream>  // NOLINT(readability/streams)
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef USE_SNAPPY
+#include <snappy.h>
+#endif
+
+#include <cstring>
+#include <string>
+
+namespace caffe { namespace db {
+
+static const char kPackedMagic[8] = {'C', 'A', 'F', 'F', 'E', 'P', 'K', 'D'};
+static const uint32_t kPackedVersion = 1;
+
+PackedCursor::PackedCursor(const char* data, const PackedHeader& header)
+    : data_(data), header_(header),
+      index_(reinterpret_cast<const PackedRecord*>(data + header.index_offset)),
+      keys_(data + header.keys_offset), position_(0) {
+}
+
+string PackedCursor::key() {
+  const PackedRecord& record = index_[position_];
+  return string(keys_ + record.key_offset, record.key_size);
+}
+
+string PackedCursor::value() {
+  const char* data;
+  size_t size;
+  value(&data, &size);
+  return string(data, size);
+}
+
+void PackedCursor::value(const char** data, size_t* size) {
+  DCHECK(valid());
+  if (header_.record_stride > 0) {
+    *data = data_ + sizeof(PackedHeader) + position_ * header_.record_stride;
+    *size = header_.record_stride;
+    return;
+  }
+  const PackedRecord& record = index_[position_];
+  switch (record.codec) {
+  case PACKED_RAW:
+    *data = data_ + record.offset;
+    *size = record.size;
+    break;
+#ifdef USE_SNAPPY
+  case PACKED_SNAPPY:
+    CHECK(snappy::Uncompress(data_ + record.offset, record.size, &buffer_))
+        << "Corrupted record " << position_;
+    CHECK_EQ(buffer_.size(), record.raw_size);
+    *data = buffer_.data();
+    *size = buffer_.size();
+    break;
+#endif  // USE_SNAPPY
+  default:
+    LOG(FATAL) << "Unsupported codec " << record.codec << " of record "
+               << position_;
+  }
+}
+
+void PackedDB::Open(const string& source, Mode mode) {
+  source_ = source;
+  if (mode == NEW) {
+    memcpy(header_.magic, kPackedMagic, sizeof(kPackedMagic));
+    header_.version = kPackedVersion;
+    header_.flags = 0;
+    header_.num_records = 0;
+    header_.index_offset = sizeof(PackedHeader);
+    header_.keys_offset = sizeof(PackedHeader);
+    header_.record_stride = 0;
+    index_.clear();
+    keys_.clear();
+    file_ = fopen(source.c_str(), "wb");
+    CHECK(file_) << "Failed to create packed db " << source;
+    CHECK_EQ(fwrite(&header_, sizeof(header_), 1, file_), 1);
+    LOG_IF(INFO, Caffe::root_solver()) << "Created packed db " << source;
+    return;
+  }
+
+#if defined(_MSC_VER)
+  std::ifstream file(source.c_str(), std::ios::in | std::ios::binary);
+  CHECK(file) << "Failed to open packed db " << source;
+  file.seekg(0, std::ios::end);
+  map_size_ = file.tellg();
+  file.seekg(0, std::ios::beg);
+  map_ = new char[map_size_];
+  CHECK(file.read(map_, map_size_)) << "Failed to read packed db " << source;
+#else
+  int fd = open(source.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open packed db " << source;
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat packed db " << source;
+  map_size_ = st.st_size;
+  CHECK_GE(map_size_, sizeof(PackedHeader)) << "Truncated packed db "
+                                            << source;
+  void* map = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(map != MAP_FAILED) << "Failed to map packed db " << source;
+  map_ = static_cast<char*>(map);
+#endif
+  memcpy(&header_, map_, sizeof(PackedHeader));
+  CHECK_EQ(memcmp(header_.magic, kPackedMagic, sizeof(kPackedMagic)), 0)
+      << source << " is not a packed db";
+  CHECK_EQ(header_.version, kPackedVersion)
+      << "Unsupported version of packed db " << source;
+  CHECK_LE(header_.index_offset
+           + header_.num_records * sizeof(PackedRecord), header_.keys_offset)
+      << "Corrupted index of packed db " << source;
+  CHECK_LE(header_.keys_offset, map_size_)
+      << "Truncated packed db " << source;
+  CHECK(header_.record_stride == 0
+        || sizeof(PackedHeader) + header_.num_records * header_.record_stride
+           <= header_.index_offset)
+      << "Corrupted records of packed db " << source;
+
+  if (mode == WRITE) {
+    // Append after the last record, the index and keys are rewritten on Close
+    const PackedRecord* index =
+        reinterpret_cast<const PackedRecord*>(map_ + header_.index_offset);
+    index_.assign(index, index + header_.num_records);
+    keys_.assign(map_ + header_.keys_offset,
+                 map_size_ - header_.keys_offset);
+    const uint64_t index_offset = header_.index_offset;
+    Close();
+    file_ = fopen(source.c_str(), "r+b");
+    CHECK(file_) << "Failed to open packed db " << source;
+    CHECK_EQ(fseek(file_, index_offset, SEEK_SET), 0);
+    header_.index_offset = index_offset;
+    LOG_IF(INFO, Caffe::root_solver()) << "Opened packed db " << source;
+    return;
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Opened packed db " << source
+      << " with " << header_.num_records << " records";
+}
+
+void PackedDB::Close() {
+  if (file_ != NULL) {
+    // The index and keys follow the last record, aligned for the index
+    const char padding[sizeof(uint64_t)] = {0};
+    const size_t padding_size = (sizeof(uint64_t)
+        - header_.index_offset % sizeof(uint64_t)) % sizeof(uint64_t);
+    CHECK_EQ(fwrite(padding, 1, padding_size, file_), padding_size);
+    header_.index_offset += padding_size;
+    header_.num_records = index_.size();
+    header_.keys_offset = header_.index_offset
+                          + index_.size() * sizeof(PackedRecord);
+    header_.record_stride = 0;
+    if (index_.size() > 0 && (header_.flags & kPackedCompressed) == 0) {
+      header_.record_stride = index_[0].size;
+      for (size_t i = 0; i < index_.size(); ++i) {
+        if (index_[i].size != header_.record_stride || index_[i].offset
+            != sizeof(PackedHeader) + i * header_.record_stride) {
+          header_.record_stride = 0;
+          break;
+        }
+      }
+    }
+    if (index_.size() > 0) {
+      CHECK_EQ(fwrite(&index_[0], sizeof(PackedRecord), index_.size(), file_),
+               index_.size());
+    }
+    CHECK_EQ(fwrite(keys_.data(), 1, keys_.size(), file_), keys_.size());
+    CHECK_EQ(fseek(file_, 0, SEEK_SET), 0);
+    CHECK_EQ(fwrite(&header_, sizeof(header_), 1, file_), 1);
+    CHECK_EQ(fclose(file_), 0) << "Failed to write packed db " << source_;
+    file_ = NULL;
+    index_.clear();
+    keys_.clear();
+  }
+  if (map_ != NULL) {
+#if defined(_MSC_VER)
+    delete[] map_;
+#else
+    munmap(map_, map_size_);
+#endif
+    map_ = NULL;
+    map_size_ = 0;
+  }
+}
+
+PackedCursor* PackedDB::NewCursor() {
+  CHECK(map_) << "Packed db " << source_ << " is not open for reading";
+  return new PackedCursor(map_, header_);
+}
+
+PackedTransaction* PackedDB::NewTransaction() {
+  CHECK(file_) << "Packed db " << source_ << " is not open for writing";
+  return new PackedTransaction(this);
+}
+
+void PackedDB::set_compress(bool compress) {
+#ifndef USE_SNAPPY
+  CHECK(!compress) << "Compression of packed db requires Snappy";
+#endif
+  compress_ = compress;
+}
+
+void PackedDB::Append(const string& key, const string& value) {
+  PackedRecord record;
+  record.offset = header_.index_offset;
+  record.size = value.size();
+  record.raw_size = value.size();
+  record.key_offset = keys_.size();
+  record.key_size = key.size();
+  record.codec = PACKED_RAW;
+  const char* data = value.data();
+#ifdef USE_SNAPPY
+  string compressed;
+  if (compress_) {
+    snappy::Compress(value.data(), value.size(), &compressed);
+    if (compressed.size() < value.size()) {
+      record.size = compressed.size();
+      record.codec = PACKED_SNAPPY;
+      data = compressed.data();
+      header_.flags |= kPackedCompressed;
+    }
+  }
+#endif  // USE_SNAPPY
+  CHECK_EQ(fwrite(data, 1, record.size, file_), record.size)
+      << "Failed to write packed db " << source_;
+  header_.index_offset += record.size;
+  index_.push_back(record);
+  keys_ += key;
+}
+
+void PackedTransaction::Put(const string& key, const string& value) {
+  keys.push_back(key);
+  values.push_back(value);
+}
+
+void PackedTransaction::Commit() {
+  for (size_t i = 0; i < keys.size(); ++i) {
+    db_->Append(keys[i], values[i]);
+  }
+  CHECK_EQ(fflush(db_->file_), 0) << "Failed to write packed db "
+                                  << db_->source_;
+  keys.clear();
+  values.clear();
+}
+
+}  // namespace db
+}  // namespace caffe
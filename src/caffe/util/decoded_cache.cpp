@@ -0,0 +1,108 @@
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "caffe/util/decoded_cache.hpp"
+
+namespace caffe {
+
+struct DecodedCache::Entry {
+  string key;
+  cv::Mat image;
+  int_tp label;
+  size_t bytes;
+};
+
+DecodedCache::DecodedCache(size_t capacity)
+    : capacity_(capacity), bytes_(0), hits_(0), misses_(0) {
+}
+
+shared_ptr<DecodedCache> DecodedCache::Shared(const string& name,
+                                              size_t capacity) {
+  static std::mutex mutex;
+  static std::map<string, std::weak_ptr<DecodedCache> > caches;
+  std::lock_guard<std::mutex> lock(mutex);
+  shared_ptr<DecodedCache> cache = caches[name].lock();
+  if (!cache) {
+    cache.reset(new DecodedCache(capacity));
+    caches[name] = cache;
+    LOG(INFO) << "Caching up to " << (capacity >> 20)
+              << " MB of decoded images of " << name;
+  }
+  return cache;
+}
+
+bool DecodedCache::Lookup(const string& key, cv::Mat* image,
+                          int_tp* label) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unordered_map<string, EntryList::iterator>::iterator it =
+      index_.find(key);
+  if (it == index_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  // Move to the front, iterators of std::list stay valid
+  entries_.splice(entries_.begin(), entries_, it->second);
+  *image = (*it->second)->image;
+  *label = (*it->second)->label;
+  return true;
+}
+
+void DecodedCache::Insert(const string& key, const cv::Mat& image,
+                          int_tp label) {
+  const size_t bytes = image.total() * image.elemSize();
+  if (bytes > capacity_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index_.find(key) != index_.end()) {
+    // Decoded by another worker meanwhile
+    return;
+  }
+  while (bytes_ + bytes > capacity_) {
+    bytes_ -= entries_.back()->bytes;
+    index_.erase(entries_.back()->key);
+    entries_.pop_back();
+  }
+  shared_ptr<Entry> entry(new Entry());
+  entry->key = key;
+  entry->image = image;
+  entry->label = label;
+  entry->bytes = bytes;
+  entries_.push_front(entry);
+  index_[key] = entries_.begin();
+  bytes_ += bytes;
+}
+
+size_t DecodedCache::bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_;
+}
+
+size_t DecodedCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+uint64_t DecodedCache::hits() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+uint64_t DecodedCache::misses() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+double DecodedCache::hit_rate() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const uint64_t lookups = hits_ + misses_;
+  return lookups > 0 ? static_cast<double>(hits_) / lookups : 0.;
+}
+
+}  // namespace caffe
+#endif  // USE_OPENCV
@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Whether the convolution applies fuse_type itself
+static bool SupportsFusion(const LayerParameter& layer_param) {
+  const ConvolutionParameter& conv_param = layer_param.convolution_param();
+  return (conv_param.engine() == ConvolutionParameter_Engine_DIRECT
+          && conv_param.group() == 1)
+      || conv_param.engine() == ConvolutionParameter_Engine_INTEL_SPATIAL;
+}
+
+static bool SameDataTypes(const LayerParameter& a, const LayerParameter& b) {
+  return a.bottom_data_type() == b.bottom_data_type()
+      && a.compute_data_type() == b.compute_data_type()
+      && a.top_data_type() == b.top_data_type();
+}
+
+static bool IsSingleBlobLayer(const LayerParameter& layer_param) {
+  return layer_param.bottom_size() == 1 && layer_param.top_size() == 1
+      && layer_param.loss_weight_size() == 0;
+}
+
+static bool IsFoldableBatchNorm(const LayerParameter& layer_param) {
+  const BatchNormParameter& bn_param = layer_param.batch_norm_param();
+  return layer_param.type() == "BatchNorm" && IsSingleBlobLayer(layer_param)
+      && (!bn_param.has_use_global_stats() || bn_param.use_global_stats())
+      && !bn_param.fused_relu();
+}
+
+static bool IsFoldableScale(const LayerParameter& layer_param) {
+  const ScaleParameter& scale_param = layer_param.scale_param();
+  return layer_param.type() == "Scale" && IsSingleBlobLayer(layer_param)
+      && scale_param.axis() == 1 && scale_param.num_axes() == 1;
+}
+
+static bool IsFusableEltwise(const LayerParameter& layer_param) {
+  const EltwiseParameter& eltwise_param = layer_param.eltwise_param();
+  if (layer_param.type() != "Eltwise" || layer_param.bottom_size() != 2
+      || layer_param.top_size() != 1 || layer_param.loss_weight_size() > 0
+      || eltwise_param.operation() != EltwiseParameter_EltwiseOp_SUM) {
+    return false;
+  }
+  for (int_tp i = 0; i < eltwise_param.coeff_size(); ++i) {
+    if (eltwise_param.coeff(i) != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The layers reading each top, as (layer, bottom) indices
+typedef map<pair<int_tp, int_tp>, vector<pair<int_tp, int_tp> > > TopReaders;
+
+// The only layer reading the first top of layer i, or -1
+static int_tp SoleReader(TopReaders* readers, int_tp i) {
+  const vector<pair<int_tp, int_tp> >& top_readers =
+      (*readers)[make_pair(i, 0)];
+  return top_readers.size() == 1 ? top_readers[0].first : -1;
+}
+
+// Removes in-place Dropout layers, which copy their input in the TEST
+// phase, and Split layers with a single top, which only alias their input.
+static void RemoveIdentityLayers(const NetParameter& param,
+                                 vector<LayerParameter>* layers) {
+  // Removed Split tops and the blobs they alias
+  map<string, string> aliases;
+  for (int_tp i = 0; i < param.layer_size(); ++i) {
+    LayerParameter layer_param = param.layer(i);
+    for (int_tp j = 0; j < layer_param.bottom_size(); ++j) {
+      if (aliases.count(layer_param.bottom(j))) {
+        layer_param.set_bottom(j, aliases[layer_param.bottom(j)]);
+      }
+    }
+    const bool single = IsSingleBlobLayer(layer_param);
+    const bool in_place = single
+        && layer_param.bottom(0) == layer_param.top(0);
+    if (layer_param.type() == "Dropout" && in_place) {
+      continue;
+    }
+    for (int_tp j = 0; j < layer_param.top_size(); ++j) {
+      aliases.erase(layer_param.top(j));
+    }
+    if (layer_param.type() == "Split" && single) {
+      // Keep the tops that are net outputs.
+      bool read_later = in_place;
+      for (int_tp k = i + 1; k < param.layer_size() && !read_later; ++k) {
+        for (int_tp j = 0; j < param.layer(k).bottom_size(); ++j) {
+          read_later |= param.layer(k).bottom(j) == layer_param.top(0);
+        }
+      }
+      if (read_later) {
+        if (!in_place) {
+          aliases[layer_param.top(0)] = layer_param.bottom(0);
+        }
+        continue;
+      }
+    }
+    layers->push_back(layer_param);
+  }
+}
+
+void FuseLayers(const NetParameter& param, NetParameter* param_fused,
+                map<string, vector<LayerParameter> >* folded_layers) {
+  param_fused->CopyFrom(param);
+  if (!param.fuse_layers() || param.state().phase() != TEST) {
+    return;
+  }
+  param_fused->clear_layer();
+  vector<LayerParameter> layers;
+  RemoveIdentityLayers(param, &layers);
+
+  TopReaders readers;
+  map<string, pair<int_tp, int_tp> > last_top;
+  for (int_tp i = 0; i < layers.size(); ++i) {
+    for (int_tp j = 0; j < layers[i].bottom_size(); ++j) {
+      if (last_top.count(layers[i].bottom(j))) {
+        readers[last_top[layers[i].bottom(j)]].push_back(make_pair(i, j));
+      }
+    }
+    for (int_tp j = 0; j < layers[i].top_size(); ++j) {
+      last_top[layers[i].top(j)] = make_pair(i, j);
+    }
+  }
+
+  vector<bool> fused(layers.size(), false);
+  map<int_tp, LayerParameter> fused_layers;
+  for (int_tp i = 0; i < layers.size(); ++i) {
+    const LayerParameter& conv = layers[i];
+    if (conv.type() != "Convolution" || !IsSingleBlobLayer(conv)
+        || conv.convolution_param().fuse_type()
+            != ConvolutionParameter_FuseType_UNFUSED) {
+      continue;
+    }
+    vector<int_tp> chain;
+    int_tp last = i;
+    int_tp next = SoleReader(&readers, last);
+    if (next >= 0 && IsFoldableBatchNorm(layers[next])
+        && SameDataTypes(conv, layers[next])) {
+      chain.push_back(next);
+      last = next;
+      next = SoleReader(&readers, last);
+    }
+    if (next >= 0 && IsFoldableScale(layers[next])
+        && SameDataTypes(conv, layers[next])) {
+      chain.push_back(next);
+      last = next;
+      next = SoleReader(&readers, last);
+    }
+    const int_tp folds = chain.size();
+    int_tp eltwise = -1;
+    int_tp relu = -1;
+    // An Eltwise layer may end the chains of two convolutions, the first
+    // one takes it.
+    if (next >= 0 && !fused[next] && SupportsFusion(conv)
+        && SameDataTypes(conv, layers[next])) {
+      if (IsFusableEltwise(layers[next])) {
+        const int_tp after = SoleReader(&readers, next);
+        if (after >= 0 && layers[after].type() == "ReLU"
+            && IsSingleBlobLayer(layers[after])
+            && SameDataTypes(conv, layers[after])) {
+          eltwise = next;
+          relu = after;
+        }
+      } else if (layers[next].type() == "ReLU"
+                 && IsSingleBlobLayer(layers[next])) {
+        relu = next;
+      }
+    }
+    if (relu >= 0) {
+      if (eltwise >= 0) {
+        chain.push_back(eltwise);
+      }
+      chain.push_back(relu);
+      last = relu;
+    }
+    if (chain.empty()) {
+      continue;
+    }
+
+    LayerParameter fused_conv = conv;
+    ConvolutionParameter* conv_param = fused_conv.mutable_convolution_param();
+    if (eltwise >= 0) {
+      const LayerParameter& eltwise_param = layers[eltwise];
+      // The summand is the Eltwise bottom not produced by the chain.
+      const int_tp producer = folds > 0 ? chain[folds - 1] : i;
+      const int_tp chain_bottom = readers[make_pair(producer, 0)][0].second;
+      fused_conv.add_bottom(eltwise_param.bottom(1 - chain_bottom));
+      *conv_param->mutable_eltwise_param() = eltwise_param.eltwise_param();
+      conv_param->set_fuse_type(
+          ConvolutionParameter_FuseType_FUSED_CONV_ELTWISE_RELU);
+    } else if (relu >= 0) {
+      conv_param->set_fuse_type(ConvolutionParameter_FuseType_FUSED_CONV_RELU);
+    }
+    if (relu >= 0) {
+      *conv_param->mutable_relu_param() = layers[relu].relu_param();
+    }
+    // The fused layer runs in place of the last layer of the chain, the
+    // other layers in between must not overwrite the input of the
+    // convolution, or the summand after the Eltwise layer read it.
+    fused_conv.set_top(0, layers[last].top(0));
+    bool bottoms_intact = true;
+    for (int_tp b = 0; b < fused_conv.bottom_size(); ++b) {
+      bottoms_intact &= fused_conv.top(0) != fused_conv.bottom(b);
+    }
+    for (int_tp k = i + 1; k < last; ++k) {
+      if (std::find(chain.begin(), chain.end(), k) != chain.end()) {
+        continue;
+      }
+      for (int_tp j = 0; j < layers[k].top_size(); ++j) {
+        bottoms_intact &= layers[k].top(j) != fused_conv.bottom(0);
+        if (eltwise >= 0 && k > eltwise) {
+          bottoms_intact &= layers[k].top(j) != fused_conv.bottom(1);
+        }
+      }
+    }
+    if (!bottoms_intact) {
+      continue;
+    }
+    if (folds > 0) {
+      conv_param->set_bias_term(true);
+      vector<LayerParameter>& folded = (*folded_layers)[conv.name()];
+      for (int_tp k = 0; k < folds; ++k) {
+        folded.push_back(layers[chain[k]]);
+      }
+    }
+    fused[i] = true;
+    for (int_tp k = 0; k < chain.size(); ++k) {
+      fused[chain[k]] = true;
+    }
+    fused_layers[last] = fused_conv;
+    LOG(INFO) << "Fused layer " << conv.name() << " with "
+              << chain.size() << " following layer(s)";
+  }
+  for (int_tp i = 0; i < layers.size(); ++i) {
+    if (fused_layers.count(i)) {
+      param_fused->add_layer()->CopyFrom(fused_layers[i]);
+    } else if (!fused[i]) {
+      param_fused->add_layer()->CopyFrom(layers[i]);
+    }
+  }
+}
+
+void FoldLayerWeights(
+    const map<string, vector<LayerParameter> >& folded_layers,
+    NetParameter* weights) {
+  map<string, int_tp> layer_index;
+  for (int_tp i = 0; i < weights->layer_size(); ++i) {
+    layer_index[weights->layer(i).name()] = i;
+  }
+  for (map<string, vector<LayerParameter> >::const_iterator it =
+       folded_layers.begin(); it != folded_layers.end(); ++it) {
+    if (layer_index.count(it->first) == 0) {
+      continue;
+    }
+    LayerParameter* conv = weights->mutable_layer(layer_index[it->first]);
+    bool folding = false;
+    for (int_tp f = 0; f < it->second.size(); ++f) {
+      folding |= layer_index.count(it->second[f].name()) > 0;
+    }
+    // Weights saved from a fused net are folded already.
+    if (!folding || conv->blobs_size() == 0) {
+      continue;
+    }
+    Blob<double> weight(Caffe::GetDefaultDevice());
+    weight.FromProto(conv->blobs(0), true);
+    const int_tp channels = weight.shape(0);
+    const int_tp weight_dim = weight.count() / channels;
+    Blob<double> bias(Caffe::GetDefaultDevice());
+    if (conv->blobs_size() > 1) {
+      bias.FromProto(conv->blobs(1), true);
+    } else {
+      bias.Reshape(vector<int_tp>(1, channels));
+      caffe_set(channels, 0.0, bias.mutable_cpu_data());
+    }
+    CHECK_EQ(bias.count(), channels);
+    double* weight_data = weight.mutable_cpu_data();
+    double* bias_data = bias.mutable_cpu_data();
+    for (int_tp f = 0; f < it->second.size(); ++f) {
+      const LayerParameter& folded = it->second[f];
+      if (layer_index.count(folded.name()) == 0) {
+        continue;
+      }
+      const LayerParameter& source = weights->layer(layer_index[folded.name()]);
+      vector<shared_ptr<Blob<double> > > blobs;
+      for (int_tp j = 0; j < source.blobs_size(); ++j) {
+        blobs.push_back(make_shared<Blob<double> >(
+            Caffe::GetDefaultDevice()));
+        blobs[j]->FromProto(source.blobs(j), true);
+      }
+      vector<double> scale(channels);
+      vector<double> shift(channels, 0.0);
+      if (folded.type() == "BatchNorm") {
+        CHECK_EQ(blobs.size(), 3) << "Incompatible number of blobs for layer "
+                                  << folded.name();
+        // y = (x - mean) / sqrt(variance + eps), the statistics being sums
+        // weighted by the moving average factor in blobs[2].
+        const double factor = blobs[2]->cpu_data()[0] == 0 ?
+            0 : 1 / blobs[2]->cpu_data()[0];
+        const double eps = folded.batch_norm_param().eps();
+        for (int_tp c = 0; c < channels; ++c) {
+          const double mean = blobs[0]->cpu_data()[c] * factor;
+          const double variance = blobs[1]->cpu_data()[c] * factor;
+          scale[c] = 1 / std::sqrt(variance + eps);
+          shift[c] = -mean * scale[c];
+        }
+      } else {
+        CHECK_GE(blobs.size(), 1) << "Incompatible number of blobs for layer "
+                                  << folded.name();
+        for (int_tp c = 0; c < channels; ++c) {
+          scale[c] = blobs[0]->cpu_data()[c];
+          shift[c] = blobs.size() > 1 ? blobs[1]->cpu_data()[c] : 0;
+        }
+      }
+      for (int_tp c = 0; c < channels; ++c) {
+        caffe_scal(weight_dim, scale[c], weight_data + c * weight_dim);
+        bias_data[c] = bias_data[c] * scale[c] + shift[c];
+      }
+      LOG(INFO) << "Folded " << folded.name() << " into " << conv->name();
+    }
+    weight.ToProto(conv->mutable_blobs(0));
+    if (conv->blobs_size() > 1) {
+      bias.ToProto(conv->mutable_blobs(1));
+    } else {
+      bias.ToProto(conv->add_blobs());
+    }
+  }
+}
+
+}  // namespace caffe
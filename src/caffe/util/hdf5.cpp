@@ -6,11 +6,9 @@
 
 namespace caffe {
 
-// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
-template <typename Dtype>
-void hdf5_load_nd_dataset_helper(
-    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
-    Blob<Dtype>* blob, bool reshape) {
+// Verifies format of data stored in HDF5 file and returns its shape.
+vector<int_tp> hdf5_get_dataset_shape(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim) {
   // Verify that the dataset exists.
   CHECK(H5LTfind_dataset(file_id, dataset_name_))
       << "Failed to find HDF5 dataset " << dataset_name_;
@@ -61,7 +59,16 @@ void hdf5_load_nd_dataset_helper(
   for (int_tp i = 0; i < dims.size(); ++i) {
     blob_dims[i] = dims[i];
   }
+  return blob_dims;
+}
 
+// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
+template <typename Dtype>
+void hdf5_load_nd_dataset_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob<Dtype>* blob, bool reshape) {
+  vector<int_tp> blob_dims = hdf5_get_dataset_shape(file_id, dataset_name_,
+                                                    min_dim, max_dim);
   if (reshape) {
     blob->Reshape(blob_dims);
   } else {
@@ -115,6 +122,71 @@ void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
   CHECK_GE(status, 0) << "Failed to read double dataset " << dataset_name_;
 }
 
+template <typename Dtype>
+static hid_t hdf5_native_type();
+#ifdef USE_HALF
+// Matches the short datasets read and written for half_fp blobs
+template <>
+hid_t hdf5_native_type<half_fp>() {
+  return H5T_NATIVE_SHORT;
+}
+#endif
+template <>
+hid_t hdf5_native_type<float>() {
+  return H5T_NATIVE_FLOAT;
+}
+template <>
+hid_t hdf5_native_type<double>() {
+  return H5T_NATIVE_DOUBLE;
+}
+
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(
+    hid_t file_id, const char* dataset_name_, hsize_t row_start,
+    hsize_t num_rows, Blob<Dtype>* blob) {
+  vector<int_tp> shape = hdf5_get_dataset_shape(file_id, dataset_name_, 1,
+                                                INT_MAX);
+  CHECK_LE(row_start + num_rows, static_cast<hsize_t>(shape[0]))
+      << "Rows out of range of HDF5 dataset " << dataset_name_;
+  shape[0] = num_rows;
+  blob->Reshape(shape);
+  if (num_rows == 0) {
+    return;
+  }
+  vector<hsize_t> start(shape.size(), 0);
+  start[0] = row_start;
+  vector<hsize_t> count(shape.begin(), shape.end());
+  hid_t dataset_id = H5Dopen2(file_id, dataset_name_, H5P_DEFAULT);
+  CHECK_GE(dataset_id, 0) << "Failed to open HDF5 dataset " << dataset_name_;
+  hid_t file_space_id = H5Dget_space(dataset_id);
+  CHECK_GE(file_space_id, 0) << "Failed to get dataspace of "
+                             << dataset_name_;
+  herr_t status = H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET,
+      start.data(), NULL, count.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select rows of " << dataset_name_;
+  hid_t mem_space_id = H5Screate_simple(count.size(), count.data(), NULL);
+  CHECK_GE(mem_space_id, 0) << "Failed to create dataspace for "
+                            << dataset_name_;
+  status = H5Dread(dataset_id, hdf5_native_type<Dtype>(), mem_space_id,
+                   file_space_id, H5P_DEFAULT, blob->mutable_cpu_data());
+  CHECK_GE(status, 0) << "Failed to read rows of dataset " << dataset_name_;
+  H5Sclose(mem_space_id);
+  H5Sclose(file_space_id);
+  H5Dclose(dataset_id);
+}
+
+#ifdef USE_HALF
+template void hdf5_load_nd_dataset_rows<half_fp>(
+    hid_t file_id, const char* dataset_name_, hsize_t row_start,
+    hsize_t num_rows, Blob<half_fp>* blob);
+#endif
+template void hdf5_load_nd_dataset_rows<float>(
+    hid_t file_id, const char* dataset_name_, hsize_t row_start,
+    hsize_t num_rows, Blob<float>* blob);
+template void hdf5_load_nd_dataset_rows<double>(
+    hid_t file_id, const char* dataset_name_, hsize_t row_start,
+    hsize_t num_rows, Blob<double>* blob);
+
 #ifdef USE_HALF
 template <>
 void hdf5_save_nd_dataset<half_fp>(
@@ -221,6 +293,22 @@ void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i) {
     << "Failed to save int dataset with name " << dataset_name;
 }
 
+float hdf5_load_float(hid_t loc_id, const string& dataset_name) {
+  float val;
+  herr_t status = H5LTread_dataset_float(loc_id, dataset_name.c_str(), &val);
+  CHECK_GE(status, 0)
+    << "Failed to load float dataset with name " << dataset_name;
+  return val;
+}
+
+void hdf5_save_float(hid_t loc_id, const string& dataset_name, float f) {
+  hsize_t one = 1;
+  herr_t status = \
+    H5LTmake_dataset_float(loc_id, dataset_name.c_str(), 1, &one, &f);
+  CHECK_GE(status, 0)
+    << "Failed to save float dataset with name " << dataset_name;
+}
+
 int hdf5_get_num_links(hid_t loc_id) {
   H5G_info_t info;
   herr_t status = H5Gget_info(loc_id, &info);
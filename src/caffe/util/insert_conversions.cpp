@@ -1,3 +1,6 @@
+#include <set>
+#include <utility>
+
 #include "caffe/util/insert_conversions.hpp"
 
 namespace caffe {
@@ -76,4 +79,151 @@ string ConversionBlobName(const string& layer_name, const string& blob_name,
   return convert_blob_name.str();
 }
 
+// Current versions of the blobs while InsertLayoutConversions walks the net
+struct BlobLayouts {
+  // Blocked blob name and block size of blobs with a current blocked version
+  map<string, std::pair<string, int_tp> > blocked;
+  // Blobs whose only current version is the blocked one
+  std::set<string> stale_plain;
+  // Blocked blobs read by some layer
+  std::set<string> consumed;
+  map<string, DataType> data_types;
+};
+
+// Points bottom j of layer_param at a version of the blob with the given
+// block size (0 for NCHW), inserting Reorder layers into param_convert.
+static void RequireLayout(int_tp j, int_tp channel_block,
+                          BlobLayouts* layouts, LayerParameter* layer_param,
+                          NetParameter* param_convert) {
+  const string blob_name = layer_param->bottom(j);
+  const DataType data_type = layouts->data_types.count(blob_name) ?
+      layouts->data_types[blob_name] : layer_param->bottom_data_type();
+  if (channel_block > 0 && layouts->blocked.count(blob_name)
+      && layouts->blocked[blob_name].second == channel_block) {
+    layer_param->set_bottom(j, layouts->blocked[blob_name].first);
+    layouts->consumed.insert(layouts->blocked[blob_name].first);
+    return;
+  }
+  if (layouts->stale_plain.count(blob_name)) {
+    const std::pair<string, int_tp>& blocked = layouts->blocked[blob_name];
+    ConfigureReorderLayer(blocked.first, blocked.second, blob_name, 0,
+                          data_type, param_convert->add_layer());
+    layouts->consumed.insert(blocked.first);
+    layouts->stale_plain.erase(blob_name);
+  }
+  if (channel_block == 0) {
+    return;
+  }
+  const string blocked_name = BlockedBlobName(
+      blob_name + "_" + layer_param->name(), channel_block);
+  ConfigureReorderLayer(blob_name, 0, blocked_name, channel_block,
+                        data_type, param_convert->add_layer());
+  layouts->blocked[blob_name] = std::make_pair(blocked_name, channel_block);
+  layer_param->set_bottom(j, blocked_name);
+  layouts->consumed.insert(blocked_name);
+}
+
+void InsertLayoutConversions(const NetParameter& param,
+                             NetParameter* param_convert) {
+  param_convert->CopyFrom(param);
+  param_convert->clear_layer();
+  const bool test_phase = param.state().phase() == TEST;
+  BlobLayouts layouts;
+  for (int_tp i = 0; i < param.layer_size(); ++i) {
+    LayerParameter layer_param = param.layer(i);
+    const bool direct = layer_param.type() == "Convolution"
+        && layer_param.convolution_param().engine()
+            == ConvolutionParameter_Engine_DIRECT;
+    vector<int_tp> top_blocks(layer_param.top_size(), 0);
+    if (direct) {
+      ConvolutionParameter* conv_param =
+          layer_param.mutable_convolution_param();
+      const bool eltwise = conv_param->fuse_type()
+          == ConvolutionParameter_FuseType_FUSED_CONV_ELTWISE_RELU;
+      const int_tp image_bottoms = eltwise ? 1 : layer_param.bottom_size();
+      // Blocked activations have no backward pass.
+      const bool blockable = test_phase && conv_param->group() == 1
+          && image_bottoms == 1;
+      int_tp top_block = conv_param->channel_block();
+      if (!blockable || top_block == 0
+          || conv_param->num_output() % top_block != 0) {
+        top_block = 0;
+      }
+      int_tp bottom_block = 0;
+      if (blockable && layouts.blocked.count(layer_param.bottom(0))) {
+        bottom_block = layouts.blocked[layer_param.bottom(0)].second;
+      }
+      for (int_tp j = 0; j < image_bottoms; ++j) {
+        RequireLayout(j, bottom_block, &layouts, &layer_param, param_convert);
+      }
+      if (eltwise) {
+        RequireLayout(1, top_block, &layouts, &layer_param, param_convert);
+      }
+      conv_param->set_channel_block(top_block);
+      conv_param->set_bottom_channel_block(bottom_block);
+      top_blocks.assign(layer_param.top_size(), top_block);
+    } else if (layer_param.type() == "Split"
+               && layouts.stale_plain.count(layer_param.bottom(0))) {
+      // Only the blocked version is current, split that one.
+      const int_tp block = layouts.blocked[layer_param.bottom(0)].second;
+      RequireLayout(0, block, &layouts, &layer_param, param_convert);
+      top_blocks.assign(layer_param.top_size(), block);
+    } else {
+      for (int_tp j = 0; j < layer_param.bottom_size(); ++j) {
+        RequireLayout(j, 0, &layouts, &layer_param, param_convert);
+      }
+    }
+    for (int_tp j = 0; j < layer_param.top_size(); ++j) {
+      const string blob_name = layer_param.top(j);
+      layouts.data_types[blob_name] = layer_param.top_data_type();
+      if (top_blocks[j] > 0) {
+        const string blocked_name = BlockedBlobName(blob_name, top_blocks[j]);
+        layer_param.set_top(j, blocked_name);
+        layouts.blocked[blob_name] = std::make_pair(blocked_name,
+                                                    top_blocks[j]);
+        layouts.stale_plain.insert(blob_name);
+      } else {
+        // Also invalidates the blocked version of in-place tops.
+        layouts.blocked.erase(blob_name);
+        layouts.stale_plain.erase(blob_name);
+      }
+    }
+    param_convert->add_layer()->CopyFrom(layer_param);
+  }
+  // Net outputs are NCHW.
+  for (std::set<string>::const_iterator it = layouts.stale_plain.begin();
+       it != layouts.stale_plain.end(); ++it) {
+    const std::pair<string, int_tp>& blocked = layouts.blocked[*it];
+    if (layouts.consumed.count(blocked.first) == 0) {
+      ConfigureReorderLayer(blocked.first, blocked.second, *it, 0,
+                            layouts.data_types[*it],
+                            param_convert->add_layer());
+    }
+  }
+}
+
+void ConfigureReorderLayer(const string& bottom_name,
+    const int_tp bottom_channel_block, const string& top_name,
+    const int_tp top_channel_block, DataType data_type,
+    LayerParameter* reorder_layer_param) {
+  reorder_layer_param->Clear();
+  reorder_layer_param->set_name(top_name + "_reorder");
+  reorder_layer_param->set_type("Reorder");
+  reorder_layer_param->add_bottom(bottom_name);
+  reorder_layer_param->add_top(top_name);
+  reorder_layer_param->set_compute_data_type(data_type);
+  reorder_layer_param->set_bottom_data_type(data_type);
+  reorder_layer_param->set_top_data_type(data_type);
+  ReorderParameter* reorder_param =
+      reorder_layer_param->mutable_reorder_param();
+  reorder_param->set_bottom_channel_block(bottom_channel_block);
+  reorder_param->set_top_channel_block(top_channel_block);
+}
+
+string BlockedBlobName(const string& blob_name, const int_tp channel_block) {
+  ostringstream blocked_blob_name;
+  blocked_blob_name << blob_name << "_nchw" << channel_block << "c";
+  return blocked_blob_name.str();
+}
+
 }
@@ -6,6 +6,7 @@
 
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <google/protobuf/text_format.h>
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
@@ -63,7 +64,7 @@ bool ReadProtoFromBinaryFile(const char* filename, Message* proto) {
   CHECK_NE(fd, -1) << "File not found: " << filename;
   ZeroCopyInputStream* raw_input = new FileInputStream(fd);
   CodedInputStream* coded_input = new CodedInputStream(raw_input);
-  coded_input->SetTotalBytesLimit(kProtoReadBytesLimit, 536870912);
+  coded_input->SetTotalBytesLimit(kProtoReadBytesLimit);
 
   bool success = proto->ParseFromCodedStream(coded_input);
 
@@ -173,29 +174,31 @@ bool ReadFileToDatum(const string& filename, const int_tp label,
 
 #ifdef USE_OPENCV
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum) {
-  cv::Mat cv_img;
-  CHECK(datum.encoded()) << "Datum not encoded";
-  const string& data = datum.data();
-  vector<char> vec_data(data.c_str(), data.c_str() + data.size());
-  cv_img = cv::imdecode(vec_data, -1);
-  if (!cv_img.data) {
-    LOG(ERROR) << "Could not decode datum ";
-  }
-  return cv_img;
+  return DecodeDatumToCVMatNative(DatumView(datum));
 }
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color) {
-  cv::Mat cv_img;
-  CHECK(datum.encoded()) << "Datum not encoded";
-  const string& data = datum.data();
-  vector<char> vec_data(data.c_str(), data.c_str() + data.size());
-  int_tp cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
-    CV_LOAD_IMAGE_GRAYSCALE);
-  cv_img = cv::imdecode(vec_data, cv_read_flag);
+  return DecodeDatumToCVMat(DatumView(datum), is_color);
+}
+
+static cv::Mat DecodeDatumViewToCVMat(const DatumView& datum,
+                                      int_tp cv_read_flag) {
+  CHECK(datum.encoded) << "Datum not encoded";
+  // Wraps the encoded bytes, imdecode does not modify them
+  const cv::Mat encoded(1, datum.data_size, CV_8UC1,
+                        const_cast<char*>(datum.data));
+  cv::Mat cv_img = cv::imdecode(encoded, cv_read_flag);
   if (!cv_img.data) {
     LOG(ERROR) << "Could not decode datum ";
   }
   return cv_img;
 }
+cv::Mat DecodeDatumToCVMatNative(const DatumView& datum) {
+  return DecodeDatumViewToCVMat(datum, -1);
+}
+cv::Mat DecodeDatumToCVMat(const DatumView& datum, bool is_color) {
+  return DecodeDatumViewToCVMat(datum, is_color ? CV_LOAD_IMAGE_COLOR :
+                                CV_LOAD_IMAGE_GRAYSCALE);
+}
 
 // If Datum is encoded will decoded using DecodeDatumToCVMat and CVMatToDatum
 // If Datum is not encoded will do nothing
@@ -244,4 +247,59 @@ void CVMatToDatum(const cv::Mat& cv_img, Datum* datum) {
   datum->set_data(buffer);
 }
 #endif  // USE_OPENCV
+bool ParseDatumView(const char* bytes, size_t size, DatumView* datum) {
+  using google::protobuf::internal::WireFormatLite;
+  *datum = DatumView();
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(bytes), size);
+  while (true) {
+    const uint32_t tag = input.ReadTag();
+    if (tag == 0) {
+      return input.ConsumedEntireMessage();
+    }
+    const int field = WireFormatLite::GetTagFieldNumber(tag);
+    const bool is_varint = WireFormatLite::GetTagWireType(tag)
+        == WireFormatLite::WIRETYPE_VARINT;
+    uint64_t value;
+    if (field == Datum::kDataFieldNumber) {
+      uint32_t length;
+      if (WireFormatLite::GetTagWireType(tag)
+          != WireFormatLite::WIRETYPE_LENGTH_DELIMITED
+          || !input.ReadVarint32(&length)) {
+        return false;
+      }
+      const void* data = NULL;
+      int available = 0;
+      if (length > 0 && (!input.GetDirectBufferPointer(&data, &available)
+                         || available < static_cast<int>(length))) {
+        return false;
+      }
+      datum->data = static_cast<const char*>(data);
+      datum->data_size = length;
+      if (!input.Skip(length)) {
+        return false;
+      }
+    } else if (field == Datum::kFloatDataFieldNumber) {
+      return false;
+    } else if (is_varint && (field == Datum::kChannelsFieldNumber
+                             || field == Datum::kHeightFieldNumber
+                             || field == Datum::kWidthFieldNumber
+                             || field == Datum::kLabelFieldNumber
+                             || field == Datum::kEncodedFieldNumber)) {
+      if (!input.ReadVarint64(&value)) {
+        return false;
+      }
+      const int_tp signed_value = static_cast<int64_t>(value);
+      switch (field) {
+        case Datum::kChannelsFieldNumber: datum->channels = signed_value; break;
+        case Datum::kHeightFieldNumber: datum->height = signed_value; break;
+        case Datum::kWidthFieldNumber: datum->width = signed_value; break;
+        case Datum::kLabelFieldNumber: datum->label = signed_value; break;
+        default: datum->encoded = value != 0; break;
+      }
+    } else if (!WireFormatLite::SkipField(&input, tag)) {
+      return false;
+    }
+  }
+}
+
 }  // namespace caffe
@@ -119,8 +119,8 @@ double caffe_strided_dot<double>(const int_tp n, const double* X,
 
 template<typename Dtype>
 Dtype caffe_dot(const int_tp n, const Dtype* X, const Dtype* Y) {
-  Dtype r;
-  #pragma omp for reduction(+ : r)
+  Dtype r = 0;
+  // local
   for (size_t i = 0; i < n; i++) {
     r += X[i] * Y[i];
   }
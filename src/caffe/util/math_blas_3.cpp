@@ -1,36 +1,308 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
+#include <cstdlib>
 #include <limits>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+// Blocking parameters of the packed CPU GEMM used for the types without a
+// BLAS backend (half_fp and the quantized integer types).
+// A MR x NR block of C is held in registers by the microkernel, a KC x NC
+// panel of B is meant to stay in L2 and a MR x KC sliver of A in L1.
+// MC and NC are multiples of MR and NR.
+#define CAFFE_GEMM_MR 6
+#ifdef __AVX512F__
+#define CAFFE_GEMM_NR 32
+#else
+#define CAFFE_GEMM_NR 16
+#endif
+#define CAFFE_GEMM_MC 96
+#define CAFFE_GEMM_NC 256
+#define CAFFE_GEMM_KC 256
+
+// Type the packed GEMM accumulates in: half_fp is converted to fp32 and the
+// narrow integer types accumulate in int32, which matches the truncating
+// behavior of the naive loop after the final conversion.
+template<typename Dtype>
+struct gemm_accumulator {
+  typedef Dtype type;
+};
+template<>
+struct gemm_accumulator<half_fp> {
+  typedef float type;
+};
+template<>
+struct gemm_accumulator<int8_t> {
+  typedef int32_t type;
+};
+template<>
+struct gemm_accumulator<int16_t> {
+  typedef int32_t type;
+};
+
+// Packs a mc x kc block of op(A) into slivers of MR rows, k-major and zero
+// padded to a multiple of MR rows.
+template<typename Dtype, typename Acc>
+static void gemm_pack_a(const CBLAS_TRANSPOSE trans_A, const Dtype* A,
+                        const int_tp lda, const int_tp mc, const int_tp kc,
+                        Acc* pa) {
+  for (int_tp ir = 0; ir < mc; ir += CAFFE_GEMM_MR) {
+    const int_tp mr = std::min<int_tp>(CAFFE_GEMM_MR, mc - ir);
+    for (int_tp p = 0; p < kc; ++p) {
+      for (int_tp i = 0; i < mr; ++i) {
+        pa[i] = static_cast<Acc>(trans_A == CblasNoTrans ?
+            A[(ir + i) * lda + p] : A[p * lda + ir + i]);
+      }
+      for (int_tp i = mr; i < CAFFE_GEMM_MR; ++i) {
+        pa[i] = Acc(0);
+      }
+      pa += CAFFE_GEMM_MR;
+    }
+  }
+}
+
+// Packs a kc x nc block of op(B) into slivers of NR columns, k-major and
+// zero padded to a multiple of NR columns.
+template<typename Dtype, typename Acc>
+static void gemm_pack_b(const CBLAS_TRANSPOSE trans_B, const Dtype* B,
+                        const int_tp ldb, const int_tp kc, const int_tp nc,
+                        Acc* pb) {
+  for (int_tp jr = 0; jr < nc; jr += CAFFE_GEMM_NR) {
+    const int_tp nr = std::min<int_tp>(CAFFE_GEMM_NR, nc - jr);
+    for (int_tp p = 0; p < kc; ++p) {
+      for (int_tp j = 0; j < nr; ++j) {
+        pb[j] = static_cast<Acc>(trans_B == CblasNoTrans ?
+            B[p * ldb + jr + j] : B[(jr + j) * ldb + p]);
+      }
+      for (int_tp j = nr; j < CAFFE_GEMM_NR; ++j) {
+        pb[j] = Acc(0);
+      }
+      pb += CAFFE_GEMM_NR;
+    }
+  }
+}
+
+// Computes C += A_sliver * B_sliver for one MR x NR register block.
+// Portable version, relies on the compiler to vectorize the inner loop.
+template<typename Acc>
+static inline void gemm_micro_kernel(const int_tp kc, const Acc* pa,
+                                     const Acc* pb, Acc* c,
+                                     const int_tp ldc) {
+  Acc acc[CAFFE_GEMM_MR][CAFFE_GEMM_NR];
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    for (int_tp j = 0; j < CAFFE_GEMM_NR; ++j) {
+      acc[i][j] = Acc(0);
+    }
+  }
+  for (int_tp p = 0; p < kc; ++p) {
+    for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+      const Acc a = pa[i];
+      for (int_tp j = 0; j < CAFFE_GEMM_NR; ++j) {
+        acc[i][j] += a * pb[j];
+      }
+    }
+    pa += CAFFE_GEMM_MR;
+    pb += CAFFE_GEMM_NR;
+  }
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    for (int_tp j = 0; j < CAFFE_GEMM_NR; ++j) {
+      c[i * ldc + j] += acc[i][j];
+    }
+  }
+}
+
+#if defined(__AVX512F__)
+// Each row of the register block is two 16-wide vectors: 12 accumulators.
+template<>
+inline void gemm_micro_kernel<float>(const int_tp kc, const float* pa,
+                                     const float* pb, float* c,
+                                     const int_tp ldc) {
+  __m512 acc[CAFFE_GEMM_MR][2];
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    acc[i][0] = _mm512_setzero_ps();
+    acc[i][1] = _mm512_setzero_ps();
+  }
+  for (int_tp p = 0; p < kc; ++p) {
+    const __m512 b0 = _mm512_loadu_ps(pb);
+    const __m512 b1 = _mm512_loadu_ps(pb + 16);
+    for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+      const __m512 a = _mm512_set1_ps(pa[i]);
+      acc[i][0] = _mm512_fmadd_ps(a, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_ps(a, b1, acc[i][1]);
+    }
+    pa += CAFFE_GEMM_MR;
+    pb += CAFFE_GEMM_NR;
+  }
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    float* ci = c + i * ldc;
+    _mm512_storeu_ps(ci, _mm512_add_ps(_mm512_loadu_ps(ci), acc[i][0]));
+    _mm512_storeu_ps(ci + 16,
+                     _mm512_add_ps(_mm512_loadu_ps(ci + 16), acc[i][1]));
+  }
+}
+
+template<>
+inline void gemm_micro_kernel<int32_t>(const int_tp kc, const int32_t* pa,
+                                       const int32_t* pb, int32_t* c,
+                                       const int_tp ldc) {
+  __m512i acc[CAFFE_GEMM_MR][2];
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    acc[i][0] = _mm512_setzero_si512();
+    acc[i][1] = _mm512_setzero_si512();
+  }
+  for (int_tp p = 0; p < kc; ++p) {
+    const __m512i b0 = _mm512_loadu_si512(pb);
+    const __m512i b1 = _mm512_loadu_si512(pb + 16);
+    for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+      const __m512i a = _mm512_set1_epi32(pa[i]);
+      acc[i][0] = _mm512_add_epi32(acc[i][0], _mm512_mullo_epi32(a, b0));
+      acc[i][1] = _mm512_add_epi32(acc[i][1], _mm512_mullo_epi32(a, b1));
+    }
+    pa += CAFFE_GEMM_MR;
+    pb += CAFFE_GEMM_NR;
+  }
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    int32_t* ci = c + i * ldc;
+    _mm512_storeu_si512(ci, _mm512_add_epi32(_mm512_loadu_si512(ci),
+                                             acc[i][0]));
+    _mm512_storeu_si512(ci + 16, _mm512_add_epi32(_mm512_loadu_si512(ci + 16),
+                                                  acc[i][1]));
+  }
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+// Each row of the register block is two 8-wide vectors: 12 accumulators.
+template<>
+inline void gemm_micro_kernel<float>(const int_tp kc, const float* pa,
+                                     const float* pb, float* c,
+                                     const int_tp ldc) {
+  __m256 acc[CAFFE_GEMM_MR][2];
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    acc[i][0] = _mm256_setzero_ps();
+    acc[i][1] = _mm256_setzero_ps();
+  }
+  for (int_tp p = 0; p < kc; ++p) {
+    const __m256 b0 = _mm256_loadu_ps(pb);
+    const __m256 b1 = _mm256_loadu_ps(pb + 8);
+    for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+      const __m256 a = _mm256_broadcast_ss(pa + i);
+      acc[i][0] = _mm256_fmadd_ps(a, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_ps(a, b1, acc[i][1]);
+    }
+    pa += CAFFE_GEMM_MR;
+    pb += CAFFE_GEMM_NR;
+  }
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    float* ci = c + i * ldc;
+    _mm256_storeu_ps(ci, _mm256_add_ps(_mm256_loadu_ps(ci), acc[i][0]));
+    _mm256_storeu_ps(ci + 8,
+                     _mm256_add_ps(_mm256_loadu_ps(ci + 8), acc[i][1]));
+  }
+}
+
+template<>
+inline void gemm_micro_kernel<int32_t>(const int_tp kc, const int32_t* pa,
+                                       const int32_t* pb, int32_t* c,
+                                       const int_tp ldc) {
+  __m256i acc[CAFFE_GEMM_MR][2];
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    acc[i][0] = _mm256_setzero_si256();
+    acc[i][1] = _mm256_setzero_si256();
+  }
+  for (int_tp p = 0; p < kc; ++p) {
+    const __m256i b0 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(pb));
+    const __m256i b1 = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(pb + 8));
+    for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+      const __m256i a = _mm256_set1_epi32(pa[i]);
+      acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_mullo_epi32(a, b0));
+      acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_mullo_epi32(a, b1));
+    }
+    pa += CAFFE_GEMM_MR;
+    pb += CAFFE_GEMM_NR;
+  }
+  for (int_tp i = 0; i < CAFFE_GEMM_MR; ++i) {
+    __m256i* ci = reinterpret_cast<__m256i*>(c + i * ldc);
+    _mm256_storeu_si256(ci, _mm256_add_epi32(_mm256_loadu_si256(ci),
+                                             acc[i][0]));
+    _mm256_storeu_si256(ci + 1, _mm256_add_epi32(_mm256_loadu_si256(ci + 1),
+                                                 acc[i][1]));
+  }
+}
+#endif  // __AVX512F__ / __AVX2__
+
+// Packed, cache-blocked GEMM for the types not covered by BLAS.
+// C is split into MC x NC tiles that are distributed over the OpenMP threads.
+// Every thread packs the A and B blocks of its tile into the accumulator
+// type, runs the microkernel over all KC blocks and only then applies
+// alpha and beta, so that half_fp is rounded once per output element.
 template<typename Dtype>
 void caffe_gemm(const CBLAS_TRANSPOSE trans_A, const CBLAS_TRANSPOSE trans_B,
                 const int_tp M, const int_tp N, const int_tp K,
                 const Dtype alpha, const Dtype* A,
                 const Dtype* B, const Dtype beta, Dtype* C) {
-  int_tp inc_a = (trans_A == CblasNoTrans) ? 1 : M;
-  int_tp inc_b = (trans_B == CblasNoTrans) ? N : 1;
-  for (int_tp m = 0; m < M; ++m) {
-    for (int_tp n = 0; n < N; ++n) {
-      Dtype acc = 0;
-      int_tp b_index = trans_B == CblasNoTrans ? n : K * n;
-      int_tp a_index = trans_A == CblasNoTrans ? K * m : m;
-      for (int_tp k = 0; k < K; ++k) {
-        acc += A[a_index] * B[b_index];
-        a_index += inc_a;
-        b_index += inc_b;
-      }
-      if (beta != 0) {
-        C[m * N + n] = acc * alpha + beta * C[m * N + n];
+  typedef typename gemm_accumulator<Dtype>::type Acc;
+  if (M == 0 || N == 0) {
+    return;
+  }
+  const int_tp lda = (trans_A == CblasNoTrans) ? K : M;
+  const int_tp ldb = (trans_B == CblasNoTrans) ? N : K;
+  const Acc acc_alpha = static_cast<Acc>(alpha);
+  const Acc acc_beta = static_cast<Acc>(beta);
+  const int_tp m_tiles = (M + CAFFE_GEMM_MC - 1) / CAFFE_GEMM_MC;
+  const int_tp n_tiles = (N + CAFFE_GEMM_NC - 1) / CAFFE_GEMM_NC;
+
+#pragma omp parallel
+  {
+    vector<Acc> pa(CAFFE_GEMM_MC * CAFFE_GEMM_KC);
+    vector<Acc> pb(CAFFE_GEMM_KC * CAFFE_GEMM_NC);
+    vector<Acc> c_tile(CAFFE_GEMM_MC * CAFFE_GEMM_NC);
+#pragma omp for schedule(dynamic)
+    for (int_tp tile = 0; tile < m_tiles * n_tiles; ++tile) {
+      const int_tp ic = (tile / n_tiles) * CAFFE_GEMM_MC;
+      const int_tp jc = (tile % n_tiles) * CAFFE_GEMM_NC;
+      const int_tp mc = std::min<int_tp>(CAFFE_GEMM_MC, M - ic);
+      const int_tp nc = std::min<int_tp>(CAFFE_GEMM_NC, N - jc);
+      std::fill(c_tile.begin(), c_tile.end(), Acc(0));
+      for (int_tp pc = 0; pc < K; pc += CAFFE_GEMM_KC) {
+        const int_tp kc = std::min<int_tp>(CAFFE_GEMM_KC, K - pc);
+        gemm_pack_a(trans_A, trans_A == CblasNoTrans ?
+                    A + ic * lda + pc : A + pc * lda + ic,
+                    lda, mc, kc, &pa[0]);
+        gemm_pack_b(trans_B, trans_B == CblasNoTrans ?
+                    B + pc * ldb + jc : B + jc * ldb + pc,
+                    ldb, kc, nc, &pb[0]);
+        for (int_tp jr = 0; jr < nc; jr += CAFFE_GEMM_NR) {
+          for (int_tp ir = 0; ir < mc; ir += CAFFE_GEMM_MR) {
+            gemm_micro_kernel<Acc>(kc, &pa[ir * kc], &pb[jr * kc],
+                                   &c_tile[ir * CAFFE_GEMM_NC + jr],
+                                   CAFFE_GEMM_NC);
+          }
+        }
       }
-      else {
-        C[m * N + n] = acc * alpha;
+      for (int_tp i = 0; i < mc; ++i) {
+        const Acc* c_row = &c_tile[i * CAFFE_GEMM_NC];
+        Dtype* C_row = C + (ic + i) * N + jc;
+        if (beta != Dtype(0)) {
+          for (int_tp j = 0; j < nc; ++j) {
+            C_row[j] = static_cast<Dtype>(c_row[j] * acc_alpha
+                                  + acc_beta * static_cast<Acc>(C_row[j]));
+          }
+        } else {
+          for (int_tp j = 0; j < nc; ++j) {
+            C_row[j] = static_cast<Dtype>(c_row[j] * acc_alpha);
+          }
+        }
       }
     }
   }
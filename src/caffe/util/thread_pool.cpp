@@ -0,0 +1,133 @@
+#include <boost/thread.hpp>
+#include <exception>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// Pool and worker index of the calling thread
+static thread_local const ThreadPool* current_pool_ = nullptr;
+static thread_local int current_index_ = -1;
+
+ThreadPool::ThreadPool(int num_threads, Device* device_context)
+    : pending_(0), queued_(0), next_queue_(0), stop_(false) {
+  CHECK_GT(num_threads, 0);
+  Caffe::Brew mode = Caffe::mode();
+  int solver_count = Caffe::solver_count();
+  int solver_rank = Caffe::solver_rank();
+  bool multiprocess = Caffe::multiprocess();
+  for (int i = 0; i < num_threads; ++i) {
+    queues_.push_back(shared_ptr<TaskQueue>(new TaskQueue()));
+  }
+  try {
+    for (int i = 0; i < num_threads; ++i) {
+      int rand_seed = caffe_rng_rand();
+      threads_.push_back(shared_ptr<boost::thread>(new boost::thread(
+          &ThreadPool::entry, this, i, device_context, mode, rand_seed,
+          solver_count, solver_rank, multiprocess)));
+    }
+  } catch (std::exception& e) {
+    LOG(FATAL) << "Thread exception: " << e.what();
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_condition_.notify_all();
+  for (int i = 0; i < threads_.size(); ++i) {
+    try {
+      threads_[i]->join();
+    } catch (std::exception& e) {
+      LOG(FATAL) << "Thread exception: " << e.what();
+    }
+  }
+}
+
+int ThreadPool::worker_index() const {
+  return current_pool_ == this ? current_index_ : -1;
+}
+
+void ThreadPool::Submit(const std::function<void()>& task) {
+  int index = worker_index();
+  if (index < 0) {
+    index = next_queue_++ % queues_.size();
+  }
+  ++pending_;
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(task);
+  }
+  {
+    // Under the lock, so that a worker going to sleep can not miss it
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++queued_;
+  }
+  work_condition_.notify_one();
+}
+
+void ThreadPool::Wait() {
+  CHECK_LT(worker_index(), 0) << "Wait() called from a worker of the pool";
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_condition_.wait(lock, [this] { return pending_ == 0; });
+}
+
+bool ThreadPool::PopTask(int index, std::function<void()>* task) {
+  {
+    TaskQueue* queue = queues_[index].get();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (!queue->tasks.empty()) {
+      *task = queue->tasks.back();
+      queue->tasks.pop_back();
+      --queued_;
+      return true;
+    }
+  }
+  for (int i = 1; i < queues_.size(); ++i) {
+    TaskQueue* queue = queues_[(index + i) % queues_.size()].get();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (!queue->tasks.empty()) {
+      *task = queue->tasks.front();
+      queue->tasks.pop_front();
+      --queued_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::entry(int index, Device* dev, Caffe::Brew mode,
+                       int_tp rand_seed, int_tp solver_count,
+                       int_tp solver_rank, bool multiprocess) {
+  Caffe::SelectDevice(dev);
+  Caffe::set_mode(mode);
+  Caffe::set_random_seed(rand_seed, dev);
+  Caffe::set_solver_count(solver_count);
+  Caffe::set_solver_rank(solver_rank);
+  Caffe::set_multiprocess(multiprocess);
+  current_pool_ = this;
+  current_index_ = index;
+
+  std::function<void()> task;
+  while (true) {
+    if (PopTask(index, &task)) {
+      task();
+      task = nullptr;
+      if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_condition_.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_condition_.wait(lock, [this] { return stop_ || queued_ > 0; });
+    if (stop_ && queued_ == 0) {
+      return;
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,301 @@
+#include "caffe/util/transport.hpp"
+
+#if !defined(_MSC_VER)
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace caffe {
+
+#if !defined(_MSC_VER)
+
+// Seconds the ranks keep trying to connect to rank 0
+static const int kConnectTimeout = 120;
+
+// First message on every connection, in network byte order
+struct TCPHello {
+  uint32_t rank;
+  uint32_t port;
+};
+
+// Address other ranks connect to, in network byte order
+struct TCPEndpoint {
+  uint32_t address;
+  uint32_t port;
+};
+
+static void SendAll(int fd, const void* data, size_t size) {
+  const char* ptr = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t sent = send(fd, ptr, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(sent, 0) << "Failed to send: " << strerror(errno);
+    ptr += sent;
+    size -= sent;
+  }
+}
+
+static void RecvAll(int fd, void* data, size_t size) {
+  char* ptr = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t received = recv(fd, ptr, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GE(received, 0) << "Failed to receive: " << strerror(errno);
+    CHECK_GT(received, 0) << "Connection closed by peer";
+    ptr += received;
+    size -= received;
+  }
+}
+
+static void SetNoDelay(int fd) {
+  int one = 1;
+  CHECK_EQ(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)), 0)
+      << strerror(errno);
+}
+
+// Listens on port, or on a free port if 0, returned in bound_port
+static int Listen(uint16_t port, int backlog, uint16_t* bound_port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0) << "Failed to create socket: " << strerror(errno);
+  int one = 1;
+  CHECK_EQ(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)), 0);
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)),
+           0) << "Failed to bind port " << port << ": " << strerror(errno);
+  CHECK_EQ(listen(fd, backlog), 0) << strerror(errno);
+  socklen_t length = sizeof(address);
+  CHECK_EQ(getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length),
+           0);
+  *bound_port = ntohs(address.sin_port);
+  return fd;
+}
+
+static int Accept(int listen_fd, sockaddr_in* address) {
+  socklen_t length = sizeof(*address);
+  int fd;
+  do {
+    fd = accept(listen_fd, reinterpret_cast<sockaddr*>(address), &length);
+  } while (fd < 0 && errno == EINTR);
+  CHECK_GE(fd, 0) << "Failed to accept connection: " << strerror(errno);
+  SetNoDelay(fd);
+  return fd;
+}
+
+// Connects to address, retrying until the peer listens
+static int Connect(const sockaddr_in& address) {
+  for (int attempt = 0; ; ++attempt) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0) << "Failed to create socket: " << strerror(errno);
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                sizeof(address)) == 0) {
+      SetNoDelay(fd);
+      return fd;
+    }
+    close(fd);
+    CHECK_LT(attempt, kConnectTimeout * 10) << "Failed to connect to "
+        << inet_ntoa(address.sin_addr) << ":" << ntohs(address.sin_port)
+        << ": " << strerror(errno);
+    usleep(100000);
+  }
+}
+
+TCPTransport::TCPTransport(const string& master, int rank, int size)
+    : rank_(rank), size_(size), sockets_(size, -1) {
+  CHECK_GE(rank, 0);
+  CHECK_LT(rank, size);
+  const size_t colon = master.rfind(':');
+  CHECK(colon != string::npos) << "Expected host:port, got " << master;
+  const string host = master.substr(0, colon);
+  const int master_port = atoi(master.substr(colon + 1).c_str());
+  CHECK_GT(master_port, 0) << "Invalid port in " << master;
+  if (size == 1) {
+    return;
+  }
+
+  if (rank == 0) {
+    uint16_t port;
+    const int listen_fd = Listen(master_port, size, &port);
+    vector<TCPEndpoint> endpoints(size);
+    for (int i = 1; i < size; ++i) {
+      sockaddr_in address;
+      const int fd = Accept(listen_fd, &address);
+      TCPHello hello;
+      RecvAll(fd, &hello, sizeof(hello));
+      const int peer = ntohl(hello.rank);
+      CHECK(peer > 0 && peer < size && sockets_[peer] < 0)
+          << "Unexpected rank " << peer << " connected";
+      sockets_[peer] = fd;
+      endpoints[peer].address = address.sin_addr.s_addr;
+      endpoints[peer].port = hello.port;
+    }
+    close(listen_fd);
+    for (int i = 1; i < size; ++i) {
+      SendAll(sockets_[i], &endpoints[0], size * sizeof(TCPEndpoint));
+    }
+  } else {
+    // Listen for the ranks above this one before registering with rank 0
+    uint16_t port;
+    const int listen_fd = Listen(0, size, &port);
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* info;
+    CHECK_EQ(getaddrinfo(host.c_str(), NULL, &hints, &info), 0)
+        << "Failed to resolve " << host;
+    sockaddr_in address = *reinterpret_cast<sockaddr_in*>(info->ai_addr);
+    freeaddrinfo(info);
+    address.sin_port = htons(master_port);
+    sockets_[0] = Connect(address);
+    TCPHello hello;
+    hello.rank = htonl(rank);
+    hello.port = htonl(port);
+    SendAll(sockets_[0], &hello, sizeof(hello));
+    vector<TCPEndpoint> endpoints(size);
+    RecvAll(sockets_[0], &endpoints[0], size * sizeof(TCPEndpoint));
+    // Connect to the ranks below, accept the ranks above
+    for (int i = 1; i < rank; ++i) {
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = endpoints[i].address;
+      address.sin_port = htons(ntohl(endpoints[i].port));
+      sockets_[i] = Connect(address);
+      SendAll(sockets_[i], &hello, sizeof(hello));
+    }
+    for (int i = rank + 1; i < size; ++i) {
+      const int fd = Accept(listen_fd, &address);
+      TCPHello peer_hello;
+      RecvAll(fd, &peer_hello, sizeof(peer_hello));
+      const int peer = ntohl(peer_hello.rank);
+      CHECK(peer > rank && peer < size && sockets_[peer] < 0)
+          << "Unexpected rank " << peer << " connected";
+      sockets_[peer] = fd;
+    }
+    close(listen_fd);
+  }
+  LOG_IF(INFO, rank == 0) << "Connected " << size << " processes";
+}
+
+TCPTransport::~TCPTransport() {
+  for (int i = 0; i < sockets_.size(); ++i) {
+    if (sockets_[i] >= 0) {
+      close(sockets_[i]);
+    }
+  }
+}
+
+void TCPTransport::Send(int peer, const void* data, size_t size) {
+  CHECK_NE(peer, rank_);
+  SendAll(sockets_[peer], data, size);
+}
+
+void TCPTransport::Recv(int peer, void* data, size_t size) {
+  CHECK_NE(peer, rank_);
+  RecvAll(sockets_[peer], data, size);
+}
+
+void TCPTransport::SendRecv(int dst, const void* send_data, size_t send_size,
+                            int src, void* recv_data, size_t recv_size) {
+  CHECK_NE(dst, rank_);
+  CHECK_NE(src, rank_);
+  const char* send_ptr = static_cast<const char*>(send_data);
+  char* recv_ptr = static_cast<char*>(recv_data);
+  // Progress in both directions as the sockets become ready, so that peers
+  // sending to each other at once do not wait for full buffers forever
+  while (send_size > 0 || recv_size > 0) {
+    pollfd fds[2];
+    int count = 0;
+    int send_index = -1;
+    int recv_index = -1;
+    if (send_size > 0) {
+      fds[count].fd = sockets_[dst];
+      fds[count].events = POLLOUT;
+      send_index = count++;
+    }
+    if (recv_size > 0) {
+      if (send_index >= 0 && src == dst) {
+        fds[send_index].events |= POLLIN;
+        recv_index = send_index;
+      } else {
+        fds[count].fd = sockets_[src];
+        fds[count].events = POLLIN;
+        recv_index = count++;
+      }
+    }
+    const int ready = poll(fds, count, -1);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(ready, 0) << "Failed to poll: " << strerror(errno);
+    if (send_index >= 0 && (fds[send_index].revents & (POLLOUT | POLLERR))) {
+      const ssize_t sent = send(sockets_[dst], send_ptr, send_size,
+                                MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (sent < 0) {
+        CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            << "Failed to send: " << strerror(errno);
+      } else {
+        send_ptr += sent;
+        send_size -= sent;
+      }
+    }
+    if (recv_index >= 0
+        && (fds[recv_index].revents & (POLLIN | POLLERR | POLLHUP))) {
+      const ssize_t received = recv(sockets_[src], recv_ptr, recv_size,
+                                    MSG_DONTWAIT);
+      if (received < 0) {
+        CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            << "Failed to receive: " << strerror(errno);
+      } else {
+        CHECK_GT(received, 0) << "Connection closed by peer";
+        recv_ptr += received;
+        recv_size -= received;
+      }
+    }
+  }
+}
+
+#else  // _MSC_VER
+
+TCPTransport::TCPTransport(const string& master, int rank, int size)
+    : rank_(rank), size_(size) {
+  LOG(FATAL) << "TCPTransport is not supported on Windows";
+}
+
+TCPTransport::~TCPTransport() {
+}
+
+void TCPTransport::Send(int peer, const void* data, size_t size) {
+  NOT_IMPLEMENTED;
+}
+
+void TCPTransport::Recv(int peer, void* data, size_t size) {
+  NOT_IMPLEMENTED;
+}
+
+void TCPTransport::SendRecv(int dst, const void* send_data, size_t send_size,
+                            int src, void* recv_data, size_t recv_size) {
+  NOT_IMPLEMENTED;
+}
+
+#endif  // _MSC_VER
+
+}  // namespace caffe
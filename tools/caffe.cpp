@@ -15,6 +15,8 @@ namespace bp = boost::python;
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
 #include "caffe/backend/device.hpp"
+#include "caffe/quantizer_calibrator.hpp"
+#include "caffe/sgd_solvers.hpp"
 #include "caffe/util/signal_handler.h"
 
 using caffe::BlobBase;
@@ -64,6 +66,33 @@ DEFINE_string(sighup_effect, "snapshot",
              "snapshot, stop or none.");
 DEFINE_bool(lt, false,
     "Optional; enable per layer timings");
+DEFINE_bool(host_memory_pool, false,
+    "Optional; cache host memory allocations in a per device memory pool");
+DEFINE_int32(forward_threads, 0,
+    "Optional; number of threads running independent layers of the forward "
+    "pass on CPU, overrides forward_threads of the model if set");
+DEFINE_int32(cpu_workers, 1,
+    "Optional; number of solvers training in parallel on the CPU, each on "
+    "its own thread and shard of the data. The effective training batch "
+    "size is multiplied by the number of workers.");
+DEFINE_string(master, "",
+    "Optional; host:port of rank 0 when training with several processes. "
+    "Start one process per rank with the same flags and its own -rank.");
+DEFINE_int32(world_size, 1,
+    "Optional; number of processes training together, see -master.");
+DEFINE_int32(rank, 0,
+    "Optional; rank of this process when training with several processes.");
+DEFINE_string(calibration, "entropy",
+    "Optional; how 'calibrate' picks quantizer ranges: max, percentile or "
+    "entropy.");
+DEFINE_double(percentile, 99.99,
+    "Optional; percentile of the absolute values covered by the ranges of "
+    "'calibrate -calibration percentile'.");
+DEFINE_string(output_weights, "",
+    "The calibrated weights written by 'calibrate'.");
+DEFINE_string(output_model, "",
+    "Optional; the model definition written by 'calibrate', with the "
+    "quantizer indices it assigned to layers.");
 
 
 // A simple registry for caffe commands.
@@ -236,9 +265,19 @@ int train() {
 
   vector<int> gpus;
   get_gpus(&gpus);
+  CHECK_GE(FLAGS_cpu_workers, 1);
+  CHECK(gpus.size() == 0 || FLAGS_cpu_workers == 1)
+      << "-cpu_workers cannot be combined with -gpu";
+  CHECK_GE(FLAGS_world_size, 1);
+  CHECK(FLAGS_world_size == 1 || FLAGS_master.size())
+      << "Training with several processes needs the -master address";
+  CHECK(FLAGS_world_size == 1 || (gpus.size() == 0 && FLAGS_cpu_workers == 1))
+      << "-world_size trains on the CPU and cannot be combined with -gpu or "
+      << "-cpu_workers";
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    Caffe::set_solver_count(FLAGS_cpu_workers);
   } else {
 #ifndef CPU_ONLY
     // Load all devices that will be used
@@ -257,6 +296,12 @@ int train() {
 #endif  // !CPU_ONLY
   }
 
+  if (FLAGS_world_size > 1) {
+    Caffe::set_solver_count(FLAGS_world_size);
+    Caffe::set_solver_rank(FLAGS_rank);
+    Caffe::set_multiprocess(true);
+  }
+
   caffe::SignalHandler signal_handler(
         GetRequestedAction(FLAGS_sigint_effect),
         GetRequestedAction(FLAGS_sighup_effect));
@@ -284,10 +329,38 @@ int train() {
     LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif  // USE_NCCL
 #endif  // USE_CUDA
+  } else if (FLAGS_world_size > 1) {
+    shared_ptr<caffe::Transport> transport(new caffe::TCPTransport(
+        FLAGS_master, FLAGS_rank, FLAGS_world_size));
+    caffe::CollectiveSync<float> sync(solver, transport);
+    sync.Run(signal_handler.GetActionFunction());
+    LOG(INFO) << "Trained with " << FLAGS_world_size << " processes at "
+              << sync.iterations_per_second() << " iter/s, all-reduce "
+              << sync.reduce_ms() << " ms/iter of which "
+              << sync.exposed_ms() << " ms not overlapped with backward, "
+              << "scaling efficiency " << sync.efficiency() * 100 << "%";
+  } else if (FLAGS_cpu_workers > 1) {
+    caffe::CPUSync<float> sync(solver);
+    sync.Run(FLAGS_snapshot.size() > 0 ? FLAGS_snapshot.c_str() : NULL);
+    LOG(INFO) << "Trained with " << FLAGS_cpu_workers << " CPU workers at "
+              << sync.iterations_per_second() << " iter/s, all-reduce "
+              << sync.reduce_ms() << " ms/iter of which "
+              << sync.exposed_ms() << " ms not overlapped with backward, "
+              << "scaling efficiency " << sync.efficiency() * 100 << "%";
   } else {
     solver->Solve();
   }
   LOG(INFO) << "Optimization Done.";
+  const caffe::SGDSolver<float>* sgd_solver =
+      dynamic_cast<caffe::SGDSolver<float>*>(solver.get());
+  if (solver_param.mixed_precision() && sgd_solver) {
+    LOG(INFO) << "Mixed precision: final loss scale "
+              << sgd_solver->loss_scale() << ", "
+              << sgd_solver->skipped_updates() << " updates skipped on "
+              << "overflow, loss scale increased "
+              << sgd_solver->loss_scale_increases() << " and decreased "
+              << sgd_solver->loss_scale_decreases() << " times";
+  }
 
 #ifdef USE_OPENCL
   if (Caffe::GetDefaultDevice()->backend() == caffe::BACKEND_OPENCL) {
@@ -326,6 +399,9 @@ int test() {
   Net<float> caffe_net(FLAGS_model, caffe::TEST,
                        Caffe::GetDefaultDevice(), FLAGS_level, &stages);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  if (FLAGS_forward_threads > 0) {
+    caffe_net.set_forward_threads(FLAGS_forward_threads);
+  }
   LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
 
   vector<int> test_score_output_id;
@@ -383,6 +459,122 @@ int test() {
 RegisterBrewFunction(test);
 
 
+// Mean of the output blobs of net over FLAGS_iterations batches.
+static vector<float> ScoreNet(Net<float>* net) {
+  vector<float> scores;
+  for (int_tp i = 0; i < FLAGS_iterations; ++i) {
+    const vector<BlobBase*>& result = net->Forward();
+    int_tp idx = 0;
+    for (int_tp j = 0; j < result.size(); ++j) {
+      const float* result_vec = static_cast<Blob<float>*>(result[j])
+          ->cpu_data();
+      for (int_tp k = 0; k < result[j]->count(); ++k, ++idx) {
+        if (i == 0) {
+          scores.push_back(result_vec[k]);
+        } else {
+          scores[idx] += result_vec[k];
+        }
+      }
+    }
+  }
+  for (int_tp i = 0; i < scores.size(); ++i) {
+    scores[i] /= FLAGS_iterations;
+  }
+  return scores;
+}
+
+// Calibrate: pick int8 quantizer ranges of a trained model.
+int calibrate() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to calibrate.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to calibrate.";
+  CHECK_GT(FLAGS_output_weights.size(), 0)
+      << "Need a file to write the calibrated weights to.";
+  caffe::CalibrationMethod method = caffe::CALIBRATION_ENTROPY;
+  if (FLAGS_calibration == "max") {
+    method = caffe::CALIBRATION_MAX;
+  } else if (FLAGS_calibration == "percentile") {
+    method = caffe::CALIBRATION_PERCENTILE;
+  } else if (FLAGS_calibration == "entropy") {
+    method = caffe::CALIBRATION_ENTROPY;
+  } else {
+    LOG(FATAL) << "Unknown calibration method " << FLAGS_calibration;
+  }
+  vector<string> stages = get_stages_from_flags();
+
+  // Set device id and mode
+  vector<int> gpus;
+  get_gpus(&gpus);
+  if (gpus.size() != 0) {
+#ifndef CPU_ONLY
+    LOG(INFO) << "Use GPU with device ID " << gpus[0];
+    Caffe::SetDevices(gpus);
+    Caffe::set_mode(Caffe::GPU);
+    Caffe::SetDevice(gpus[0]);
+#endif  // !CPU_ONLY
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  caffe::NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  param.mutable_state()->set_phase(caffe::TEST);
+  param.mutable_state()->set_level(FLAGS_level);
+  for (int i = 0; i < stages.size(); i++) {
+    param.mutable_state()->add_stage(stages[i]);
+  }
+  const bool assigned_indices = caffe::AssignQuantizerIndices(&param);
+  if (assigned_indices && FLAGS_output_model.size() == 0) {
+    LOG(WARNING) << "Layers were assigned quantizer indices, use "
+                 << "-output_model to save the model definition matching "
+                 << "the calibrated weights.";
+  }
+
+  // Every net reads the same batches from the start of its data source.
+  LOG(INFO) << "Calibrating on " << FLAGS_iterations << " iterations.";
+  Net<float> calibration_net(param, Caffe::GetDefaultDevice());
+  calibration_net.CopyTrainedLayersFrom(FLAGS_weights);
+  caffe::QuantizerCalibrator<float> calibrator(&calibration_net);
+  calibrator.Calibrate(FLAGS_iterations);
+  calibrator.ComputeRanges(method, FLAGS_percentile);
+  for (std::map<int_tp, double>::const_iterator it =
+       calibrator.ranges().begin(); it != calibrator.ranges().end(); ++it) {
+    LOG(INFO) << "Quantizer " << it->first << " range = " << it->second;
+  }
+
+  Net<float> float_net(param, Caffe::GetDefaultDevice());
+  float_net.CopyTrainedLayersFrom(FLAGS_weights);
+  const vector<float> float_scores = ScoreNet(&float_net);
+  Net<float> int8_net(param, Caffe::GetDefaultDevice());
+  int8_net.CopyTrainedLayersFrom(FLAGS_weights);
+  caffe::SimulatedQuantization<float> simulation(&int8_net,
+                                                 calibrator.ranges());
+  const vector<float> int8_scores = ScoreNet(&int8_net);
+  int_tp idx = 0;
+  for (int_tp j = 0; j < float_net.output_blobs().size(); ++j) {
+    const string& output_name = float_net.blob_names()[
+        float_net.output_blob_indices()[j]];
+    for (int_tp k = 0; k < float_net.output_blobs()[j]->count();
+         ++k, ++idx) {
+      LOG(INFO) << output_name << " = " << int8_scores[idx] << " (fp32 "
+                << float_scores[idx] << ", delta "
+                << int8_scores[idx] - float_scores[idx] << ")";
+    }
+  }
+
+  caffe::NetParameter weights;
+  calibration_net.ToProto(&weights, false);
+  calibrator.RangesToProto(&weights);
+  LOG(INFO) << "Writing calibrated weights to " << FLAGS_output_weights;
+  caffe::WriteProtoToBinaryFile(weights, FLAGS_output_weights);
+  if (FLAGS_output_model.size()) {
+    LOG(INFO) << "Writing model definition to " << FLAGS_output_model;
+    caffe::WriteProtoToTextFile(param, FLAGS_output_model);
+  }
+  return 0;
+}
+RegisterBrewFunction(calibrate);
+
+
 // Time: benchmark the execution time of a model.
 int time() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
@@ -406,6 +598,15 @@ int time() {
   // Instantiate the caffe net.
   Net<float> caffe_net(FLAGS_model, phase,
                        Caffe::GetDefaultDevice(), FLAGS_level, &stages);
+  if (FLAGS_forward_threads > 0) {
+    caffe_net.set_forward_threads(FLAGS_forward_threads);
+  }
+  // Layers of a parallel forward pass overlap, time the whole pass instead.
+  const bool parallel_forward = caffe_net.forward_threads() > 1;
+  if (parallel_forward && FLAGS_lt) {
+    LOG(INFO) << "Per layer forward timings are not available with "
+              << caffe_net.forward_threads() << " forward threads.";
+  }
 
   // Do a clean forward and backward pass, so that memory allocation are done
   // and future iterations will be more stable.
@@ -441,7 +642,10 @@ int time() {
     Timer iter_timer;
     iter_timer.Start();
     forward_timer.Start();
-    for (int_tp i = 0; i < layers.size(); ++i) {
+    if (parallel_forward) {
+      caffe_net.Forward();
+    }
+    for (int_tp i = 0; !parallel_forward && i < layers.size(); ++i) {
       if (FLAGS_lt) {
         timer.Start();
       }
@@ -490,6 +694,14 @@ int time() {
   LOG(INFO) << "Average Forward-Backward: " << total_timer.MilliSeconds() /
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
+  if (FLAGS_host_memory_pool) {
+    const caffe::HostMemoryStats stats =
+        Caffe::GetDefaultDevice()->host_memory_pool()->stats();
+    LOG(INFO) << "Host memory pool: " << stats.allocations << " allocations, "
+              << stats.cache_hits << " from cache, peak "
+              << stats.peak_bytes_in_use << " B in use, "
+              << stats.bytes_cached << " B cached.";
+  }
   LOG(INFO) << "*** Benchmark ends ***";
 
 #ifdef USE_OPENCL
@@ -515,10 +727,12 @@ int main(int argc, char** argv) {
       "commands:\n"
       "  train           train or finetune a model\n"
       "  test            score a model\n"
+      "  calibrate       pick int8 quantizer ranges of a trained model\n"
       "  device_query    show GPU diagnostic information\n"
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  Caffe::set_host_memory_pool(FLAGS_host_memory_pool);
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
@@ -1,16 +1,19 @@
 #include <stdint.h>
 #include <algorithm>
+#include <cmath>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 
@@ -19,7 +22,103 @@ using std::pair;
 using boost::scoped_ptr;
 
 DEFINE_string(backend, "lmdb",
-        "The backend {leveldb, lmdb} containing the images");
+        "The backend {leveldb, lmdb, packed} containing the images");
+DEFINE_int32(threads, 0,
+    "Number of threads decoding and summing images, 0 for one per core");
+
+// Records handed to a worker at once, for backends without random access
+const int_tp kBatchSize = 256;
+// Images summed in 32 bit integers before moving the sums to doubles,
+// 255 * 2^24 still fits.
+const int_tp kFlushInterval = 1 << 24;
+
+// Per element and per channel sums of the images seen by one worker
+class MeanAccumulator {
+ public:
+  MeanAccumulator(int_tp channels, int_tp dim)
+      : channels_(channels), dim_(dim), count_(0), pending_(0),
+        byte_sum_(channels * dim, 0), sum_(channels * dim, 0.),
+        channel_sq_sum_(channels, 0.) { }
+
+  void Add(const Datum& datum) {
+    const int_tp data_size = channels_ * dim_;
+    const string& data = datum.data();
+    const int_tp size_in_datum = std::max<int_tp>(data.size(),
+        datum.float_data_size());
+    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
+        size_in_datum;
+    if (data.size() != 0) {
+      // Integer sums, the loops are simple enough for the compiler to
+      // vectorize them
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+      uint32_t* byte_sum = &byte_sum_[0];
+      for (int_tp i = 0; i < data_size; ++i) {
+        byte_sum[i] += bytes[i];
+      }
+      for (int_tp c = 0; c < channels_; ++c) {
+        const uint8_t* plane = bytes + c * dim_;
+        uint64_t sq_sum = 0;
+        for (int_tp i = 0; i < dim_; ++i) {
+          sq_sum += static_cast<uint32_t>(plane[i]) * plane[i];
+        }
+        channel_sq_sum_[c] += sq_sum;
+      }
+      if (++pending_ == kFlushInterval) {
+        Flush();
+      }
+    } else {
+      for (int_tp c = 0; c < channels_; ++c) {
+        double sq_sum = 0.;
+        for (int_tp i = c * dim_; i < (c + 1) * dim_; ++i) {
+          const double value = datum.float_data(i);
+          sum_[i] += value;
+          sq_sum += value * value;
+        }
+        channel_sq_sum_[c] += sq_sum;
+      }
+    }
+    ++count_;
+  }
+
+  void Flush() {
+    for (int_tp i = 0; i < byte_sum_.size(); ++i) {
+      sum_[i] += byte_sum_[i];
+      byte_sum_[i] = 0;
+    }
+    pending_ = 0;
+  }
+
+  // Adds the sums of other to this accumulator
+  void Reduce(MeanAccumulator* other) {
+    Flush();
+    other->Flush();
+    for (int_tp i = 0; i < sum_.size(); ++i) {
+      sum_[i] += other->sum_[i];
+    }
+    for (int_tp c = 0; c < channels_; ++c) {
+      channel_sq_sum_[c] += other->channel_sq_sum_[c];
+    }
+    count_ += other->count_;
+  }
+
+  int_tp count() const { return count_; }
+  const vector<double>& sum() const { return sum_; }
+  const vector<double>& channel_sq_sum() const { return channel_sq_sum_; }
+
+ private:
+  int_tp channels_, dim_;
+  int_tp count_, pending_;
+  vector<uint32_t> byte_sum_;
+  vector<double> sum_;
+  vector<double> channel_sq_sum_;
+};
+
+void AddRecord(const char* value, size_t size, MeanAccumulator* accumulator) {
+  Datum datum;
+  CHECK(datum.ParseFromArray(value, size));
+  DecodeDatumNative(&datum);
+  accumulator->Add(datum);
+}
 
 int main(int argc, char** argv) {
 #ifdef USE_OPENCV
@@ -31,8 +130,9 @@ int main(int argc, char** argv) {
   namespace gflags = google;
 #endif
 
-  gflags::SetUsageMessage("Compute the mean_image of a set of images given by"
-        " a leveldb/lmdb\n"
+  gflags::SetUsageMessage("Compute the mean_image and the per channel mean "
+        "and standard deviation of a set of images given by a "
+        "leveldb/lmdb/packed db\n"
         "Usage:\n"
         "    compute_image_mean [FLAGS] INPUT_DB [OUTPUT_FILE]\n");
 
@@ -48,7 +148,6 @@ int main(int argc, char** argv) {
   scoped_ptr<db::Cursor> cursor(db->NewCursor());
 
   BlobProto sum_blob;
-  int_tp count = 0;
   // load first datum
   Datum datum;
   datum.ParseFromString(cursor->value());
@@ -61,62 +160,99 @@ int main(int argc, char** argv) {
   sum_blob.set_channels(datum.channels());
   sum_blob.set_height(datum.height());
   sum_blob.set_width(datum.width());
-  const int_tp data_size = datum.channels() * datum.height() * datum.width();
-  int_tp size_in_datum = std::max<int_tp>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int_tp i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
-  }
-  LOG(INFO) << "Starting iteration";
-  while (cursor->valid()) {
-    Datum datum;
-    datum.ParseFromString(cursor->value());
-    DecodeDatumNative(&datum);
+  const int_tp channels = sum_blob.channels();
+  const int_tp dim = sum_blob.height() * sum_blob.width();
 
-    const string& data = datum.data();
-    size_in_datum = std::max<int_tp>(datum.data().size(),
-        datum.float_data_size());
-    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-        size_in_datum;
-    if (data.size() != 0) {
-      CHECK_EQ(data.size(), size_in_datum);
-      for (int_tp i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
+  const int num_threads = FLAGS_threads > 0 ? FLAGS_threads
+      : std::max(1u, boost::thread::hardware_concurrency());
+  ThreadPool pool(num_threads, Caffe::GetCPUDevice());
+  vector<shared_ptr<MeanAccumulator> > accumulators(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    accumulators[i].reset(new MeanAccumulator(channels, dim));
+  }
+  LOG(INFO) << "Starting iteration with " << num_threads << " threads";
+  if (cursor->random_access()) {
+    // Every worker reads a contiguous range of records with its own cursor
+    const size_t num_records = cursor->num_records();
+    vector<shared_ptr<db::Cursor> > cursors(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+      cursors[i].reset(db->NewCursor());
+      const size_t begin = num_records * i / num_threads;
+      const size_t end = num_records * (i + 1) / num_threads;
+      db::Cursor* range_cursor = cursors[i].get();
+      pool.Submit([&pool, &accumulators, range_cursor, begin, end] {
+        MeanAccumulator* accumulator =
+            accumulators[pool.worker_index()].get();
+        for (size_t j = begin; j < end; ++j) {
+          range_cursor->Seek(j);
+          const char* value;
+          size_t size;
+          range_cursor->value(&value, &size);
+          AddRecord(value, size, accumulator);
+        }
+      });
+    }
+    pool.Wait();
+  } else {
+    // Read the next round of records on this thread while the workers decode
+    // and sum the previous one
+    const size_t round_size = kBatchSize * num_threads;
+    vector<string> reading, summing;
+    int_tp count = 0;
+    while (true) {
+      reading.clear();
+      for (; reading.size() < round_size && cursor->valid(); cursor->Next()) {
+        reading.push_back(cursor->value());
       }
-    } else {
-      CHECK_EQ(datum.float_data_size(), size_in_datum);
-      for (int_tp i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) +
-            static_cast<float>(datum.float_data(i)));
+      pool.Wait();
+      if (reading.empty()) {
+        break;
+      }
+      summing.swap(reading);
+      for (size_t begin = 0; begin < summing.size(); begin += kBatchSize) {
+        const size_t end = std::min(begin + kBatchSize, summing.size());
+        pool.Submit([&pool, &accumulators, &summing, begin, end] {
+          MeanAccumulator* accumulator =
+              accumulators[pool.worker_index()].get();
+          for (size_t j = begin; j < end; ++j) {
+            AddRecord(summing[j].data(), summing[j].size(), accumulator);
+          }
+        });
+      }
+      const int_tp previous = count;
+      count += summing.size();
+      if (count / 10000 > previous / 10000) {
+        LOG(INFO) << "Read " << count << " files.";
       }
     }
-    ++count;
-    if (count % 10000 == 0) {
-      LOG(INFO) << "Processed " << count << " files.";
-    }
-    cursor->Next();
   }
 
-  if (count % 10000 != 0) {
-    LOG(INFO) << "Processed " << count << " files.";
+  for (int i = 1; i < num_threads; ++i) {
+    accumulators[0]->Reduce(accumulators[i].get());
   }
-  for (int_tp i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  const MeanAccumulator& total = *accumulators[0];
+  const int_tp count = total.count();
+  LOG(INFO) << "Processed " << count << " files.";
+  for (int_tp i = 0; i < total.sum().size(); ++i) {
+    sum_blob.add_data(total.sum()[i] / count);
   }
   // Write to disk
   if (argc == 3) {
     LOG(INFO) << "Write to " << argv[2];
     WriteProtoToBinaryFile(sum_blob, argv[2]);
   }
-  const int_tp channels = sum_blob.channels();
-  const int_tp dim = sum_blob.height() * sum_blob.width();
-  vector<float> mean_values(channels, 0.0);
   LOG(INFO) << "Number of channels: " << channels;
   for (int_tp c = 0; c < channels; ++c) {
+    double mean_value = 0.;
     for (int_tp i = 0; i < dim; ++i) {
-      mean_values[c] += sum_blob.data(dim * c + i);
+      mean_value += total.sum()[dim * c + i];
     }
-    LOG(INFO) << "mean_value channel [" << c << "]: " << mean_values[c] / dim;
+    mean_value /= static_cast<double>(count) * dim;
+    const double variance = total.channel_sq_sum()[c]
+        / (static_cast<double>(count) * dim) - mean_value * mean_value;
+    LOG(INFO) << "mean_value channel [" << c << "]: " << mean_value;
+    LOG(INFO) << "std channel [" << c << "]: "
+              << std::sqrt(std::max(variance, 0.));
   }
 #else
   LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
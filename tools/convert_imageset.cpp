@@ -1,5 +1,5 @@
-// This program converts a set of images to a lmdb/leveldb by storing them
-// as Datum proto buffers.
+// This program converts a set of images to a lmdb/leveldb/packed db by
+// storing them as Datum proto buffers.
 // Usage:
 //   convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME
 //
@@ -7,33 +7,43 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.JPEG 7
 //   ....
+//
+// Images are read, resized and encoded by a pool of threads, in chunks of
+// kChunkSize lines, while the previous chunk is committed in order. With
+// -shards=N, line i goes to DB_NAME_<i % N>. After each chunk the position in
+// the list is saved to DB_NAME.checkpoint, so an interrupted conversion can
+// continue with -resume and otherwise the same arguments.
 
 #include <algorithm>
+#include <cstdio>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
 #include <vector>
 
-#include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_packed.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::pair;
-using boost::scoped_ptr;
 
 DEFINE_bool(gray, false,
     "When this option is on, treat images as grayscale ones");
 DEFINE_bool(shuffle, false,
     "Randomly shuffle the order of images and their labels");
 DEFINE_string(backend, "lmdb",
-        "The backend {lmdb, leveldb} for storing the result");
+        "The backend {lmdb, leveldb, packed} for storing the result");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
 DEFINE_bool(check_size, false,
@@ -42,6 +52,76 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg',...).");
+DEFINE_bool(compress, false,
+    "Compress each record of a packed db. Unencoded images of a fixed size "
+    "are otherwise read in place without decompression.");
+DEFINE_int32(threads, 0,
+    "Number of threads reading and encoding images, 0 for one per core");
+DEFINE_int32(shards, 1,
+    "Number of databases DB_NAME_<shard> the images are distributed over, "
+    "for parallel readers");
+DEFINE_bool(resume, false,
+    "Continue an interrupted conversion from DB_NAME.checkpoint. The other "
+    "arguments must be the same as for the interrupted run.");
+
+// Lines converted in parallel and committed together
+const int_tp kChunkSize = 1000;
+
+// Result of converting one line of LISTFILE
+struct ConvertedImage {
+  bool status;
+  // Size of the data, and channels * height * width, for -check_size
+  int_tp data_size;
+  int_tp image_size;
+  string value;
+};
+
+// Reads, resizes and encodes an image into a serialized Datum
+void ConvertImage(const string& root_folder,
+                  const std::pair<string, int>& line,
+                  const int_tp resize_height, const int_tp resize_width,
+                  const bool is_color, const bool encoded,
+                  const string& encode_type, ConvertedImage* image) {
+  string enc = encode_type;
+  if (encoded && !enc.size()) {
+    // Guess the encoding type from the file name
+    string fn = line.first;
+    uint_tp p = fn.rfind('.');
+    if ( p == fn.npos )
+      LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
+    enc = fn.substr(p);
+    std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+  }
+  Datum datum;
+  image->status = ReadImageToDatum(root_folder + line.first, line.second,
+      resize_height, resize_width, is_color, enc, &datum);
+  if (image->status) {
+    image->data_size = datum.data().size();
+    image->image_size = datum.channels() * datum.height() * datum.width();
+    CHECK(datum.SerializeToString(&image->value));
+  }
+}
+
+// The checkpoint holds the next line to convert, the number of images
+// stored so far and the seed the list was shuffled with.
+bool ReadCheckpoint(const string& filename, int_tp* line_id, int_tp* count,
+                    uint_tp* seed) {
+  std::ifstream file(filename.c_str());
+  return static_cast<bool>(file >> *line_id >> *count >> *seed);
+}
+
+void WriteCheckpoint(const string& filename, int_tp line_id, int_tp count,
+                     uint_tp seed) {
+  // Replace the previous checkpoint atomically
+  const string tmp = filename + ".tmp";
+  {
+    std::ofstream file(tmp.c_str());
+    file << line_id << " " << count << " " << seed << std::endl;
+    CHECK(file) << "Failed to write " << tmp;
+  }
+  CHECK_EQ(std::rename(tmp.c_str(), filename.c_str()), 0)
+      << "Failed to write " << filename;
+}
 
 int main(int argc, char** argv) {
 #ifdef USE_OPENCV
@@ -53,7 +133,7 @@ int main(int argc, char** argv) {
   namespace gflags = google;
 #endif
 
-  gflags::SetUsageMessage("Convert a set of images to the leveldb/lmdb\n"
+  gflags::SetUsageMessage("Convert a set of images to the leveldb/lmdb/packed\n"
         "format used as input for Caffe.\n"
         "Usage:\n"
         "    convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME\n"
@@ -71,6 +151,24 @@ int main(int argc, char** argv) {
   const bool encoded = FLAGS_encoded;
   const string encode_type = FLAGS_encode_type;
 
+  const string db_name(argv[3]);
+  const string checkpoint = db_name + ".checkpoint";
+  const int_tp num_shards = FLAGS_shards;
+  CHECK_GE(num_shards, 1);
+  int_tp start_line = 0;
+  int_tp count = 0;
+  uint_tp seed = 0;
+  if (FLAGS_resume) {
+    CHECK_NE(FLAGS_backend, "packed") << "The packed backend cannot resume, "
+        "its index is only written once the conversion completes";
+    CHECK(ReadCheckpoint(checkpoint, &start_line, &count, &seed))
+        << "Failed to read " << checkpoint;
+    LOG(INFO) << "Resuming from line " << start_line << " with " << count
+              << " images stored.";
+  } else if (FLAGS_shuffle) {
+    seed = caffe_rng_rand();
+  }
+
   std::ifstream infile(argv[2]);
   vector<std::pair<string, int> > lines;
   string line;
@@ -82,9 +180,11 @@ int main(int argc, char** argv) {
     lines.push_back(make_pair(line.substr(0, pos), label));
   }
   if (FLAGS_shuffle) {
-    // randomly shuffle data
+    // randomly shuffle data, reproducibly so that a resumed run continues
+    // in the same order
     LOG(INFO) << "Shuffling data";
-    shuffle(lines.begin(), lines.end());
+    rng_t rng(seed);
+    shuffle(lines.begin(), lines.end(), &rng);
   }
   LOG(INFO) << "A total of " << lines.size() << " images.";
 
@@ -94,64 +194,104 @@ int main(int argc, char** argv) {
   int_tp resize_height = std::max<int_tp>(0, FLAGS_resize_height);
   int_tp resize_width = std::max<int_tp>(0, FLAGS_resize_width);
 
-  // Create new DB
-  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
-  db->Open(argv[3], db::NEW);
-  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  // Create new DBs, or reopen them to append
+  vector<shared_ptr<db::DB> > dbs(num_shards);
+  vector<shared_ptr<db::Transaction> > txns(num_shards);
+  for (int_tp shard = 0; shard < num_shards; ++shard) {
+    const string source = num_shards == 1 ? db_name
+        : db_name + "_" + caffe::format_int(shard, 3);
+    dbs[shard].reset(db::GetDB(FLAGS_backend));
+    dbs[shard]->Open(source, FLAGS_resume ? db::WRITE : db::NEW);
+    if (FLAGS_compress) {
+      db::PackedDB* packed = dynamic_cast<db::PackedDB*>(dbs[shard].get());
+      CHECK(packed) << "Only the packed backend supports -compress";
+      packed->set_compress(true);
+    }
+  }
+
+  const int num_threads = FLAGS_threads > 0 ? FLAGS_threads
+      : std::max(1u, boost::thread::hardware_concurrency());
+  ThreadPool pool(num_threads, Caffe::GetCPUDevice());
+  LOG(INFO) << "Converting with " << num_threads << " threads.";
 
   // Storing to db
   string root_folder(argv[1]);
-  Datum datum;
-  int_tp count = 0;
   int_tp data_size = 0;
   bool data_size_initialized = false;
+  // The chunk being committed and the chunk being converted meanwhile
+  vector<ConvertedImage> committing(kChunkSize), converting(kChunkSize);
+  CPUTimer timer;
+  timer.Start();
+  float seconds = 0;
+  const int_tp start_count = count;
+  size_t bytes = 0;
 
-  for (int_tp line_id = 0; line_id < lines.size(); ++line_id) {
-    bool status;
-    string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      uint_tp p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+  const int_tp num_lines = lines.size();
+  for (int_tp chunk_begin = start_line; chunk_begin < num_lines;
+       chunk_begin += kChunkSize) {
+    const int_tp chunk_end = std::min(chunk_begin + kChunkSize, num_lines);
+    if (chunk_begin == start_line) {
+      // Nothing to overlap the first chunk with
+      for (int_tp line_id = chunk_begin; line_id < chunk_end; ++line_id) {
+        pool.Submit([&, line_id, chunk_begin] {
+          ConvertImage(root_folder, lines[line_id], resize_height,
+                       resize_width, is_color, encoded, encode_type,
+                       &converting[line_id - chunk_begin]);
+        });
+      }
+    }
+    pool.Wait();
+    committing.swap(converting);
+    // Convert the next chunk while this one is committed
+    const int_tp next_end = std::min(chunk_end + kChunkSize, num_lines);
+    for (int_tp line_id = chunk_end; line_id < next_end; ++line_id) {
+      pool.Submit([&, line_id, chunk_end] {
+        ConvertImage(root_folder, lines[line_id], resize_height,
+                     resize_width, is_color, encoded, encode_type,
+                     &converting[line_id - chunk_end]);
+      });
+    }
+
+    for (int_tp shard = 0; shard < num_shards; ++shard) {
+      txns[shard].reset(dbs[shard]->NewTransaction());
     }
-    status = ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color,
-        enc, &datum);
-    if (status == false) continue;
-    if (check_size) {
-      if (!data_size_initialized) {
-        data_size = datum.channels() * datum.height() * datum.width();
-        data_size_initialized = true;
-      } else {
-        const string& data = datum.data();
-        CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-            << data.size();
+    for (int_tp line_id = chunk_begin; line_id < chunk_end; ++line_id) {
+      const ConvertedImage& image = committing[line_id - chunk_begin];
+      if (image.status == false) continue;
+      if (check_size) {
+        if (!data_size_initialized) {
+          data_size = image.image_size;
+          data_size_initialized = true;
+        } else {
+          CHECK_EQ(image.data_size, data_size) << "Incorrect data field size "
+              << image.data_size;
+        }
       }
+      // sequential
+      string key_str = caffe::format_int(line_id, 8) + "_"
+                       + lines[line_id].first;
+      // Put in db
+      txns[line_id % num_shards]->Put(key_str, image.value);
+      bytes += image.value.size();
+      ++count;
     }
-    // sequential
-    string key_str = caffe::format_int(line_id, 8) + "_" + lines[line_id].first;
-
-    // Put in db
-    string out;
-    CHECK(datum.SerializeToString(&out));
-    txn->Put(key_str, out);
-
-    if (++count % 1000 == 0) {
-      // Commit db
-      txn->Commit();
-      txn.reset(db->NewTransaction());
-      LOG(INFO) << "Processed " << count << " files.";
+    // Commit db
+    for (int_tp shard = 0; shard < num_shards; ++shard) {
+      txns[shard]->Commit();
     }
+    if (FLAGS_backend != "packed") {
+      WriteCheckpoint(checkpoint, chunk_end, count, seed);
+    }
+    // Reading the timer stops it
+    seconds += timer.Seconds();
+    timer.Start();
+    LOG(INFO) << "Processed " << count << " files, "
+              << (count - start_count) / seconds << " files/s, "
+              << bytes / seconds / (1 << 20) << " MB/s.";
   }
-  // write the last batch
-  if (count % 1000 != 0) {
-    txn->Commit();
-    LOG(INFO) << "Processed " << count << " files.";
-  }
+  txns.clear();
+  dbs.clear();
+  std::remove(checkpoint.c_str());
 #else
   LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
 #endif  // USE_OPENCV